@@ -125,6 +125,16 @@
  * GstBaseParse uses subclasses conversion methods also for seeking. If
  * subclass doesn't provide @convert function, seeking will get disabled.
  *
+ * While parsing, GstBaseParse records the byte offset of a keyframe at
+ * regular time intervals in a seek table, as long as the timestamps are known
+ * to match the offsets (i.e. from the start of the stream or after a seek to
+ * a seek table entry). Subclasses can add entries they know about, e.g. from
+ * a seek table in the stream headers, with gst_base_parse_add_seek_entry().
+ * Seeks start from the closest seek table entry before the requested position
+ * if there is one nearby and only fall back to the @convert estimate
+ * otherwise. For seeks with %GST_SEEK_FLAG_ACCURATE, the frames between
+ * the seek table entry and the requested position are parsed and dropped.
+ *
  * Subclass @start and @stop functions will be called to inform the beginning
  * and end of data processing.
  *
@@ -172,8 +182,6 @@
  *    - NEWSEGMENT for gaps
  *    - Not NEWSEGMENT starting at 0 but at first frame timestamp
  *  - GstIndex support
- *  - Seek table generation and subclass seek entry injection
- *  - Accurate seeking
  *  - In push mode provide a queue of adapter-"queued" buffers for upstream
  *    buffer metadata
  *  - Queue buffers/events until caps are set
@@ -192,6 +200,12 @@
 
 #define MIN_FRAMES_TO_POST_BITRATE 10
 
+/* Minimal distance between two seek table entries recorded while parsing */
+#define MIN_SEEK_ENTRY_INTERVAL GST_SECOND
+/* Maximal distance from a seek table entry to the requested position for
+ * non-accurate seeks before the converted byte position is used instead */
+#define MAX_SEEK_SCAN_DURATION (5 * GST_SECOND)
+
 GST_DEBUG_CATEGORY_STATIC (gst_base_parse_debug);
 #define GST_CAT_DEFAULT gst_base_parse_debug
 
@@ -203,6 +217,12 @@ static GstFormat fmtlist[] = {
   0
 };
 
+typedef struct
+{
+  GstClockTime ts;
+  gint64 offset;
+} GstBaseParseSeekEntry;
+
 #define GST_BASE_PARSE_GET_PRIVATE(obj)  \
     (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GST_TYPE_BASE_PARSE, GstBaseParsePrivate))
 
@@ -243,6 +263,20 @@ struct _GstBaseParsePrivate
   GList *pending_events;
 
   GstBuffer *cache;
+
+  /* Seek table, sorted by time and offset, protected by the object lock */
+  GArray *seek_table;
+  /* Byte offset of the frame that is currently parsed or -1 */
+  gint64 frame_offset;
+  /* TRUE if the buffer timestamps match their offsets */
+  gboolean exact_position;
+  gboolean accurate_seek;
+
+  /* Seek that was sent upstream in push mode */
+  gint64 pending_seek_offset;
+  GstClockTime pending_seek_ts;
+  GstClockTime pending_seek_start;
+  gboolean pending_seek_exact;
 };
 
 static GstElementClass *parent_class = NULL;
@@ -345,6 +379,9 @@ gst_base_parse_finalize (GObject * object)
   g_list_free (parse->priv->pending_events);
   parse->priv->pending_events = NULL;
 
+  g_array_free (parse->priv->seek_table, TRUE);
+  parse->priv->seek_table = NULL;
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -425,6 +462,10 @@ gst_base_parse_init (GstBaseParse * parse, GstBaseParseClass * bclass)
   parse->priv->discont = FALSE;
   parse->priv->flushing = FALSE;
   parse->priv->offset = 0;
+  parse->priv->seek_table =
+      g_array_new (FALSE, FALSE, sizeof (GstBaseParseSeekEntry));
+  parse->priv->pending_seek_offset = -1;
+  parse->priv->frame_offset = -1;
   GST_DEBUG_OBJECT (parse, "init ok");
 }
 
@@ -579,7 +620,8 @@ gst_base_parse_sink_eventfunc (GstBaseParse * parse, GstEvent * event)
       gdouble rate, applied_rate;
       GstFormat format;
       gint64 start, stop, pos, offset = 0;
-      gboolean update;
+      GstClockTime next_ts = GST_CLOCK_TIME_NONE;
+      gboolean update, exact = FALSE;
 
       gst_event_parse_new_segment_full (event, &update, &rate, &applied_rate,
           &format, &start, &stop, &pos);
@@ -592,8 +634,23 @@ gst_base_parse_sink_eventfunc (GstBaseParse * parse, GstEvent * event)
         seg_stop = GST_CLOCK_TIME_NONE;
         offset = pos;
 
-        if (gst_base_parse_bytepos_to_time (parse, start, &seg_start) &&
-            gst_base_parse_bytepos_to_time (parse, pos, &seg_pos)) {
+        /* our own seek, we know the times already */
+        GST_OBJECT_LOCK (parse);
+        if (parse->priv->pending_seek_offset != -1 &&
+            parse->priv->pending_seek_offset == pos) {
+          exact = parse->priv->pending_seek_exact;
+          next_ts = parse->priv->pending_seek_ts;
+          seg_start = seg_pos = parse->priv->pending_seek_start;
+        } else {
+          exact = (pos == 0);
+          parse->priv->accurate_seek = FALSE;
+        }
+        parse->priv->pending_seek_offset = -1;
+        GST_OBJECT_UNLOCK (parse);
+
+        if (GST_CLOCK_TIME_IS_VALID (next_ts) ||
+            (gst_base_parse_bytepos_to_time (parse, start, &seg_start) &&
+                gst_base_parse_bytepos_to_time (parse, pos, &seg_pos))) {
           gst_event_unref (event);
           event = gst_event_new_new_segment_full (update, rate, applied_rate,
               GST_FORMAT_TIME, seg_start, seg_stop, seg_pos);
@@ -637,7 +694,9 @@ gst_base_parse_sink_eventfunc (GstBaseParse * parse, GstEvent * event)
       gst_base_parse_drain (parse);
       gst_adapter_clear (parse->adapter);
       parse->priv->offset = offset;
-      parse->priv->next_ts = start;
+      parse->priv->next_ts =
+          GST_CLOCK_TIME_IS_VALID (next_ts) ? next_ts : start;
+      parse->priv->exact_position = exact;
       break;
     }
 
@@ -990,6 +1049,7 @@ gst_base_parse_handle_and_push_buffer (GstBaseParse * parse,
       GST_BUFFER_OFFSET (buffer), GST_BUFFER_OFFSET (buffer),
       GST_BUFFER_SIZE (buffer));
 
+  parse->priv->frame_offset = GST_BUFFER_OFFSET (buffer);
   ret = klass->parse_frame (parse, buffer);
 
   /* re-use default handler to add missing metadata as-much-as-possible */
@@ -1009,13 +1069,18 @@ gst_base_parse_handle_and_push_buffer (GstBaseParse * parse,
    * frames to decide on the format and queues them internally */
   /* convert internal flow to OK and mark discont for the next buffer. */
   if (ret == GST_BASE_PARSE_FLOW_DROPPED) {
+    parse->priv->frame_offset = -1;
     gst_buffer_unref (buffer);
     return GST_FLOW_OK;
   } else if (ret != GST_FLOW_OK) {
+    parse->priv->frame_offset = -1;
     return ret;
   }
 
-  return gst_base_parse_push_buffer (parse, buffer);
+  ret = gst_base_parse_push_buffer (parse, buffer);
+  parse->priv->frame_offset = -1;
+
+  return ret;
 }
 
 /**
@@ -1073,6 +1138,7 @@ gst_base_parse_push_buffer (GstBaseParse * parse, GstBuffer * buffer)
    * actual frame data might lead subclass to different timestamps,
    * so override segment start from what is supplied there */
   if (G_UNLIKELY (parse->pending_segment && !parse->priv->passthrough &&
+          !parse->priv->accurate_seek &&
           GST_CLOCK_TIME_IS_VALID (last_start))) {
     gst_event_unref (parse->pending_segment);
     /* stop time possibly lost this way,
@@ -1113,7 +1179,15 @@ gst_base_parse_push_buffer (GstBaseParse * parse, GstBuffer * buffer)
     parse->priv->pending_events = NULL;
   }
 
-  /* TODO: Add to seek table */
+  /* Subclasses might use the buffer offset for something else, so take
+   * the byte offset the frame was parsed from */
+  if (parse->priv->exact_position && parse->priv->frame_offset != -1 &&
+      GST_BUFFER_TIMESTAMP_IS_VALID (buffer) &&
+      !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    gst_base_parse_add_seek_entry (parse, parse->priv->frame_offset,
+        GST_BUFFER_TIMESTAMP (buffer), FALSE);
+    parse->priv->frame_offset = -1;
+  }
 
   if (GST_BUFFER_TIMESTAMP_IS_VALID (buffer) &&
       GST_CLOCK_TIME_IS_VALID (parse->segment.stop) &&
@@ -1592,6 +1666,10 @@ gst_base_parse_activate (GstBaseParse * parse, gboolean active)
     parse->priv->min_bitrate = G_MAXUINT;
     parse->priv->max_bitrate = 0;
     parse->priv->max_bitrate = 0;
+    g_array_set_size (parse->priv->seek_table, 0);
+    parse->priv->exact_position = TRUE;
+    parse->priv->accurate_seek = FALSE;
+    parse->priv->pending_seek_offset = -1;
 
     if (parse->pending_segment)
       gst_event_unref (parse->pending_segment);
@@ -1852,6 +1930,105 @@ gst_base_parse_get_drain (GstBaseParse * parse)
   return ret;
 }
 
+/* Returns the index of the first seek table entry after @ts */
+static guint
+gst_base_parse_seek_table_upper_bound (GArray * table, GstClockTime ts)
+{
+  guint low = 0, high = table->len;
+
+  while (low < high) {
+    guint mid = low + (high - low) / 2;
+
+    if (g_array_index (table, GstBaseParseSeekEntry, mid).ts <= ts)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+/**
+ * gst_base_parse_add_seek_entry:
+ * @parse: #GstBaseParse.
+ * @offset: byte offset of a keyframe.
+ * @ts: timestamp of the keyframe.
+ * @force: add the entry even if it is close to an existing one.
+ *
+ * Adds an entry to the seek table. GstBaseParse adds entries for the frames
+ * it parses itself, subclasses can use this to add entries they know about
+ * from the stream, e.g. from a seek table in the stream headers. Entries
+ * that are inconsistent with the existing ones are ignored.
+ *
+ * Returns: TRUE if the entry was added.
+ */
+gboolean
+gst_base_parse_add_seek_entry (GstBaseParse * parse, gint64 offset,
+    GstClockTime ts, gboolean force)
+{
+  GArray *table;
+  GstBaseParseSeekEntry entry, *prev = NULL, *next = NULL;
+  gboolean ret = FALSE;
+  guint pos;
+
+  g_return_val_if_fail (parse != NULL, FALSE);
+  g_return_val_if_fail (offset >= 0, FALSE);
+  g_return_val_if_fail (GST_CLOCK_TIME_IS_VALID (ts), FALSE);
+
+  GST_OBJECT_LOCK (parse);
+  table = parse->priv->seek_table;
+
+  pos = gst_base_parse_seek_table_upper_bound (table, ts);
+  if (pos > 0)
+    prev = &g_array_index (table, GstBaseParseSeekEntry, pos - 1);
+  if (pos < table->len)
+    next = &g_array_index (table, GstBaseParseSeekEntry, pos);
+
+  /* offsets have to increase with the timestamps */
+  if ((prev && (prev->ts == ts || prev->offset >= offset)) ||
+      (next && next->offset <= offset))
+    goto done;
+
+  if (!force && ((prev && ts - prev->ts < MIN_SEEK_ENTRY_INTERVAL) ||
+          (next && next->ts - ts < MIN_SEEK_ENTRY_INTERVAL)))
+    goto done;
+
+  entry.ts = ts;
+  entry.offset = offset;
+  g_array_insert_val (table, pos, entry);
+  ret = TRUE;
+
+  GST_LOG_OBJECT (parse, "added seek entry %" GST_TIME_FORMAT " at offset %"
+      G_GINT64_FORMAT, GST_TIME_ARGS (ts), offset);
+
+done:
+  GST_OBJECT_UNLOCK (parse);
+  return ret;
+}
+
+/* Looks up the last seek table entry at or before @time */
+static gboolean
+gst_base_parse_find_seek_entry (GstBaseParse * parse, GstClockTime time,
+    gint64 * offset, GstClockTime * ts)
+{
+  GstBaseParseSeekEntry *entry;
+  gboolean ret = FALSE;
+  guint pos;
+
+  GST_OBJECT_LOCK (parse);
+  pos = gst_base_parse_seek_table_upper_bound (parse->priv->seek_table, time);
+  if (pos > 0) {
+    entry = &g_array_index (parse->priv->seek_table, GstBaseParseSeekEntry,
+        pos - 1);
+    *offset = entry->offset;
+    *ts = entry->ts;
+    ret = TRUE;
+  }
+  GST_OBJECT_UNLOCK (parse);
+
+  return ret;
+}
+
 /**
  * gst_base_parse_get_querytypes:
  * @pad: GstPad
@@ -2037,8 +2214,9 @@ gst_base_parse_handle_seek (GstBaseParse * parse, GstEvent * event)
   GstFormat format;
   GstSeekFlags flags;
   GstSeekType cur_type = GST_SEEK_TYPE_NONE, stop_type;
-  gboolean flush, update, res = TRUE;
-  gint64 cur, stop, seekpos;
+  gboolean flush, accurate, exact, update, res = TRUE;
+  gint64 cur, stop, seekpos = -1;
+  GstClockTime seek_ts = GST_CLOCK_TIME_NONE;
   GstSegment seeksegment = { 0, };
   GstFormat dstformat;
 
@@ -2081,6 +2259,7 @@ gst_base_parse_handle_seek (GstBaseParse * parse, GstEvent * event)
 
   /* get flush flag */
   flush = flags & GST_SEEK_FLAG_FLUSH;
+  accurate = flags & GST_SEEK_FLAG_ACCURATE;
 
   /* copy segment, we need this because we still need the old
    * segment when we close the current segment. */
@@ -2095,11 +2274,34 @@ gst_base_parse_handle_seek (GstBaseParse * parse, GstEvent * event)
   if ((stop = seeksegment.stop) == -1)
     stop = seeksegment.duration;
 
-  dstformat = GST_FORMAT_BYTES;
-  if (!gst_pad_query_convert (parse->srcpad, format, seeksegment.last_stop,
-          &dstformat, &seekpos)) {
-    GST_DEBUG_OBJECT (parse, "conversion failed");
-    return FALSE;
+  /* Start from the closest seek table entry before the position. Accurate
+   * seeks always do, the frames up to the position are dropped then */
+  exact = gst_base_parse_find_seek_entry (parse, seeksegment.last_stop,
+      &seekpos, &seek_ts);
+  if (exact && !accurate &&
+      seeksegment.last_stop - seek_ts > MAX_SEEK_SCAN_DURATION) {
+    GST_DEBUG_OBJECT (parse, "seek table entry %" GST_TIME_FORMAT
+        " too far away", GST_TIME_ARGS (seek_ts));
+    exact = FALSE;
+  }
+
+  if (exact) {
+    GST_DEBUG_OBJECT (parse, "seek table entry %" GST_TIME_FORMAT
+        " at offset %" G_GINT64_FORMAT, GST_TIME_ARGS (seek_ts), seekpos);
+
+    if (!accurate) {
+      seeksegment.start = seeksegment.last_stop = seeksegment.time = seek_ts;
+    }
+  } else {
+    dstformat = GST_FORMAT_BYTES;
+    if (!gst_pad_query_convert (parse->srcpad, format, seeksegment.last_stop,
+            &dstformat, &seekpos)) {
+      GST_DEBUG_OBJECT (parse, "conversion failed");
+      return FALSE;
+    }
+    seek_ts = seeksegment.last_stop;
+    /* the start of the stream is still exact */
+    exact = (seekpos == 0);
   }
 
   GST_DEBUG_OBJECT (parse,
@@ -2131,6 +2333,8 @@ gst_base_parse_handle_seek (GstBaseParse * parse, GstEvent * event)
 
     /* now commit to new position */
     parse->priv->offset = seekpos;
+    parse->priv->exact_position = exact;
+    parse->priv->accurate_seek = accurate;
 
     /* prepare for streaming again */
     if (flush) {
@@ -2178,8 +2382,8 @@ gst_base_parse_handle_seek (GstBaseParse * parse, GstEvent * event)
       GST_DEBUG_OBJECT (parse,
           "mark DISCONT, we did a seek to another position");
       parse->priv->discont = TRUE;
-      parse->priv->next_ts = parse->segment.last_stop;
     }
+    parse->priv->next_ts = seek_ts;
 
     /* Start streaming thread if paused */
     gst_pad_start_task (parse->sinkpad,
@@ -2192,6 +2396,16 @@ gst_base_parse_handle_seek (GstBaseParse * parse, GstEvent * event)
        seek event (in bytes) to upstream. Segment / flush handling happens
        in corresponding src event handlers */
     GST_DEBUG_OBJECT (parse, "seek in PUSH mode");
+
+    /* remember where we seeked to for the newsegment from upstream */
+    GST_OBJECT_LOCK (parse);
+    parse->priv->pending_seek_offset = seekpos;
+    parse->priv->pending_seek_ts = seek_ts;
+    parse->priv->pending_seek_start = seeksegment.last_stop;
+    parse->priv->pending_seek_exact = exact;
+    parse->priv->accurate_seek = accurate;
+    GST_OBJECT_UNLOCK (parse);
+
     new_event = gst_event_new_seek (rate, GST_FORMAT_BYTES, flush,
         GST_SEEK_TYPE_SET, seekpos, stop_type, stop);
 
@@ -261,6 +261,9 @@ gboolean gst_base_parse_get_sync (GstBaseParse * parse);
 
 gboolean gst_base_parse_get_drain (GstBaseParse * parse);
 
+gboolean gst_base_parse_add_seek_entry (GstBaseParse * parse, gint64 offset,
+                                        GstClockTime ts, gboolean force);
+
 G_END_DECLS
 
 #endif /* __GST_BASE_PARSE_H__ */
@@ -299,6 +299,11 @@ gst_flac_parse_finalize (GObject * object)
   g_list_free (flacparse->headers);
   flacparse->headers = NULL;
 
+  if (flacparse->seektable) {
+    gst_buffer_unref (flacparse->seektable);
+    flacparse->seektable = NULL;
+  }
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -346,6 +351,11 @@ gst_flac_parse_stop (GstBaseParse * parse)
   g_list_free (flacparse->headers);
   flacparse->headers = NULL;
 
+  if (flacparse->seektable) {
+    gst_buffer_unref (flacparse->seektable);
+    flacparse->seektable = NULL;
+  }
+
   return TRUE;
 }
 
@@ -1078,6 +1088,44 @@ error:
   return FALSE;
 }
 
+/* Seek points are relative to the first frame, which is only known
+ * after the last metadata block */
+static void
+gst_flac_parse_process_seektable (GstFlacParse * flacparse, gint64 boffset)
+{
+  GstByteReader reader =
+      GST_BYTE_READER_INIT_FROM_BUFFER (flacparse->seektable);
+  guint64 samples, offset;
+
+  GST_DEBUG_OBJECT (flacparse, "Handling seektable, first frame at offset %"
+      G_GINT64_FORMAT, boffset);
+
+  if (flacparse->samplerate == 0)
+    goto done;
+
+  /* Skip metadata block header */
+  if (!gst_byte_reader_skip (&reader, 4))
+    goto done;
+
+  while (gst_byte_reader_get_remaining (&reader) >= 18) {
+    gst_byte_reader_get_uint64_be (&reader, &samples);
+    gst_byte_reader_get_uint64_be (&reader, &offset);
+    gst_byte_reader_skip (&reader, 2);
+
+    /* Placeholder seek point */
+    if (samples == G_GUINT64_CONSTANT (0xffffffffffffffff))
+      continue;
+
+    gst_base_parse_add_seek_entry (GST_BASE_PARSE (flacparse),
+        boffset + offset, GST_FRAMES_TO_CLOCK_TIME (samples,
+            flacparse->samplerate), TRUE);
+  }
+
+done:
+  gst_buffer_unref (flacparse->seektable);
+  flacparse->seektable = NULL;
+}
+
 static void
 _value_array_append_buffer (GValue * array_val, GstBuffer * buf)
 {
@@ -1338,6 +1386,7 @@ gst_flac_parse_parse_frame (GstBaseParse * parse, GstBuffer * buffer)
   } else if (flacparse->state == GST_FLAC_PARSE_STATE_HEADERS) {
     gboolean is_last = ((data[0] & 0x80) == 0x80);
     guint type = (data[0] & 0x7F);
+    gint64 end_offset = GST_BUFFER_OFFSET (buffer) + GST_BUFFER_SIZE (buffer);
 
     if (type == 127) {
       GST_WARNING_OBJECT (flacparse, "Invalid metadata block type");
@@ -1352,7 +1401,9 @@ gst_flac_parse_parse_frame (GstBaseParse * parse, GstBuffer * buffer)
           return GST_FLOW_ERROR;
         break;
       case 3:                  /* SEEKTABLE */
-        /* TODO: handle seektables */
+        if (flacparse->seektable)
+          gst_buffer_unref (flacparse->seektable);
+        flacparse->seektable = gst_buffer_ref (buffer);
         break;
       case 4:                  /* VORBIS_COMMENT */
         if (!gst_flac_parse_handle_vorbiscomment (flacparse, buffer))
@@ -1381,6 +1432,9 @@ gst_flac_parse_parse_frame (GstBaseParse * parse, GstBuffer * buffer)
       if (!gst_flac_parse_handle_headers (flacparse))
         return GST_FLOW_ERROR;
 
+      if (flacparse->seektable)
+        gst_flac_parse_process_seektable (flacparse, end_offset);
+
       /* Minimal size of a frame header */
       gst_base_parse_set_min_frame_size (GST_BASE_PARSE (flacparse), MAX (16,
               flacparse->min_framesize));
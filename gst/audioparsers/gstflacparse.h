@@ -80,6 +80,7 @@ struct _GstFlacParse {
   GstTagList *tags;
 
   GList *headers;
+  GstBuffer *seektable;
 };
 
 struct _GstFlacParseClass {
@@ -25,6 +25,7 @@
 #include "geometricmath.h"
 #include <gst/controller/gstcontroller.h>
 #include <string.h>
+#include <math.h>
 
 GST_DEBUG_CATEGORY_STATIC (geometric_transform_debug);
 #define GST_CAT_DEFAULT geometric_transform_debug
@@ -76,7 +77,8 @@ static GstVideoFilterClass *parent_class = NULL;
 enum
 {
   PROP_0,
-  PROP_OFF_EDGE_PIXELS
+  PROP_OFF_EDGE_PIXELS,
+  PROP_INTERPOLATION
 };
 
 #define GST_GT_OFF_EDGES_PIXELS_METHOD_TYPE ( \
@@ -103,51 +105,137 @@ gst_geometric_transform_off_edges_pixels_method_get_type (void)
 
 #define DEFAULT_OFF_EDGE_PIXELS GST_GT_OFF_EDGES_PIXELS_IGNORE
 
+#define GST_GT_INTERPOLATION_METHOD_TYPE ( \
+    gst_geometric_transform_interpolation_method_get_type())
+static GType
+gst_geometric_transform_interpolation_method_get_type (void)
+{
+  static GType method_type = 0;
+
+  static const GEnumValue method_types[] = {
+    {GST_GT_INTERPOLATION_NEAREST, "Nearest neighbour", "nearest"},
+    {GST_GT_INTERPOLATION_BILINEAR, "Bilinear", "bilinear"},
+    {0, NULL, NULL}
+  };
+
+  if (!method_type) {
+    method_type =
+        g_enum_register_static ("GstGeometricTransformInterpolationMethod",
+        method_types);
+  }
+  return method_type;
+}
+
+#define DEFAULT_INTERPOLATION GST_GT_INTERPOLATION_NEAREST
+
+/* Resolves the input position of an output pixel to a map entry, applying
+ * the off edge pixels method once here instead of on every frame */
+static void
+gst_geometric_transform_fill_map_entry (GstGeometricTransform * gt,
+    GstGeometricTransformMapEntry * entry, gdouble in_x, gdouble in_y)
+{
+  gint x0, y0;
+
+  switch (gt->off_edge_pixels) {
+    case GST_GT_OFF_EDGES_PIXELS_CLAMP:
+      in_x = CLAMP (in_x, 0, gt->width - 1);
+      in_y = CLAMP (in_y, 0, gt->height - 1);
+      break;
+
+    case GST_GT_OFF_EDGES_PIXELS_WRAP:
+      in_x = mod_float (in_x, gt->width);
+      in_y = mod_float (in_y, gt->height);
+      if (in_x < 0)
+        in_x += gt->width;
+      if (in_y < 0)
+        in_y += gt->height;
+      break;
+
+    default:
+      break;
+  }
+
+  if (gt->map_bilinear) {
+    x0 = (gint) floor (in_x);
+    y0 = (gint) floor (in_y);
+  } else {
+    x0 = (gint) in_x;
+    y0 = (gint) in_y;
+  }
+
+  entry->fx = entry->fy = 0;
+
+  /* less than a pixel before the first column or row is still that edge
+   * pixel, as with nearest neighbour, it just has no left or top neighbour
+   * to blend with */
+  if (x0 == -1 && in_x > -1) {
+    x0 = 0;
+    in_x = 0;
+  }
+  if (y0 == -1 && in_y > -1) {
+    y0 = 0;
+    in_y = 0;
+  }
+
+  /* only map valid positions, the rest stays black */
+  if (x0 < 0 || x0 >= gt->width || y0 < 0 || y0 >= gt->height) {
+    entry->offset = -1;
+    return;
+  }
+  entry->offset = y0 * gt->row_stride + x0 * gt->pixel_stride;
+
+  /* the last column and row only blend with their neighbours when
+   * wrapping around, the row loop finds out where these are */
+  if (gt->map_bilinear) {
+    gboolean wrap = gt->off_edge_pixels == GST_GT_OFF_EDGES_PIXELS_WRAP;
+
+    if (x0 + 1 < gt->width || wrap)
+      entry->fx = (guint8) ((in_x - x0) * 256);
+    if (y0 + 1 < gt->height || wrap)
+      entry->fy = (guint8) ((in_y - y0) * 256);
+  }
+}
+
 /* must be called with the object lock */
 static gboolean
 gst_geometric_transform_generate_map (GstGeometricTransform * gt)
 {
   gint x, y;
   gdouble in_x, in_y;
-  gboolean ret = TRUE;
   GstGeometricTransformClass *klass;
-  gdouble *ptr;
-
-  /* cleanup old map */
-  g_free (gt->map);
-  gt->map = NULL;
+  GstGeometricTransformMapEntry *ptr;
 
   klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
 
   /* subclass must have defined the map_func */
   g_return_val_if_fail (klass->map_func, FALSE);
 
-  /*
-   * (x,y) pairs of the inverse mapping
-   */
-  gt->map = g_malloc0 (sizeof (gdouble) * gt->width * gt->height * 2);
+  /* 16 bit gray is sampled nearest neighbour */
+  gt->map_bilinear = gt->interpolation == GST_GT_INTERPOLATION_BILINEAR &&
+      gt->format != GST_VIDEO_FORMAT_GRAY16_BE &&
+      gt->format != GST_VIDEO_FORMAT_GRAY16_LE;
+
+  /* the map keeps its size until the caps change */
+  if (gt->map == NULL)
+    gt->map = g_new (GstGeometricTransformMapEntry, gt->width * gt->height);
   ptr = gt->map;
 
   for (y = 0; y < gt->height; y++) {
     for (x = 0; x < gt->width; x++) {
       if (!klass->map_func (gt, x, y, &in_x, &in_y)) {
         /* child should have warned */
-        ret = FALSE;
-        goto end;
+        GST_WARNING_OBJECT (gt, "Failed to do mapping for %d %d", x, y);
+        g_free (gt->map);
+        gt->map = NULL;
+        return FALSE;
       }
 
-      ptr[0] = in_x;
-      ptr[1] = in_y;
-      ptr += 2;
+      gst_geometric_transform_fill_map_entry (gt, ptr++, in_x, in_y);
     }
   }
 
-end:
-  if (!ret)
-    g_free (gt->map);
-  else
-    gt->needs_remap = FALSE;
-  return ret;
+  gt->needs_remap = FALSE;
+  return TRUE;
 }
 
 static gboolean
@@ -176,6 +264,8 @@ gst_geometric_transform_set_caps (GstBaseTransform * btrans, GstCaps * incaps,
     GST_OBJECT_LOCK (gt);
     if (old_width == 0 || old_height == 0 || gt->width != old_width ||
         gt->height != old_height) {
+      g_free (gt->map);
+      gt->map = NULL;
       if (klass->prepare_func)
         if (!klass->prepare_func (gt)) {
           GST_OBJECT_UNLOCK (gt);
@@ -189,46 +279,108 @@ gst_geometric_transform_set_caps (GstBaseTransform * btrans, GstCaps * incaps,
   return ret;
 }
 
+/* nearest neighbour copy of a row, specialized per pixel size so the
+ * copies become plain loads and stores */
+#define NEAREST_ROW_FUNC(bpp)                                                 \
+static void                                                                   \
+gst_geometric_transform_nearest_row_##bpp (                                   \
+    const GstGeometricTransformMapEntry * map, const guint8 * in,             \
+    guint8 * out, gint width)                                                 \
+{                                                                             \
+  gint x;                                                                     \
+                                                                              \
+  for (x = 0; x < width; x++, out += bpp) {                                   \
+    if (map[x].offset >= 0)                                                   \
+      memcpy (out, in + map[x].offset, bpp);                                  \
+  }                                                                           \
+}
+
+NEAREST_ROW_FUNC (1)
+NEAREST_ROW_FUNC (2)
+NEAREST_ROW_FUNC (3)
+NEAREST_ROW_FUNC (4)
+
+/* bilinear interpolation of 8 bit components, with 8 bit weights. The
+ * neighbours are one pixel and one row further, except that a pixel of the
+ * last column or row that has a weight wraps around to the first one */
 static void
-gst_geometric_transform_do_map (GstGeometricTransform * gt, GstBuffer * inbuf,
-    GstBuffer * outbuf, gint x, gint y, gdouble in_x, gdouble in_y)
+gst_geometric_transform_bilinear_row (GstGeometricTransform * gt,
+    const GstGeometricTransformMapEntry * map, const guint8 * in,
+    guint8 * out, gint width)
 {
-  gint in_offset;
-  gint out_offset;
-
-  out_offset = y * gt->row_stride + x * gt->pixel_stride;
+  gint x, c;
+  gint pixel_stride = gt->pixel_stride;
+  gint row_stride = gt->row_stride;
+  gint last_column = (gt->width - 1) * pixel_stride;
+  gint last_row = (gt->height - 1) * row_stride;
+  gboolean wrap = gt->off_edge_pixels == GST_GT_OFF_EDGES_PIXELS_WRAP;
+
+  for (x = 0; x < width; x++, out += pixel_stride) {
+    const guint8 *p, *q;
+    guint wx, wy;
+    gint offset, sx, sy;
+
+    offset = map[x].offset;
+    if (offset < 0)
+      continue;
+
+    wx = map[x].fx;
+    wy = map[x].fy;
+    /* without weight the neighbour may be off the edge, don't read it */
+    sx = wx ? pixel_stride : 0;
+    sy = wy ? row_stride : 0;
+    if (wrap) {
+      if (wx && offset % row_stride == last_column)
+        sx = -last_column;
+      if (wy && offset >= last_row)
+        sy = -last_row;
+    }
 
-  /* operate on out of edge pixels */
-  switch (gt->off_edge_pixels) {
-    case GST_GT_OFF_EDGES_PIXELS_CLAMP:
-      in_x = CLAMP (in_x, 0, gt->width - 1);
-      in_y = CLAMP (in_y, 0, gt->height - 1);
-      break;
+    p = in + offset;
+    q = p + sy;
 
-    case GST_GT_OFF_EDGES_PIXELS_WRAP:
-      in_x = mod_float (in_x, gt->width);
-      in_y = mod_float (in_y, gt->height);
-      if (in_x < 0)
-        in_x += gt->width;
-      if (in_y < 0)
-        in_y += gt->height;
-      break;
+    for (c = 0; c < pixel_stride; c++) {
+      guint top, bottom;
 
-    default:
-      break;
+      top = p[c] * (256 - wx) + p[c + sx] * wx;
+      bottom = q[c] * (256 - wx) + q[c + sx] * wx;
+      out[c] = (top * (256 - wy) + bottom * wy + 32768) >> 16;
+    }
   }
+}
 
-  {
-    gint trunc_x = (gint) in_x;
-    gint trunc_y = (gint) in_y;
-    /* only set the values if the values are valid */
-    if (trunc_x >= 0 && trunc_x < gt->width && trunc_y >= 0 &&
-        trunc_y < gt->height) {
-      in_offset = trunc_y * gt->row_stride + trunc_x * gt->pixel_stride;
+static void
+gst_geometric_transform_do_map (GstGeometricTransform * gt, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  const guint8 *in = GST_BUFFER_DATA (inbuf);
+  guint8 *out = GST_BUFFER_DATA (outbuf);
+  const GstGeometricTransformMapEntry *map = gt->map;
+  gint y;
 
-      memcpy (GST_BUFFER_DATA (outbuf) + out_offset,
-          GST_BUFFER_DATA (inbuf) + in_offset, gt->pixel_stride);
+  for (y = 0; y < gt->height; y++) {
+    if (gt->map_bilinear) {
+      gst_geometric_transform_bilinear_row (gt, map, in, out, gt->width);
+    } else {
+      switch (gt->pixel_stride) {
+        case 1:
+          gst_geometric_transform_nearest_row_1 (map, in, out, gt->width);
+          break;
+        case 2:
+          gst_geometric_transform_nearest_row_2 (map, in, out, gt->width);
+          break;
+        case 3:
+          gst_geometric_transform_nearest_row_3 (map, in, out, gt->width);
+          break;
+        case 4:
+          gst_geometric_transform_nearest_row_4 (map, in, out, gt->width);
+          break;
+        default:
+          g_assert_not_reached ();
+      }
     }
+    map += gt->width;
+    out += gt->row_stride;
   }
 }
 
@@ -255,9 +407,7 @@ gst_geometric_transform_transform (GstBaseTransform * trans, GstBuffer * buf,
 {
   GstGeometricTransform *gt;
   GstGeometricTransformClass *klass;
-  gint x, y;
   GstFlowReturn ret = GST_FLOW_OK;
-  gdouble *ptr;
 
   gt = GST_GEOMETRIC_TRANSFORM_CAST (trans);
   klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
@@ -265,39 +415,21 @@ gst_geometric_transform_transform (GstBaseTransform * trans, GstBuffer * buf,
   memset (GST_BUFFER_DATA (outbuf), 0, GST_BUFFER_SIZE (outbuf));
 
   GST_OBJECT_LOCK (gt);
-  if (gt->precalc_map) {
-    if (gt->needs_remap) {
-      if (klass->prepare_func)
-        if (!klass->prepare_func (gt)) {
-          GST_OBJECT_UNLOCK (gt);
-          return FALSE;
-        }
-      gst_geometric_transform_generate_map (gt);
-    }
-    g_return_val_if_fail (gt->map, GST_FLOW_ERROR);
-    ptr = gt->map;
-    for (y = 0; y < gt->height; y++) {
-      for (x = 0; x < gt->width; x++) {
-        /* do the mapping */
-        gst_geometric_transform_do_map (gt, buf, outbuf, x, y, ptr[0], ptr[1]);
-        ptr += 2;
+  /* without a precalculated map, it is regenerated for every frame */
+  if (!gt->precalc_map || gt->needs_remap) {
+    if (gt->precalc_map && klass->prepare_func) {
+      if (!klass->prepare_func (gt)) {
+        ret = GST_FLOW_ERROR;
+        goto end;
       }
     }
-  } else {
-    for (y = 0; y < gt->height; y++) {
-      for (x = 0; x < gt->width; x++) {
-        gdouble in_x, in_y;
-
-        if (klass->map_func (gt, x, y, &in_x, &in_y)) {
-          gst_geometric_transform_do_map (gt, buf, outbuf, x, y, in_x, in_y);
-        } else {
-          GST_WARNING_OBJECT (gt, "Failed to do mapping for %d %d", x, y);
-          ret = GST_FLOW_ERROR;
-          goto end;
-        }
-      }
+    if (!gst_geometric_transform_generate_map (gt)) {
+      ret = GST_FLOW_ERROR;
+      goto end;
     }
   }
+  gst_geometric_transform_do_map (gt, buf, outbuf);
+
 end:
   GST_OBJECT_UNLOCK (gt);
   return ret;
@@ -315,6 +447,13 @@ gst_geometric_transform_set_property (GObject * object, guint prop_id,
     case PROP_OFF_EDGE_PIXELS:
       GST_OBJECT_LOCK (gt);
       gt->off_edge_pixels = g_value_get_enum (value);
+      gst_geometric_transform_set_need_remap (gt);
+      GST_OBJECT_UNLOCK (gt);
+      break;
+    case PROP_INTERPOLATION:
+      GST_OBJECT_LOCK (gt);
+      gt->interpolation = g_value_get_enum (value);
+      gst_geometric_transform_set_need_remap (gt);
       GST_OBJECT_UNLOCK (gt);
       break;
     default:
@@ -335,6 +474,9 @@ gst_geometric_transform_get_property (GObject * object, guint prop_id,
     case PROP_OFF_EDGE_PIXELS:
       g_value_set_enum (value, gt->off_edge_pixels);
       break;
+    case PROP_INTERPOLATION:
+      g_value_set_enum (value, gt->interpolation);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -348,6 +490,7 @@ gst_geometric_transform_stop (GstBaseTransform * trans)
   GstGeometricTransform *gt = GST_GEOMETRIC_TRANSFORM_CAST (trans);
 
   g_free (gt->map);
+  gt->map = NULL;
 
   return TRUE;
 }
@@ -391,6 +534,11 @@ gst_geometric_transform_class_init (gpointer klass, gpointer class_data)
           "What to do with off edge pixels",
           GST_GT_OFF_EDGES_PIXELS_METHOD_TYPE, DEFAULT_OFF_EDGE_PIXELS,
           GST_PARAM_CONTROLLABLE | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (obj_class, PROP_INTERPOLATION,
+      g_param_spec_enum ("interpolation", "Interpolation",
+          "How to sample the input pixels",
+          GST_GT_INTERPOLATION_METHOD_TYPE, DEFAULT_INTERPOLATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -399,6 +547,7 @@ gst_geometric_transform_init (GTypeInstance * instance, gpointer g_class)
   GstGeometricTransform *gt = GST_GEOMETRIC_TRANSFORM_CAST (instance);
 
   gt->off_edge_pixels = DEFAULT_OFF_EDGE_PIXELS;
+  gt->interpolation = DEFAULT_INTERPOLATION;
   gt->precalc_map = TRUE;
   gt->needs_remap = TRUE;
 }
@@ -46,6 +46,12 @@ enum
   GST_GT_OFF_EDGES_PIXELS_WRAP
 };
 
+enum
+{
+  GST_GT_INTERPOLATION_NEAREST = 0,
+  GST_GT_INTERPOLATION_BILINEAR
+};
+
 typedef struct _GstGeometricTransform GstGeometricTransform;
 typedef struct _GstGeometricTransformClass GstGeometricTransformClass;
 
@@ -77,6 +83,19 @@ typedef gboolean (*GstGeometricTransformMapFunc) (GstGeometricTransform * gt,
 typedef gboolean (*GstGeometricTransformPrepareFunc) (
     GstGeometricTransform * gt);
 
+/**
+ * GstGeometricTransformMapEntry:
+ *
+ * Precalculated source of an output pixel: the byte offset of the (top-left)
+ * input pixel, -1 if there is none, and for bilinear interpolation the
+ * weights of its right and bottom neighbours in 1/256 units. A weight is 0
+ * when there is no neighbour on that side.
+ */
+typedef struct {
+  gint32 offset;
+  guint8 fx, fy;
+} GstGeometricTransformMapEntry;
+
 /**
  * GstGeometricTransform:
  *
@@ -99,8 +118,12 @@ struct _GstGeometricTransform {
 
   /* properties */
   gint off_edge_pixels;
+  gint interpolation;
 
-  gdouble *map;
+  /* width * height entries, row by row */
+  GstGeometricTransformMapEntry *map;
+  /* whether the map carries bilinear weights */
+  gboolean map_bilinear;
 };
 
 struct _GstGeometricTransformClass {
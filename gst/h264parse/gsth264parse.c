@@ -34,6 +34,7 @@
 #include <gst/base/gstbytewriter.h>
 
 #include "gsth264parse.h"
+#include "gstnalbs.h"
 
 static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
@@ -154,107 +155,6 @@ gst_nal_list_delete_head (GstNalList * list)
   return list;
 }
 
-/* simple bitstream parser, automatically skips over
- * emulation_prevention_three_bytes. */
-typedef struct
-{
-  const guint8 *data;
-  const guint8 *end;
-  gint head;                    /* bitpos in the cache of next bit */
-  guint64 cache;                /* cached bytes */
-} GstNalBs;
-
-static void
-gst_nal_bs_init (GstNalBs * bs, const guint8 * data, guint size)
-{
-  bs->data = data;
-  bs->end = data + size;
-  bs->head = 0;
-  /* fill with something other than 0 to detect emulation prevention bytes */
-  bs->cache = 0xffffffff;
-}
-
-static guint32
-gst_nal_bs_read (GstNalBs * bs, guint n)
-{
-  guint32 res = 0;
-  gint shift;
-
-  if (n == 0)
-    return res;
-
-  /* fill up the cache if we need to */
-  while (bs->head < n) {
-    guint8 byte;
-    gboolean check_three_byte;
-
-    check_three_byte = TRUE;
-  next_byte:
-    if (bs->data >= bs->end) {
-      /* we're at the end, can't produce more than head number of bits */
-      n = bs->head;
-      break;
-    }
-    /* get the byte, this can be an emulation_prevention_three_byte that we need
-     * to ignore. */
-    byte = *bs->data++;
-    if (check_three_byte && byte == 0x03 && ((bs->cache & 0xffff) == 0)) {
-      /* next byte goes unconditionally to the cache, even if it's 0x03 */
-      check_three_byte = FALSE;
-      goto next_byte;
-    }
-    /* shift bytes in cache, moving the head bits of the cache left */
-    bs->cache = (bs->cache << 8) | byte;
-    bs->head += 8;
-  }
-
-  /* bring the required bits down and truncate */
-  if ((shift = bs->head - n) > 0)
-    res = bs->cache >> shift;
-  else
-    res = bs->cache;
-
-  /* mask out required bits */
-  if (n < 32)
-    res &= (1 << n) - 1;
-
-  bs->head = shift;
-
-  return res;
-}
-
-static gboolean
-gst_nal_bs_eos (GstNalBs * bs)
-{
-  return (bs->data >= bs->end) && (bs->head == 0);
-}
-
-/* read unsigned Exp-Golomb code */
-static gint
-gst_nal_bs_read_ue (GstNalBs * bs)
-{
-  gint i = 0;
-
-  while (gst_nal_bs_read (bs, 1) == 0 && !gst_nal_bs_eos (bs) && i < 32)
-    i++;
-
-  return ((1 << i) - 1 + gst_nal_bs_read (bs, i));
-}
-
-/* read signed Exp-Golomb code */
-static gint
-gst_nal_bs_read_se (GstNalBs * bs)
-{
-  gint i = 0;
-
-  i = gst_nal_bs_read_ue (bs);
-  /* (-1)^(i+1) Ceil (i / 2) */
-  i = (i + 1) / 2 * (i & 1 ? 1 : -1);
-
-  return i;
-}
-
-
 /* SEI type */
 typedef enum
 {
@@ -872,6 +772,7 @@ gst_nal_decode_slice_header (GstH264Parse * h, GstNalBs * bs)
 GST_BOILERPLATE (GstH264Parse, gst_h264_parse, GstElement, GST_TYPE_ELEMENT);
 
 static void gst_h264_parse_reset (GstH264Parse * h264parse);
+static void gst_h264_parse_clear_picture (GstH264Parse * h264parse);
 static void gst_h264_parse_finalize (GObject * object);
 static void gst_h264_parse_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
@@ -957,9 +858,11 @@ gst_h264_parse_init (GstH264Parse * h264parse, GstH264ParseClass * g_class)
 
   h264parse->split_packetized = DEFAULT_SPLIT_PACKETIZED;
   h264parse->adapter = gst_adapter_new ();
+  h264parse->nal_starts = g_array_new (FALSE, FALSE, sizeof (guint));
+  h264parse->scan_state = 0xffffffff;
 
   h264parse->merge = DEFAULT_ACCESS_UNIT;
-  h264parse->picture_adapter = gst_adapter_new ();
+  h264parse->picture_ts = GST_CLOCK_TIME_NONE;
 
   h264parse->interval = DEFAULT_CONFIG_INTERVAL;
   h264parse->last_report = GST_CLOCK_TIME_NONE;
@@ -1015,6 +918,7 @@ gst_h264_parse_reset (GstH264Parse * h264parse)
   h264parse->codec_nals = NULL;
   h264parse->picture_start = FALSE;
   h264parse->idr_offset = -1;
+  h264parse->idr_index = -1;
 
   gst_caps_replace (&h264parse->src_caps, NULL);
 }
@@ -1028,7 +932,8 @@ gst_h264_parse_finalize (GObject * object)
   h264parse = GST_H264PARSE (object);
 
   g_object_unref (h264parse->adapter);
-  g_object_unref (h264parse->picture_adapter);
+  g_array_free (h264parse->nal_starts, TRUE);
+  gst_h264_parse_clear_picture (h264parse);
 
   for (i = 0; i < MAX_SPS_COUNT; i++) {
     if (h264parse->sps_buffers[i] != NULL)
@@ -1493,6 +1398,58 @@ wrong_version:
   }
 }
 
+static void
+gst_h264_parse_write_length (guint8 * data, guint nal_length, guint32 size)
+{
+  switch (nal_length) {
+    case 1:
+      GST_WRITE_UINT8 (data, size);
+      break;
+    case 2:
+      GST_WRITE_UINT16_BE (data, size);
+      break;
+    case 3:
+      GST_WRITE_UINT24_BE (data, size);
+      break;
+    case 4:
+      GST_WRITE_UINT32_BE (data, size);
+      break;
+    default:
+      g_assert_not_reached ();
+      break;
+  }
+}
+
+static guint32
+gst_h264_parse_read_length (const guint8 * data, guint nal_length)
+{
+  guint32 size = 0;
+  guint i;
+
+  for (i = 0; i < nal_length; i++)
+    size = (size << 8) | data[i];
+
+  return size;
+}
+
+static void
+gst_h264_parse_free_parts (GList * parts)
+{
+  g_list_foreach (parts, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (parts);
+}
+
+static void
+gst_h264_parse_clear_picture (GstH264Parse * h264parse)
+{
+  gst_h264_parse_free_parts (h264parse->picture_nals);
+  h264parse->picture_nals = NULL;
+  h264parse->picture_size = 0;
+  h264parse->picture_ts = GST_CLOCK_TIME_NONE;
+  gst_h264_parse_free_parts (h264parse->out_parts);
+  h264parse->out_parts = NULL;
+}
+
 /* if forced output mode,
  * ensures that NALU @nal starts with start code or length
  * takes ownership of nal and returns buffer
@@ -1508,27 +1465,8 @@ gst_h264_parse_write_nal_prefix (GstH264Parse * h264parse, GstBuffer * nal)
   /* ensure proper transformation on prefix if needed */
   if (h264parse->format == GST_H264_PARSE_FORMAT_SAMPLE) {
     nal = gst_buffer_make_writable (nal);
-    switch (nal_length) {
-      case 1:
-        GST_WRITE_UINT8 (GST_BUFFER_DATA (nal),
-            GST_BUFFER_SIZE (nal) - nal_length);
-        break;
-      case 2:
-        GST_WRITE_UINT16_BE (GST_BUFFER_DATA (nal),
-            GST_BUFFER_SIZE (nal) - nal_length);
-        break;
-      case 3:
-        GST_WRITE_UINT24_BE (GST_BUFFER_DATA (nal),
-            GST_BUFFER_SIZE (nal) - nal_length);
-        break;
-      case 4:
-        GST_WRITE_UINT32_BE (GST_BUFFER_DATA (nal),
-            GST_BUFFER_SIZE (nal) - nal_length);
-        break;
-      default:
-        g_assert_not_reached ();
-        break;
-    }
+    gst_h264_parse_write_length (GST_BUFFER_DATA (nal), nal_length,
+        GST_BUFFER_SIZE (nal) - nal_length);
   } else if (h264parse->format == GST_H264_PARSE_FORMAT_BYTE) {
     gint offset = 0;
     guint nalu_size = 0;
@@ -1576,6 +1514,149 @@ gst_h264_parse_write_nal_prefix (GstH264Parse * h264parse, GstBuffer * nal)
   return nal;
 }
 
+/* Appends NALU @nal, with the start code or length the output format asks
+ * for, to @parts. Only fresh prefixes are written, the NALU payloads are
+ * referenced from @nal instead of copied. Takes ownership of @nal. */
+static GList *
+gst_h264_parse_add_nal_parts (GstH264Parse * h264parse, GList * parts,
+    GstBuffer * nal, guint * size)
+{
+  guint nal_length = h264parse->nal_length_size;
+  const guint8 *data = GST_BUFFER_DATA (nal);
+  guint nal_size = GST_BUFFER_SIZE (nal);
+  GstBuffer *prefix, *payload;
+  guint offset = 0;
+
+  if (!h264parse->packetized) {
+    guint sc_len = data[2] == 0x01 ? 3 : 4;
+
+    /* 4-byte start codes are what we output for bytestream */
+    if (sc_len == 4 && h264parse->format != GST_H264_PARSE_FORMAT_SAMPLE)
+      goto keep;
+
+    prefix = gst_buffer_new_and_alloc (nal_length);
+    if (h264parse->format == GST_H264_PARSE_FORMAT_SAMPLE)
+      gst_h264_parse_write_length (GST_BUFFER_DATA (prefix), nal_length,
+          nal_size - sc_len);
+    else
+      GST_WRITE_UINT32_BE (GST_BUFFER_DATA (prefix), 0x01);
+    gst_buffer_copy_metadata (prefix, nal,
+        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS);
+    payload = gst_buffer_create_sub (nal, sc_len, nal_size - sc_len);
+    gst_buffer_unref (nal);
+
+    parts = g_list_append (parts, prefix);
+    parts = g_list_append (parts, payload);
+    *size += nal_length + nal_size - sc_len;
+    return parts;
+  }
+
+  if (h264parse->format == GST_H264_PARSE_FORMAT_SAMPLE) {
+    /* only rewrite (and copy) if the length is off */
+    if (gst_h264_parse_read_length (data, nal_length) !=
+        nal_size - nal_length)
+      nal = gst_h264_parse_write_nal_prefix (h264parse, nal);
+    goto keep;
+  } else if (h264parse->format != GST_H264_PARSE_FORMAT_BYTE) {
+    goto keep;
+  }
+
+  while (offset + nal_length <= nal_size) {
+    guint nalu_size;
+
+    nalu_size = gst_h264_parse_read_length (data + offset, nal_length);
+    /* input may already be in byte-stream */
+    if (nal_length == 4 && nalu_size == 1) {
+      payload = gst_buffer_create_sub (nal, offset, nal_size - offset);
+      parts = g_list_append (parts, payload);
+      *size += nal_size - offset;
+      break;
+    }
+    if (nalu_size > nal_size - nal_length - offset) {
+      GST_WARNING_OBJECT (h264parse, "NAL size %u is larger than buffer, "
+          "reducing it to the buffer size: %u", nalu_size,
+          nal_size - nal_length - offset);
+      nalu_size = nal_size - nal_length - offset;
+    }
+
+    prefix = gst_buffer_new_and_alloc (4);
+    GST_WRITE_UINT32_BE (GST_BUFFER_DATA (prefix), 0x01);
+    if (offset == 0)
+      gst_buffer_copy_metadata (prefix, nal,
+          GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS);
+    parts = g_list_append (parts, prefix);
+    *size += 4;
+    if (nalu_size > 0) {
+      payload = gst_buffer_create_sub (nal, offset + nal_length, nalu_size);
+      parts = g_list_append (parts, payload);
+      *size += nalu_size;
+    }
+    offset += nalu_size + nal_length;
+  }
+  gst_buffer_unref (nal);
+
+  return parts;
+
+keep:
+  parts = g_list_append (parts, nal);
+  *size += GST_BUFFER_SIZE (nal);
+
+  return parts;
+}
+
+/* buffer lists only pay off when downstream handles them itself, the core
+ * would merge every group into a buffer otherwise */
+static gboolean
+gst_h264_parse_use_lists (GstH264Parse * h264parse)
+{
+  GstPad *peer;
+  gboolean res = FALSE;
+
+  /* reverse playback pushes its own buffers */
+  if (h264parse->segment.rate < 0.0)
+    return FALSE;
+
+  peer = gst_pad_get_peer (h264parse->srcpad);
+  if (peer) {
+    res = GST_PAD_CHAINLISTFUNC (peer) != NULL;
+    gst_object_unref (peer);
+  }
+  return res;
+}
+
+/* Makes the buffer to push out of @parts. If they can go downstream as a
+ * buffer list group, the first part is returned and the others are kept
+ * in out_parts for gst_h264_parse_push_buffer(), otherwise they are copied
+ * together. */
+static GstBuffer *
+gst_h264_parse_finish_parts (GstH264Parse * h264parse, GList * parts,
+    guint size)
+{
+  GstBuffer *outbuf;
+  GList *walk;
+  guint8 *data;
+
+  if (parts->next == NULL || gst_h264_parse_use_lists (h264parse)) {
+    outbuf = gst_buffer_make_metadata_writable (parts->data);
+    h264parse->out_parts = g_list_delete_link (parts, parts);
+    return outbuf;
+  }
+
+  outbuf = gst_buffer_new_and_alloc (size);
+  gst_buffer_copy_metadata (outbuf, parts->data,
+      GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS);
+  data = GST_BUFFER_DATA (outbuf);
+  for (walk = parts; walk; walk = walk->next) {
+    GstBuffer *part = walk->data;
+
+    memcpy (data, GST_BUFFER_DATA (part), GST_BUFFER_SIZE (part));
+    data += GST_BUFFER_SIZE (part);
+  }
+  gst_h264_parse_free_parts (parts);
+
+  return outbuf;
+}
+
 /* sends a codec NAL downstream, decorating and transforming as needed.
  * No ownership is taken of @nal */
 static GstFlowReturn
@@ -1630,7 +1711,11 @@ gst_h264_parse_push_buffer (GstH264Parse * h264parse, GstBuffer * buf)
     }
 
     if (!h264parse->merge) {
-      nal_type = data[nal_length] & 0x1f;
+      /* with a separate prefix, the NALU header starts the next part */
+      if (h264parse->out_parts)
+        nal_type = GST_BUFFER_DATA (h264parse->out_parts->data)[0] & 0x1f;
+      else
+        nal_type = data[nal_length] & 0x1f;
       GST_LOG_OBJECT (h264parse, "- nal type: %d", nal_type);
     } else if (h264parse->idr_offset >= 0) {
       GST_LOG_OBJECT (h264parse, "AU has IDR nal at offset %d",
@@ -1675,6 +1760,47 @@ gst_h264_parse_push_buffer (GstH264Parse * h264parse, GstBuffer * buf)
               h264parse->last_report = timestamp;
             }
           }
+        } else if (h264parse->out_parts) {
+          /* insert config NALs into the AU group */
+          GList *codec = NULL;
+          GstBuffer *codec_nal;
+
+          GST_DEBUG_OBJECT (h264parse, "- inserting SPS/PPS");
+          for (i = 0; i < MAX_SPS_COUNT; i++) {
+            if (h264parse->sps_nals[i]) {
+              GST_DEBUG_OBJECT (h264parse, "inserting SPS nal");
+              codec_nal = gst_buffer_copy (h264parse->sps_nals[i]);
+              codec = g_list_append (codec,
+                  gst_h264_parse_write_nal_prefix (h264parse, codec_nal));
+              h264parse->last_report = timestamp;
+            }
+          }
+          for (i = 0; i < MAX_PPS_COUNT; i++) {
+            if (h264parse->pps_nals[i]) {
+              GST_DEBUG_OBJECT (h264parse, "inserting PPS nal");
+              codec_nal = gst_buffer_copy (h264parse->pps_nals[i]);
+              codec = g_list_append (codec,
+                  gst_h264_parse_write_nal_prefix (h264parse, codec_nal));
+              h264parse->last_report = timestamp;
+            }
+          }
+          if (codec && h264parse->idr_index <= 0) {
+            /* the config NALs now start the group */
+            codec_nal = codec->data;
+            gst_buffer_copy_metadata (codec_nal, buf,
+                GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS);
+            codec = g_list_append (g_list_delete_link (codec, codec), buf);
+            h264parse->out_parts = g_list_concat (codec, h264parse->out_parts);
+            buf = codec_nal;
+          } else if (codec) {
+            GList *walk, *idr;
+
+            idr = g_list_nth (h264parse->out_parts, h264parse->idr_index - 1);
+            for (walk = codec; walk; walk = walk->next)
+              h264parse->out_parts =
+                  g_list_insert_before (h264parse->out_parts, idr, walk->data);
+            g_list_free (codec);
+          }
         } else {
           /* insert config NALs into AU */
           GstByteWriter bw;
@@ -1720,6 +1846,29 @@ gst_h264_parse_push_buffer (GstH264Parse * h264parse, GstBuffer * buf)
   }
 
   gst_buffer_set_caps (buf, h264parse->src_caps);
+
+  if (h264parse->out_parts) {
+    GstBufferList *list;
+    GstBufferListIterator *it;
+    GList *walk;
+
+    list = gst_buffer_list_new ();
+    it = gst_buffer_list_iterate (list);
+    gst_buffer_list_iterator_add_group (it);
+    gst_buffer_list_iterator_add (it, buf);
+    for (walk = h264parse->out_parts; walk; walk = walk->next) {
+      GstBuffer *part = gst_buffer_make_metadata_writable (walk->data);
+
+      gst_buffer_set_caps (part, h264parse->src_caps);
+      gst_buffer_list_iterator_add (it, part);
+    }
+    gst_buffer_list_iterator_free (it);
+    g_list_free (h264parse->out_parts);
+    h264parse->out_parts = NULL;
+
+    return gst_pad_push_list (h264parse->srcpad, list);
+  }
+
   return gst_pad_push (h264parse->srcpad, buf);
 }
 
@@ -1731,30 +1880,17 @@ gst_h264_parse_push_nal (GstH264Parse * h264parse, GstBuffer * nal,
   gint nal_type;
   guint8 *data;
   GstBuffer *outbuf = NULL;
-  guint outsize, size, nal_length = h264parse->nal_length_size;
+  guint size, nal_length, next_length;
   gboolean start;
   gboolean complete;
 
   data = GST_BUFFER_DATA (nal);
   size = GST_BUFFER_SIZE (nal);
 
-  /* deal with 3-byte start code by normalizing to 4-byte here */
-  if (!h264parse->packetized && data[2] == 0x01) {
-    GstBuffer *tmp;
-
-    /* ouch, copy */
-    GST_DEBUG_OBJECT (h264parse, "replacing 3-byte startcode");
-    tmp = gst_buffer_new_and_alloc (1);
-    GST_BUFFER_DATA (tmp)[0] = 0;
-    gst_buffer_ref (nal);
-    tmp = gst_buffer_join (tmp, nal);
-    GST_BUFFER_TIMESTAMP (tmp) = GST_BUFFER_TIMESTAMP (nal);
-    gst_buffer_unref (nal);
-    nal = tmp;
-
-    data = GST_BUFFER_DATA (nal);
-    size = GST_BUFFER_SIZE (nal);
-  }
+  /* 3-byte start codes are normalized to 4-byte when writing the prefix */
+  nal_length = h264parse->nal_length_size;
+  if (!h264parse->packetized && size >= 3 && data[2] == 0x01)
+    nal_length = 3;
 
   /* caller ensures number of bytes available */
   g_return_val_if_fail (size >= nal_length + 1, NULL);
@@ -1768,6 +1904,9 @@ gst_h264_parse_push_nal (GstH264Parse * h264parse, GstBuffer * nal,
   if (G_UNLIKELY (!next_nal)) {
     complete = TRUE;
   } else {
+    next_length = h264parse->nal_length_size;
+    if (!h264parse->packetized && next_nal[2] == 0x01)
+      next_length = 3;
     /* consider a coded slices (IDR or not) to start a picture,
      * (so ending the previous one) if first_mb_in_slice == 0
      * (non-0 is part of previous one) */
@@ -1775,12 +1914,12 @@ gst_h264_parse_push_nal (GstH264Parse * h264parse, GstBuffer * nal,
      * but in practice it works in sane cases, needs not much parsing,
      * and also works with broken frame_num in NAL
      * (where spec-wise would fail) */
-    nal_type = next_nal[nal_length] & 0x1f;
+    nal_type = next_nal[next_length] & 0x1f;
     GST_LOG_OBJECT (h264parse, "next nal type: %d", nal_type);
     complete = h264parse->picture_start && (nal_type >= 6 && nal_type <= 9);
     complete |= h264parse->picture_start &&
         (nal_type == 1 || nal_type == 2 || nal_type == 5) &&
-        (next_nal[nal_length + 1] & 0x80);
+        (next_nal[next_length + 1] & 0x80);
   }
 
   /* collect SPS and PPS NALUs to make up codec_data, if so needed */
@@ -1818,47 +1957,59 @@ gst_h264_parse_push_nal (GstH264Parse * h264parse, GstBuffer * nal,
 
   if (h264parse->merge) {
     /* clear IDR mark state */
-    if (gst_adapter_available (h264parse->picture_adapter) == 0)
+    if (h264parse->picture_nals == NULL) {
       h264parse->idr_offset = -1;
-
-    /* proper prefix */
-    nal = gst_h264_parse_write_nal_prefix (h264parse, nal);
+      h264parse->idr_index = -1;
+    }
 
     /* start of a picture is a good time to insert codec SPS and PPS */
     if (G_UNLIKELY (h264parse->codec_nals && h264parse->picture_start)) {
       while (h264parse->codec_nals) {
+        GstBuffer *codec_nal = h264parse->codec_nals->data;
+
         GST_DEBUG_OBJECT (h264parse, "inserting codec_nal of size %d into AU",
-            GST_BUFFER_SIZE (h264parse->codec_nals->data));
-        gst_adapter_push (h264parse->picture_adapter,
-            h264parse->codec_nals->data);
+            GST_BUFFER_SIZE (codec_nal));
+        h264parse->picture_nals =
+            g_list_append (h264parse->picture_nals, codec_nal);
+        h264parse->picture_size += GST_BUFFER_SIZE (codec_nal);
         h264parse->codec_nals =
             g_slist_delete_link (h264parse->codec_nals, h264parse->codec_nals);
       }
     }
 
     /* mark IDR nal location for later possible config insertion */
-    if (nal_type == 5 && h264parse->idr_offset < 0)
-      h264parse->idr_offset =
-          gst_adapter_available (h264parse->picture_adapter);
+    if (nal_type == 5 && h264parse->idr_offset < 0) {
+      h264parse->idr_offset = h264parse->picture_size;
+      h264parse->idr_index = g_list_length (h264parse->picture_nals);
+    }
 
-    /* regardless, collect this NALU */
-    gst_adapter_push (h264parse->picture_adapter, nal);
+    if (!GST_CLOCK_TIME_IS_VALID (h264parse->picture_ts))
+      h264parse->picture_ts = GST_BUFFER_TIMESTAMP (nal);
+
+    /* regardless, collect this NALU, with proper prefix */
+    h264parse->picture_nals = gst_h264_parse_add_nal_parts (h264parse,
+        h264parse->picture_nals, nal, &h264parse->picture_size);
 
     if (complete) {
-      GstClockTime ts;
+      GstClockTime ts = h264parse->picture_ts;
 
       h264parse->picture_start = FALSE;
-      ts = gst_adapter_prev_timestamp (h264parse->picture_adapter, NULL);
-      outsize = gst_adapter_available (h264parse->picture_adapter);
-      outbuf = gst_adapter_take_buffer (h264parse->picture_adapter, outsize);
-      outbuf = gst_buffer_make_metadata_writable (outbuf);
+      outbuf = gst_h264_parse_finish_parts (h264parse,
+          h264parse->picture_nals, h264parse->picture_size);
+      h264parse->picture_nals = NULL;
+      h264parse->picture_size = 0;
+      h264parse->picture_ts = GST_CLOCK_TIME_NONE;
       GST_BUFFER_TIMESTAMP (outbuf) = ts;
 
       /* AU always starts a frame */
       start = TRUE;
     }
   } else {
-    outbuf = gst_h264_parse_write_nal_prefix (h264parse, nal);
+    GList *parts;
+
+    size = 0;
+    parts = gst_h264_parse_add_nal_parts (h264parse, NULL, nal, &size);
+    outbuf = gst_h264_parse_finish_parts (h264parse, parts, size);
   }
 
   if (_start)
@@ -1867,6 +2018,116 @@ gst_h264_parse_push_nal (GstH264Parse * h264parse, GstBuffer * nal,
   return outbuf;
 }
 
+static void
+gst_h264_parse_reset_scan (GstH264Parse * h264parse)
+{
+  g_array_set_size (h264parse->nal_starts, 0);
+  h264parse->scanned = 0;
+  h264parse->scan_state = 0xffffffff;
+}
+
+static inline void
+gst_h264_parse_add_start (GstH264Parse * h264parse, guint pos,
+    gboolean zero_before)
+{
+  guint entry = (pos << 1) | (zero_before ? 1 : 0);
+
+  g_array_append_val (h264parse->nal_starts, entry);
+}
+
+/* Records the 00 00 01 start codes of a buffer appended to the adapter, so
+ * that every byte of the input is inspected only once, no matter in how many
+ * pieces a NAL arrives. */
+static void
+gst_h264_parse_scan_start_codes (GstH264Parse * h264parse,
+    const guint8 * data, guint size)
+{
+  guint32 state = h264parse->scan_state;
+  guint base = h264parse->scanned;
+  guint i;
+
+  /* start codes ending in the first two bytes begin in the previous data */
+  for (i = 0; i < MIN (size, 2); i++) {
+    state = (state << 8) | data[i];
+    if ((state & 0x00ffffff) == 0x000001)
+      gst_h264_parse_add_start (h264parse, base + i - 2, (state >> 24) == 0);
+  }
+
+  i = 0;
+  while (i + 3 <= size) {
+    /* skip 4 bytes at a time as long as none of them is zero, as a start
+     * code can not begin at any of them then */
+    if (i + 4 <= size) {
+      guint32 w = GST_READ_UINT32_LE (data + i);
+
+      if (!((w - 0x01010101) & ~w & 0x80808080)) {
+        i += 4;
+        continue;
+      }
+    }
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+      gboolean zero_before;
+
+      if (i > 0)
+        zero_before = data[i - 1] == 0;
+      else
+        zero_before = (h264parse->scan_state & 0xff) == 0;
+      gst_h264_parse_add_start (h264parse, base + i, zero_before);
+      i += 3;
+    } else {
+      i++;
+    }
+  }
+
+  /* keep the last bytes around for the next buffer */
+  state = h264parse->scan_state;
+  for (i = size > 4 ? size - 4 : 0; i < size; i++)
+    state = (state << 8) | data[i];
+  h264parse->scan_state = state;
+  h264parse->scanned = base + size;
+}
+
+/* to be called when @size bytes are flushed from the adapter */
+static void
+gst_h264_parse_flush_scan (GstH264Parse * h264parse, guint size)
+{
+  GArray *starts = h264parse->nal_starts;
+  guint i, n = 0;
+
+  while (n < starts->len && (g_array_index (starts, guint, n) >> 1) < size)
+    n++;
+  g_array_remove_range (starts, 0, n);
+
+  for (i = 0; i < starts->len; i++)
+    g_array_index (starts, guint, i) -= size << 1;
+  h264parse->scanned -= size;
+}
+
+/* Returns the offset of the first start code after the one the adapter
+ * begins with, including a leading zero byte, or -1 when none is known yet.
+ * The byte following the start code must be available too. */
+static gint
+gst_h264_parse_next_start (GstH264Parse * h264parse, guint avail)
+{
+  GArray *starts = h264parse->nal_starts;
+
+  while (starts->len > 0) {
+    guint entry = g_array_index (starts, guint, 0);
+    guint pos = entry >> 1;
+
+    /* this is the start code of the current NALU */
+    if (pos < 2) {
+      g_array_remove_index (starts, 0);
+      continue;
+    }
+    if (pos + 3 >= avail)
+      break;
+
+    return (entry & 1) ? pos - 1 : pos;
+  }
+  return -1;
+}
+
 static void
 gst_h264_parse_clear_queues (GstH264Parse * h264parse)
 {
@@ -1884,8 +2145,9 @@ gst_h264_parse_clear_queues (GstH264Parse * h264parse)
     h264parse->prev = NULL;
   }
   gst_adapter_clear (h264parse->adapter);
+  gst_h264_parse_reset_scan (h264parse);
   h264parse->have_i_frame = FALSE;
-  gst_adapter_clear (h264parse->picture_adapter);
+  gst_h264_parse_clear_picture (h264parse);
   h264parse->picture_start = FALSE;
 }
 
@@ -1898,9 +2160,13 @@ gst_h264_parse_chain_forward (GstH264Parse * h264parse, gboolean discont,
 
   if (discont) {
     gst_adapter_clear (h264parse->adapter);
+    gst_h264_parse_reset_scan (h264parse);
     h264parse->discont = TRUE;
   }
 
+  if (!h264parse->packetized)
+    gst_h264_parse_scan_start_codes (h264parse, GST_BUFFER_DATA (buffer),
+        GST_BUFFER_SIZE (buffer));
   gst_adapter_push (h264parse->adapter, buffer);
 
   while (res == GST_FLOW_OK) {
@@ -1913,45 +2179,45 @@ gst_h264_parse_chain_forward (GstH264Parse * h264parse, gboolean discont,
     avail = gst_adapter_available (h264parse->adapter);
     if (avail < h264parse->nal_length_size + 2)
       break;
-    data = gst_adapter_peek (h264parse->adapter, avail);
 
     if (!h264parse->packetized) {
       /* Bytestream format, first 3/4 bytes are sync code */
       /* re-sync; locate initial startcode */
       if (G_UNLIKELY (h264parse->discont)) {
-        guint32 value;
-
         /* check for initial 00 00 01 */
         i = gst_adapter_masked_scan_uint32 (h264parse->adapter, 0xffffff00,
             0x00000100, 0, 4);
         if (i < 0) {
-          i = gst_adapter_masked_scan_uint32_peek (h264parse->adapter,
-              0x00ffffff, 0x01, 0, avail, &value);
-          if (i < 0) {
+          guint entry;
+
+          if (h264parse->nal_starts->len == 0) {
             /* no sync code, flush and try next time */
             gst_adapter_flush (h264parse->adapter, avail - 2);
+            gst_h264_parse_flush_scan (h264parse, avail - 2);
             break;
-          } else {
-            if (value >> 24 != 00)
-              /* so a 3 byte startcode */
-              i++;
-            gst_adapter_flush (h264parse->adapter, i);
-            avail -= i;
-            data = gst_adapter_peek (h264parse->adapter, avail);
           }
+          entry = g_array_index (h264parse->nal_starts, guint, 0);
+          i = entry >> 1;
+          if ((entry & 1) && i > 0)
+            /* so a 4 byte startcode */
+            i--;
+          gst_adapter_flush (h264parse->adapter, i);
+          gst_h264_parse_flush_scan (h264parse, i);
+          avail -= i;
         }
         GST_DEBUG_OBJECT (h264parse, "re-sync found startcode at %d", i);
       }
       /* Find next NALU header, might be 3 or 4 bytes */
-      for (i = 1; i < avail - 4; ++i) {
-        if (data[i + 1] == 0 && data[i + 2] == 0 && data[i + 3] == 1) {
-          if (data[i + 0] == 0)
-            next_nalu_pos = i;
-          else
-            next_nalu_pos = i + 1;
-          break;
-        }
+      next_nalu_pos = gst_h264_parse_next_start (h264parse, avail);
+      if (next_nalu_pos < 0) {
+        /* NALU can not be parsed yet, we wait for more data in the adapter. */
+        break;
       }
+      /* only the complete NALU needs to be contiguous, along with the
+       * next start code that is known to be available */
+      avail = next_nalu_pos + 4;
+      data = gst_adapter_peek (h264parse->adapter, avail);
+
       /* skip sync */
       if (data[2] == 0x1) {
         data += 3;
@@ -1963,6 +2229,8 @@ gst_h264_parse_chain_forward (GstH264Parse * h264parse, gboolean discont,
     } else {
       guint32 nalu_size;
 
+      data = gst_adapter_peek (h264parse->adapter, avail);
+
       nalu_size = 0;
       for (i = 0; i < h264parse->nal_length_size; i++)
         nalu_size = (nalu_size << 8) | data[i];
@@ -2078,6 +2346,8 @@ gst_h264_parse_chain_forward (GstH264Parse * h264parse, gboolean discont,
 
       outbuf_dts = gst_adapter_prev_timestamp (h264parse->adapter, NULL);       /* Better value for the second parameter? */
       outbuf = gst_adapter_take_buffer (h264parse->adapter, next_nalu_pos);
+      if (!h264parse->packetized)
+        gst_h264_parse_flush_scan (h264parse, next_nalu_pos);
 
       /* packetized will have no next data, which serves fine here */
       next_data = (guint8 *) gst_adapter_peek (h264parse->adapter, 6);
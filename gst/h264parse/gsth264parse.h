@@ -90,6 +90,14 @@ struct _GstH264Parse
   gboolean have_i_frame;
 
   GstAdapter *adapter;
+  /* start codes found in the bytestream input, as adapter offsets of the
+   * 00 00 01 shifted left by one, with the low bit set when a zero byte
+   * precedes it */
+  GArray *nal_starts;
+  /* bytes of the adapter already scanned for start codes */
+  guint scanned;
+  /* last bytes scanned, for start codes spanning buffers */
+  guint32 scan_state;
 
   /* SPS: sequential parameter set */ 
   GstH264Sps *sps_buffers[MAX_SPS_COUNT];
@@ -126,9 +134,14 @@ struct _GstH264Parse
   guint32 frame_cnt;
 
   /* NALU AU */
-  GstAdapter *picture_adapter;
+  GList *picture_nals;
+  guint picture_size;
+  GstClockTime picture_ts;
   gboolean picture_start;
   gint idr_offset;
+  gint idr_index;
+  /* rest of the output unit when pushing a buffer list */
+  GList *out_parts;
 
   /* codec data NALUs to be inserted into stream */
   GSList  *codec_nals;
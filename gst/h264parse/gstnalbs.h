@@ -0,0 +1,200 @@
+/* GStreamer h264 parser
+ *
+ * gstnalbs.h: bitstream reader for NAL unit headers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_NAL_BS_H__
+#define __GST_NAL_BS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* bytes of the NAL unit that are unescaped at a time */
+#define GST_NAL_BS_CHUNK_SIZE 16
+
+/* Bitstream reader that strips emulation_prevention_three_bytes from the NAL
+ * unit a chunk at a time into a scratch buffer, so that only the bytes
+ * actually needed for the headers get unescaped, and then reads from a 64 bit
+ * cache that is refilled a word at a time. */
+typedef struct
+{
+  /* escaped input that was not unescaped yet */
+  const guint8 *data;
+  const guint8 *end;
+  guint zeros;                  /* zero bytes preceding data */
+
+  /* unescaped bytes */
+  guint8 buf[GST_NAL_BS_CHUNK_SIZE];
+  guint pos;
+  guint len;
+
+  guint64 cache;                /* next bits, most significant bit first */
+  gint bits;                    /* number of valid bits in cache */
+} GstNalBs;
+
+static inline void
+gst_nal_bs_init (GstNalBs * bs, const guint8 * data, guint size)
+{
+  bs->data = data;
+  bs->end = data + size;
+  bs->zeros = 0;
+  bs->pos = bs->len = 0;
+  bs->cache = 0;
+  bs->bits = 0;
+}
+
+/* unescape the next chunk of input into buf */
+static inline gboolean
+gst_nal_bs_unescape (GstNalBs * bs)
+{
+  const guint8 *data = bs->data;
+  guint zeros = bs->zeros;
+  guint len = 0;
+
+  while (len < GST_NAL_BS_CHUNK_SIZE && data < bs->end) {
+    guint8 byte = *data++;
+
+    if (G_UNLIKELY (zeros >= 2 && byte == 0x03)) {
+      zeros = 0;
+      continue;
+    }
+    zeros = byte ? 0 : zeros + 1;
+    bs->buf[len++] = byte;
+  }
+  bs->data = data;
+  bs->zeros = zeros;
+  bs->pos = 0;
+  bs->len = len;
+
+  return len > 0;
+}
+
+static inline void
+gst_nal_bs_refill (GstNalBs * bs)
+{
+  if (G_LIKELY (bs->pos + 8 <= bs->len)) {
+    guint n = (64 - bs->bits) >> 3;
+
+    /* the bits of the partial byte below the filled ones are the same that
+     * the next refill will put there */
+    bs->cache |= GST_READ_UINT64_BE (bs->buf + bs->pos) >> bs->bits;
+    bs->pos += n;
+    bs->bits += n << 3;
+    return;
+  }
+
+  while (bs->bits <= 56) {
+    if (bs->pos >= bs->len && !gst_nal_bs_unescape (bs))
+      break;
+    bs->cache |= (guint64) bs->buf[bs->pos++] << (56 - bs->bits);
+    bs->bits += 8;
+  }
+}
+
+/* read @n bits, at most 32; at the end of the data the remaining bits are
+ * returned */
+static inline guint32
+gst_nal_bs_read (GstNalBs * bs, guint n)
+{
+  guint32 res;
+
+  if (n == 0)
+    return 0;
+
+  if (bs->bits < (gint) n) {
+    gst_nal_bs_refill (bs);
+    /* we're at the end, can't produce more than bits number of bits */
+    if (G_UNLIKELY (bs->bits < (gint) n)) {
+      n = bs->bits;
+      if (n == 0)
+        return 0;
+    }
+  }
+
+  res = bs->cache >> (64 - n);
+  bs->cache <<= n;
+  bs->bits -= n;
+
+  return res;
+}
+
+static inline gboolean
+gst_nal_bs_eos (GstNalBs * bs)
+{
+  return bs->bits == 0 && bs->pos >= bs->len && bs->data >= bs->end;
+}
+
+static inline guint
+gst_nal_bs_clz64 (guint64 value)
+{
+#if defined(__GNUC__) && (__GNUC__ >= 4)
+  return __builtin_clzll (value);
+#else
+  guint n = 0;
+
+  while (!(value & G_GUINT64_CONSTANT (0x8000000000000000))) {
+    value <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* read unsigned Exp-Golomb code */
+static inline gint
+gst_nal_bs_read_ue (GstNalBs * bs)
+{
+  gint i = 0;
+
+  if (bs->bits < 32)
+    gst_nal_bs_refill (bs);
+
+  /* count the leading zero bits at once when the marker bit is cached */
+  if (G_LIKELY (bs->cache != 0)) {
+    i = gst_nal_bs_clz64 (bs->cache);
+    if (G_LIKELY (i < bs->bits && i < 32)) {
+      bs->cache <<= i + 1;
+      bs->bits -= i + 1;
+      return ((1 << i) - 1 + gst_nal_bs_read (bs, i));
+    }
+    i = 0;
+  }
+
+  while (gst_nal_bs_read (bs, 1) == 0 && !gst_nal_bs_eos (bs) && i < 32)
+    i++;
+
+  return ((1 << i) - 1 + gst_nal_bs_read (bs, i));
+}
+
+/* read signed Exp-Golomb code */
+static inline gint
+gst_nal_bs_read_se (GstNalBs * bs)
+{
+  gint i = 0;
+
+  i = gst_nal_bs_read_ue (bs);
+  /* (-1)^(i+1) Ceil (i / 2) */
+  i = (i + 1) / 2 * (i & 1 ? 1 : -1);
+
+  return i;
+}
+
+G_END_DECLS
+
+#endif /* __GST_NAL_BS_H__ */
@@ -35,6 +35,13 @@
  * Unlike the adder, the liveadder mixes the streams according the their
  * timestamps and waits for some milli-seconds before trying doing the mixing.
  *
+ * Each sink pad has a "volume" and a "mute" property that are applied to its
+ * data before it is mixed in.
+ *
+ * Requesting a "mixminus%d" source pad gives a mix of all the inputs except
+ * the one coming in on the sink pad with the same number, as is needed to
+ * send each participant of a conference everybody but themselves.
+ *
  * Last reviewed on 2008-02-10 (0.10.11)
  */
 
@@ -46,10 +53,20 @@
 
 #include <gst/audio/audio.h>
 
+#include <stdio.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define DEFAULT_LATENCY_MS 60
 
+/* duration of the periods the ring is sliced into and of the output buffers */
+#define PERIOD_MS 10
+/* the ring holds twice our latency and the peer latency plus this much */
+#define RING_EXTRA_MS 500
+
 GST_DEBUG_CATEGORY_STATIC (live_adder_debug);
 #define GST_CAT_DEFAULT (live_adder_debug)
 
@@ -69,6 +86,14 @@ static GstStaticPadTemplate gst_live_adder_src_template =
         GST_AUDIO_FLOAT_PAD_TEMPLATE_CAPS)
     );
 
+static GstStaticPadTemplate gst_live_adder_mixminus_template =
+    GST_STATIC_PAD_TEMPLATE ("mixminus%d",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (GST_AUDIO_INT_PAD_TEMPLATE_CAPS "; "
+        GST_AUDIO_FLOAT_PAD_TEMPLATE_CAPS)
+    );
+
 /* Valve signals and args */
 enum
 {
@@ -82,6 +107,16 @@ enum
   PROP_LATENCY,
 };
 
+#define DEFAULT_PAD_VOLUME 1.0
+#define DEFAULT_PAD_MUTE FALSE
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_VOLUME,
+  PROP_PAD_MUTE
+};
+
 typedef struct _GstLiveAdderPadPrivate
 {
   GstSegment segment;
@@ -89,11 +124,26 @@ typedef struct _GstLiveAdderPadPrivate
 
   GstClockTime expected_timestamp;
 
+  /* N of sinkN, matches the mixminusN pad that leaves this input out */
+  gint index;
+  /* what this pad added to each period of the ring, only kept while there
+   * are mixminus pads */
+  guint8 *contrib;
+
 } GstLiveAdderPadPrivate;
 
+typedef struct _GstLiveAdderMixMinusPrivate
+{
+  /* N of mixminusN */
+  gint index;
+  gboolean segment_pending;
+} GstLiveAdderMixMinusPrivate;
+
 
 GST_BOILERPLATE (GstLiveAdder, gst_live_adder, GstElement, GST_TYPE_ELEMENT);
 
+G_DEFINE_TYPE (GstLiveAdderPad, gst_live_adder_pad, GST_TYPE_PAD);
+
 
 static void gst_live_adder_finalize (GObject * object);
 static void
@@ -104,7 +154,7 @@ gst_live_adder_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec);
 
 static GstPad *gst_live_adder_request_new_pad (GstElement * element,
-    GstPadTemplate * templ, const gchar * unused);
+    GstPadTemplate * templ, const gchar * req_name);
 static void gst_live_adder_release_pad (GstElement * element, GstPad * pad);
 static GstStateChangeReturn
 gst_live_adder_change_state (GstElement * element, GstStateChange transition);
@@ -121,34 +171,206 @@ static gboolean gst_live_adder_sink_event (GstPad * pad, GstEvent * event);
 
 
 static void reset_pad_private (GstPad * pad);
+static void reset_mixminus_private (GstPad * pad);
+
+/* SSE2 loop adding 16 bytes at a time, the remaining samples are left to the
+ * scalar loop */
+#ifdef __SSE2__
+#define SSE2_LOOP(type,ptype,load,store,vadd)                   \
+  for (; i + 16 / sizeof (type) <= n; i += 16 / sizeof (type))  \
+    store ((ptype) (out + i),                                   \
+        vadd (load ((ptype) (out + i)), load ((ptype) (in + i))));
+#else
+#define SSE2_LOOP(type,ptype,load,store,vadd)
+#endif
+
+#define SSE2_LOOP_INT(type,vadd) \
+  SSE2_LOOP (type, __m128i *, _mm_loadu_si128, _mm_storeu_si128, vadd)
 
-/* clipping versions */
-#define MAKE_FUNC(name,type,ttype,min,max)                      \
+/* clipping versions, op is + or - */
+#define MAKE_FUNC(name,type,ttype,min,max,op,simd)              \
 static void name (type *out, type *in, gint bytes) {            \
-  gint i;                                                       \
-  for (i = 0; i < bytes / sizeof (type); i++)                   \
-    out[i] = CLAMP ((ttype)out[i] + (ttype)in[i], min, max);    \
+  gint i = 0;                                                   \
+  gint n = bytes / sizeof (type);                               \
+  simd                                                          \
+  for (; i < n; i++)                                            \
+    out[i] = CLAMP ((ttype)out[i] op (ttype)in[i], min, max);   \
 }
 
 /* non-clipping versions (for float) */
-#define MAKE_FUNC_NC(name,type,ttype)                           \
+#define MAKE_FUNC_NC(name,type,ttype,op,simd)                   \
 static void name (type *out, type *in, gint bytes) {            \
+  gint i = 0;                                                   \
+  gint n = bytes / sizeof (type);                               \
+  simd                                                          \
+  for (; i < n; i++)                                            \
+    out[i] = (ttype)out[i] op (ttype)in[i];                     \
+}
+
+/* out = in * volume */
+#define MAKE_VOLUME_FUNC(name,type,min,max)                     \
+static void name (type *out, type *in, gdouble volume,          \
+    gint bytes) {                                               \
   gint i;                                                       \
-  for (i = 0; i < bytes / sizeof (type); i++)                   \
-    out[i] = (ttype)out[i] + (ttype)in[i];                      \
+  gint n = bytes / sizeof (type);                               \
+  for (i = 0; i < n; i++)                                       \
+    out[i] = CLAMP (in[i] * volume, min, max);                  \
+}
+
+#define MAKE_VOLUME_FUNC_NC(name,type)                          \
+static void name (type *out, type *in, gdouble volume,          \
+    gint bytes) {                                               \
+  gint i;                                                       \
+  gint n = bytes / sizeof (type);                               \
+  for (i = 0; i < n; i++)                                       \
+    out[i] = in[i] * volume;                                    \
+}
+
+/* TRUE if a sample is at the limits of the format, which is where the
+ * clipping adds leave it when they saturate */
+#define MAKE_CLIPPED_FUNC(name,type,min,max)                    \
+static gboolean name (type *data, gint bytes) {                 \
+  gint i;                                                       \
+  gint n = bytes / sizeof (type);                               \
+  for (i = 0; i < n; i++)                                       \
+    if (data[i] == min || data[i] == max)                       \
+      return TRUE;                                              \
+  return FALSE;                                                 \
 }
 
 /* *INDENT-OFF* */
-MAKE_FUNC (add_int32, gint32, gint64, G_MININT32, G_MAXINT32)
-MAKE_FUNC (add_int16, gint16, gint32, G_MININT16, G_MAXINT16)
-MAKE_FUNC (add_int8, gint8, gint16, G_MININT8, G_MAXINT8)
-MAKE_FUNC (add_uint32, guint32, guint64, 0, G_MAXUINT32)
-MAKE_FUNC (add_uint16, guint16, guint32, 0, G_MAXUINT16)
-MAKE_FUNC (add_uint8, guint8, guint16, 0, G_MAXUINT8)
-MAKE_FUNC_NC (add_float64, gdouble, gdouble)
-MAKE_FUNC_NC (add_float32, gfloat, gfloat)
+MAKE_FUNC (add_int32, gint32, gint64, G_MININT32, G_MAXINT32, +, )
+MAKE_FUNC (add_int16, gint16, gint32, G_MININT16, G_MAXINT16, +,
+    SSE2_LOOP_INT (gint16, _mm_adds_epi16))
+MAKE_FUNC (add_int8, gint8, gint16, G_MININT8, G_MAXINT8, +,
+    SSE2_LOOP_INT (gint8, _mm_adds_epi8))
+MAKE_FUNC (add_uint32, guint32, guint64, 0, G_MAXUINT32, +, )
+MAKE_FUNC (add_uint16, guint16, guint32, 0, G_MAXUINT16, +,
+    SSE2_LOOP_INT (guint16, _mm_adds_epu16))
+MAKE_FUNC (add_uint8, guint8, guint16, 0, G_MAXUINT8, +,
+    SSE2_LOOP_INT (guint8, _mm_adds_epu8))
+MAKE_FUNC_NC (add_float64, gdouble, gdouble, +,
+    SSE2_LOOP (gdouble, gdouble *, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd))
+MAKE_FUNC_NC (add_float32, gfloat, gfloat, +,
+    SSE2_LOOP (gfloat, gfloat *, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps))
+
+MAKE_FUNC (sub_int32, gint32, gint64, G_MININT32, G_MAXINT32, -, )
+MAKE_FUNC (sub_int16, gint16, gint32, G_MININT16, G_MAXINT16, -,
+    SSE2_LOOP_INT (gint16, _mm_subs_epi16))
+MAKE_FUNC (sub_int8, gint8, gint16, G_MININT8, G_MAXINT8, -,
+    SSE2_LOOP_INT (gint8, _mm_subs_epi8))
+MAKE_FUNC (sub_uint32, guint32, gint64, 0, G_MAXUINT32, -, )
+MAKE_FUNC (sub_uint16, guint16, gint32, 0, G_MAXUINT16, -,
+    SSE2_LOOP_INT (guint16, _mm_subs_epu16))
+MAKE_FUNC (sub_uint8, guint8, gint16, 0, G_MAXUINT8, -,
+    SSE2_LOOP_INT (guint8, _mm_subs_epu8))
+MAKE_FUNC_NC (sub_float64, gdouble, gdouble, -,
+    SSE2_LOOP (gdouble, gdouble *, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd))
+MAKE_FUNC_NC (sub_float32, gfloat, gfloat, -,
+    SSE2_LOOP (gfloat, gfloat *, _mm_loadu_ps, _mm_storeu_ps, _mm_sub_ps))
+
+MAKE_VOLUME_FUNC (volume_int32, gint32, G_MININT32, G_MAXINT32)
+MAKE_VOLUME_FUNC (volume_int16, gint16, G_MININT16, G_MAXINT16)
+MAKE_VOLUME_FUNC (volume_int8, gint8, G_MININT8, G_MAXINT8)
+MAKE_VOLUME_FUNC (volume_uint32, guint32, 0, G_MAXUINT32)
+MAKE_VOLUME_FUNC (volume_uint16, guint16, 0, G_MAXUINT16)
+MAKE_VOLUME_FUNC (volume_uint8, guint8, 0, G_MAXUINT8)
+MAKE_VOLUME_FUNC_NC (volume_float64, gdouble)
+MAKE_VOLUME_FUNC_NC (volume_float32, gfloat)
+
+MAKE_CLIPPED_FUNC (clipped_int32, gint32, G_MININT32, G_MAXINT32)
+MAKE_CLIPPED_FUNC (clipped_int16, gint16, G_MININT16, G_MAXINT16)
+MAKE_CLIPPED_FUNC (clipped_int8, gint8, G_MININT8, G_MAXINT8)
+MAKE_CLIPPED_FUNC (clipped_uint32, guint32, 0, G_MAXUINT32)
+MAKE_CLIPPED_FUNC (clipped_uint16, guint16, 0, G_MAXUINT16)
+MAKE_CLIPPED_FUNC (clipped_uint8, guint8, 0, G_MAXUINT8)
 /* *INDENT-ON* */
 
+#define SET_FUNCS(adder,type) G_STMT_START {                                 \
+  (adder)->func = (GstLiveAdderFunction) add_##type;                         \
+  (adder)->sub_func = (GstLiveAdderFunction) sub_##type;                     \
+  (adder)->volume_func = (GstLiveAdderVolumeFunction) volume_##type;         \
+  (adder)->clipped_func = (GstLiveAdderClippedFunction) clipped_##type;      \
+} G_STMT_END
+
+#define SET_FUNCS_NC(adder,type) G_STMT_START {                              \
+  (adder)->func = (GstLiveAdderFunction) add_##type;                         \
+  (adder)->sub_func = (GstLiveAdderFunction) sub_##type;                     \
+  (adder)->volume_func = (GstLiveAdderVolumeFunction) volume_##type;         \
+  (adder)->clipped_func = NULL;                                              \
+} G_STMT_END
+
+
+static void
+gst_live_adder_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstLiveAdderPad *pad = GST_LIVE_ADDER_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_VOLUME:
+      GST_OBJECT_LOCK (pad);
+      pad->volume = g_value_get_double (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_MUTE:
+      GST_OBJECT_LOCK (pad);
+      pad->mute = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_live_adder_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstLiveAdderPad *pad = GST_LIVE_ADDER_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_VOLUME:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_double (value, pad->volume);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_MUTE:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_boolean (value, pad->mute);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_live_adder_pad_class_init (GstLiveAdderPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = gst_live_adder_pad_set_property;
+  gobject_class->get_property = gst_live_adder_pad_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PAD_VOLUME,
+      g_param_spec_double ("volume", "Volume",
+          "Gain applied to this input before mixing", 0.0, 10.0,
+          DEFAULT_PAD_VOLUME, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_MUTE,
+      g_param_spec_boolean ("mute", "Mute",
+          "Leave this input out of the mix", DEFAULT_PAD_MUTE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_live_adder_pad_init (GstLiveAdderPad * pad)
+{
+  pad->volume = DEFAULT_PAD_VOLUME;
+  pad->mute = DEFAULT_PAD_MUTE;
+}
 
 static void
 gst_live_adder_base_init (gpointer klass)
@@ -173,6 +395,8 @@ gst_live_adder_class_init (GstLiveAdderClass * klass)
       gst_static_pad_template_get (&gst_live_adder_src_template));
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&gst_live_adder_sink_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&gst_live_adder_mixminus_template));
   gst_element_class_set_details_simple (gstelement_class, "Live Adder element",
       "Generic/Audio",
       "Mixes live/discontinuous audio streams",
@@ -217,12 +441,18 @@ gst_live_adder_init (GstLiveAdder * adder, GstLiveAdderClass * klass)
   adder->padcount = 0;
   adder->func = NULL;
   adder->not_empty_cond = g_cond_new ();
+  adder->not_full_cond = g_cond_new ();
 
   adder->next_timestamp = GST_CLOCK_TIME_NONE;
 
   adder->latency_ms = DEFAULT_LATENCY_MS;
 
-  adder->buffers = g_queue_new ();
+  adder->ring = NULL;
+  adder->filled = NULL;
+  adder->clipped = NULL;
+  adder->read_period = -1;
+  adder->write_period = -1;
+  adder->mixminus_period = -1;
 }
 
 
@@ -233,13 +463,15 @@ gst_live_adder_finalize (GObject * object)
   GstLiveAdder *adder = GST_LIVE_ADDER (object);
 
   g_cond_free (adder->not_empty_cond);
+  g_cond_free (adder->not_full_cond);
 
-  g_queue_foreach (adder->buffers, (GFunc) gst_mini_object_unref, NULL);
-  while (g_queue_pop_head (adder->buffers)) {
-  }
-  g_queue_free (adder->buffers);
+  g_free (adder->ring);
+  g_free (adder->filled);
+  g_free (adder->clipped);
+  g_free (adder->scratch);
 
   g_list_free (adder->sinkpads);
+  g_list_free (adder->mixminus_pads);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -261,6 +493,7 @@ gst_live_adder_set_property (GObject * object,
       GST_OBJECT_LOCK (adder);
       old_latency = adder->latency_ms;
       adder->latency_ms = new_latency;
+      gst_live_adder_ring_resize (adder);
       GST_OBJECT_UNLOCK (adder);
 
       /* post message if latency changed, this will inform the parent pipeline
@@ -300,6 +533,300 @@ gst_live_adder_get_property (GObject * object,
 }
 
 
+/* Must be called with the object lock */
+static void
+gst_live_adder_ring_reset (GstLiveAdder * adder)
+{
+  GList *item;
+
+  if (adder->ring) {
+    memset (adder->ring, 0,
+        adder->nperiods * adder->period_samples * adder->bps);
+    memset (adder->filled, 0, adder->nperiods * sizeof (gboolean));
+    memset (adder->clipped, 0, adder->nperiods * sizeof (gboolean));
+  }
+  for (item = adder->sinkpads; item; item = g_list_next (item)) {
+    GstLiveAdderPadPrivate *padprivate =
+        gst_pad_get_element_private (GST_PAD (item->data));
+
+    if (padprivate && padprivate->contrib)
+      memset (padprivate->contrib, 0,
+          adder->nperiods * adder->period_samples * adder->bps);
+  }
+  adder->nfilled = 0;
+  adder->read_period = -1;
+  adder->write_period = -1;
+  adder->mixminus_period = -1;
+}
+
+/* Starts or stops keeping track of what each input adds to the ring. Must
+ * be called with the object lock */
+static void
+gst_live_adder_track_contribs (GstLiveAdder * adder, gboolean track)
+{
+  GList *item;
+
+  for (item = adder->sinkpads; item; item = g_list_next (item)) {
+    GstLiveAdderPadPrivate *padprivate =
+        gst_pad_get_element_private (GST_PAD (item->data));
+
+    if (padprivate == NULL)
+      continue;
+
+    if (!track) {
+      g_free (padprivate->contrib);
+      padprivate->contrib = NULL;
+    } else if (adder->ring && padprivate->contrib == NULL) {
+      padprivate->contrib = g_malloc0 (adder->nperiods *
+          adder->period_samples * adder->bps);
+    }
+  }
+}
+
+/* The periods are pushed latency_ms + peer_latency after their running
+ * time, the ring has to hold the data until then. Must be called with the
+ * object lock */
+static guint
+gst_live_adder_ring_size (GstLiveAdder * adder)
+{
+  guint64 ring_ms;
+
+  ring_ms = 2 * (adder->latency_ms + adder->peer_latency / GST_MSECOND) +
+      RING_EXTRA_MS;
+
+  return (ring_ms + PERIOD_MS - 1) / PERIOD_MS;
+}
+
+/* Must be called with the object lock, after rate and bps were set */
+static void
+gst_live_adder_ring_alloc (GstLiveAdder * adder)
+{
+  adder->period_samples = MAX (1, adder->rate * PERIOD_MS / 1000);
+  adder->nperiods = gst_live_adder_ring_size (adder);
+
+  GST_DEBUG_OBJECT (adder, "allocating ring of %u periods of %u samples",
+      adder->nperiods, adder->period_samples);
+
+  g_free (adder->ring);
+  g_free (adder->filled);
+  g_free (adder->clipped);
+  g_free (adder->scratch);
+  adder->ring = g_malloc (adder->nperiods * adder->period_samples *
+      adder->bps);
+  adder->filled = g_new (gboolean, adder->nperiods);
+  adder->clipped = g_new (gboolean, adder->nperiods);
+  adder->scratch = g_malloc (adder->period_samples * adder->bps);
+
+  /* the contributions follow the layout of the ring */
+  gst_live_adder_track_contribs (adder, FALSE);
+  if (adder->mixminus_pads)
+    gst_live_adder_track_contribs (adder, TRUE);
+
+  gst_live_adder_ring_reset (adder);
+}
+
+/* Moves the first n periods from read_period on from a ring of
+ * old_nperiods periods of size bytes into a new one of nperiods periods */
+static gpointer
+gst_live_adder_ring_move (GstLiveAdder * adder, gpointer old,
+    guint old_nperiods, guint nperiods, guint n, guint size)
+{
+  guint8 *ring = g_malloc0 (nperiods * size);
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    gint64 period = adder->read_period + i;
+
+    memcpy (ring + (period % nperiods) * size,
+        (guint8 *) old + (period % old_nperiods) * size, size);
+  }
+  g_free (old);
+
+  return ring;
+}
+
+/* Resizes the ring after the latency changed, the periods waiting to be
+ * pushed are kept as long as they fit. Must be called with the object
+ * lock */
+static void
+gst_live_adder_ring_resize (GstLiveAdder * adder)
+{
+  guint nperiods, old_nperiods, keep, size, i;
+  GList *item;
+
+  if (adder->ring == NULL)
+    return;
+
+  nperiods = gst_live_adder_ring_size (adder);
+  if (nperiods == adder->nperiods)
+    return;
+
+  if (adder->read_period < 0) {
+    gst_live_adder_ring_alloc (adder);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (adder, "resizing ring from %u to %u periods",
+      adder->nperiods, nperiods);
+
+  old_nperiods = adder->nperiods;
+  keep = MIN (old_nperiods, nperiods);
+  size = adder->period_samples * adder->bps;
+
+  adder->ring = gst_live_adder_ring_move (adder, adder->ring, old_nperiods,
+      nperiods, keep, size);
+  adder->filled = gst_live_adder_ring_move (adder, adder->filled,
+      old_nperiods, nperiods, keep, sizeof (gboolean));
+  adder->clipped = gst_live_adder_ring_move (adder, adder->clipped,
+      old_nperiods, nperiods, keep, sizeof (gboolean));
+  for (item = adder->sinkpads; item; item = g_list_next (item)) {
+    GstLiveAdderPadPrivate *padprivate =
+        gst_pad_get_element_private (GST_PAD (item->data));
+
+    if (padprivate && padprivate->contrib)
+      padprivate->contrib = gst_live_adder_ring_move (adder,
+          padprivate->contrib, old_nperiods, nperiods, keep, size);
+  }
+  adder->nperiods = nperiods;
+
+  /* a smaller ring drops the periods furthest ahead */
+  adder->nfilled = 0;
+  for (i = 0; i < nperiods; i++)
+    if (adder->filled[i])
+      adder->nfilled++;
+  adder->write_period = MIN (adder->write_period, adder->read_period +
+      nperiods);
+
+  /* the src task waits with the old latency for a period that may be gone,
+   * the chain functions may have room now */
+  if (adder->clock_id)
+    gst_clock_id_unschedule (adder->clock_id);
+  g_cond_broadcast (adder->not_full_cond);
+}
+
+static GstClockTime
+gst_live_adder_period_timestamp (GstLiveAdder * adder, gint64 period)
+{
+  return gst_util_uint64_scale_int (period * adder->period_samples,
+      GST_SECOND, adder->rate);
+}
+
+static GstLiveAdderPadPrivate *
+gst_live_adder_find_sink_private (GstLiveAdder * adder, gint index)
+{
+  GList *item;
+
+  for (item = adder->sinkpads; item; item = g_list_next (item)) {
+    GstLiveAdderPadPrivate *padprivate =
+        gst_pad_get_element_private (GST_PAD (item->data));
+
+    if (padprivate && padprivate->index == index)
+      return padprivate;
+  }
+
+  return NULL;
+}
+
+/* Makes the mix of period without the input of the sink pad matching
+ * mmpad */
+static GstBuffer *
+gst_live_adder_ring_mixminus (GstLiveAdder * adder, GstPad * mmpad,
+    gint64 period)
+{
+  GstLiveAdderMixMinusPrivate *mmprivate = gst_pad_get_element_private (mmpad);
+  GstLiveAdderPadPrivate *excluded;
+  guint slot = period % adder->nperiods;
+  guint size = adder->period_samples * adder->bps;
+  guint8 *mix = adder->ring + slot * size;
+  GstBuffer *buffer;
+  guint8 *data;
+  GList *item;
+
+  buffer = gst_buffer_new_and_alloc (size);
+  data = GST_BUFFER_DATA (buffer);
+  gst_buffer_set_caps (buffer, GST_PAD_CAPS (mmpad));
+
+  excluded = gst_live_adder_find_sink_private (adder, mmprivate->index);
+
+  if (period < adder->mixminus_period) {
+    /* mixed before the contributions were tracked, the input to leave out
+     * can't be taken out anymore */
+    memset (data, 0, size);
+  } else if (excluded == NULL || excluded->contrib == NULL) {
+    /* nothing to take out */
+    memcpy (data, mix, size);
+  } else if (!adder->clipped[slot]) {
+    memcpy (data, mix, size);
+    adder->sub_func (data, excluded->contrib + slot * size, size);
+  } else {
+    /* the mix saturated, subtracting would not give back the sum of the
+     * others, add them up again */
+    memset (data, 0, size);
+    for (item = adder->sinkpads; item; item = g_list_next (item)) {
+      GstLiveAdderPadPrivate *padprivate =
+          gst_pad_get_element_private (GST_PAD (item->data));
+
+      if (padprivate && padprivate != excluded && padprivate->contrib)
+        adder->func (data, padprivate->contrib + slot * size, size);
+    }
+  }
+
+  return buffer;
+}
+
+/* Takes period out of the ring into a new buffer and clears its slot, all
+ * periods before it are considered done. If mixminus is not NULL, it gets
+ * a buffer for each of the mixminus pads, in the same order. Must be called
+ * with the object lock */
+static GstBuffer *
+gst_live_adder_ring_pop (GstLiveAdder * adder, gint64 period,
+    GList ** mixminus)
+{
+  guint slot = period % adder->nperiods;
+  guint size = adder->period_samples * adder->bps;
+  guint8 *data = adder->ring + slot * size;
+  GstBuffer *buffer;
+  GList *item;
+
+  buffer = gst_buffer_new_and_alloc (size);
+  memcpy (GST_BUFFER_DATA (buffer), data, size);
+  gst_buffer_set_caps (buffer, GST_PAD_CAPS (adder->srcpad));
+  GST_BUFFER_TIMESTAMP (buffer) =
+      gst_live_adder_period_timestamp (adder, period);
+  GST_BUFFER_DURATION (buffer) =
+      gst_live_adder_period_timestamp (adder, period + 1) -
+      GST_BUFFER_TIMESTAMP (buffer);
+
+  if (mixminus && adder->mixminus_pads) {
+    for (item = adder->mixminus_pads; item; item = g_list_next (item)) {
+      GstBuffer *mmbuffer;
+
+      mmbuffer = gst_live_adder_ring_mixminus (adder, GST_PAD (item->data),
+          period);
+      GST_BUFFER_TIMESTAMP (mmbuffer) = GST_BUFFER_TIMESTAMP (buffer);
+      GST_BUFFER_DURATION (mmbuffer) = GST_BUFFER_DURATION (buffer);
+      *mixminus = g_list_append (*mixminus, mmbuffer);
+    }
+  }
+
+  memset (data, 0, size);
+  for (item = adder->sinkpads; item; item = g_list_next (item)) {
+    GstLiveAdderPadPrivate *padprivate =
+        gst_pad_get_element_private (GST_PAD (item->data));
+
+    if (padprivate && padprivate->contrib)
+      memset (padprivate->contrib + slot * size, 0, size);
+  }
+  adder->filled[slot] = FALSE;
+  adder->clipped[slot] = FALSE;
+  adder->nfilled--;
+  adder->read_period = period + 1;
+
+  g_cond_broadcast (adder->not_full_cond);
+
+  return buffer;
+}
+
 /* we can only accept caps that we and downstream can handle. */
 static GstCaps *
 gst_live_adder_sink_getcaps (GstPad * pad)
@@ -340,6 +867,7 @@ gst_live_adder_setcaps (GstPad * pad, GstCaps * caps)
   GList *pads;
   GstStructure *structure;
   const char *media_type;
+  gint old_rate, old_bps;
 
   adder = GST_LIVE_ADDER (GST_PAD_PARENT (pad));
 
@@ -349,6 +877,9 @@ gst_live_adder_setcaps (GstPad * pad, GstCaps * caps)
   /* FIXME, see if the other pads can accept the format. Also lock the
    * format on the other pads to this new format. */
   GST_OBJECT_LOCK (adder);
+  old_rate = adder->rate;
+  old_bps = adder->bps;
+
   pads = GST_ELEMENT (adder)->pads;
   while (pads) {
     GstPad *otherpad = GST_PAD (pads->data);
@@ -375,18 +906,22 @@ gst_live_adder_setcaps (GstPad * pad, GstCaps * caps)
 
     switch (adder->width) {
       case 8:
-        adder->func = (adder->is_signed ?
-            (GstLiveAdderFunction) add_int8 : (GstLiveAdderFunction) add_uint8);
+        if (adder->is_signed)
+          SET_FUNCS (adder, int8);
+        else
+          SET_FUNCS (adder, uint8);
         break;
       case 16:
-        adder->func = (adder->is_signed ?
-            (GstLiveAdderFunction) add_int16 : (GstLiveAdderFunction)
-            add_uint16);
+        if (adder->is_signed)
+          SET_FUNCS (adder, int16);
+        else
+          SET_FUNCS (adder, uint16);
         break;
       case 32:
-        adder->func = (adder->is_signed ?
-            (GstLiveAdderFunction) add_int32 : (GstLiveAdderFunction)
-            add_uint32);
+        if (adder->is_signed)
+          SET_FUNCS (adder, int32);
+        else
+          SET_FUNCS (adder, uint32);
         break;
       default:
         goto not_supported;
@@ -398,10 +933,10 @@ gst_live_adder_setcaps (GstPad * pad, GstCaps * caps)
 
     switch (adder->width) {
       case 32:
-        adder->func = (GstLiveAdderFunction) add_float32;
+        SET_FUNCS_NC (adder, float32);
         break;
       case 64:
-        adder->func = (GstLiveAdderFunction) add_float64;
+        SET_FUNCS_NC (adder, float64);
         break;
       default:
         goto not_supported;
@@ -415,6 +950,10 @@ gst_live_adder_setcaps (GstPad * pad, GstCaps * caps)
   /* precalc bps */
   adder->bps = (adder->width / 8) * adder->channels;
 
+  /* all pads get the same caps, only the first one reallocates */
+  if (adder->ring == NULL || adder->rate != old_rate || adder->bps != old_bps)
+    gst_live_adder_ring_alloc (adder);
+
   GST_OBJECT_UNLOCK (adder);
   return TRUE;
 
@@ -436,9 +975,8 @@ gst_live_adder_flush_start (GstLiveAdder * adder)
   /* mark ourselves as flushing */
   adder->srcresult = GST_FLOW_WRONG_STATE;
 
-  /* Empty the queue */
-  g_queue_foreach (adder->buffers, (GFunc) gst_mini_object_unref, NULL);
-  while (g_queue_pop_head (adder->buffers));
+  /* Empty the ring */
+  gst_live_adder_ring_reset (adder);
 
   /* unlock clock, we just unschedule, the entry will be released by the
    * locking streaming thread. */
@@ -446,6 +984,7 @@ gst_live_adder_flush_start (GstLiveAdder * adder)
     gst_clock_id_unschedule (adder->clock_id);
 
   g_cond_broadcast (adder->not_empty_cond);
+  g_cond_broadcast (adder->not_full_cond);
   GST_OBJECT_UNLOCK (adder);
 }
 
@@ -482,6 +1021,30 @@ gst_live_adder_src_activate_push (GstPad * pad, gboolean active)
   return result;
 }
 
+/* pushes the event on the srcpad and on all the mixminus pads, takes
+ * ownership of the event
+ *
+ * Returns: the result of pushing on the srcpad
+ */
+static gboolean
+gst_live_adder_push_src_event (GstLiveAdder * adder, GstEvent * event)
+{
+  GList *pads, *item;
+
+  GST_OBJECT_LOCK (adder);
+  pads = g_list_copy (adder->mixminus_pads);
+  g_list_foreach (pads, (GFunc) gst_object_ref, NULL);
+  GST_OBJECT_UNLOCK (adder);
+
+  for (item = pads; item; item = g_list_next (item)) {
+    gst_pad_push_event (GST_PAD (item->data), gst_event_ref (event));
+    gst_object_unref (item->data);
+  }
+  g_list_free (pads);
+
+  return gst_pad_push_event (adder->srcpad, event);
+}
+
 static gboolean
 gst_live_adder_sink_event (GstPad * pad, GstEvent * event)
 {
@@ -531,7 +1094,7 @@ gst_live_adder_sink_event (GstPad * pad, GstEvent * event)
     }
     case GST_EVENT_FLUSH_START:
       gst_live_adder_flush_start (adder);
-      ret = gst_pad_push_event (adder->srcpad, event);
+      ret = gst_live_adder_push_src_event (adder, event);
       break;
     case GST_EVENT_FLUSH_STOP:
       GST_OBJECT_LOCK (adder);
@@ -539,8 +1102,10 @@ gst_live_adder_sink_event (GstPad * pad, GstEvent * event)
       adder->next_timestamp = GST_CLOCK_TIME_NONE;
       reset_pad_private (pad);
       adder->segment_pending = TRUE;
+      g_list_foreach (adder->mixminus_pads, (GFunc) reset_mixminus_private,
+          NULL);
       GST_OBJECT_UNLOCK (adder);
-      ret = gst_pad_push_event (adder->srcpad, event);
+      ret = gst_live_adder_push_src_event (adder, event);
       ret = gst_live_adder_src_activate_push (adder->srcpad, TRUE);
       break;
     case GST_EVENT_EOS:
@@ -767,7 +1332,10 @@ gst_live_adder_query (GstPad * pad, GstQuery * query)
       if (res) {
         GstClockTime my_latency = adder->latency_ms * GST_MSECOND;
         GST_OBJECT_LOCK (adder);
-        adder->peer_latency = min_latency;
+        if (adder->peer_latency != min_latency) {
+          adder->peer_latency = min_latency;
+          gst_live_adder_ring_resize (adder);
+        }
         min_latency += my_latency;
         GST_OBJECT_UNLOCK (adder);
 
@@ -880,24 +1448,22 @@ gst_live_adder_src_event (GstPad * pad, GstEvent * event)
   return result;
 }
 
-static guint
-gst_live_adder_length_from_duration (GstLiveAdder * adder,
-    GstClockTime duration)
-{
-  guint64 ret = (duration * adder->rate / GST_SECOND) * adder->bps;
-
-  return (guint) ret;
-}
-
 static GstFlowReturn
 gst_live_live_adder_chain (GstPad * pad, GstBuffer * buffer)
 {
   GstLiveAdder *adder = GST_LIVE_ADDER (gst_pad_get_parent_element (pad));
   GstLiveAdderPadPrivate *padprivate = NULL;
   GstFlowReturn ret = GST_FLOW_OK;
-  GList *item = NULL;
-  GstClockTime skip = 0;
+  guint8 *data;
+  guint64 samples, pos;
   gint64 drift = 0;             /* Positive if new buffer after old buffer */
+  gdouble volume;
+  gboolean mute;
+
+  GST_OBJECT_LOCK (pad);
+  volume = GST_LIVE_ADDER_PAD (pad)->volume;
+  mute = GST_LIVE_ADDER_PAD (pad)->mute;
+  GST_OBJECT_UNLOCK (pad);
 
   GST_OBJECT_LOCK (adder);
 
@@ -943,6 +1509,9 @@ gst_live_live_adder_chain (GstPad * pad, GstBuffer * buffer)
   if (padprivate->segment.format != GST_FORMAT_TIME)
     goto invalid_segment;
 
+  if (adder->ring == NULL)
+    goto not_negotiated;
+
   buffer = gst_buffer_make_metadata_writable (buffer);
 
   drift = GST_BUFFER_TIMESTAMP (buffer) - padprivate->expected_timestamp;
@@ -1000,119 +1569,112 @@ gst_live_live_adder_chain (GstPad * pad, GstBuffer * buffer)
       gst_segment_to_running_time (&padprivate->segment,
       padprivate->segment.format, GST_BUFFER_TIMESTAMP (buffer));
 
-
-  if (GST_CLOCK_TIME_IS_VALID (adder->next_timestamp) &&
-      GST_BUFFER_TIMESTAMP (buffer) < adder->next_timestamp) {
-    if (GST_BUFFER_TIMESTAMP (buffer) + GST_BUFFER_DURATION (buffer) <
-        adder->next_timestamp) {
-      GST_DEBUG_OBJECT (adder, "Buffer is late, dropping (ts: %" GST_TIME_FORMAT
-          " duration: %" GST_TIME_FORMAT ")",
-          GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buffer)),
-          GST_TIME_ARGS (GST_BUFFER_DURATION (buffer)));
-      gst_buffer_unref (buffer);
-      goto out;
-    } else {
-      skip = adder->next_timestamp - GST_BUFFER_TIMESTAMP (buffer);
-      GST_DEBUG_OBJECT (adder, "Buffer is partially late, skipping %"
-          GST_TIME_FORMAT, GST_TIME_ARGS (skip));
-    }
+  if (mute) {
+    GST_LOG_OBJECT (pad, "Muted, dropping buffer");
+    gst_buffer_unref (buffer);
+    goto out;
   }
 
-  /* If our new buffer's head is higher than the queue's head, lets wake up,
-   * we may not have to wait for as long
-   */
-  if (adder->clock_id &&
-      g_queue_peek_head (adder->buffers) != NULL &&
-      GST_BUFFER_TIMESTAMP (buffer) + skip <
-      GST_BUFFER_TIMESTAMP (g_queue_peek_head (adder->buffers)))
-    gst_clock_id_unschedule (adder->clock_id);
+  data = GST_BUFFER_DATA (buffer);
+  samples = GST_BUFFER_SIZE (buffer) / adder->bps;
+  pos = gst_util_uint64_scale_int_round (GST_BUFFER_TIMESTAMP (buffer),
+      adder->rate, GST_SECOND);
+
+  if (adder->read_period < 0) {
+    adder->read_period = adder->write_period = pos / adder->period_samples;
+  } else if (!GST_CLOCK_TIME_IS_VALID (adder->next_timestamp) &&
+      pos / adder->period_samples < adder->read_period &&
+      adder->write_period - pos / adder->period_samples <= adder->nperiods) {
+    /* nothing was pushed yet and the ring has room for the earlier data */
+    adder->read_period = pos / adder->period_samples;
+  }
 
-  for (item = g_queue_peek_head_link (adder->buffers);
-      item; item = g_list_next (item)) {
-    GstBuffer *oldbuffer = item->data;
-    GstClockTime old_skip = 0;
-    GstClockTime mix_duration = 0;
-    GstClockTime mix_start = 0;
-    GstClockTime mix_end = 0;
-
-    /* We haven't reached our place yet */
-    if (GST_BUFFER_TIMESTAMP (buffer) + skip >=
-        GST_BUFFER_TIMESTAMP (oldbuffer) + GST_BUFFER_DURATION (oldbuffer))
+  /* Mix the buffer into the ring, one period at a time */
+  while (samples > 0) {
+    guint64 first = adder->read_period * adder->period_samples;
+    gint64 period;
+    guint offset, len, slot;
+    guint8 *in, *out;
+
+    /* The periods before read_period have already been pushed */
+    if (pos < first) {
+      guint64 late = MIN (first - pos, samples);
+
+      GST_DEBUG_OBJECT (adder, "Buffer is %s late, skipping %" G_GUINT64_FORMAT
+          " samples", late == samples ? "completely" : "partially", late);
+      data += late * adder->bps;
+      samples -= late;
+      pos += late;
       continue;
+    }
 
-    /* We're past our place, lets insert ouselves here */
-    if (GST_BUFFER_TIMESTAMP (buffer) + GST_BUFFER_DURATION (buffer) <=
-        GST_BUFFER_TIMESTAMP (oldbuffer))
-      break;
-
-    /* if we reach this spot, we have overlap, so we must mix */
-
-    /* First make a subbuffer with the non-overlapping part */
-    if (GST_BUFFER_TIMESTAMP (buffer) + skip < GST_BUFFER_TIMESTAMP (oldbuffer)) {
-      GstBuffer *subbuffer = NULL;
-      GstClockTime subbuffer_duration = GST_BUFFER_TIMESTAMP (oldbuffer) -
-          (GST_BUFFER_TIMESTAMP (buffer) + skip);
-
-      subbuffer = gst_buffer_create_sub (buffer,
-          gst_live_adder_length_from_duration (adder, skip),
-          gst_live_adder_length_from_duration (adder, subbuffer_duration));
-
-      GST_BUFFER_TIMESTAMP (subbuffer) = GST_BUFFER_TIMESTAMP (buffer) + skip;
-      GST_BUFFER_DURATION (subbuffer) = subbuffer_duration;
+    period = pos / adder->period_samples;
 
-      skip += subbuffer_duration;
+    if (period >= adder->read_period + adder->nperiods) {
+      if (adder->nfilled == 0) {
+        GST_DEBUG_OBJECT (adder, "Ring is empty, moving it to %"
+            GST_TIME_FORMAT, GST_TIME_ARGS (gst_live_adder_period_timestamp
+                (adder, period)));
+        adder->read_period = adder->write_period = period;
+        continue;
+      }
 
-      g_queue_insert_before (adder->buffers, item, subbuffer);
+      /* wait for the src task to make room */
+      GST_LOG_OBJECT (adder, "Ring is full, waiting");
+      g_cond_broadcast (adder->not_empty_cond);
+      g_cond_wait (adder->not_full_cond, GST_OBJECT_GET_LOCK (adder));
+      if (adder->srcresult != GST_FLOW_OK) {
+        ret = adder->srcresult;
+        break;
+      }
+      /* we were flushed while waiting */
+      if (adder->read_period < 0)
+        break;
+      continue;
     }
 
-    /* Now we are on the overlapping part */
-    oldbuffer = gst_buffer_make_writable (oldbuffer);
-    item->data = oldbuffer;
-
-    old_skip = GST_BUFFER_TIMESTAMP (buffer) + skip -
-        GST_BUFFER_TIMESTAMP (oldbuffer);
+    offset = pos % adder->period_samples;
+    len = MIN (samples, adder->period_samples - offset);
+    slot = period % adder->nperiods;
 
-    mix_start = GST_BUFFER_TIMESTAMP (oldbuffer) + old_skip;
+    in = data;
+    if (volume != 1.0) {
+      adder->volume_func (adder->scratch, data, volume, len * adder->bps);
+      in = adder->scratch;
+    }
 
-    if (GST_BUFFER_TIMESTAMP (buffer) + GST_BUFFER_DURATION (buffer) <
-        GST_BUFFER_TIMESTAMP (oldbuffer) + GST_BUFFER_DURATION (oldbuffer))
-      mix_end = GST_BUFFER_TIMESTAMP (buffer) + GST_BUFFER_DURATION (buffer);
-    else
-      mix_end = GST_BUFFER_TIMESTAMP (oldbuffer) +
-          GST_BUFFER_DURATION (oldbuffer);
+    out = adder->ring + (slot * adder->period_samples + offset) * adder->bps;
+    adder->func (out, in, len * adder->bps);
+
+    /* Keep track of what this pad adds so it can be taken out again, the
+     * mix of the others has to be rebuilt if any add saturated */
+    if (padprivate->contrib) {
+      adder->func (padprivate->contrib +
+          (slot * adder->period_samples + offset) * adder->bps, in,
+          len * adder->bps);
+      if (adder->clipped_func && !adder->clipped[slot])
+        adder->clipped[slot] = adder->clipped_func (out, len * adder->bps);
+    }
 
-    mix_duration = mix_end - mix_start;
+    if (!adder->filled[slot]) {
+      adder->filled[slot] = TRUE;
+      adder->nfilled++;
+    }
+    adder->write_period = MAX (adder->write_period, period + 1);
 
-    adder->func (GST_BUFFER_DATA (oldbuffer) +
-        gst_live_adder_length_from_duration (adder, old_skip),
-        GST_BUFFER_DATA (buffer) +
-        gst_live_adder_length_from_duration (adder, skip),
-        gst_live_adder_length_from_duration (adder, mix_duration));
+    /* If we filled a period before the one the src task is waiting for, lets
+     * wake it up, we may not have to wait for as long */
+    if (adder->clock_id && period < adder->waiting_period)
+      gst_clock_id_unschedule (adder->clock_id);
 
-    skip += mix_duration;
+    data += len * adder->bps;
+    samples -= len;
+    pos += len;
   }
 
   g_cond_broadcast (adder->not_empty_cond);
 
-  if (skip == GST_BUFFER_DURATION (buffer)) {
-    gst_buffer_unref (buffer);
-  } else {
-    if (skip) {
-      GstClockTime subbuffer_duration = GST_BUFFER_DURATION (buffer) - skip;
-      GstClockTime subbuffer_ts = GST_BUFFER_TIMESTAMP (buffer) + skip;
-
-      buffer = gst_buffer_create_sub (buffer,
-          gst_live_adder_length_from_duration (adder, skip),
-          gst_live_adder_length_from_duration (adder, subbuffer_duration));
-      GST_BUFFER_TIMESTAMP (buffer) = subbuffer_ts;
-      GST_BUFFER_DURATION (buffer) = subbuffer_duration;
-    }
-
-    if (item)
-      g_queue_insert_before (adder->buffers, item, buffer);
-    else
-      g_queue_push_tail (adder->buffers, buffer);
-  }
+  gst_buffer_unref (buffer);
 
 out:
 
@@ -1131,6 +1693,16 @@ invalid_timestamp:
 
   return GST_FLOW_ERROR;
 
+not_negotiated:
+  {
+    GST_OBJECT_UNLOCK (adder);
+    gst_buffer_unref (buffer);
+    GST_DEBUG_OBJECT (adder, "Received buffer before caps");
+    gst_object_unref (adder);
+
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
 invalid_segment:
   {
     const gchar *format = gst_format_get_name (padprivate->segment.format);
@@ -1182,6 +1754,9 @@ gst_live_adder_loop (gpointer data)
   GstBuffer *buffer = NULL;
   GstFlowReturn result;
   GstEvent *newseg_event = NULL;
+  gint64 period;
+  GList *mmpads = NULL, *mmbuffers = NULL, *mmsegs = NULL;
+  GList *item, *bitem, *sitem;
 
   GST_OBJECT_LOCK (adder);
 
@@ -1190,14 +1765,19 @@ again:
   for (;;) {
     if (adder->srcresult != GST_FLOW_OK)
       goto flushing;
-    if (!g_queue_is_empty (adder->buffers))
+    if (adder->nfilled > 0)
       break;
     if (check_eos_locked (adder))
       goto eos;
     g_cond_wait (adder->not_empty_cond, GST_OBJECT_GET_LOCK (adder));
   }
 
-  buffer_timestamp = GST_BUFFER_TIMESTAMP (g_queue_peek_head (adder->buffers));
+  /* The first period that received data, gaps before it are skipped */
+  period = adder->read_period;
+  while (!adder->filled[period % adder->nperiods])
+    period++;
+
+  buffer_timestamp = gst_live_adder_period_timestamp (adder, period);
 
   clock = GST_ELEMENT_CLOCK (adder);
 
@@ -1219,6 +1799,7 @@ again:
 
   /* create an entry for the clock */
   id = adder->clock_id = gst_clock_new_single_shot_id (clock, sync_time);
+  adder->waiting_period = period;
   GST_OBJECT_UNLOCK (adder);
 
   ret = gst_clock_id_wait (id, NULL);
@@ -1229,8 +1810,8 @@ again:
   gst_clock_id_unref (id);
   adder->clock_id = NULL;
 
-  /* at this point, the clock could have been unlocked by a timeout, a new
-   * head element was added to the queue or because we are shutting down. Check
+  /* at this point, the clock could have been unlocked by a timeout, an
+   * earlier period was filled or because we are shutting down. Check
    * for shutdown first. */
 
   if (adder->srcresult != GST_FLOW_OK)
@@ -1247,10 +1828,21 @@ again:
 
 push_buffer:
 
-  buffer = g_queue_pop_head (adder->buffers);
-
-  if (!buffer)
-    goto again;
+  buffer = gst_live_adder_ring_pop (adder, period, &mmbuffers);
+  for (item = mmbuffers ? adder->mixminus_pads : NULL; item;
+      item = g_list_next (item)) {
+    GstLiveAdderMixMinusPrivate *mmprivate =
+        gst_pad_get_element_private (GST_PAD (item->data));
+    GstEvent *mmseg = NULL;
+
+    if (mmprivate->segment_pending) {
+      mmseg = gst_event_new_new_segment_full (FALSE, 1.0, 1.0,
+          GST_FORMAT_TIME, 0, -1, 0);
+      mmprivate->segment_pending = FALSE;
+    }
+    mmpads = g_list_append (mmpads, gst_object_ref (item->data));
+    mmsegs = g_list_append (mmsegs, mmseg);
+  }
 
   /*
    * We make sure the timestamps are exactly contiguous
@@ -1288,6 +1880,10 @@ push_buffer:
   else
     adder->next_timestamp = GST_CLOCK_TIME_NONE;
 
+  for (item = mmbuffers; item; item = g_list_next (item))
+    gst_buffer_copy_metadata (GST_BUFFER (item->data), buffer,
+        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS);
+
   if (adder->segment_pending) {
     /*
      * We set the start at 0, because we re-timestamps to the running time
@@ -1309,6 +1905,28 @@ push_buffer:
       GST_TIME_ARGS (GST_BUFFER_DURATION (buffer)));
 
   result = gst_pad_push (adder->srcpad, buffer);
+
+  /* A mixminus output that is not linked or fails does not stop the main
+   * mix */
+  for (item = mmpads, bitem = mmbuffers, sitem = mmsegs; item;
+      item = g_list_next (item), bitem = g_list_next (bitem),
+      sitem = g_list_next (sitem)) {
+    GstPad *mmpad = GST_PAD (item->data);
+    GstFlowReturn mmresult;
+
+    if (sitem->data)
+      gst_pad_push_event (mmpad, GST_EVENT (sitem->data));
+
+    mmresult = gst_pad_push (mmpad, GST_BUFFER (bitem->data));
+    if (mmresult != GST_FLOW_OK)
+      GST_LOG_OBJECT (mmpad, "push returned %s",
+          gst_flow_get_name (mmresult));
+  }
+  g_list_foreach (mmpads, (GFunc) gst_object_unref, NULL);
+  g_list_free (mmpads);
+  g_list_free (mmbuffers);
+  g_list_free (mmsegs);
+
   if (result != GST_FLOW_OK)
     goto pause;
 
@@ -1365,14 +1983,86 @@ eos:
     adder->srcresult = GST_FLOW_UNEXPECTED;
     gst_pad_pause_task (adder->srcpad);
     GST_OBJECT_UNLOCK (adder);
-    gst_pad_push_event (adder->srcpad, gst_event_new_eos ());
+    gst_live_adder_push_src_event (adder, gst_event_new_eos ());
     return;
   }
 }
 
+static GstPad *
+gst_live_adder_request_mixminus_pad (GstLiveAdder * adder,
+    GstPadTemplate * templ, const gchar * name)
+{
+  GstPad *newpad;
+  gint index;
+  GstLiveAdderMixMinusPrivate *mmprivate = NULL;
+
+  /* the number says which input to leave out, so it can't be picked for
+   * the application */
+  if (name == NULL || sscanf (name, "mixminus%d", &index) != 1)
+    goto invalid_name;
+
+  newpad = gst_pad_new_from_template (templ, name);
+  GST_DEBUG_OBJECT (adder, "request new pad %s", name);
+
+  gst_pad_set_getcaps_function (newpad,
+      GST_DEBUG_FUNCPTR (gst_pad_proxy_getcaps));
+  gst_pad_set_setcaps_function (newpad,
+      GST_DEBUG_FUNCPTR (gst_live_adder_setcaps));
+  gst_pad_set_query_function (newpad,
+      GST_DEBUG_FUNCPTR (gst_live_adder_query));
+  gst_pad_set_event_function (newpad,
+      GST_DEBUG_FUNCPTR (gst_live_adder_src_event));
+
+  mmprivate = g_new0 (GstLiveAdderMixMinusPrivate, 1);
+  mmprivate->index = index;
+  mmprivate->segment_pending = TRUE;
+
+  gst_pad_set_element_private (newpad, mmprivate);
+
+  if (!gst_pad_set_active (newpad, TRUE))
+    goto could_not_activate;
+
+  /* takes ownership of the pad */
+  if (!gst_element_add_pad (GST_ELEMENT (adder), newpad))
+    goto could_not_add;
+
+  GST_OBJECT_LOCK (adder);
+  gst_caps_replace (&GST_PAD_CAPS (newpad), GST_PAD_CAPS (adder->srcpad));
+  if (adder->mixminus_pads == NULL) {
+    /* what is in the ring already can't be split up anymore */
+    gst_live_adder_track_contribs (adder, TRUE);
+    adder->mixminus_period = adder->write_period;
+  }
+  adder->mixminus_pads = g_list_append (adder->mixminus_pads, newpad);
+  GST_OBJECT_UNLOCK (adder);
+
+  return newpad;
+
+  /* errors */
+invalid_name:
+  {
+    g_warning ("liveadder: mixminus pads must be requested by name");
+    return NULL;
+  }
+could_not_add:
+  {
+    GST_DEBUG_OBJECT (adder, "could not add pad");
+    g_free (mmprivate);
+    gst_object_unref (newpad);
+    return NULL;
+  }
+could_not_activate:
+  {
+    GST_DEBUG_OBJECT (adder, "could not activate new pad");
+    g_free (mmprivate);
+    gst_object_unref (newpad);
+    return NULL;
+  }
+}
+
 static GstPad *
 gst_live_adder_request_new_pad (GstElement * element, GstPadTemplate * templ,
-    const gchar * unused)
+    const gchar * req_name)
 {
   gchar *name;
   GstLiveAdder *adder;
@@ -1380,16 +2070,20 @@ gst_live_adder_request_new_pad (GstElement * element, GstPadTemplate * templ,
   gint padcount;
   GstLiveAdderPadPrivate *padprivate = NULL;
 
+  adder = GST_LIVE_ADDER (element);
+
+  if (templ->direction == GST_PAD_SRC)
+    return gst_live_adder_request_mixminus_pad (adder, templ, req_name);
+
   if (templ->direction != GST_PAD_SINK)
     goto not_sink;
 
-  adder = GST_LIVE_ADDER (element);
-
   /* increment pad counter */
   padcount = g_atomic_int_exchange_and_add (&adder->padcount, 1);
 
   name = g_strdup_printf ("sink%d", padcount);
-  newpad = gst_pad_new_from_template (templ, name);
+  newpad = g_object_new (GST_TYPE_LIVE_ADDER_PAD, "name", name,
+      "direction", templ->direction, "template", templ, NULL);
   GST_DEBUG_OBJECT (adder, "request new pad %s", name);
   g_free (name);
 
@@ -1405,6 +2099,7 @@ gst_live_adder_request_new_pad (GstElement * element, GstPadTemplate * templ,
   gst_segment_init (&padprivate->segment, GST_FORMAT_UNDEFINED);
   padprivate->eos = FALSE;
   padprivate->expected_timestamp = GST_CLOCK_TIME_NONE;
+  padprivate->index = padcount;
 
   gst_pad_set_element_private (newpad, padprivate);
 
@@ -1420,6 +2115,8 @@ gst_live_adder_request_new_pad (GstElement * element, GstPadTemplate * templ,
 
   GST_OBJECT_LOCK (adder);
   adder->sinkpads = g_list_prepend (adder->sinkpads, newpad);
+  if (adder->mixminus_pads)
+    gst_live_adder_track_contribs (adder, TRUE);
   GST_OBJECT_UNLOCK (adder);
 
   return newpad;
@@ -1456,13 +2153,29 @@ gst_live_adder_release_pad (GstElement * element, GstPad * pad)
 
   GST_DEBUG_OBJECT (adder, "release pad %s:%s", GST_DEBUG_PAD_NAME (pad));
 
-  GST_OBJECT_LOCK (element);
-  padprivate = gst_pad_get_element_private (pad);
-  gst_pad_set_element_private (pad, NULL);
-  adder->sinkpads = g_list_remove_all (adder->sinkpads, pad);
-  GST_OBJECT_UNLOCK (element);
+  if (GST_PAD_IS_SRC (pad)) {
+    GstLiveAdderMixMinusPrivate *mmprivate;
 
-  g_free (padprivate);
+    GST_OBJECT_LOCK (element);
+    mmprivate = gst_pad_get_element_private (pad);
+    gst_pad_set_element_private (pad, NULL);
+    adder->mixminus_pads = g_list_remove_all (adder->mixminus_pads, pad);
+    if (adder->mixminus_pads == NULL)
+      gst_live_adder_track_contribs (adder, FALSE);
+    GST_OBJECT_UNLOCK (element);
+
+    g_free (mmprivate);
+  } else {
+    GST_OBJECT_LOCK (element);
+    padprivate = gst_pad_get_element_private (pad);
+    gst_pad_set_element_private (pad, NULL);
+    adder->sinkpads = g_list_remove_all (adder->sinkpads, pad);
+    GST_OBJECT_UNLOCK (element);
+
+    if (padprivate)
+      g_free (padprivate->contrib);
+    g_free (padprivate);
+  }
 
   gst_element_remove_pad (element, pad);
 }
@@ -1483,6 +2196,19 @@ reset_pad_private (GstPad * pad)
   padprivate->eos = FALSE;
 }
 
+static void
+reset_mixminus_private (GstPad * pad)
+{
+  GstLiveAdderMixMinusPrivate *mmprivate;
+
+  mmprivate = gst_pad_get_element_private (pad);
+
+  if (!mmprivate)
+    return;
+
+  mmprivate->segment_pending = TRUE;
+}
+
 static GstStateChangeReturn
 gst_live_adder_change_state (GstElement * element, GstStateChange transition)
 {
@@ -1497,7 +2223,11 @@ gst_live_adder_change_state (GstElement * element, GstStateChange transition)
       adder->segment_pending = TRUE;
       adder->peer_latency = 0;
       adder->next_timestamp = GST_CLOCK_TIME_NONE;
+      gst_live_adder_ring_reset (adder);
+      gst_live_adder_ring_resize (adder);
       g_list_foreach (adder->sinkpads, (GFunc) reset_pad_private, NULL);
+      g_list_foreach (adder->mixminus_pads, (GFunc) reset_mixminus_private,
+          NULL);
       GST_OBJECT_UNLOCK (adder);
       break;
     case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
@@ -39,6 +39,12 @@ G_BEGIN_DECLS
 typedef struct _GstLiveAdder GstLiveAdder;
 typedef struct _GstLiveAdderClass GstLiveAdderClass;
 
+#define GST_TYPE_LIVE_ADDER_PAD        (gst_live_adder_pad_get_type())
+#define GST_LIVE_ADDER_PAD(pad)        (G_TYPE_CHECK_INSTANCE_CAST((pad),GST_TYPE_LIVE_ADDER_PAD,GstLiveAdderPad))
+#define GST_IS_LIVE_ADDER_PAD(pad)     (G_TYPE_CHECK_INSTANCE_TYPE((pad),GST_TYPE_LIVE_ADDER_PAD))
+typedef struct _GstLiveAdderPad GstLiveAdderPad;
+typedef struct _GstLiveAdderPadClass GstLiveAdderPadClass;
+
 typedef enum
 {
   GST_LIVE_ADDER_FORMAT_UNSET,
@@ -47,6 +53,29 @@ typedef enum
 } GstLiveAdderFormat;
 
 typedef void (*GstLiveAdderFunction) (gpointer out, gpointer in, guint size);
+typedef void (*GstLiveAdderVolumeFunction) (gpointer out, gpointer in,
+    gdouble volume, guint size);
+typedef gboolean (*GstLiveAdderClippedFunction) (gpointer data, guint size);
+
+/**
+ * GstLiveAdderPad:
+ *
+ * The sink pad object structure.
+ */
+struct _GstLiveAdderPad
+{
+  /*< private >*/
+  GstPad parent;
+
+  /* protected by the pad's object lock */
+  gdouble volume;
+  gboolean mute;
+};
+
+struct _GstLiveAdderPadClass
+{
+  GstPadClass parent_class;
+};
 
 /**
  * GstLiveAdder:
@@ -66,9 +95,27 @@ struct _GstLiveAdder
   GstFlowReturn srcresult;
   GstClockID clock_id;
 
-  /* the queue is ordered head to tail */
-  GQueue *buffers;
+  /* The inputs are mixed into a ring of nperiods periods of period_samples
+   * samples each. Period n covers the running time of samples
+   * [n * period_samples, (n + 1) * period_samples) and is kept in slot
+   * n % nperiods. The ring holds periods [read_period, read_period +
+   * nperiods), read_period is -1 until the first buffer arrives. */
+  guint8 *ring;
+  gboolean *filled;
+  /* TRUE for the periods where an add saturated while mixminus pads were
+   * tracking the contributions */
+  gboolean *clipped;
+  guint period_samples;
+  guint nperiods;
+  guint nfilled;
+  gint64 read_period;
+  /* 1 + the last period that received data */
+  gint64 write_period;
+  /* the period the src task is waiting on the clock for */
+  gint64 waiting_period;
+
   GCond *not_empty_cond;
+  GCond *not_full_cond;
 
   GstClockTime next_timestamp;
 
@@ -88,6 +135,19 @@ struct _GstLiveAdder
 
   /* function to add samples */
   GstLiveAdderFunction func;
+  /* function to subtract samples */
+  GstLiveAdderFunction sub_func;
+  /* function to apply the volume of a pad, into scratch */
+  GstLiveAdderVolumeFunction volume_func;
+  /* function telling if samples may have been clipped, NULL for float */
+  GstLiveAdderClippedFunction clipped_func;
+  /* one period of samples */
+  guint8 *scratch;
+
+  /* the mixminus%d request src pads */
+  GList *mixminus_pads;
+  /* the first period the contributions of the inputs were tracked for */
+  gint64 mixminus_period;
 
   GstClockTime latency_ms;
   GstClockTime peer_latency;
@@ -103,6 +163,7 @@ struct _GstLiveAdderClass
 };
 
 GType gst_live_adder_get_type (void);
+GType gst_live_adder_pad_get_type (void);
 
 G_END_DECLS
 #endif /* __GST_LIVE_ADDER_H__ */
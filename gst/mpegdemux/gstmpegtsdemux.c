@@ -47,8 +47,10 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <gst/tag/tag.h>
+#include <gst/gst-mpegts-crc.h>
 
 #include "gstmpegdefs.h"
 #include "gstmpegtsdemux.h"
@@ -84,6 +86,8 @@ enum
 #define DEFAULT_PROP_ES_PIDS        ""
 #define DEFAULT_PROP_CHECK_CRC      TRUE
 #define DEFAULT_PROP_PROGRAM_NUMBER -1
+#define DEFAULT_PROP_INDEX_LOCATION NULL
+#define DEFAULT_PROP_INDEX_NEXT_TO_FILE FALSE
 
 /* latency in mseconds */
 #define TS_LATENCY 700
@@ -96,8 +100,32 @@ enum
   PROP_PROGRAM_NUMBER,
   PROP_PAT_INFO,
   PROP_PMT_INFO,
+  PROP_PID_STATISTICS,
+  PROP_INDEX_LOCATION,
+  PROP_INDEX_NEXT_TO_FILE,
 };
 
+/* size of the blocks pulled in pull mode and when scanning for PCRs */
+#define MPEGTS_BLOCK_SZ (MPEGTS_NORMAL_TS_PACKETSIZE * 256)
+/* PCRs are 33 bits and wrap around */
+#define MPEGTS_PCR_MASK (((guint64) 1 << 33) - 1)
+/* bisection stops when the PCRs around the target are this close */
+#define MPEGTS_SEEK_TOLERANCE (250 * GST_MSECOND)
+#define MPEGTS_SEEK_MAX_STEPS 32
+/* frames are presented after their PCR, start accurate seeks this early */
+#define MPEGTS_SEEK_PCR_MARGIN (500 * GST_MSECOND)
+/* how far back to look for a random access point before the seek target */
+#define MPEGTS_RAP_SCAN_SZ (4 * 1024 * 1024)
+/* minimum distance between two index entries */
+#define MPEGTS_INDEX_INTERVAL (500 * GST_MSECOND)
+#define MPEGTS_INDEX_SUFFIX ".tsidx"
+
+typedef enum
+{
+  SCAN_PCR,
+  SCAN_RAP
+} MpegTSScanMode;
+
 #define GSTTIME_TO_BYTES(time) \
   ((time != -1) ? gst_util_uint64_scale (MAX(0,(gint64) ((time))), \
   demux->bitrate, GST_SECOND) : -1)
@@ -195,6 +223,22 @@ static GstStateChangeReturn gst_mpegts_demux_change_state (GstElement * element,
 
 static MpegTsPmtInfo *mpegts_demux_build_pmt_info (GstMpegTSDemux * demux,
     guint16 pmt_pid);
+static void gst_mpegts_demux_update_pid_filter (GstMpegTSDemux * demux);
+
+static gboolean gst_mpegts_demux_sink_activate (GstPad * sinkpad);
+static gboolean gst_mpegts_demux_sink_activate_push (GstPad * sinkpad,
+    gboolean active);
+static gboolean gst_mpegts_demux_sink_activate_pull (GstPad * sinkpad,
+    gboolean active);
+static void gst_mpegts_demux_loop (GstPad * pad);
+static void gst_mpegts_demux_flush (GstMpegTSDemux * demux, gboolean discard);
+static gboolean gst_mpegts_demux_send_event (GstMpegTSDemux * demux,
+    GstEvent * event);
+static guint64 gst_mpegts_demux_find_seek_offset (GstMpegTSDemux * demux,
+    GstClockTime target, GstClockTime * time);
+static void gst_mpegts_demux_reset_pull (GstMpegTSDemux * demux);
+static void gst_mpegts_demux_pull_setup (GstMpegTSDemux * demux);
+static void gst_mpegts_demux_index_save (GstMpegTSDemux * demux);
 
 static GstElementClass *parent_class = NULL;
 
@@ -298,6 +342,27 @@ gst_mpegts_demux_class_init (GstMpegTSDemuxClass * klass)
           "about the currently selected program and its streams",
           MPEGTS_TYPE_PMT_INFO, G_PARAM_READABLE));
 
+  g_object_class_install_property (gobject_class, PROP_PID_STATISTICS,
+      g_param_spec_value_array ("pid-statistics",
+          "Per PID packet statistics",
+          "Array of GstStructures with the number of packets that were "
+          "parsed (forwarded) and dropped by the PID filter for each PID "
+          "seen so far",
+          g_param_spec_boxed ("pid-stats", "PID statistics",
+              "Packet statistics of one PID", GST_TYPE_STRUCTURE,
+              G_PARAM_READABLE), G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_INDEX_LOCATION,
+      g_param_spec_string ("index-location", "Index location",
+          "File to load the seek index from and to save it to when operating "
+          "in pull mode (NULL = don't store the index)",
+          DEFAULT_PROP_INDEX_LOCATION, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_INDEX_NEXT_TO_FILE,
+      g_param_spec_boolean ("index-next-to-file", "Index next to file",
+          "Store the seek index next to the upstream file (with an \""
+          MPEGTS_INDEX_SUFFIX "\" suffix) when no index-location is set",
+          DEFAULT_PROP_INDEX_NEXT_TO_FILE, G_PARAM_READWRITE));
+
   gstelement_class->change_state = gst_mpegts_demux_change_state;
   gstelement_class->provide_clock = gst_mpegts_demux_provide_clock;
 }
@@ -310,6 +375,12 @@ gst_mpegts_demux_init (GstMpegTSDemux * demux)
   demux->streams =
       g_malloc0 (sizeof (GstMpegTSStream *) * (MPEGTS_MAX_PID + 1));
   demux->sinkpad = gst_pad_new_from_template (klass->sink_template, "sink");
+  gst_pad_set_activate_function (demux->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_mpegts_demux_sink_activate));
+  gst_pad_set_activatepull_function (demux->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_mpegts_demux_sink_activate_pull));
+  gst_pad_set_activatepush_function (demux->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_mpegts_demux_sink_activate_push));
   gst_pad_set_chain_function (demux->sinkpad, gst_mpegts_demux_chain);
   gst_pad_set_event_function (demux->sinkpad, gst_mpegts_demux_sink_event);
   gst_pad_set_setcaps_function (demux->sinkpad, gst_mpegts_demux_sink_setcaps);
@@ -319,14 +390,22 @@ gst_mpegts_demux_init (GstMpegTSDemux * demux)
   demux->nb_elementary_pids = 0;
   demux->check_crc = DEFAULT_PROP_CHECK_CRC;
   demux->program_number = DEFAULT_PROP_PROGRAM_NUMBER;
+  demux->pid_forwarded = g_new0 (guint64, MPEGTS_MAX_PID + 1);
+  demux->pid_dropped = g_new0 (guint64, MPEGTS_MAX_PID + 1);
+  gst_mpegts_demux_update_pid_filter (demux);
   demux->sync_lut = NULL;
   demux->sync_lut_len = 0;
+  demux->in_sync = FALSE;
   demux->bitrate = -1;
   demux->num_packets = 0;
   demux->pcr[0] = -1;
   demux->pcr[1] = -1;
   demux->cache_duration = GST_CLOCK_TIME_NONE;
   demux->base_pts = GST_CLOCK_TIME_NONE;
+  demux->index = g_array_new (FALSE, FALSE, sizeof (GstMpegTSIndexEntry));
+  demux->index_location = g_strdup (DEFAULT_PROP_INDEX_LOCATION);
+  demux->index_next_to_file = DEFAULT_PROP_INDEX_NEXT_TO_FILE;
+  gst_mpegts_demux_reset_pull (demux);
 }
 
 static void
@@ -334,6 +413,11 @@ gst_mpegts_demux_finalize (GstMpegTSDemux * demux)
 {
   gst_mpegts_demux_reset (demux);
   g_free (demux->streams);
+  g_free (demux->pid_forwarded);
+  g_free (demux->pid_dropped);
+  g_array_free (demux->index, TRUE);
+  g_free (demux->index_location);
+  g_free (demux->index_file);
 
   G_OBJECT_CLASS (parent_class)->finalize (G_OBJECT (demux));
 }
@@ -384,6 +468,12 @@ gst_mpegts_demux_reset (GstMpegTSDemux * demux)
     g_object_unref (demux->clock);
     demux->clock = NULL;
   }
+
+  demux->in_sync = FALSE;
+
+  memset (demux->pid_forwarded, 0, sizeof (guint64) * (MPEGTS_MAX_PID + 1));
+  memset (demux->pid_dropped, 0, sizeof (guint64) * (MPEGTS_MAX_PID + 1));
+  gst_mpegts_demux_update_pid_filter (demux);
 }
 
 #if 0
@@ -419,52 +509,6 @@ gst_mpegts_demux_remove_pads (GstMpegTSDemux * demux)
 #endif
 
 
-static guint32 crc_tab[256] = {
-  0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
-  0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
-  0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd, 0x4c11db70, 0x48d0c6c7,
-  0x4593e01e, 0x4152fda9, 0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75,
-  0x6a1936c8, 0x6ed82b7f, 0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3,
-  0x709f7b7a, 0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
-  0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58, 0xbaea46ef,
-  0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d,
-  0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49, 0xc7361b4c, 0xc3f706fb,
-  0xceb42022, 0xca753d95, 0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1,
-  0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d, 0x34867077, 0x30476dc0,
-  0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
-  0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16, 0x018aeb13, 0x054bf6a4,
-  0x0808d07d, 0x0cc9cdca, 0x7897ab07, 0x7c56b6b0, 0x71159069, 0x75d48dde,
-  0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08,
-  0x571d7dd1, 0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
-  0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b, 0xbb60adfc,
-  0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6,
-  0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a, 0xe0b41de7, 0xe4750050,
-  0xe9362689, 0xedf73b3e, 0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2,
-  0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
-  0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637,
-  0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb, 0x4f040d56, 0x4bc510e1,
-  0x46863638, 0x42472b8f, 0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
-  0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5,
-  0x3f9b762c, 0x3b5a6b9b, 0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
-  0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e, 0xf5ee4bb9,
-  0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b,
-  0xd727bbb6, 0xd3e6a601, 0xdea580d8, 0xda649d6f, 0xc423cd6a, 0xc0e2d0dd,
-  0xcda1f604, 0xc960ebb3, 0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7,
-  0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71,
-  0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74, 0x857130c3,
-  0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640, 0x4e8ee645, 0x4a4ffbf2,
-  0x470cdd2b, 0x43cdc09c, 0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8,
-  0x68860bfd, 0x6c47164a, 0x61043093, 0x65c52d24, 0x119b4be9, 0x155a565e,
-  0x18197087, 0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
-  0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d, 0x2056cd3a,
-  0x2d15ebe3, 0x29d4f654, 0xc5a92679, 0xc1683bce, 0xcc2b1d17, 0xc8ea00a0,
-  0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c, 0xe3a1cbc1, 0xe760d676,
-  0xea23f0af, 0xeee2ed18, 0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4,
-  0x89b8fd09, 0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662,
-  0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668,
-  0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
-};
-
 /*This function fills the value of negotiated packetsize at sinkpad*/
 static gboolean
 gst_mpegts_demux_sink_setcaps (GstPad * pad, GstCaps * caps)
@@ -479,23 +523,12 @@ gst_mpegts_demux_sink_setcaps (GstPad * pad, GstCaps * caps)
   if (!gst_structure_get_int (structure, "packetsize", &demux->packetsize)) {
     GST_DEBUG_OBJECT (demux, "packetsize parameter not found in sink caps");
   }
+  demux->in_sync = FALSE;
 
   gst_object_unref (demux);
   return TRUE;
 }
 
-static FORCE_INLINE guint32
-gst_mpegts_demux_calc_crc32 (guint8 * data, guint datalen)
-{
-  gint i;
-  guint32 crc = 0xffffffff;
-
-  for (i = 0; i < datalen; i++) {
-    crc = (crc << 8) ^ crc_tab[((crc >> 24) ^ *data++) & 0xff];
-  }
-  return crc;
-}
-
 static FORCE_INLINE gboolean
 gst_mpegts_is_dirac_stream (GstMpegTSStream * stream)
 {
@@ -843,6 +876,13 @@ gst_mpegts_demux_setup_base_pts (GstMpegTSDemux * demux, gint64 pts)
   GstMpegTSStream *PMT_stream;
   guint64 base_PCR;
 
+  /* in pull mode the first PCR of the file is the reference, no matter
+   * where demuxing started */
+  if (demux->first_pcr != -1) {
+    demux->base_pts = MPEGTIME_TO_GSTTIME (demux->first_pcr);
+    return TRUE;
+  }
+
   /* for the reference start time we need to consult the PCR_PID of the
    * current PMT */
   if (demux->current_PMT == 0)
@@ -890,6 +930,33 @@ no_pcr_stream:
   }
 }
 
+/* Time of @pcr relative to the first PCR of the file */
+static FORCE_INLINE GstClockTime
+gst_mpegts_demux_pcr_to_time (GstMpegTSDemux * demux, guint64 pcr)
+{
+  return MPEGTIME_TO_GSTTIME ((pcr - demux->first_pcr) & MPEGTS_PCR_MASK);
+}
+
+/* Newsegment event for the pull mode segment, which is in stream time */
+static GstEvent *
+gst_mpegts_demux_new_segment_event (GstMpegTSDemux * demux, gboolean update)
+{
+  GstSegment *segment = &demux->segment;
+  gint64 start, stop;
+
+  start = demux->base_pts + segment->start;
+  stop = segment->stop;
+  if (stop != -1)
+    stop += demux->base_pts;
+
+  GST_DEBUG_OBJECT (demux, "newsegment from %" GST_TIME_FORMAT " to %"
+      GST_TIME_FORMAT " time %" GST_TIME_FORMAT, GST_TIME_ARGS (start),
+      GST_TIME_ARGS (stop), GST_TIME_ARGS (segment->time));
+
+  return gst_event_new_new_segment (update, segment->rate, GST_FORMAT_TIME,
+      start, stop, segment->time);
+}
+
 static gboolean
 gst_mpegts_demux_send_new_segment (GstMpegTSDemux * demux,
     GstMpegTSStream * stream, gint64 pts)
@@ -912,6 +979,13 @@ gst_mpegts_demux_send_new_segment (GstMpegTSDemux * demux,
         gst_clock_get_internal_time (demux->clock), demux->clock_base, 1, 1);
   }
 
+  if (demux->random_access) {
+    /* in pull mode we configured the segment ourselves */
+    gst_pad_push_event (stream->pad,
+        gst_mpegts_demux_new_segment_event (demux, FALSE));
+    return TRUE;
+  }
+
   gst_pad_push_event (stream->pad,
       gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_TIME, time, -1, 0));
 
@@ -1260,6 +1334,7 @@ gst_mpegts_activate_pmt (GstMpegTSDemux * demux, GstMpegTSStream * stream)
   /* gst_mpegts_demux_remove_pads (demux); */
 
   demux->current_PMT = stream->PID;
+  gst_mpegts_demux_update_pid_filter (demux);
 
   /* PMT has been updated, signal the change */
   if (demux->current_PMT == stream->PID)
@@ -1323,7 +1398,7 @@ gst_mpegts_stream_parse_pmt (GstMpegTSStream * stream,
   data += 2;
 
   if (demux->check_crc)
-    if (G_UNLIKELY (gst_mpegts_demux_calc_crc32 (data - 3, datalen) != 0))
+    if (G_UNLIKELY (gst_mpegts_crc32 (data - 3, datalen) != 0))
       goto wrong_crc;
 
   GST_LOG_OBJECT (demux, "PMT section_length: %d", datalen - 3);
@@ -1590,7 +1665,7 @@ gst_mpegts_stream_parse_private_section (GstMpegTSStream * stream,
   demux = stream->demux;
 
   if (demux->check_crc)
-    if (gst_mpegts_demux_calc_crc32 (data, datalen) != 0)
+    if (gst_mpegts_crc32 (data, datalen) != 0)
       goto wrong_crc;
 
   /* just dump this down the pad */
@@ -1976,7 +2051,7 @@ gst_mpegts_stream_parse_pat (GstMpegTSStream * stream,
   GST_DEBUG_OBJECT (demux, "PAT section_length: %d", datalen - 3);
 
   if (demux->check_crc)
-    if (gst_mpegts_demux_calc_crc32 (data - 3, datalen) != 0)
+    if (gst_mpegts_crc32 (data - 3, datalen) != 0)
       goto wrong_crc;
 
   PAT = &stream->PAT;
@@ -2044,6 +2119,9 @@ gst_mpegts_stream_parse_pat (GstMpegTSStream * stream,
   CRC = GST_READ_UINT32_BE (data);
   GST_DEBUG_OBJECT (demux, "PAT CRC: 0x%08x", CRC);
 
+  /* the PMT PID of our program might have changed */
+  gst_mpegts_demux_update_pid_filter (demux);
+
   /* PAT has been updated, signal the change */
   g_object_notify ((GObject *) (demux), "pat-info");
 
@@ -2462,7 +2540,15 @@ gst_mpegts_demux_parse_transport_packet (GstMpegTSDemux * demux,
 
   /* Skip NULL packets */
   if (G_UNLIKELY (PID == 0x1fff))
-    goto beach;
+    goto drop;
+
+  /* Skip PIDs that are not part of the selected program before doing any
+   * other work on them */
+  if (demux->pid_filter_active &&
+      !MPEGTS_PID_FILTER_IS_SET (demux->pid_filter, PID))
+    goto drop;
+
+  demux->pid_forwarded[PID]++;
 
   /* get the stream. */
   stream = gst_mpegts_demux_get_stream_for_PID (demux, PID);
@@ -2499,7 +2585,88 @@ beach:
   demux->num_packets++;
   return ret;
 
-  /* ERRORS */
+drop:
+  demux->pid_dropped[PID]++;
+  goto beach;
+}
+
+/* Rebuild the PID filter from the PAT, the active PMT and the es-pids. The
+ * filter is only active when a program is selected, until then all PIDs are
+ * processed */
+static void
+gst_mpegts_demux_update_pid_filter (GstMpegTSDemux * demux)
+{
+  GstMpegTSStream *PAT_stream;
+  GstMpegTSStream *PMT_stream;
+  gint i;
+
+  memset (demux->pid_filter, 0, sizeof (demux->pid_filter));
+
+  demux->pid_filter_active = (demux->program_number != -1);
+  if (!demux->pid_filter_active)
+    return;
+
+  MPEGTS_PID_FILTER_SET (demux->pid_filter, PID_PROGRAM_ASSOCIATION_TABLE);
+  MPEGTS_PID_FILTER_SET (demux->pid_filter, PID_CONDITIONAL_ACCESS_TABLE);
+
+  for (i = 0; i < demux->nb_elementary_pids; i++)
+    MPEGTS_PID_FILTER_SET (demux->pid_filter,
+        demux->elementary_pids[i] & MPEGTS_MAX_PID);
+
+  /* PMT of the selected program */
+  PAT_stream = demux->streams[PID_PROGRAM_ASSOCIATION_TABLE];
+  if (PAT_stream != NULL && PAT_stream->PAT.entries != NULL) {
+    for (i = 0; i < PAT_stream->PAT.entries->len; i++) {
+      GstMpegTSPATEntry *entry =
+          &g_array_index (PAT_stream->PAT.entries, GstMpegTSPATEntry, i);
+
+      if (entry->program_number == demux->program_number)
+        MPEGTS_PID_FILTER_SET (demux->pid_filter, entry->PID);
+    }
+  }
+
+  /* PCR and elementary streams of the active PMT */
+  if (demux->current_PMT != 0) {
+    PMT_stream = demux->streams[demux->current_PMT];
+    MPEGTS_PID_FILTER_SET (demux->pid_filter, demux->current_PMT);
+
+    if (PMT_stream != NULL && PMT_stream->PMT.entries != NULL) {
+      MPEGTS_PID_FILTER_SET (demux->pid_filter, PMT_stream->PMT.PCR_PID);
+
+      for (i = 0; i < PMT_stream->PMT.entries->len; i++) {
+        GstMpegTSPMTEntry *entry =
+            &g_array_index (PMT_stream->PMT.entries, GstMpegTSPMTEntry, i);
+
+        MPEGTS_PID_FILTER_SET (demux->pid_filter, entry->PID);
+      }
+    }
+  }
+}
+
+static GValueArray *
+mpegts_demux_build_pid_statistics (GstMpegTSDemux * demux)
+{
+  GValueArray *vals;
+  guint i;
+
+  vals = g_value_array_new (0);
+
+  for (i = 0; i < MPEGTS_MAX_PID + 1; i++) {
+    GValue v = { 0, };
+
+    if (demux->pid_forwarded[i] == 0 && demux->pid_dropped[i] == 0)
+      continue;
+
+    g_value_init (&v, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&v, gst_structure_new ("pid-stats",
+            "pid", G_TYPE_UINT, i,
+            "forwarded", G_TYPE_UINT64, demux->pid_forwarded[i],
+            "dropped", G_TYPE_UINT64, demux->pid_dropped[i], NULL));
+    g_value_array_append (vals, &v);
+    g_value_unset (&v);
+  }
+
+  return vals;
 }
 
 static gboolean
@@ -2562,6 +2729,140 @@ beach:
   return res;
 }
 
+static gboolean
+gst_mpegts_demux_handle_seek_pull (GstMpegTSDemux * demux, GstEvent * event)
+{
+  GstFormat format;
+  GstSeekFlags flags;
+  GstSeekType start_type, stop_type;
+  gint64 start, stop;
+  gdouble rate;
+  gboolean update, flush, keyframe;
+  GstSegment seeksegment;
+  GstClockTime target, time;
+  guint64 offset;
+
+  gst_event_parse_seek (event, &rate, &format, &flags, &start_type, &start,
+      &stop_type, &stop);
+
+  if (format != GST_FORMAT_TIME)
+    goto wrong_format;
+
+  if (rate <= 0.0)
+    goto wrong_rate;
+
+  GST_DEBUG_OBJECT (demux, "seek requested start %" GST_TIME_FORMAT " stop %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (start), GST_TIME_ARGS (stop));
+
+  flush = flags & GST_SEEK_FLAG_FLUSH;
+  keyframe = flags & GST_SEEK_FLAG_KEY_UNIT;
+
+  if (flush) {
+    /* Flush start up and downstream to make sure data flow and loops are
+       idle */
+    demux->flushing = TRUE;
+    gst_mpegts_demux_send_event (demux, gst_event_new_flush_start ());
+    gst_pad_push_event (demux->sinkpad, gst_event_new_flush_start ());
+  } else {
+    /* Pause the pulling task */
+    gst_pad_pause_task (demux->sinkpad);
+  }
+
+  /* Take the stream lock */
+  GST_PAD_STREAM_LOCK (demux->sinkpad);
+
+  if (flush) {
+    /* Stop flushing upstream we need to pull */
+    demux->flushing = FALSE;
+    gst_pad_push_event (demux->sinkpad, gst_event_new_flush_stop ());
+  }
+
+  /* the task might not have had the chance to look at the file yet */
+  if (G_UNLIKELY (demux->sink_segment.format == GST_FORMAT_UNDEFINED))
+    gst_mpegts_demux_pull_setup (demux);
+
+  if (demux->first_pcr == -1)
+    goto no_pcr;
+
+  /* Work on a copy until we are sure the seek succeeded. */
+  memcpy (&seeksegment, &demux->segment, sizeof (GstSegment));
+
+  gst_segment_set_seek (&seeksegment, rate, format, flags,
+      start_type, start, stop_type, stop, &update);
+
+  GST_DEBUG_OBJECT (demux, "seek segment configured %" GST_SEGMENT_FORMAT,
+      &seeksegment);
+
+  if (flush) {
+    /* Stop flushing, the sinks are at time 0 now */
+    gst_mpegts_demux_send_event (demux, gst_event_new_flush_stop ());
+  }
+  gst_mpegts_demux_flush (demux, flush);
+
+  /* frames are presented a bit after the PCR of the packets carrying them,
+   * start early enough for accurate seeks to find the target frame */
+  target = seeksegment.last_stop;
+  if (!keyframe)
+    target = MAX (target, MPEGTS_SEEK_PCR_MARGIN) - MPEGTS_SEEK_PCR_MARGIN;
+
+  offset = gst_mpegts_demux_find_seek_offset (demux, target, &time);
+
+  if (keyframe) {
+    /* start the segment at the random access point */
+    seeksegment.start = seeksegment.last_stop = seeksegment.time = time;
+  }
+
+  GST_INFO_OBJECT (demux, "seeking to offset %" G_GUINT64_FORMAT " time %"
+      GST_TIME_FORMAT, offset, GST_TIME_ARGS (time));
+
+  /* Ok seek succeeded, take the newly configured segment */
+  memcpy (&demux->segment, &seeksegment, sizeof (GstSegment));
+  gst_segment_set_last_stop (&demux->sink_segment, GST_FORMAT_BYTES, offset);
+
+  /* Notify about the start of a new segment */
+  if (demux->segment.flags & GST_SEEK_FLAG_SEGMENT) {
+    gst_element_post_message (GST_ELEMENT (demux),
+        gst_message_new_segment_start (GST_OBJECT (demux),
+            demux->segment.format, demux->segment.last_stop));
+  }
+
+  gst_mpegts_demux_send_event (demux,
+      gst_mpegts_demux_new_segment_event (demux, FALSE));
+
+  gst_pad_start_task (demux->sinkpad,
+      (GstTaskFunction) gst_mpegts_demux_loop, demux->sinkpad);
+
+  GST_PAD_STREAM_UNLOCK (demux->sinkpad);
+
+  gst_event_unref (event);
+  return TRUE;
+
+  /* ERRORS */
+wrong_format:
+  {
+    GST_WARNING_OBJECT (demux, "we only support seeking in TIME format");
+    gst_event_unref (event);
+    return FALSE;
+  }
+wrong_rate:
+  {
+    GST_WARNING_OBJECT (demux, "reverse playback is not supported");
+    gst_event_unref (event);
+    return FALSE;
+  }
+no_pcr:
+  {
+    GST_WARNING_OBJECT (demux, "seek not possible, no PCR found in the file");
+    if (flush)
+      gst_mpegts_demux_send_event (demux, gst_event_new_flush_stop ());
+    gst_pad_start_task (demux->sinkpad,
+        (GstTaskFunction) gst_mpegts_demux_loop, demux->sinkpad);
+    GST_PAD_STREAM_UNLOCK (demux->sinkpad);
+    gst_event_unref (event);
+    return FALSE;
+  }
+}
+
 static gboolean
 gst_mpegts_demux_src_event (GstPad * pad, GstEvent * event)
 {
@@ -2573,7 +2874,11 @@ gst_mpegts_demux_src_event (GstPad * pad, GstEvent * event)
 
   switch (GST_EVENT_TYPE (event)) {
     case GST_EVENT_SEEK:
-      res = gst_mpegts_demux_handle_seek_push (demux, event);
+      if (demux->random_access) {
+        res = gst_mpegts_demux_handle_seek_pull (demux, event);
+      } else {
+        res = gst_mpegts_demux_handle_seek_push (demux, event);
+      }
       break;
     default:
       res = gst_pad_push_event (demux->sinkpad, event);
@@ -2597,8 +2902,13 @@ gst_mpegts_demux_flush (GstMpegTSDemux * demux, gboolean discard)
   /* Start by flushing internal buffers */
   gst_mpegts_demux_pes_buffer_flush (demux, discard);
 
+  /* the data that follows does not continue the current index run */
+  demux->pull_pcr = -1;
+  demux->index_last = -1;
+
   /* Clear adapter */
   gst_adapter_clear (demux->adapter);
+  demux->in_sync = FALSE;
 
   /* Try resetting the last_PCR value as we will have a discont */
   if (demux->current_PMT == 0)
@@ -2807,6 +3117,15 @@ gst_mpegts_demux_src_pad_query (GstPad * pad, GstQuery * query)
 
       gst_query_parse_duration (query, &format, NULL);
 
+      /* In pull mode we know the duration from the PCRs in the file */
+      if (demux->random_access && format == GST_FORMAT_TIME &&
+          demux->last_pcr != -1) {
+        gst_query_set_duration (query, GST_FORMAT_TIME,
+            gst_mpegts_demux_pcr_to_time (demux, demux->last_pcr));
+        res = TRUE;
+        break;
+      }
+
       /* Try query upstream first */
       peer = gst_pad_get_peer (demux->sinkpad);
       if (peer) {
@@ -2854,6 +3173,15 @@ gst_mpegts_demux_src_pad_query (GstPad * pad, GstQuery * query)
       if (fmt == GST_FORMAT_BYTES) {
         /* Seeking in BYTES format not supported at all */
         gst_query_set_seeking (query, fmt, FALSE, -1, -1);
+      } else if (demux->random_access && fmt == GST_FORMAT_TIME) {
+        /* In pull mode we seek ourselves on the PCRs */
+        if (demux->last_pcr != -1) {
+          gst_query_set_seeking (query, fmt, TRUE, 0,
+              gst_mpegts_demux_pcr_to_time (demux, demux->last_pcr));
+        } else {
+          gst_query_set_seeking (query, fmt, FALSE, -1, -1);
+        }
+        res = TRUE;
       } else {
         GstQuery *peerquery;
         gboolean seekable;
@@ -2953,14 +3281,81 @@ done:
   GST_DEBUG_OBJECT (demux, "packet_size set to %d bytes", demux->packetsize);
 }
 
+/* Number of consecutive sync bytes that must line up at the packet stride
+ * before a candidate packet size or sync position is trusted */
+#define MPEGTS_SYNC_LOCK_PACKETS 4
+
+static const guint mpegts_packet_sizes[] = {
+  MPEGTS_NORMAL_TS_PACKETSIZE,
+  MPEGTS_M2TS_TS_PACKETSIZE,
+  MPEGTS_DVB_ASI_TS_PACKETSIZE,
+  MPEGTS_ATSC_TS_PACKETSIZE
+};
+
+/* Check that @count packets of @packetsize starting at @in_data all begin
+ * with a sync byte */
+static FORCE_INLINE gboolean
+is_mpegts_sync_stride (const guint8 * in_data, guint packetsize, guint count)
+{
+  guint i;
+
+  for (i = 0; i < count; i++) {
+    if (in_data[i * packetsize] != 0x47)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Find the packet size by looking for a run of sync bytes at one of the
+ * known packet strides. Returns FALSE if there is not enough data to
+ * decide yet */
+static gboolean
+gst_mpegts_demux_probe_packet_size (GstMpegTSDemux * demux,
+    const guint8 * in_data, guint size)
+{
+  const guint8 *ptr_data = in_data;
+  const guint8 *end_data = in_data + size;
+  guint i;
+
+  /* Only the first few candidates, real sync bytes show up in the first
+   * packet */
+  while (ptr_data < end_data && ptr_data < in_data + MPEGTS_ATSC_TS_PACKETSIZE) {
+    ptr_data = memchr (ptr_data, 0x47, end_data - ptr_data);
+    if (ptr_data == NULL)
+      break;
+
+    for (i = 0; i < G_N_ELEMENTS (mpegts_packet_sizes); i++) {
+      guint packetsize = mpegts_packet_sizes[i];
+
+      if (ptr_data + (MPEGTS_SYNC_LOCK_PACKETS - 1) * packetsize >= end_data)
+        continue;
+      if (is_mpegts_sync_stride (ptr_data, packetsize,
+              MPEGTS_SYNC_LOCK_PACKETS)) {
+        demux->packetsize = packetsize;
+        GST_DEBUG_OBJECT (demux, "packet_size set to %d bytes",
+            demux->packetsize);
+        return TRUE;
+      }
+    }
+    ptr_data++;
+  }
+  return FALSE;
+}
+
 static FORCE_INLINE guint
 gst_mpegts_demux_sync_scan (GstMpegTSDemux * demux, const guint8 * in_data,
     guint size, guint * flush)
 {
   guint sync_count = 0;
-  const guint8 *end_scan = in_data + size - demux->packetsize;
+  const guint8 *end_scan;
   guint8 *ptr_data = (guint8 *) in_data;
-  guint packetsize =
+  guint packetsize;
+
+  if (G_UNLIKELY (!demux->packetsize))
+    gst_mpegts_demux_probe_packet_size (demux, in_data, size);
+
+  end_scan = in_data + size - demux->packetsize;
+  packetsize =
       (demux->packetsize ? demux->packetsize : MPEGTS_NORMAL_TS_PACKETSIZE);
 
   /* Check if the LUT table is big enough */
@@ -2974,12 +3369,49 @@ gst_mpegts_demux_sync_scan (GstMpegTSDemux * demux, const guint8 * in_data,
   }
 
   while (ptr_data <= end_scan && sync_count < demux->sync_lut_len) {
+    guint chance;
+
+    if (G_LIKELY (demux->in_sync)) {
+      /* In sync, only validate the sync byte of each packet along the
+       * stride */
+      while (ptr_data + packetsize < end_scan &&
+          sync_count < demux->sync_lut_len && ptr_data[0] == 0x47) {
+        demux->sync_lut[sync_count] = ptr_data;
+        sync_count++;
+        ptr_data += packetsize;
+      }
+      if (ptr_data + packetsize >= end_scan ||
+          sync_count >= demux->sync_lut_len)
+        goto done;
+
+      GST_DEBUG_OBJECT (demux, "lost sync at offset %u",
+          (guint) (ptr_data - in_data));
+      demux->in_sync = FALSE;
+    }
+
+    /* Resync, skip ahead to the next sync byte candidate. memchr is
+     * vectorized on all relevant platforms */
+    ptr_data = memchr (ptr_data, 0x47, end_scan - ptr_data + 1);
+    if (ptr_data == NULL) {
+      ptr_data = (guint8 *) end_scan + 1;
+      goto done;
+    }
+
     /* if sync code is found try to store it in the LUT */
-    guint chance = is_mpegts_sync (ptr_data, end_scan, packetsize);
+    chance = is_mpegts_sync (ptr_data, end_scan, packetsize);
     if (G_LIKELY (chance > 50)) {
       /* skip paketsize bytes and try find next */
       guint8 *next_sync = ptr_data + packetsize;
       if (next_sync < end_scan) {
+        /* lock again once a whole stride of packets lines up */
+        if (demux->packetsize && ptr_data +
+            (MPEGTS_SYNC_LOCK_PACKETS - 1) * packetsize < end_scan &&
+            is_mpegts_sync_stride (ptr_data, packetsize,
+                MPEGTS_SYNC_LOCK_PACKETS)) {
+          GST_DEBUG_OBJECT (demux, "in sync at offset %u",
+              (guint) (ptr_data - in_data));
+          demux->in_sync = TRUE;
+        }
         demux->sync_lut[sync_count] = ptr_data;
         sync_count++;
         ptr_data += packetsize;
@@ -2998,6 +3430,787 @@ done:
   return sync_count;
 }
 
+/* Read the PID of the packet at @data, and the PCR and random access
+ * indicator from its adaptation field if it has one */
+static FORCE_INLINE guint16
+gst_mpegts_demux_peek_packet (const guint8 * data, guint64 * pcr,
+    gboolean * rap)
+{
+  *pcr = -1;
+  *rap = FALSE;
+
+  /* adaptation field with at least the flags */
+  if ((data[3] & 0x20) && data[4] > 0) {
+    guint8 flags = data[5];
+
+    *rap = (flags & 0x40) != 0;
+    if ((flags & 0x10) && data[4] >= 7) {
+      *pcr = ((guint64) GST_READ_UINT32_BE (data + 6)) << 1;
+      *pcr |= (data[10] & 0x80) >> 7;
+    }
+  }
+  return ((data[1] & 0x1f) << 8) | data[2];
+}
+
+/* Random access points are only interesting on the PCR PID and on video,
+ * recognized from the PMT or from the PES header starting in the packet */
+static gboolean
+gst_mpegts_demux_is_rap_packet (GstMpegTSDemux * demux, const guint8 * data,
+    guint16 PID)
+{
+  GstMpegTSStream *stream;
+  const guint8 *payload;
+
+  if (PID == demux->scan_pcr_pid)
+    return TRUE;
+
+  stream = demux->streams[PID];
+  if (stream && (stream->flags & MPEGTS_STREAM_FLAG_IS_VIDEO))
+    return TRUE;
+
+  /* payload_unit_start_indicator */
+  if (!(data[1] & 0x40) || !(data[3] & 0x10))
+    return FALSE;
+
+  payload = data + 4;
+  if (data[3] & 0x20)
+    payload += 1 + data[4];
+  if (payload + 4 > data + MPEGTS_NORMAL_TS_PACKETSIZE)
+    return FALSE;
+
+  return payload[0] == 0x00 && payload[1] == 0x00 && payload[2] == 0x01 &&
+      (payload[3] & 0xf0) == 0xe0;
+}
+
+static FORCE_INLINE gboolean
+gst_mpegts_demux_scan_match (GstMpegTSDemux * demux, const guint8 * data,
+    MpegTSScanMode mode, guint64 * pcr)
+{
+  guint16 PID;
+  guint64 ts;
+  gboolean rap;
+
+  PID = gst_mpegts_demux_peek_packet (data, &ts, &rap);
+
+  if (mode == SCAN_RAP)
+    return rap && gst_mpegts_demux_is_rap_packet (demux, data, PID);
+
+  if (ts == -1)
+    return FALSE;
+
+  /* lock on the first PID carrying PCRs */
+  if (demux->scan_pcr_pid == -1) {
+    GST_DEBUG_OBJECT (demux, "scanning PCRs on PID 0x%04x", PID);
+    demux->scan_pcr_pid = PID;
+  } else if (PID != demux->scan_pcr_pid) {
+    return FALSE;
+  }
+  *pcr = ts;
+  return TRUE;
+}
+
+/* Find the first packet in @data that is followed by a run of sync bytes at
+ * the packet stride */
+static const guint8 *
+gst_mpegts_demux_find_packet (GstMpegTSDemux * demux, const guint8 * data,
+    const guint8 * end)
+{
+  guint run = MPEGTS_SYNC_LOCK_PACKETS * demux->packetsize;
+
+  while (data + run <= end) {
+    data = memchr (data, 0x47, end - run - data + 1);
+    if (data == NULL)
+      break;
+    if (is_mpegts_sync_stride (data, demux->packetsize,
+            MPEGTS_SYNC_LOCK_PACKETS))
+      return data;
+    data++;
+  }
+  return NULL;
+}
+
+/* Look for packets matching @mode in the packets of @data starting before
+ * @scan_end. Returns the position of the first match, or of the last one
+ * when @last is set, or -1. @next is set to the position of the first packet
+ * that was not looked at */
+static gint
+gst_mpegts_demux_scan_block (GstMpegTSDemux * demux, const guint8 * data,
+    guint size, guint scan_end, MpegTSScanMode mode, gboolean last,
+    guint64 * pcr, guint * next)
+{
+  const guint8 *end = data + size;
+  const guint8 *packet;
+  gint found = -1;
+  guint64 ts;
+
+  packet = gst_mpegts_demux_find_packet (demux, data, end);
+  while (packet && packet < data + scan_end &&
+      packet + demux->packetsize <= end) {
+    if (G_UNLIKELY (packet[0] != 0x47)) {
+      packet = gst_mpegts_demux_find_packet (demux, packet + 1, end);
+      continue;
+    }
+    if (gst_mpegts_demux_scan_match (demux, packet, mode, &ts)) {
+      found = packet - data;
+      *pcr = ts;
+      if (!last)
+        break;
+    }
+    packet += demux->packetsize;
+  }
+
+  if (packet)
+    *next = packet - data;
+  else
+    *next = MAX (size, MPEGTS_SYNC_LOCK_PACKETS * demux->packetsize) -
+        MPEGTS_SYNC_LOCK_PACKETS * demux->packetsize;
+
+  return found;
+}
+
+/* Find the first packet matching @mode at or after @pos and before @limit */
+static gboolean
+gst_mpegts_demux_scan_forward (GstMpegTSDemux * demux, guint64 * pos,
+    guint64 limit, MpegTSScanMode mode, guint64 * pcr)
+{
+  GstBuffer *buffer = NULL;
+  guint64 offset = *pos;
+  guint size, next;
+  gint found;
+
+  while (offset < limit) {
+    size = MPEGTS_BLOCK_SZ;
+    if (demux->sink_segment.stop != -1)
+      size = MIN (size, demux->sink_segment.stop - offset);
+
+    if (gst_pad_pull_range (demux->sinkpad, offset, size, &buffer) !=
+        GST_FLOW_OK)
+      return FALSE;
+
+    size = GST_BUFFER_SIZE (buffer);
+    found = gst_mpegts_demux_scan_block (demux, GST_BUFFER_DATA (buffer),
+        size, MIN (size, limit - offset), mode, FALSE, pcr, &next);
+    gst_buffer_unref (buffer);
+
+    if (found != -1) {
+      *pos = offset + found;
+      return TRUE;
+    }
+    /* end of file */
+    if (size < MPEGTS_BLOCK_SZ)
+      break;
+
+    offset += MAX (next, 1);
+  }
+  return FALSE;
+}
+
+/* Find the last packet matching @mode before @pos and at or after @limit */
+static gboolean
+gst_mpegts_demux_scan_backward (GstMpegTSDemux * demux, guint64 * pos,
+    guint64 limit, MpegTSScanMode mode, guint64 * pcr)
+{
+  GstBuffer *buffer = NULL;
+  guint64 end = *pos;
+  guint64 start;
+  guint size, next;
+  gint found;
+
+  while (end > limit) {
+    start = (end > limit + MPEGTS_BLOCK_SZ) ? end - MPEGTS_BLOCK_SZ : limit;
+
+    /* also read the packet starting right before the end */
+    size = end - start + demux->packetsize;
+    if (demux->sink_segment.stop != -1)
+      size = MIN (size, demux->sink_segment.stop - start);
+
+    if (gst_pad_pull_range (demux->sinkpad, start, size, &buffer) !=
+        GST_FLOW_OK)
+      return FALSE;
+
+    found = gst_mpegts_demux_scan_block (demux, GST_BUFFER_DATA (buffer),
+        GST_BUFFER_SIZE (buffer), end - start, mode, TRUE, pcr, &next);
+    gst_buffer_unref (buffer);
+
+    if (found != -1) {
+      *pos = start + found;
+      return TRUE;
+    }
+    end = start;
+  }
+  return FALSE;
+}
+
+/* Position of the first index entry after @time */
+static guint
+gst_mpegts_demux_index_find (GstMpegTSDemux * demux, GstClockTime time)
+{
+  guint lo = 0, hi = demux->index->len;
+
+  while (lo < hi) {
+    guint mid = (lo + hi) / 2;
+
+    if (g_array_index (demux->index, GstMpegTSIndexEntry, mid).time <= time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Add a point where demuxing can start to the index. Entries closer than
+ * the index interval are merged, and the entries passed since the previous
+ * one of the current run are marked contiguous */
+static void
+gst_mpegts_demux_index_add (GstMpegTSDemux * demux, GstClockTime time,
+    guint64 offset)
+{
+  GstMpegTSIndexEntry *entry;
+  guint pos, i;
+
+  pos = gst_mpegts_demux_index_find (demux, time);
+  if (pos > 0) {
+    entry = &g_array_index (demux->index, GstMpegTSIndexEntry, pos - 1);
+    if (entry->offset == offset || time - entry->time < MPEGTS_INDEX_INTERVAL) {
+      pos--;
+      goto link;
+    }
+  }
+
+  {
+    GstMpegTSIndexEntry new_entry = { time, offset, 0 };
+
+    GST_LOG_OBJECT (demux, "index entry %u at %" GST_TIME_FORMAT " offset %"
+        G_GUINT64_FORMAT, pos, GST_TIME_ARGS (time), offset);
+    g_array_insert_val (demux->index, pos, new_entry);
+    if (demux->index_last >= (gint) pos)
+      demux->index_last++;
+    demux->index_dirty = TRUE;
+  }
+
+link:
+  if (demux->index_last != -1) {
+    for (i = demux->index_last; i < pos; i++) {
+      entry = &g_array_index (demux->index, GstMpegTSIndexEntry, i);
+      if (!(entry->flags & MPEGTS_INDEX_FLAG_CONTIGUOUS)) {
+        entry->flags |= MPEGTS_INDEX_FLAG_CONTIGUOUS;
+        demux->index_dirty = TRUE;
+      }
+    }
+  }
+  demux->index_last = pos;
+}
+
+/* Called for every packet demuxed in pull mode to track the position and
+ * to grow the index */
+static FORCE_INLINE void
+gst_mpegts_demux_index_packet (GstMpegTSDemux * demux, const guint8 * data,
+    guint64 offset)
+{
+  guint16 PID;
+  guint64 pcr;
+  gboolean rap;
+
+  if (G_UNLIKELY (demux->first_pcr == -1))
+    return;
+
+  PID = gst_mpegts_demux_peek_packet (data, &pcr, &rap);
+  if (pcr != -1 && PID == demux->scan_pcr_pid) {
+    demux->pull_pcr = pcr;
+    demux->segment.last_stop = gst_mpegts_demux_pcr_to_time (demux, pcr);
+    if (!demux->have_rap)
+      gst_mpegts_demux_index_add (demux, demux->segment.last_stop, offset);
+  }
+  if (G_UNLIKELY (rap) && demux->pull_pcr != -1 && demux->have_rap &&
+      gst_mpegts_demux_is_rap_packet (demux, data, PID)) {
+    gst_mpegts_demux_index_add (demux,
+        gst_mpegts_demux_pcr_to_time (demux, demux->pull_pcr), offset);
+  }
+}
+
+/* Where the index is kept, either the index-location or next to the
+ * upstream file */
+static gchar *
+gst_mpegts_demux_index_get_file (GstMpegTSDemux * demux)
+{
+  GstQuery *query;
+  gchar *uri = NULL, *filename = NULL, *file = NULL;
+
+  if (demux->index_location)
+    return g_strdup (demux->index_location);
+
+  if (!demux->index_next_to_file)
+    return NULL;
+
+  query = gst_query_new_uri ();
+  if (gst_pad_peer_query (demux->sinkpad, query))
+    gst_query_parse_uri (query, &uri);
+  gst_query_unref (query);
+
+  if (uri)
+    filename = g_filename_from_uri (uri, NULL, NULL);
+  if (filename)
+    file = g_strconcat (filename, MPEGTS_INDEX_SUFFIX, NULL);
+  else
+    GST_DEBUG_OBJECT (demux, "upstream is not a local file (%s)", uri);
+
+  g_free (filename);
+  g_free (uri);
+
+  return file;
+}
+
+/* The index is stored as text, a version line, a line with the size of the
+ * file, its first PCR and whether it flags random access points, followed by
+ * one "time offset flags" line per entry */
+static void
+gst_mpegts_demux_index_load (GstMpegTSDemux * demux)
+{
+  gchar *contents = NULL;
+  gchar **lines, **line;
+  guint64 size, first_pcr;
+  guint version, rap;
+
+  g_free (demux->index_file);
+  demux->index_file = gst_mpegts_demux_index_get_file (demux);
+  if (demux->index_file == NULL)
+    return;
+
+  if (!g_file_get_contents (demux->index_file, &contents, NULL, NULL)) {
+    GST_DEBUG_OBJECT (demux, "no index in %s", demux->index_file);
+    return;
+  }
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  if (g_strv_length (lines) < 2)
+    goto invalid;
+  if (sscanf (lines[0], "mpegtsdemux-index %u", &version) != 1 || version != 1)
+    goto invalid;
+  if (sscanf (lines[1], "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %u",
+          &size, &first_pcr, &rap) != 3)
+    goto invalid;
+  if ((gint64) size != demux->sink_segment.duration ||
+      first_pcr != demux->first_pcr)
+    goto other_file;
+
+  for (line = lines + 2; *line; line++) {
+    GstMpegTSIndexEntry entry;
+    guint flags;
+
+    if (sscanf (*line, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %u",
+            &entry.time, &entry.offset, &flags) != 3)
+      continue;
+    if (entry.offset >= size || (demux->index->len > 0 &&
+            entry.time < g_array_index (demux->index, GstMpegTSIndexEntry,
+                demux->index->len - 1).time))
+      goto invalid;
+    entry.flags = flags & MPEGTS_INDEX_FLAG_CONTIGUOUS;
+    g_array_append_val (demux->index, entry);
+  }
+  demux->have_rap = (rap != 0);
+
+  GST_INFO_OBJECT (demux, "loaded %u index entries from %s",
+      demux->index->len, demux->index_file);
+
+done:
+  g_strfreev (lines);
+  return;
+
+  /* ERRORS */
+invalid:
+  {
+    GST_WARNING_OBJECT (demux, "ignoring invalid index %s", demux->index_file);
+    g_array_set_size (demux->index, 0);
+    goto done;
+  }
+other_file:
+  {
+    GST_INFO_OBJECT (demux, "index %s belongs to another file, ignoring",
+        demux->index_file);
+    goto done;
+  }
+}
+
+static void
+gst_mpegts_demux_index_save (GstMpegTSDemux * demux)
+{
+  GString *str;
+  GError *err = NULL;
+  guint i;
+
+  if (!demux->index_dirty || demux->index_file == NULL)
+    return;
+
+  str = g_string_sized_new (64 + demux->index->len * 32);
+  g_string_append_printf (str, "mpegtsdemux-index 1\n%" G_GINT64_FORMAT
+      " %" G_GUINT64_FORMAT " %u\n", demux->sink_segment.duration,
+      demux->first_pcr, demux->have_rap ? 1 : 0);
+  for (i = 0; i < demux->index->len; i++) {
+    GstMpegTSIndexEntry *entry =
+        &g_array_index (demux->index, GstMpegTSIndexEntry, i);
+
+    g_string_append_printf (str, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+        " %u\n", entry->time, entry->offset, entry->flags);
+  }
+
+  if (g_file_set_contents (demux->index_file, str->str, str->len, &err)) {
+    GST_INFO_OBJECT (demux, "saved %u index entries to %s", demux->index->len,
+        demux->index_file);
+    demux->index_dirty = FALSE;
+  } else {
+    GST_WARNING_OBJECT (demux, "could not save index to %s: %s",
+        demux->index_file, err->message);
+    g_error_free (err);
+  }
+  g_string_free (str, TRUE);
+}
+
+/* Forget everything learned about the upstream file in pull mode */
+static void
+gst_mpegts_demux_reset_pull (GstMpegTSDemux * demux)
+{
+  gst_segment_init (&demux->sink_segment, GST_FORMAT_UNDEFINED);
+  gst_segment_init (&demux->segment, GST_FORMAT_TIME);
+  demux->adapter_offset = 0;
+  demux->scan_pcr_pid = -1;
+  demux->first_pcr = -1;
+  demux->first_pcr_offset = 0;
+  demux->last_pcr = -1;
+  demux->last_pcr_offset = 0;
+  demux->pull_pcr = -1;
+  demux->have_rap = FALSE;
+  g_array_set_size (demux->index, 0);
+  demux->index_last = -1;
+  demux->index_dirty = FALSE;
+  g_free (demux->index_file);
+  demux->index_file = NULL;
+}
+
+/* Find the file length, the first and last PCR and load the index */
+static void
+gst_mpegts_demux_pull_setup (GstMpegTSDemux * demux)
+{
+  GstFormat format = GST_FORMAT_BYTES;
+  GstBuffer *buffer = NULL;
+  gint64 length = 0;
+  guint64 offset, pcr;
+
+  gst_segment_init (&demux->sink_segment, GST_FORMAT_BYTES);
+
+  if (!gst_pad_query_peer_duration (demux->sinkpad, &format, &length) ||
+      length <= 0)
+    goto no_length;
+
+  demux->sink_segment.stop = length;
+  gst_segment_set_duration (&demux->sink_segment, GST_FORMAT_BYTES, length);
+
+  if (!demux->packetsize) {
+    if (gst_pad_pull_range (demux->sinkpad, 0, MPEGTS_BLOCK_SZ,
+            &buffer) == GST_FLOW_OK) {
+      gst_mpegts_demux_probe_packet_size (demux, GST_BUFFER_DATA (buffer),
+          GST_BUFFER_SIZE (buffer));
+      gst_buffer_unref (buffer);
+    }
+    if (!demux->packetsize)
+      demux->packetsize = MPEGTS_NORMAL_TS_PACKETSIZE;
+  }
+
+  offset = 0;
+  if (!gst_mpegts_demux_scan_forward (demux, &offset, length, SCAN_PCR,
+          &demux->first_pcr))
+    goto no_pcr;
+  demux->first_pcr_offset = offset;
+
+  offset = length;
+  if (!gst_mpegts_demux_scan_backward (demux, &offset,
+          demux->first_pcr_offset, SCAN_PCR, &demux->last_pcr)) {
+    demux->last_pcr = demux->first_pcr;
+    offset = demux->first_pcr_offset;
+  }
+  demux->last_pcr_offset = offset;
+
+  /* check whether random access points are flagged at all */
+  offset = demux->first_pcr_offset;
+  demux->have_rap = gst_mpegts_demux_scan_forward (demux, &offset,
+      MIN (length, demux->first_pcr_offset + MPEGTS_RAP_SCAN_SZ), SCAN_RAP,
+      &pcr);
+
+  gst_segment_set_duration (&demux->segment, GST_FORMAT_TIME,
+      gst_mpegts_demux_pcr_to_time (demux, demux->last_pcr));
+
+  GST_INFO_OBJECT (demux, "first PCR %" G_GUINT64_FORMAT " at %"
+      G_GUINT64_FORMAT ", last PCR %" G_GUINT64_FORMAT " at %"
+      G_GUINT64_FORMAT ", duration %" GST_TIME_FORMAT ", random access "
+      "points %sflagged", demux->first_pcr, demux->first_pcr_offset,
+      demux->last_pcr, demux->last_pcr_offset,
+      GST_TIME_ARGS (demux->segment.duration), demux->have_rap ? "" : "not ");
+
+  gst_mpegts_demux_index_load (demux);
+  return;
+
+  /* ERRORS */
+no_length:
+  {
+    GST_DEBUG_OBJECT (demux, "could not query upstream length, no seeking");
+    return;
+  }
+no_pcr:
+  {
+    GST_DEBUG_OBJECT (demux, "no PCR found, no seeking");
+    demux->first_pcr = -1;
+    return;
+  }
+}
+
+/* Find the offset to start demuxing from to reach @target and the time of
+ * that position. Uses the index when it covers the target, bisects on the
+ * PCRs otherwise and then backs up to the random access point before */
+static guint64
+gst_mpegts_demux_find_seek_offset (GstMpegTSDemux * demux,
+    GstClockTime target, GstClockTime * time)
+{
+  GstMpegTSIndexEntry *entry = NULL;
+  guint64 lo_offset, hi_offset, offset, limit, pcr;
+  GstClockTime lo_time, hi_time, ts;
+  guint pos, i;
+
+  lo_offset = demux->first_pcr_offset;
+  lo_time = 0;
+  hi_offset = demux->last_pcr_offset;
+  hi_time = gst_mpegts_demux_pcr_to_time (demux, demux->last_pcr);
+
+  /* narrow down the range with the index */
+  pos = gst_mpegts_demux_index_find (demux, target);
+  if (pos > 0) {
+    entry = &g_array_index (demux->index, GstMpegTSIndexEntry, pos - 1);
+    if (target - entry->time <= MPEGTS_INDEX_INTERVAL ||
+        (entry->flags & MPEGTS_INDEX_FLAG_CONTIGUOUS)) {
+      GST_DEBUG_OBJECT (demux, "index entry %u at %" GST_TIME_FORMAT
+          " covers the target", pos - 1, GST_TIME_ARGS (entry->time));
+      demux->index_last = pos - 1;
+      *time = entry->time;
+      return entry->offset;
+    }
+    lo_offset = entry->offset;
+    lo_time = entry->time;
+  }
+  if (pos < demux->index->len) {
+    hi_offset = g_array_index (demux->index, GstMpegTSIndexEntry, pos).offset;
+    hi_time = g_array_index (demux->index, GstMpegTSIndexEntry, pos).time;
+  }
+
+  for (i = 0; i < MPEGTS_SEEK_MAX_STEPS; i++) {
+    guint64 range = hi_offset - lo_offset;
+
+    if (hi_offset <= lo_offset || hi_time <= lo_time ||
+        hi_time - lo_time <= MPEGTS_SEEK_TOLERANCE || range <= MPEGTS_BLOCK_SZ)
+      break;
+
+    /* interpolate, but stay a quarter of the range away from the bounds so
+     * VBR streams still converge like a bisection */
+    offset = lo_offset + gst_util_uint64_scale (range, target - lo_time,
+        hi_time - lo_time);
+    offset = CLAMP (offset, lo_offset + range / 4, hi_offset - range / 4);
+
+    limit = offset;
+    if (!gst_mpegts_demux_scan_forward (demux, &offset, hi_offset, SCAN_PCR,
+            &pcr)) {
+      /* no PCR between the probe and the upper bound */
+      hi_offset = limit;
+      continue;
+    }
+    ts = gst_mpegts_demux_pcr_to_time (demux, pcr);
+
+    GST_LOG_OBJECT (demux, "step %u: PCR %" GST_TIME_FORMAT " at %"
+        G_GUINT64_FORMAT, i, GST_TIME_ARGS (ts), offset);
+
+    if (ts <= target) {
+      lo_offset = offset;
+      lo_time = ts;
+    } else {
+      hi_offset = offset;
+      hi_time = ts;
+    }
+  }
+
+  GST_DEBUG_OBJECT (demux, "PCR %" GST_TIME_FORMAT " at %" G_GUINT64_FORMAT
+      " after %u steps", GST_TIME_ARGS (lo_time), lo_offset, i);
+
+  *time = lo_time;
+  offset = lo_offset;
+
+  if (demux->have_rap) {
+    guint64 rap = lo_offset + 1;
+
+    limit = MAX (lo_offset, MPEGTS_RAP_SCAN_SZ) - MPEGTS_RAP_SCAN_SZ;
+    if (entry)
+      limit = MAX (limit, entry->offset);
+
+    if (gst_mpegts_demux_scan_backward (demux, &rap, limit, SCAN_RAP, &pcr)) {
+      guint64 pcr_offset = rap + 1;
+
+      /* the time of a random access point is that of the PCR before it */
+      offset = rap;
+      if (gst_mpegts_demux_scan_backward (demux, &pcr_offset,
+              MAX (rap, MPEGTS_RAP_SCAN_SZ) - MPEGTS_RAP_SCAN_SZ, SCAN_PCR,
+              &pcr))
+        *time = gst_mpegts_demux_pcr_to_time (demux, pcr);
+      else
+        *time = entry ? entry->time : 0;
+    } else if (entry) {
+      offset = entry->offset;
+      *time = entry->time;
+    } else {
+      GST_DEBUG_OBJECT (demux, "no random access point before the target");
+      return offset;
+    }
+  }
+
+  gst_mpegts_demux_index_add (demux, *time, offset);
+
+  return offset;
+}
+
+static void
+gst_mpegts_demux_loop (GstPad * pad)
+{
+  GstMpegTSDemux *demux;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBuffer *buffer = NULL;
+  guint64 offset;
+  guint size = MPEGTS_BLOCK_SZ;
+
+  demux = GST_MPEGTS_DEMUX (gst_pad_get_parent (pad));
+
+  if (G_UNLIKELY (demux->flushing)) {
+    ret = GST_FLOW_WRONG_STATE;
+    goto pause;
+  }
+
+  if (G_UNLIKELY (demux->sink_segment.format == GST_FORMAT_UNDEFINED))
+    gst_mpegts_demux_pull_setup (demux);
+
+  offset = demux->sink_segment.last_stop;
+  if (demux->sink_segment.stop != -1) {
+    if (offset >= demux->sink_segment.stop) {
+      ret = GST_FLOW_UNEXPECTED;
+      goto pause;
+    }
+    size = MIN (size, demux->sink_segment.stop - offset);
+  }
+
+  ret = gst_pad_pull_range (pad, offset, size, &buffer);
+  if (G_UNLIKELY (ret != GST_FLOW_OK))
+    goto pause;
+
+  size = GST_BUFFER_SIZE (buffer);
+  GST_BUFFER_OFFSET (buffer) = offset;
+  ret = gst_mpegts_demux_chain (pad, buffer);
+  if (G_UNLIKELY (ret != GST_FLOW_OK))
+    goto pause;
+
+  gst_segment_set_last_stop (&demux->sink_segment, GST_FORMAT_BYTES,
+      offset + size);
+
+  /* everything after a PCR past the segment stop is presented later */
+  if (demux->segment.stop != -1 &&
+      demux->segment.last_stop > demux->segment.stop) {
+    GST_DEBUG_OBJECT (demux, "reached the end of the segment at %"
+        GST_TIME_FORMAT, GST_TIME_ARGS (demux->segment.stop));
+    ret = GST_FLOW_UNEXPECTED;
+    goto pause;
+  }
+
+  gst_object_unref (demux);
+  return;
+
+pause:
+  {
+    const gchar *reason = gst_flow_get_name (ret);
+
+    GST_LOG_OBJECT (demux, "pausing task, reason %s", reason);
+    gst_pad_pause_task (pad);
+
+    if (GST_FLOW_IS_FATAL (ret) || ret == GST_FLOW_NOT_LINKED) {
+      if (ret == GST_FLOW_UNEXPECTED) {
+        /* push out what is still pending */
+        gst_mpegts_demux_flush (demux, FALSE);
+
+        if (demux->segment.flags & GST_SEEK_FLAG_SEGMENT) {
+          gint64 stop;
+
+          if ((stop = demux->segment.stop) == -1)
+            stop = demux->segment.duration;
+
+          GST_LOG_OBJECT (demux, "sending segment done, at end of segment");
+          gst_element_post_message (GST_ELEMENT_CAST (demux),
+              gst_message_new_segment_done (GST_OBJECT_CAST (demux),
+                  GST_FORMAT_TIME, stop));
+        } else if (!gst_mpegts_demux_send_event (demux, gst_event_new_eos ())) {
+          GST_ELEMENT_ERROR (demux, STREAM, TYPE_NOT_FOUND,
+              (NULL), ("No valid streams found at EOS"));
+        }
+      } else {
+        GST_ELEMENT_ERROR (demux, STREAM, FAILED,
+            ("Internal data stream error."),
+            ("stream stopped, reason %s", reason));
+        gst_mpegts_demux_send_event (demux, gst_event_new_eos ());
+      }
+    }
+
+    gst_object_unref (demux);
+    return;
+  }
+}
+
+/* If we can pull that's prefered */
+static gboolean
+gst_mpegts_demux_sink_activate (GstPad * sinkpad)
+{
+  if (gst_pad_check_pull_range (sinkpad)) {
+    return gst_pad_activate_pull (sinkpad, TRUE);
+  } else {
+    return gst_pad_activate_push (sinkpad, TRUE);
+  }
+}
+
+static gboolean
+gst_mpegts_demux_sink_activate_push (GstPad * sinkpad, gboolean active)
+{
+  GstMpegTSDemux *demux = GST_MPEGTS_DEMUX (gst_pad_get_parent (sinkpad));
+
+  demux->random_access = FALSE;
+
+  gst_object_unref (demux);
+
+  return TRUE;
+}
+
+/* In pull mode we have random access to the file and drive the pipeline
+ * from a task */
+static gboolean
+gst_mpegts_demux_sink_activate_pull (GstPad * sinkpad, gboolean active)
+{
+  GstMpegTSDemux *demux = GST_MPEGTS_DEMUX (gst_pad_get_parent (sinkpad));
+  gboolean res;
+
+  if (active) {
+    GST_DEBUG_OBJECT (demux, "pull mode activated");
+    demux->random_access = TRUE;
+    demux->flushing = FALSE;
+    res = gst_pad_start_task (sinkpad,
+        (GstTaskFunction) gst_mpegts_demux_loop, sinkpad);
+  } else {
+    demux->random_access = FALSE;
+    res = gst_pad_stop_task (sinkpad);
+  }
+
+  gst_object_unref (demux);
+
+  return res;
+}
+
 static GstFlowReturn
 gst_mpegts_demux_chain (GstPad * pad, GstBuffer * buffer)
 {
@@ -3012,6 +4225,9 @@ gst_mpegts_demux_chain (GstPad * pad, GstBuffer * buffer)
   if (GST_BUFFER_IS_DISCONT (buffer)) {
     gst_mpegts_demux_flush (demux, FALSE);
   }
+  if (demux->random_access && gst_adapter_available (demux->adapter) == 0)
+    demux->adapter_offset = GST_BUFFER_OFFSET (buffer);
+
   /* first push the new buffer into the adapter */
   gst_adapter_push (demux->adapter, buffer);
 
@@ -3028,6 +4244,10 @@ gst_mpegts_demux_chain (GstPad * pad, GstBuffer * buffer)
 
   /* process all packets */
   for (i = 0; i < sync_count; i++) {
+    if (demux->random_access)
+      gst_mpegts_demux_index_packet (demux, demux->sync_lut[i],
+          demux->adapter_offset + (demux->sync_lut[i] - data));
+
     ret = gst_mpegts_demux_parse_transport_packet (demux, demux->sync_lut[i]);
     if (G_UNLIKELY (ret == GST_FLOW_LOST_SYNC
             || ret == GST_FLOW_NEED_MORE_DATA)) {
@@ -3046,6 +4266,7 @@ done:
   if (flush) {
     GST_DEBUG_OBJECT (demux, "flushing %d/%d", flush, avail);
     gst_adapter_flush (demux->adapter, flush);
+    demux->adapter_offset += flush;
   }
 
   gst_object_unref (demux);
@@ -3075,6 +4296,8 @@ gst_mpegts_demux_change_state (GstElement * element, GstStateChange transition)
   switch (transition) {
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       gst_mpegts_demux_reset (demux);
+      gst_mpegts_demux_index_save (demux);
+      gst_mpegts_demux_reset_pull (demux);
       break;
     case GST_STATE_CHANGE_READY_TO_NULL:
       g_object_unref (demux->adapter);
@@ -3195,12 +4418,21 @@ gst_mpegts_demux_set_property (GObject * object, guint prop_id,
         }
       }
       g_strfreev (pids);
+      gst_mpegts_demux_update_pid_filter (demux);
       break;
     case PROP_CHECK_CRC:
       demux->check_crc = g_value_get_boolean (value);
       break;
     case PROP_PROGRAM_NUMBER:
       demux->program_number = g_value_get_int (value);
+      gst_mpegts_demux_update_pid_filter (demux);
+      break;
+    case PROP_INDEX_LOCATION:
+      g_free (demux->index_location);
+      demux->index_location = g_value_dup_string (value);
+      break;
+    case PROP_INDEX_NEXT_TO_FILE:
+      demux->index_next_to_file = g_value_get_boolean (value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -3252,6 +4484,15 @@ gst_mpegts_demux_get_property (GObject * object, guint prop_id,
       }
       break;
     }
+    case PROP_PID_STATISTICS:
+      g_value_take_boxed (value, mpegts_demux_build_pid_statistics (demux));
+      break;
+    case PROP_INDEX_LOCATION:
+      g_value_set_string (value, demux->index_location);
+      break;
+    case PROP_INDEX_NEXT_TO_FILE:
+      g_value_set_boolean (value, demux->index_next_to_file);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
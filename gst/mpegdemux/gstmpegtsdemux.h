@@ -62,6 +62,12 @@ G_BEGIN_DECLS
 #define MPEGTS_DVB_ASI_TS_PACKETSIZE 204
 #define MPEGTS_ATSC_TS_PACKETSIZE    208
 
+/* Bitmap of the PIDs to process, see gst_mpegts_demux_update_pid_filter */
+#define MPEGTS_PID_FILTER_SET(filter,pid) \
+    ((filter)[(pid) >> 5] |= (1U << ((pid) & 0x1f)))
+#define MPEGTS_PID_FILTER_IS_SET(filter,pid) \
+    (((filter)[(pid) >> 5] & (1U << ((pid) & 0x1f))) != 0)
+
 #define IS_MPEGTS_SYNC(data) (((data)[0] == 0x47) && \
                                     (((data)[1] & 0x80) == 0x00) && \
                                     (((data)[3] & 0x10) == 0x10))
@@ -83,9 +89,23 @@ typedef struct _GstMpegTSPMTEntry GstMpegTSPMTEntry;
 typedef struct _GstMpegTSPMT GstMpegTSPMT;
 typedef struct _GstMpegTSPATEntry GstMpegTSPATEntry;
 typedef struct _GstMpegTSPAT GstMpegTSPAT;
+typedef struct _GstMpegTSIndexEntry GstMpegTSIndexEntry;
 typedef struct _GstMpegTSDemux GstMpegTSDemux;
 typedef struct _GstMpegTSDemuxClass GstMpegTSDemuxClass;
 
+/* The playback from this entry up to the next one was contiguous, every
+ * random access point in between is at most the index interval away */
+#define MPEGTS_INDEX_FLAG_CONTIGUOUS 0x01
+
+/* Seek index entry, time is relative to the first PCR of the file and
+ * offset points at a random access packet (or a PCR packet when the stream
+ * does not flag random access points) */
+struct _GstMpegTSIndexEntry {
+  GstClockTime      time;
+  guint64           offset;
+  guint             flags;
+};
+
 struct _GstMpegTSPMTEntry {
   guint16           PID;
 };
@@ -184,6 +204,8 @@ struct _GstMpegTSDemux {
   GstAdapter        * adapter;
   guint8            ** sync_lut;
   guint             sync_lut_len;
+  /* packets are aligned on packetsize, only sync bytes are checked */
+  gboolean          in_sync;
 
   /* current PMT PID */
   guint16           current_PMT;
@@ -200,6 +222,13 @@ struct _GstMpegTSDemux {
   /* Program number to use */
   gint              program_number;
 
+  /* When a program is selected, only packets of PIDs set in the filter
+   * are parsed. Per PID statistics of parsed and dropped packets */
+  gboolean          pid_filter_active;
+  guint32           pid_filter[(MPEGTS_MAX_PID + 1) / 32];
+  guint64           * pid_forwarded;
+  guint64           * pid_dropped;
+
   /* indicates that we need to close our pad group, because we've added
    * at least one pad */
   gboolean          need_no_more_pads;
@@ -223,6 +252,34 @@ struct _GstMpegTSDemux {
 
   /* Cached base_PCR in GStreamer time. */
   GstClockTime      base_pts;
+
+  /* pull mode: segments in bytes (sink) and stream time (src) */
+  gboolean          random_access;
+  gboolean          flushing;
+  GstSegment        sink_segment;
+  GstSegment        segment;
+  /* file offset of the first byte in the adapter */
+  guint64           adapter_offset;
+
+  /* PID the PCRs are scanned on, first and last PCR of the file and the
+   * offsets of the packets carrying them */
+  gint              scan_pcr_pid;
+  guint64           first_pcr;
+  guint64           first_pcr_offset;
+  guint64           last_pcr;
+  guint64           last_pcr_offset;
+  /* last PCR seen while demuxing in pull mode */
+  guint64           pull_pcr;
+  /* whether the stream flags random access points at all */
+  gboolean          have_rap;
+
+  /* seek index, sorted on time */
+  GArray            * index;
+  gint              index_last;
+  gboolean          index_dirty;
+  gchar             * index_location;
+  gboolean          index_next_to_file;
+  gchar             * index_file;
 };
 
 struct _GstMpegTSDemuxClass {
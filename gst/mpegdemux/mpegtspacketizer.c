@@ -24,6 +24,8 @@
 
 #include <string.h>
 
+#include <gst/gst-mpegts-crc.h>
+
 #include "mpegtspacketizer.h"
 #include "gstmpegdesc.h"
 
@@ -79,23 +81,16 @@ static gchar *get_encoding_and_convert (const gchar * text, guint length);
 #define VERSION_NUMBER_UNSET 255
 #define TABLE_ID_UNSET 0xFF
 
-static gint
-mpegts_packetizer_stream_subtable_compare (gconstpointer a, gconstpointer b)
-{
-  MpegTSPacketizerStreamSubtable *asub, *bsub;
-
-  asub = (MpegTSPacketizerStreamSubtable *) a;
-  bsub = (MpegTSPacketizerStreamSubtable *) b;
-
-  if (asub->table_id == bsub->table_id &&
-      asub->subtable_extension == bsub->subtable_extension)
-    return 0;
-  return -1;
-}
+/* subtables are hashed by table_id, subtable_extension and section_number so
+ * that every section of a multi-section table (EIT schedules, big SDTs...)
+ * keeps its own version and CRC */
+#define SUBTABLE_KEY(table_id, subtable_extension, section_number) \
+  GUINT_TO_POINTER (((guint) (table_id) << 24) | \
+      ((guint) (subtable_extension) << 8) | (guint) (section_number))
 
 static MpegTSPacketizerStreamSubtable *
 mpegts_packetizer_stream_subtable_new (guint8 table_id,
-    guint16 subtable_extension)
+    guint16 subtable_extension, guint8 section_number)
 {
   MpegTSPacketizerStreamSubtable *subtable;
 
@@ -103,6 +98,7 @@ mpegts_packetizer_stream_subtable_new (guint8 table_id,
   subtable->version_number = VERSION_NUMBER_UNSET;
   subtable->table_id = table_id;
   subtable->subtable_extension = subtable_extension;
+  subtable->section_number = section_number;
   subtable->crc = 0;
   return subtable;
 }
@@ -115,7 +111,8 @@ mpegts_packetizer_stream_new (void)
   stream = (MpegTSPacketizerStream *) g_new0 (MpegTSPacketizerStream, 1);
   stream->section_adapter = gst_adapter_new ();
   stream->continuity_counter = CONTINUITY_UNSET;
-  stream->subtables = NULL;
+  stream->subtables = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, g_free);
   stream->section_table_id = TABLE_ID_UNSET;
   return stream;
 }
@@ -125,8 +122,7 @@ mpegts_packetizer_stream_free (MpegTSPacketizerStream * stream)
 {
   gst_adapter_clear (stream->section_adapter);
   g_object_unref (stream->section_adapter);
-  g_slist_foreach (stream->subtables, (GFunc) g_free, NULL);
-  g_slist_free (stream->subtables);
+  g_hash_table_destroy (stream->subtables);
   g_free (stream);
 }
 
@@ -157,6 +153,8 @@ mpegts_packetizer_init (MpegTSPacketizer * packetizer)
   packetizer->adapter = gst_adapter_new ();
   packetizer->streams = g_new0 (MpegTSPacketizerStream *, 8192);
   packetizer->know_packet_size = FALSE;
+  packetizer->section_cache_hits = 0;
+  packetizer->section_cache_misses = 0;
 }
 
 static void
@@ -266,8 +264,10 @@ mpegts_packetizer_parse_section_header (MpegTSPacketizer * packetizer,
 {
   guint8 tmp;
   guint8 *data, *crc_data;
+  gboolean has_crc;
+  guint8 section_number;
+  gpointer key;
   MpegTSPacketizerStreamSubtable *subtable;
-  GSList *subtable_list = NULL;
 
   section->complete = TRUE;
   /* get the section buffer, pass the ownership to the caller */
@@ -276,22 +276,24 @@ mpegts_packetizer_parse_section_header (MpegTSPacketizer * packetizer,
   data = GST_BUFFER_DATA (section->buffer);
 
   section->table_id = *data++;
+  /* only long sections (section_syntax_indicator set) carry a CRC_32 */
+  has_crc = (data[0] & 0x80) != 0;
   /* if table_id is 0 (pat) then ignore the subtable extension */
   if ((data[0] & 0x80) == 0 || section->table_id == 0)
     section->subtable_extension = 0;
   else
     section->subtable_extension = GST_READ_UINT16_BE (data + 2);
 
-  subtable = mpegts_packetizer_stream_subtable_new (section->table_id,
-      section->subtable_extension);
+  /* short sections have no section_number, treat them as section 0 */
+  section_number = has_crc ? data[5] : 0;
 
-  subtable_list = g_slist_find_custom (stream->subtables, subtable,
-      mpegts_packetizer_stream_subtable_compare);
-  if (subtable_list) {
-    g_free (subtable);
-    subtable = (MpegTSPacketizerStreamSubtable *) (subtable_list->data);
-  } else {
-    stream->subtables = g_slist_prepend (stream->subtables, subtable);
+  key = SUBTABLE_KEY (section->table_id, section->subtable_extension,
+      section_number);
+  subtable = g_hash_table_lookup (stream->subtables, key);
+  if (subtable == NULL) {
+    subtable = mpegts_packetizer_stream_subtable_new (section->table_id,
+        section->subtable_extension, section_number);
+    g_hash_table_insert (stream->subtables, key, subtable);
   }
 
   section->section_length = GST_READ_UINT16_BE (data) & 0x0FFF;
@@ -312,9 +314,23 @@ mpegts_packetizer_parse_section_header (MpegTSPacketizer * packetizer,
       GST_BUFFER_DATA (section->buffer) + GST_BUFFER_SIZE (section->buffer) - 4;
   section->crc = GST_READ_UINT32_BE (crc_data);
 
+  /* Repeated section, drop it before any of the table parsers (and their
+   * charset conversions) get to see it */
   if (section->version_number == subtable->version_number &&
-      section->crc == subtable->crc)
+      section->crc == subtable->crc) {
+    packetizer->section_cache_hits++;
+    goto not_applicable;
+  }
+  packetizer->section_cache_misses++;
+
+  /* New or changed section, make sure it is intact before it replaces the
+   * one we have */
+  if (has_crc && gst_mpegts_crc32 (GST_BUFFER_DATA (section->buffer),
+          GST_BUFFER_SIZE (section->buffer)) != 0) {
+    GST_WARNING ("bad crc pid %d table_id %d", section->pid,
+        section->table_id);
     goto not_applicable;
+  }
 
   subtable->version_number = section->version_number;
   subtable->crc = section->crc;
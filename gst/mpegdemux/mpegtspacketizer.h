@@ -59,7 +59,9 @@ typedef struct
   GstAdapter *section_adapter;
   guint8 section_table_id;
   guint section_length;
-  GSList *subtables;
+  /* MpegTSPacketizerStreamSubtable hashed by table_id, subtable_extension
+   * and section_number */
+  GHashTable *subtables;
 } MpegTSPacketizerStream;
 
 struct _MpegTSPacketizer {
@@ -72,6 +74,11 @@ struct _MpegTSPacketizer {
   gboolean know_packet_size;
   guint16 packet_size;
   GstCaps *caps;
+
+  /* sections dropped because version and CRC were unchanged (hits) versus
+   * sections handed out for parsing (misses) */
+  guint64 section_cache_hits;
+  guint64 section_cache_misses;
 };
 
 struct _MpegTSPacketizerClass {
@@ -113,6 +120,7 @@ typedef struct
    * section when the section_syntax_indicator is set to a value of "1". If 
    * section_syntax_indicator is 0, sub_table_extension will be set to 0 */
   guint16 subtable_extension;
+  guint8 section_number;
   guint8 version_number;
   guint32 crc;
 } MpegTSPacketizerStreamSubtable;
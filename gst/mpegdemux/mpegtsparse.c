@@ -104,6 +104,8 @@ enum
 {
   ARG_0,
   PROP_PROGRAM_NUMBERS,
+  PROP_SECTION_CACHE_HITS,
+  PROP_SECTION_CACHE_MISSES,
   /* FILL ME */
 };
 
@@ -250,6 +252,18 @@ mpegts_parse_class_init (MpegTSParseClass * klass)
       g_param_spec_string ("program-numbers",
           "Program Numbers",
           "Colon separated list of programs", "", G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_SECTION_CACHE_HITS,
+      g_param_spec_uint64 ("section-cache-hits",
+          "Section cache hits",
+          "Number of PSI/SI sections dropped because their version and CRC "
+          "were unchanged", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_SECTION_CACHE_MISSES,
+      g_param_spec_uint64 ("section-cache-misses",
+          "Section cache misses",
+          "Number of new or changed PSI/SI sections that were parsed",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
 }
 
 static gboolean
@@ -350,6 +364,12 @@ mpegts_parse_get_property (GObject * object, guint prop_id,
     case PROP_PROGRAM_NUMBERS:
       g_value_set_string (value, parse->program_numbers);
       break;
+    case PROP_SECTION_CACHE_HITS:
+      g_value_set_uint64 (value, parse->packetizer->section_cache_hits);
+      break;
+    case PROP_SECTION_CACHE_MISSES:
+      g_value_set_uint64 (value, parse->packetizer->section_cache_misses);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -100,7 +100,8 @@ enum
   ARG_PROG_MAP,
   ARG_M2TS_MODE,
   ARG_PAT_INTERVAL,
-  ARG_PMT_INTERVAL
+  ARG_PMT_INTERVAL,
+  ARG_PACKETS_PER_BUFFER
 };
 
 static GstStaticPadTemplate mpegtsmux_sink_factory =
@@ -138,6 +139,10 @@ static void gst_mpegtsmux_get_property (GObject * object, guint prop_id,
 static void mpegtsmux_dispose (GObject * object);
 static gboolean new_packet_cb (guint8 * data, guint len, void *user_data,
     gint64 new_pcr);
+static guint8 *alloc_packet_cb (void *user_data);
+static GstFlowReturn mpegtsmux_push_packets (MpegTsMux * mux);
+static GstFlowReturn mpegtsmux_drain (MpegTsMux * mux);
+static void mpegtsmux_reset_output (MpegTsMux * mux);
 static void release_buffer_cb (guint8 * data, void *user_data);
 
 static gboolean mpegtsdemux_prepare_srcpad (MpegTsMux * mux);
@@ -202,6 +207,14 @@ mpegtsmux_class_init (MpegTsMuxClass * klass)
       g_param_spec_uint ("pmt-interval", "PMT interval",
           "Set the interval (in ticks of the 90kHz clock) for writing out the PMT table",
           1, G_MAXUINT, TSMUX_DEFAULT_PMT_INTERVAL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass),
+      ARG_PACKETS_PER_BUFFER, g_param_spec_uint ("packets-per-buffer",
+          "Packets per buffer",
+          "Maximum number of TS packets aggregated into one output buffer. "
+          "A new buffer is always started on keyframes and PCR packets",
+          1, MAX_PACKETS_PER_BUFFER, DEFAULT_PACKETS_PER_BUFFER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -223,17 +236,21 @@ mpegtsmux_init (MpegTsMux * mux, MpegTsMuxClass * g_class)
   mux->programs = g_new0 (TsMuxProgram *, MAX_PROG_NUMBER);
   mux->first = TRUE;
   mux->last_flow_ret = GST_FLOW_OK;
-  mux->adapter = gst_adapter_new ();
   mux->m2ts_mode = FALSE;
   mux->pat_interval = TSMUX_DEFAULT_PAT_INTERVAL;
   mux->pmt_interval = TSMUX_DEFAULT_PMT_INTERVAL;
-  mux->first_pcr = TRUE;
   mux->last_ts = 0;
   mux->is_delta = TRUE;
 
   mux->prog_map = NULL;
   mux->streamheader = NULL;
   mux->streamheader_sent = FALSE;
+
+  mux->packets_per_buffer = DEFAULT_PACKETS_PER_BUFFER;
+  mux->out_buffer = NULL;
+  mux->out_size = 0;
+  mux->m2ts_waiting = NULL;
+  mpegtsmux_reset_output (mux);
 }
 
 static void
@@ -241,11 +258,6 @@ mpegtsmux_dispose (GObject * object)
 {
   MpegTsMux *mux = GST_MPEG_TSMUX (object);
 
-  if (mux->adapter) {
-    gst_adapter_clear (mux->adapter);
-    g_object_unref (mux->adapter);
-    mux->adapter = NULL;
-  }
   if (mux->collect) {
     gst_object_unref (mux->collect);
     mux->collect = NULL;
@@ -275,6 +287,7 @@ mpegtsmux_dispose (GObject * object)
     g_list_free (mux->streamheader);
     mux->streamheader = NULL;
   }
+  mpegtsmux_reset_output (mux);
   GST_CALL_PARENT (G_OBJECT_CLASS, dispose, (object));
 }
 
@@ -318,6 +331,9 @@ gst_mpegtsmux_set_property (GObject * object, guint prop_id,
         walk = g_slist_next (walk);
       }
       break;
+    case ARG_PACKETS_PER_BUFFER:
+      mux->packets_per_buffer = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -343,6 +359,9 @@ gst_mpegtsmux_get_property (GObject * object, guint prop_id,
     case ARG_PMT_INTERVAL:
       g_value_set_uint (value, mux->pmt_interval);
       break;
+    case ARG_PACKETS_PER_BUFFER:
+      g_value_set_uint (value, mux->packets_per_buffer);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -725,6 +744,7 @@ mpegtsmux_collected (GstCollectPads * pads, MpegTsMux * mux)
   } else {
     /* FIXME: Drain all remaining streams */
     /* At EOS */
+    ret = mpegtsmux_drain (mux);
     gst_pad_push_event (mux->srcpad, gst_event_new_eos ());
   }
 
@@ -821,141 +841,273 @@ mpegtsmux_release_pad (GstElement * element, GstPad * pad)
   gst_collect_pads_remove_pad (mux->collect, pad);
 }
 
+/* Fill in the 4 byte TP_extra_header of the first @count pending m2ts
+ * packets, in output order. Packet i (counting from 1) gets the arrival
+ * time @base + @span * i / @interval, in units of the 27MHz clock */
+static void
+mpegtsmux_m2ts_stamp_packets (MpegTsMux * mux, guint count, gint64 base,
+    guint64 span, guint interval)
+{
+  GList *walk = mux->m2ts_waiting;
+  guint offset = mux->m2ts_pending_offset;
+  guint i = 0;
+
+  while (i < count) {
+    GstBuffer *buf;
+    guint8 *data;
+    guint size;
+
+    if (walk != NULL) {
+      buf = (GstBuffer *) walk->data;
+      size = GST_BUFFER_SIZE (buf);
+      walk = g_list_next (walk);
+    } else if (mux->out_buffer != NULL) {
+      buf = mux->out_buffer;
+      size = mux->out_offset;
+    } else {
+      break;
+    }
+
+    data = GST_BUFFER_DATA (buf);
+    for (; offset < size && i < count; offset += M2TS_PACKET_LENGTH) {
+      guint64 arrival;
+
+      i++;
+      arrival = base + gst_util_uint64_scale (span, i, interval);
+      /* 2 bits copy_permission_indicator, 30 bits arrival_time_stamp */
+      GST_WRITE_UINT32_BE (data + offset, arrival & 0x3fffffff);
+    }
+    offset = 0;
+  }
+
+  mux->m2ts_pending -= i;
+  mux->m2ts_pending_offset = mux->out_offset;
+}
+
+/* Push the output buffers that were waiting for their packets to be
+ * timestamped */
+static GstFlowReturn
+mpegtsmux_m2ts_push_waiting (MpegTsMux * mux)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (mux->m2ts_waiting != NULL) {
+    GstBuffer *buf = (GstBuffer *) mux->m2ts_waiting->data;
+
+    mux->m2ts_waiting = g_list_delete_link (mux->m2ts_waiting,
+        mux->m2ts_waiting);
+
+    if (ret == GST_FLOW_OK) {
+      GST_LOG_OBJECT (mux, "Outputting %u packets (%u bytes)",
+          GST_BUFFER_SIZE (buf) / M2TS_PACKET_LENGTH, GST_BUFFER_SIZE (buf));
+      ret = gst_pad_push (mux->srcpad, buf);
+    } else {
+      gst_buffer_unref (buf);
+    }
+  }
+
+  return ret;
+}
+
 static gboolean
 new_packet_cb (guint8 * data, guint len, void *user_data, gint64 new_pcr)
 {
   /* Called when the TsMux has prepared a packet for output. Return FALSE
    * on error */
   MpegTsMux *mux = (MpegTsMux *) user_data;
-  GstBuffer *buf, *out_buf;
+  guint packet_size, header_size;
+  GstBuffer *buf;
   GstFlowReturn ret;
-  gfloat current_ts;
-  gint64 m2ts_pcr, pcr_bytes, chunk_bytes;
-  gint8 *temp_ptr;
-  gint64 ts_rate;
-
-  if (mux->m2ts_mode == TRUE) {
-    /* Enters when the m2ts-mode is set true */
-    buf = gst_buffer_new_and_alloc (M2TS_PACKET_LENGTH);
-    if (mux->is_delta) {
-      GST_LOG_OBJECT (mux, "marking as delta unit");
-      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
-    } else {
-      GST_DEBUG_OBJECT (mux, "marking as non-delta unit");
-      mux->is_delta = TRUE;
-    }
-    if (G_UNLIKELY (buf == NULL)) {
-      mux->last_flow_ret = GST_FLOW_ERROR;
+
+  packet_size = mux->m2ts_mode ? M2TS_PACKET_LENGTH : NORMAL_TS_PACKET_LENGTH;
+  header_size = packet_size - NORMAL_TS_PACKET_LENGTH;
+
+  /* The packet normally has been assembled in place in our output buffer by
+   * alloc_packet_cb (), otherwise copy it there now */
+  if (G_UNLIKELY (mux->out_buffer == NULL ||
+          data != GST_BUFFER_DATA (mux->out_buffer) + mux->out_offset +
+          header_size)) {
+    guint8 *dest = alloc_packet_cb (mux);
+
+    if (G_UNLIKELY (dest == NULL))
       return FALSE;
-    }
-    gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
+    memcpy (dest, data, len);
+  }
+  mux->out_offset += packet_size;
 
-    /* copies the ts data of 188 bytes to the m2ts buffer at an offset 
-       of 4 bytes of timestamp  */
-    memcpy (GST_BUFFER_DATA (buf) + 4, data, len);
+  if (mux->m2ts_mode) {
+    /* The arrival timestamps of m2ts packets are interpolated between
+     * consecutive PCRs, so they can only be written once the next PCR is
+     * known. Until then the packets stay pending in the output buffers */
+    mux->m2ts_pending++;
 
     if (new_pcr >= 0) {
-      /*when there is a pcr value in ts data */
-      pcr_bytes = 0;
-      if (mux->first_pcr) {
-        /*Incase of first pcr */
-        /*writing the 4  byte timestamp value */
-        GST_WRITE_UINT32_BE (GST_BUFFER_DATA (buf), new_pcr);
-
-        GST_LOG_OBJECT (mux, "Outputting a packet of length %d",
-            M2TS_PACKET_LENGTH);
-        ret = gst_pad_push (mux->srcpad, buf);
-        if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-          mux->last_flow_ret = ret;
-          return FALSE;
-        }
-        mux->first_pcr = FALSE;
-        mux->previous_pcr = new_pcr;
-        pcr_bytes = M2TS_PACKET_LENGTH;
-      }
-      chunk_bytes = gst_adapter_available (mux->adapter);
-
-      if (G_UNLIKELY (chunk_bytes)) {
-        /* calculate rate based on latest and previous pcr values */
-        ts_rate = ((chunk_bytes * STANDARD_TIME_CLOCK) / (new_pcr -
-                mux->previous_pcr));
-        while (1) {
-          /*loop till all the accumulated ts packets are transformed to 
-             m2ts packets and pushed */
-          current_ts = ((gfloat) mux->previous_pcr / STANDARD_TIME_CLOCK) +
-              ((gfloat) pcr_bytes / ts_rate);
-          m2ts_pcr = (((gint64) (STANDARD_TIME_CLOCK * current_ts / 300) &
-                  TWO_POW_33_MINUS1) * 300) + ((gint64) (STANDARD_TIME_CLOCK *
-                  current_ts) % 300);
-          temp_ptr = (gint8 *) & m2ts_pcr;
-
-          out_buf = gst_adapter_take_buffer (mux->adapter, M2TS_PACKET_LENGTH);
-          if (G_UNLIKELY (!out_buf))
-            break;
-          gst_buffer_set_caps (out_buf, GST_PAD_CAPS (mux->srcpad));
-
-          /*writing the 4  byte timestamp value */
-          GST_WRITE_UINT32_BE (GST_BUFFER_DATA (out_buf), m2ts_pcr);
-
-          GST_LOG_OBJECT (mux, "Outputting a packet of length %d",
-              M2TS_PACKET_LENGTH);
-          ret = gst_pad_push (mux->srcpad, out_buf);
-          if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-            mux->last_flow_ret = ret;
-            return FALSE;
-          }
-          pcr_bytes += M2TS_PACKET_LENGTH;
-        }
-        mux->previous_pcr = m2ts_pcr;
+      guint64 span = 0;
+
+      if (!mux->first_pcr && new_pcr > mux->previous_pcr)
+        span = new_pcr - mux->previous_pcr;
+
+      /* Packets before the first PCR all get the first PCR value */
+      mux->m2ts_last_interval = mux->m2ts_pending;
+      mpegtsmux_m2ts_stamp_packets (mux, mux->m2ts_pending, new_pcr - span,
+          span, mux->m2ts_pending);
+
+      mux->m2ts_last_span = span;
+      mux->previous_pcr = new_pcr;
+      mux->first_pcr = FALSE;
+
+      ret = mpegtsmux_m2ts_push_waiting (mux);
+      if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+        mux->last_flow_ret = ret;
+        return FALSE;
       }
-    } else
-      /* If theres no pcr in current ts packet then push the packet 
-         to an adapter, which is used to create m2ts packets */
-      gst_adapter_push (mux->adapter, buf);
-  } else {
-    /* In case of Normal Ts packets */
-    GST_LOG_OBJECT (mux, "Outputting a packet of length %d", len);
-    buf = gst_buffer_new_and_alloc (len);
-    if (G_UNLIKELY (buf == NULL)) {
-      mux->last_flow_ret = GST_FLOW_ERROR;
+    }
+  } else if (!mux->streamheader_sent) {
+    guint pid = ((data[1] & 0x1f) << 8) | data[2];
+    /* if it's a PAT or a PMT */
+    if (pid == 0x00 ||
+        (pid >= TSMUX_START_PMT_PID && pid < TSMUX_START_ES_PID)) {
+      buf = gst_buffer_new_and_alloc (len);
+      memcpy (GST_BUFFER_DATA (buf), data, len);
+      GST_BUFFER_TIMESTAMP (buf) = mux->last_ts;
+      mux->streamheader = g_list_append (mux->streamheader, buf);
+    } else if (mux->streamheader) {
+      mpegtsdemux_set_header_on_caps (mux);
+      mux->streamheader_sent = TRUE;
+    }
+  }
+
+  if (mux->out_offset + packet_size > mux->out_size) {
+    ret = mpegtsmux_push_packets (mux);
+    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+      mux->last_flow_ret = ret;
       return FALSE;
     }
-    gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
-
-    memcpy (GST_BUFFER_DATA (buf), data, len);
-    GST_BUFFER_TIMESTAMP (buf) = mux->last_ts;
-
-    if (!mux->streamheader_sent) {
-      guint pid = ((data[1] & 0x1f) << 8) | data[2];
-      /* if it's a PAT or a PMT */
-      if (pid == 0x00 ||
-          (pid >= TSMUX_START_PMT_PID && pid < TSMUX_START_ES_PID)) {
-        mux->streamheader =
-            g_list_append (mux->streamheader, gst_buffer_copy (buf));
-      } else if (mux->streamheader) {
-        mpegtsdemux_set_header_on_caps (mux);
-        mux->streamheader_sent = TRUE;
-        /* don't unset the streamheaders by pushing old caps */
-        gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
-      }
+  }
+
+  return TRUE;
+}
+
+static guint8 *
+alloc_packet_cb (void *user_data)
+{
+  /* Called when the TsMux needs memory to write the next packet into.
+   * Return NULL on error */
+  MpegTsMux *mux = (MpegTsMux *) user_data;
+  guint packet_size, header_size;
+  GstFlowReturn ret;
+
+  packet_size = mux->m2ts_mode ? M2TS_PACKET_LENGTH : NORMAL_TS_PACKET_LENGTH;
+  header_size = packet_size - NORMAL_TS_PACKET_LENGTH;
+
+  /* Keyframes and PCRs start a new buffer, so that the buffer flags and
+   * timestamp describe the first packet they contain */
+  if (mux->out_buffer != NULL && (!mux->is_delta || mux->tsmux->new_pcr >= 0
+          || mux->out_offset + packet_size > mux->out_size)) {
+    ret = mpegtsmux_push_packets (mux);
+    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+      mux->last_flow_ret = ret;
+      return NULL;
+    }
+  }
+
+  if (mux->out_buffer == NULL) {
+    mux->out_size = mux->packets_per_buffer * packet_size;
+    mux->out_buffer = gst_buffer_new_and_alloc (mux->out_size);
+    if (G_UNLIKELY (mux->out_buffer == NULL)) {
+      mux->out_size = 0;
+      mux->last_flow_ret = GST_FLOW_ERROR;
+      return NULL;
     }
+    mux->out_offset = 0;
+    if (mux->m2ts_waiting == NULL)
+      mux->m2ts_pending_offset = 0;
+    GST_BUFFER_TIMESTAMP (mux->out_buffer) = mux->last_ts;
 
     if (mux->is_delta) {
       GST_LOG_OBJECT (mux, "marking as delta unit");
-      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+      GST_BUFFER_FLAG_SET (mux->out_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
     } else {
       GST_DEBUG_OBJECT (mux, "marking as non-delta unit");
       mux->is_delta = TRUE;
     }
+  }
 
-    ret = gst_pad_push (mux->srcpad, buf);
-    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-      mux->last_flow_ret = ret;
-      return FALSE;
-    }
+  return GST_BUFFER_DATA (mux->out_buffer) + mux->out_offset + header_size;
+}
+
+/* Finish the current output buffer and push it, or in m2ts mode queue it
+ * when it still contains packets without arrival timestamp */
+static GstFlowReturn
+mpegtsmux_push_packets (MpegTsMux * mux)
+{
+  GstBuffer *buf = mux->out_buffer;
+  guint packet_size;
+
+  if (buf == NULL)
+    return GST_FLOW_OK;
+
+  mux->out_buffer = NULL;
+  if (G_UNLIKELY (mux->out_offset == 0)) {
+    gst_buffer_unref (buf);
+    return GST_FLOW_OK;
   }
 
-  return TRUE;
+  GST_BUFFER_SIZE (buf) = mux->out_offset;
+  mux->out_offset = 0;
+  gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
+
+  if (mux->m2ts_mode && mux->m2ts_pending > 0) {
+    mux->m2ts_waiting = g_list_append (mux->m2ts_waiting, buf);
+    return GST_FLOW_OK;
+  }
+
+  packet_size = mux->m2ts_mode ? M2TS_PACKET_LENGTH : NORMAL_TS_PACKET_LENGTH;
+  GST_LOG_OBJECT (mux, "Outputting %u packets (%u bytes)",
+      GST_BUFFER_SIZE (buf) / packet_size, GST_BUFFER_SIZE (buf));
+
+  return gst_pad_push (mux->srcpad, buf);
+}
+
+/* Push out everything still pending, at EOS */
+static GstFlowReturn
+mpegtsmux_drain (MpegTsMux * mux)
+{
+  GstFlowReturn ret;
+
+  if (mux->m2ts_pending > 0) {
+    /* No more PCR will follow, extrapolate from the last PCR interval */
+    if (mux->first_pcr)
+      mpegtsmux_m2ts_stamp_packets (mux, mux->m2ts_pending, 0, 0, 1);
+    else
+      mpegtsmux_m2ts_stamp_packets (mux, mux->m2ts_pending,
+          mux->previous_pcr, mux->m2ts_last_span, mux->m2ts_last_interval);
+  }
+
+  ret = mpegtsmux_m2ts_push_waiting (mux);
+  if (ret == GST_FLOW_OK)
+    ret = mpegtsmux_push_packets (mux);
+
+  return ret;
+}
+
+/* Drop all pending output */
+static void
+mpegtsmux_reset_output (MpegTsMux * mux)
+{
+  if (mux->out_buffer) {
+    gst_buffer_unref (mux->out_buffer);
+    mux->out_buffer = NULL;
+  }
+  mux->out_offset = 0;
+  mux->out_size = 0;
+
+  g_list_foreach (mux->m2ts_waiting, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (mux->m2ts_waiting);
+  mux->m2ts_waiting = NULL;
+  mux->m2ts_pending = 0;
+  mux->m2ts_pending_offset = 0;
+  mux->first_pcr = TRUE;
 }
 
 static void
@@ -1008,6 +1160,9 @@ mpegtsdemux_prepare_srcpad (MpegTsMux * mux)
   /* Set caps on src pad from our template and push new segment */
   gst_pad_set_caps (mux->srcpad, caps);
 
+  /* Have packets assembled directly in our output buffers */
+  tsmux_set_alloc_func (mux->tsmux, alloc_packet_cb, mux);
+
   if (!gst_pad_push_event (mux->srcpad, new_seg)) {
     GST_WARNING_OBJECT (mux, "New segment event was not handled");
     return FALSE;
@@ -1032,10 +1187,9 @@ mpegtsmux_change_state (GstElement * element, GstStateChange transition)
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       gst_collect_pads_stop (mux->collect);
+      mpegtsmux_reset_output (mux);
       break;
     case GST_STATE_CHANGE_READY_TO_NULL:
-      if (mux->adapter)
-        gst_adapter_clear (mux->adapter);
       break;
     default:
       break;
@@ -85,7 +85,6 @@
 
 #include <gst/gst.h>
 #include <gst/base/gstcollectpads.h>
-#include <gst/base/gstadapter.h>
 
 G_BEGIN_DECLS
 
@@ -116,7 +115,6 @@ struct MpegTsMux {
 
   gboolean first;
   GstFlowReturn last_flow_ret;
-  GstAdapter *adapter;
   gint64 previous_pcr;
   gboolean m2ts_mode;
   gboolean first_pcr;
@@ -128,6 +126,24 @@ struct MpegTsMux {
 
   GList *streamheader;
   gboolean streamheader_sent;
+
+  /* Output aggregation: packets are written straight into out_buffer,
+   * which has room for out_size bytes. packets_per_buffer can change while
+   * out_buffer is filled and only applies to the next one */
+  guint packets_per_buffer;
+  GstBuffer *out_buffer;
+  guint out_offset;
+  guint out_size;
+
+  /* m2ts: packets written since the last PCR still lack their arrival
+   * timestamp. Finished buffers containing such packets wait in
+   * m2ts_waiting, m2ts_pending_offset is the offset of the first pending
+   * packet in the oldest buffer */
+  GList *m2ts_waiting;
+  guint m2ts_pending;
+  guint m2ts_pending_offset;
+  guint64 m2ts_last_span;
+  guint m2ts_last_interval;
 };
 
 struct MpegTsMuxClass  {
@@ -176,6 +192,9 @@ GType mpegtsmux_get_type (void);
 /*33 bits as 1 ie 0x1ffffffff*/
 #define TWO_POW_33_MINUS1     ((0xffffffff * 2) - 1) 
 
+#define DEFAULT_PACKETS_PER_BUFFER 1
+#define MAX_PACKETS_PER_BUFFER     8192
+
 #define MAX_PROG_NUMBER	32
 #define DEFAULT_PROG_ID	0
 
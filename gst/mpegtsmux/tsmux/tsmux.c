@@ -85,7 +85,8 @@
 
 #include "tsmux.h"
 #include "tsmuxstream.h"
-#include "crc.h"
+
+#include <gst/gst-mpegts-crc.h>
 
 /* Maximum total data length for a PAT section is 1024 bytes, minus an 
  * 8 byte header, then the length of each program entry is 32 bits, 
@@ -154,6 +155,30 @@ tsmux_set_write_func (TsMux * mux, TsMuxWriteFunc func, void *user_data)
   mux->write_func_data = user_data;
 }
 
+/**
+ * tsmux_set_alloc_func:
+ * @mux: a #TsMux
+ * @func: a user callback function, or %NULL
+ * @user_data: user data passed to @func
+ *
+ * Set the callback function used to obtain the memory each packet is
+ * written into. @func must return a pointer to at least %TSMUX_PACKET_LENGTH
+ * writable bytes, which is then handed to the write function once the packet
+ * is complete. This allows the caller to have packets assembled directly in
+ * its own (larger) output buffers instead of copying them out of the internal
+ * scratch packet. If @func returns %NULL, writing the packet fails.
+ *
+ * When no allocation function is set, the internal scratch packet is used.
+ */
+void
+tsmux_set_alloc_func (TsMux * mux, TsMuxAllocFunc func, void *user_data)
+{
+  g_return_if_fail (mux != NULL);
+
+  mux->alloc_func = func;
+  mux->alloc_func_data = user_data;
+}
+
 /**
  * tsmux_set_pat_interval:
  * @mux: a #TsMux
@@ -426,13 +451,25 @@ tsmux_find_stream (TsMux * mux, guint16 pid)
   return found;
 }
 
+/* Select the memory the next packet will be assembled in */
+static guint8 *
+tsmux_packet_alloc (TsMux * mux)
+{
+  if (mux->alloc_func == NULL)
+    mux->packet_out = mux->packet_buf;
+  else
+    mux->packet_out = mux->alloc_func (mux->alloc_func_data);
+
+  return mux->packet_out;
+}
+
 static gboolean
 tsmux_packet_out (TsMux * mux)
 {
   if (G_UNLIKELY (mux->write_func == NULL))
     return TRUE;
 
-  return mux->write_func (mux->packet_buf, TSMUX_PACKET_LENGTH,
+  return mux->write_func (mux->packet_out, TSMUX_PACKET_LENGTH,
       mux->write_func_data, mux->new_pcr);
 }
 
@@ -697,6 +734,7 @@ tsmux_write_stream_packet (TsMux * mux, TsMuxStream * stream)
 {
   guint payload_len, payload_offs;
   TsMuxPacketInfo *pi = &stream->pi;
+  guint8 *buf;
   gboolean res;
 
 
@@ -770,11 +808,13 @@ tsmux_write_stream_packet (TsMux * mux, TsMuxStream * stream)
   pi->stream_avail = tsmux_stream_bytes_avail (stream);
   pi->packet_start_unit_indicator = tsmux_stream_at_pes_start (stream);
 
-  if (!tsmux_write_ts_header (mux->packet_buf, pi, &payload_len, &payload_offs))
+  if (G_UNLIKELY ((buf = tsmux_packet_alloc (mux)) == NULL))
+    return FALSE;
+
+  if (!tsmux_write_ts_header (buf, pi, &payload_len, &payload_offs))
     return FALSE;
 
-  if (!tsmux_stream_get_data (stream, mux->packet_buf + payload_offs,
-          payload_len))
+  if (!tsmux_stream_get_data (stream, buf + payload_offs, payload_len))
     return FALSE;
 
   res = tsmux_packet_out (mux);
@@ -804,7 +844,7 @@ tsmux_program_free (TsMuxProgram * program)
 static gboolean
 tsmux_write_section (TsMux * mux, TsMuxSection * section)
 {
-  guint8 *cur_in;
+  guint8 *cur_in, *buf;
   guint payload_remain;
   guint payload_len, payload_offs;
   TsMuxPacketInfo *pi;
@@ -817,11 +857,14 @@ tsmux_write_section (TsMux * mux, TsMuxSection * section)
   payload_remain = pi->stream_avail;
 
   while (payload_remain > 0) {
+    if (G_UNLIKELY ((buf = tsmux_packet_alloc (mux)) == NULL))
+      return FALSE;
+
     if (pi->packet_start_unit_indicator) {
       /* Need to write an extra single byte start pointer */
       pi->stream_avail++;
 
-      if (!tsmux_write_ts_header (mux->packet_buf, pi,
+      if (!tsmux_write_ts_header (buf, pi,
               &payload_len, &payload_offs)) {
         pi->stream_avail--;
         return FALSE;
@@ -829,21 +872,20 @@ tsmux_write_section (TsMux * mux, TsMuxSection * section)
       pi->stream_avail--;
 
       /* Write the pointer byte */
-      mux->packet_buf[payload_offs] = 0x00;
+      buf[payload_offs] = 0x00;
 
       payload_offs++;
       payload_len--;
       pi->packet_start_unit_indicator = FALSE;
     } else {
-      if (!tsmux_write_ts_header (mux->packet_buf, pi,
-              &payload_len, &payload_offs))
+      if (!tsmux_write_ts_header (buf, pi, &payload_len, &payload_offs))
         return FALSE;
     }
 
     TS_DEBUG ("Outputting %d bytes to section. %d remaining after",
         payload_len, payload_remain - payload_len);
 
-    memcpy (mux->packet_buf + payload_offs, cur_in, payload_len);
+    memcpy (buf + payload_offs, cur_in, payload_len);
 
     cur_in += payload_len;
     payload_remain -= payload_len;
@@ -928,7 +970,7 @@ tsmux_write_pat (TsMux * mux)
         mux->transport_id, mux->pat_version, 0, 0);
 
     /* Calc and output CRC for data bytes, not including itself */
-    crc = calc_crc32 (pat->data, pat->pi.stream_avail - 4);
+    crc = gst_mpegts_crc32 (pat->data, pat->pi.stream_avail - 4);
     tsmux_put32 (&pos, crc);
 
     TS_DEBUG ("PAT has %d programs, is %u bytes",
@@ -1033,7 +1075,7 @@ tsmux_write_pmt (TsMux * mux, TsMuxProgram * program)
 
     /* Calc and output CRC for data bytes, 
      * but not counting the CRC bytes this time */
-    crc = calc_crc32 (pmt->data, pmt->pi.stream_avail - 4);
+    crc = gst_mpegts_crc32 (pmt->data, pmt->pi.stream_avail - 4);
     tsmux_put32 (&pos, crc);
 
     TS_DEBUG ("PMT for program %d has %d streams, is %u bytes",
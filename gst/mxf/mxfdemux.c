@@ -31,7 +31,6 @@
  */
 
 /* TODO:
- *   - Seeking support: Use IndexTableSegments
  *   - Handle timecode tracks correctly (where is this documented?)
  *   - Handle drop-frame field of timecode tracks
  *   - Handle Generic container system items
@@ -253,17 +252,18 @@ gst_mxf_demux_reset (GstMXFDemux * demux)
     demux->random_index_pack = NULL;
   }
 
-  if (demux->pending_index_table_segments) {
+  if (demux->index_table_segments) {
     GList *l;
 
-    for (l = demux->pending_index_table_segments; l; l = l->next) {
+    for (l = demux->index_table_segments; l; l = l->next) {
       MXFIndexTableSegment *s = l->data;
       mxf_index_table_segment_reset (s);
       g_free (s);
     }
-    g_list_free (demux->pending_index_table_segments);
-    demux->pending_index_table_segments = NULL;
+    g_list_free (demux->index_table_segments);
+    demux->index_table_segments = NULL;
   }
+  demux->index_table_segments_merged = FALSE;
 
   gst_mxf_demux_reset_mxf_state (demux);
   gst_mxf_demux_reset_metadata (demux);
@@ -869,6 +869,9 @@ gst_mxf_demux_update_essence_tracks (GstMXFDemux * demux)
     }
   }
 
+  /* Tracks or their durations might have changed */
+  demux->index_table_segments_merged = FALSE;
+
   return GST_FLOW_OK;
 }
 
@@ -1530,6 +1533,67 @@ gst_mxf_demux_pad_set_component (GstMXFDemux * demux, GstMXFDemuxPad * pad,
   return ret;
 }
 
+/* Returns the position of the edit unit the essence element at offset
+ * belongs to, or -1 if the index does not tell */
+static gint64
+gst_mxf_demux_find_index_position (GstMXFDemuxEssenceTrack * etrack,
+    guint64 offset)
+{
+  gint64 low, high, found = -1;
+  GstMXFDemuxIndex *idx, *next;
+
+  if (!etrack->offsets || etrack->offsets->len == 0)
+    return -1;
+
+  /* Offsets are increasing with the position but unknown
+   * offsets are 0 and have to be skipped */
+  low = 0;
+  high = etrack->offsets->len - 1;
+  while (low <= high) {
+    gint64 mid = low + (high - low) / 2;
+    gint64 m = mid;
+
+    while (m >= low
+        && g_array_index (etrack->offsets, GstMXFDemuxIndex, m).offset == 0)
+      m--;
+
+    if (m < low) {
+      low = mid + 1;
+      continue;
+    }
+
+    idx = &g_array_index (etrack->offsets, GstMXFDemuxIndex, m);
+    if (idx->offset == offset) {
+      return m;
+    } else if (idx->offset < offset) {
+      found = m;
+      low = mid + 1;
+    } else {
+      high = m - 1;
+    }
+  }
+
+  if (found == -1)
+    return -1;
+
+  /* Not an exact match, only accept it if the offset is the start of an
+   * edit unit from the index table and the element is before the next one */
+  idx = &g_array_index (etrack->offsets, GstMXFDemuxIndex, found);
+  if (!idx->edit_unit)
+    return -1;
+
+  if (found + 1 < etrack->offsets->len) {
+    next = &g_array_index (etrack->offsets, GstMXFDemuxIndex, found + 1);
+    if (next->offset != 0)
+      return found;
+  }
+
+  if (found + 1 == etrack->duration)
+    return found;
+
+  return -1;
+}
+
 static GstFlowReturn
 gst_mxf_demux_handle_generic_container_essence_element (GstMXFDemux * demux,
     const MXFUL * key, GstBuffer * buffer, gboolean peek)
@@ -1593,17 +1657,9 @@ gst_mxf_demux_handle_generic_container_essence_element (GstMXFDemux * demux,
   if (etrack->position == -1) {
     GST_DEBUG_OBJECT (demux,
         "Unknown essence track position, looking into index");
-    if (etrack->offsets) {
-      for (i = 0; i < etrack->offsets->len; i++) {
-        GstMXFDemuxIndex *idx =
-            &g_array_index (etrack->offsets, GstMXFDemuxIndex, i);
-
-        if (idx->offset != 0 && idx->offset == demux->offset - demux->run_in) {
-          etrack->position = i;
-          break;
-        }
-      }
-    }
+    etrack->position =
+        gst_mxf_demux_find_index_position (etrack,
+        demux->offset - demux->run_in);
 
     if (etrack->position == -1) {
       GST_WARNING_OBJECT (demux, "Essence track position not in index");
@@ -1650,19 +1706,16 @@ gst_mxf_demux_handle_generic_container_essence_element (GstMXFDemux * demux,
     etrack->offsets = g_array_new (FALSE, TRUE, sizeof (GstMXFDemuxIndex));
 
   {
-    if (etrack->offsets->len > etrack->position) {
-      GstMXFDemuxIndex *index =
-          &g_array_index (etrack->offsets, GstMXFDemuxIndex, etrack->position);
+    GstMXFDemuxIndex *index;
 
-      index->offset = demux->offset - demux->run_in;
-      index->keyframe = keyframe;
-    } else {
-      GstMXFDemuxIndex index;
+    if (etrack->offsets->len <= etrack->position)
+      g_array_set_size (etrack->offsets, etrack->position + 1);
 
-      index.offset = demux->offset - demux->run_in;
-      index.keyframe = keyframe;
-      g_array_insert_val (etrack->offsets, etrack->position, index);
-    }
+    index =
+        &g_array_index (etrack->offsets, GstMXFDemuxIndex, etrack->position);
+    index->offset = demux->offset - demux->run_in;
+    index->keyframe = keyframe;
+    index->edit_unit = FALSE;
   }
 
   if (peek)
@@ -1899,6 +1952,7 @@ gst_mxf_demux_handle_index_table_segment (GstMXFDemux * demux,
     const MXFUL * key, GstBuffer * buffer)
 {
   MXFIndexTableSegment *segment;
+  GList *l;
 
   GST_DEBUG_OBJECT (demux,
       "Handling index table segment of size %u at offset %"
@@ -1915,19 +1969,42 @@ gst_mxf_demux_handle_index_table_segment (GstMXFDemux * demux,
           GST_BUFFER_SIZE (buffer))) {
 
     GST_ERROR_OBJECT (demux, "Parsing index table segment failed");
+    mxf_index_table_segment_reset (segment);
+    g_free (segment);
     return GST_FLOW_ERROR;
   }
 
-  demux->pending_index_table_segments =
-      g_list_prepend (demux->pending_index_table_segments, segment);
+  /* The same segment is seen again when pulling the index tables of all
+   * partitions after we already parsed it during playback */
+  for (l = demux->index_table_segments; l; l = l->next) {
+    MXFIndexTableSegment *tmp = l->data;
+
+    if (tmp->body_sid == segment->body_sid &&
+        tmp->index_sid == segment->index_sid &&
+        tmp->index_start_position == segment->index_start_position &&
+        tmp->index_duration == segment->index_duration) {
+      GST_DEBUG_OBJECT (demux, "Index table segment already known");
+      mxf_index_table_segment_reset (segment);
+      g_free (segment);
+      return GST_FLOW_OK;
+    }
+  }
+
+  GST_DEBUG_OBJECT (demux, "Index table segment for body sid %u, "
+      "start position %" G_GINT64_FORMAT ", duration %" G_GINT64_FORMAT,
+      segment->body_sid, segment->index_start_position,
+      segment->index_duration);
 
+  demux->index_table_segments =
+      g_list_prepend (demux->index_table_segments, segment);
+  demux->index_table_segments_merged = FALSE;
 
   return GST_FLOW_OK;
 }
 
 static GstFlowReturn
-gst_mxf_demux_pull_klv_packet (GstMXFDemux * demux, guint64 offset, MXFUL * key,
-    GstBuffer ** outbuf, guint * read)
+gst_mxf_demux_pull_klv_header (GstMXFDemux * demux, guint64 offset,
+    MXFUL * key, guint * header_size, guint64 * packet_length)
 {
   GstBuffer *buffer = NULL;
   const guint8 *data;
@@ -1979,8 +2056,29 @@ gst_mxf_demux_pull_klv_packet (GstMXFDemux * demux, guint64 offset, MXFUL * key,
     }
   }
 
-  gst_buffer_unref (buffer);
-  buffer = NULL;
+  *header_size = data_offset;
+  *packet_length = length;
+
+beach:
+  if (buffer)
+    gst_buffer_unref (buffer);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_mxf_demux_pull_klv_packet (GstMXFDemux * demux, guint64 offset, MXFUL * key,
+    GstBuffer ** outbuf, guint * read)
+{
+  GstBuffer *buffer = NULL;
+  guint data_offset = 0;
+  guint64 length;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if ((ret =
+          gst_mxf_demux_pull_klv_header (demux, offset, key, &data_offset,
+              &length)) != GST_FLOW_OK)
+    goto beach;
 
   /* GStreamer's buffer sizes are stored in a guint so we
    * limit ourself to G_MAXUINT large buffers */
@@ -2074,6 +2172,114 @@ gst_mxf_demux_pull_random_index_pack (GstMXFDemux * demux)
   demux->offset = old_offset;
 }
 
+static GstFlowReturn
+gst_mxf_demux_pull_next_non_fill_key (GstMXFDemux * demux, guint64 * offset,
+    MXFUL * key, guint * header_size, guint64 * length)
+{
+  GstFlowReturn ret;
+
+  while ((ret =
+          gst_mxf_demux_pull_klv_header (demux, *offset, key, header_size,
+              length)) == GST_FLOW_OK && mxf_is_fill (key))
+    *offset += *header_size + *length;
+
+  return ret;
+}
+
+/* Pulls the index table segments of all partitions, including the ones
+ * only known from the random index pack, and remembers where the essence
+ * container starts in each of them */
+static void
+gst_mxf_demux_pull_index_table_segments (GstMXFDemux * demux)
+{
+  guint64 old_offset = demux->offset;
+  GstMXFDemuxPartition *old_partition = demux->current_partition;
+  GList *l;
+
+  for (l = demux->partitions; l; l = l->next) {
+    GstMXFDemuxPartition *p = l->data;
+    GstBuffer *buffer = NULL;
+    MXFUL key;
+    guint header_size = 0;
+    guint64 length = 0;
+    guint64 offset, index_end;
+    GstFlowReturn ret;
+
+    if (p->parsed_index)
+      continue;
+    p->parsed_index = TRUE;
+
+    offset = p->partition.this_partition + demux->run_in;
+    ret =
+        gst_mxf_demux_pull_klv_header (demux, offset, &key, &header_size,
+        &length);
+    if (ret != GST_FLOW_OK || !mxf_is_partition_pack (&key))
+      continue;
+
+    if (p->partition.major_version == 0) {
+      if (gst_mxf_demux_pull_klv_packet (demux, offset, &key, &buffer,
+              NULL) != GST_FLOW_OK)
+        continue;
+
+      demux->offset = offset;
+      ret = gst_mxf_demux_handle_partition_pack (demux, &key, buffer);
+      gst_buffer_unref (buffer);
+      buffer = NULL;
+      if (ret != GST_FLOW_OK)
+        continue;
+    }
+
+    GST_DEBUG_OBJECT (demux, "Pulling index table segments of partition at "
+        "offset %" G_GUINT64_FORMAT, offset);
+
+    /* Header metadata and index table segments follow the partition pack
+     * and its fill, the byte counts include their trailing fill */
+    offset += header_size + length;
+    if (gst_mxf_demux_pull_next_non_fill_key (demux, &offset, &key,
+            &header_size, &length) != GST_FLOW_OK)
+      continue;
+
+    offset += p->partition.header_byte_count;
+    index_end = offset + p->partition.index_byte_count;
+
+    while (offset < index_end) {
+      if (gst_mxf_demux_pull_klv_header (demux, offset, &key, &header_size,
+              &length) != GST_FLOW_OK)
+        break;
+
+      if (mxf_is_index_table_segment (&key)) {
+        if (gst_mxf_demux_pull_klv_packet (demux, offset, &key, &buffer,
+                NULL) != GST_FLOW_OK)
+          break;
+
+        demux->offset = offset;
+        demux->current_partition = p;
+        gst_mxf_demux_handle_index_table_segment (demux, &key, buffer);
+        gst_buffer_unref (buffer);
+        buffer = NULL;
+      }
+
+      offset += header_size + length;
+    }
+
+    if (p->partition.body_sid == 0 || p->essence_container_offset != 0)
+      continue;
+
+    if (gst_mxf_demux_pull_next_non_fill_key (demux, &offset, &key,
+            &header_size, &length) != GST_FLOW_OK)
+      continue;
+
+    if (mxf_is_generic_container_system_item (&key) ||
+        mxf_is_generic_container_essence_element (&key) ||
+        mxf_is_avid_essence_container_essence_element (&key))
+      p->essence_container_offset =
+          offset - p->partition.this_partition - demux->run_in;
+  }
+
+  demux->offset = old_offset;
+  demux->current_partition = old_partition;
+}
+
 static void
 gst_mxf_demux_parse_footer_metadata (GstMXFDemux * demux)
 {
@@ -2371,6 +2577,124 @@ gst_mxf_demux_set_partition_for_offset (GstMXFDemux * demux, guint64 offset)
   }
 }
 
+static void
+gst_mxf_demux_merge_index_table_segment (GstMXFDemux * demux,
+    MXFIndexTableSegment * segment, GstMXFDemuxEssenceTrack * etrack)
+{
+  GList *l = demux->partitions;
+  GstMXFDemuxPartition *p = NULL;
+  gboolean unknown = FALSE;
+  gint64 i, n;
+
+  if (segment->edit_unit_byte_count != 0) {
+    n = segment->index_duration;
+    if (n == 0)
+      n = etrack->duration - segment->index_start_position;
+  } else {
+    n = segment->n_index_entries;
+  }
+
+  for (i = 0; i < n; i++) {
+    gint64 position = segment->index_start_position + i;
+    guint64 stream_offset, offset;
+    gboolean keyframe;
+    GstMXFDemuxIndex *idx;
+
+    if (etrack->duration > 0 && position >= etrack->duration)
+      break;
+
+    if (segment->edit_unit_byte_count != 0) {
+      stream_offset = position * segment->edit_unit_byte_count;
+      keyframe = TRUE;
+    } else {
+      stream_offset = segment->index_entries[i].stream_offset;
+      keyframe = ((segment->index_entries[i].flags & 0x80) != 0);
+    }
+
+    /* Stream offsets are increasing, advance to the last partition of
+     * this essence container that starts before the stream offset. If
+     * there is an unparsed partition in between we can't map it */
+    for (; l; l = l->next) {
+      GstMXFDemuxPartition *tmp = l->data;
+
+      if (tmp->partition.body_sid != segment->body_sid)
+        continue;
+
+      if (tmp->partition.major_version == 0) {
+        unknown = TRUE;
+        continue;
+      }
+
+      if (tmp->partition.body_offset > stream_offset)
+        break;
+
+      p = tmp;
+      unknown = FALSE;
+    }
+
+    if (!p || unknown || p->essence_container_offset == 0 ||
+        stream_offset < p->partition.body_offset)
+      continue;
+
+    offset = p->partition.this_partition + p->essence_container_offset +
+        stream_offset - p->partition.body_offset;
+
+    if (!etrack->offsets)
+      etrack->offsets = g_array_new (FALSE, TRUE, sizeof (GstMXFDemuxIndex));
+
+    if (etrack->offsets->len <= position)
+      g_array_set_size (etrack->offsets, position + 1);
+
+    idx = &g_array_index (etrack->offsets, GstMXFDemuxIndex, position);
+    if (idx->offset != 0)
+      continue;
+
+    idx->offset = offset;
+    idx->keyframe = keyframe;
+    idx->edit_unit = TRUE;
+  }
+}
+
+/* Fills the per-track index with the edit unit offsets of all
+ * index table segments we know about */
+static void
+gst_mxf_demux_merge_index_table_segments (GstMXFDemux * demux)
+{
+  GList *l;
+  guint i;
+
+  if (demux->index_table_segments_merged)
+    return;
+  demux->index_table_segments_merged = TRUE;
+
+  for (l = demux->index_table_segments; l; l = l->next) {
+    MXFIndexTableSegment *segment = l->data;
+
+    if (segment->index_edit_rate.n <= 0 || segment->index_edit_rate.d <= 0)
+      continue;
+
+    for (i = 0; i < demux->essence_tracks->len; i++) {
+      GstMXFDemuxEssenceTrack *etrack =
+          &g_array_index (demux->essence_tracks, GstMXFDemuxEssenceTrack, i);
+
+      if (etrack->body_sid != segment->body_sid || !etrack->source_track)
+        continue;
+
+      if ((gint64) etrack->source_track->edit_rate.n *
+          segment->index_edit_rate.d !=
+          (gint64) segment->index_edit_rate.n *
+          etrack->source_track->edit_rate.d) {
+        GST_DEBUG_OBJECT (demux, "Index edit rate %d/%d doesn't match edit "
+            "rate of track %u", segment->index_edit_rate.n,
+            segment->index_edit_rate.d, etrack->track_number);
+        continue;
+      }
+
+      gst_mxf_demux_merge_index_table_segment (demux, segment, etrack);
+    }
+  }
+}
+
 static guint64
 gst_mxf_demux_find_essence_element (GstMXFDemux * demux,
     GstMXFDemuxEssenceTrack * etrack, gint64 * position, gboolean keyframe)
@@ -2384,6 +2708,8 @@ gst_mxf_demux_find_essence_element (GstMXFDemux * demux,
       " of track %u with body_sid %u (keyframe %d)", *position,
       etrack->track_number, etrack->body_sid, keyframe);
 
+  gst_mxf_demux_merge_index_table_segments (demux);
+
 from_index:
 
   if (etrack->duration > 0 && *position >= etrack->duration) {
@@ -3263,6 +3589,10 @@ gst_mxf_demux_seek_pull (GstMXFDemux * demux, GstEvent * event)
       }
     }
 
+    /* Make sure all index table segments are known so that the
+     * positions can be looked up directly */
+    gst_mxf_demux_pull_index_table_segments (demux);
+
     /* Do the actual seeking */
     for (i = 0; i < demux->src->len; i++) {
       GstMXFDemuxPad *p = g_ptr_array_index (demux->src, i);
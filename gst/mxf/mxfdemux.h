@@ -52,6 +52,7 @@ typedef struct
   MXFPartitionPack partition;
   MXFPrimerPack primer;
   gboolean parsed_metadata;
+  gboolean parsed_index;
   guint64 essence_container_offset;
 } GstMXFDemuxPartition;
 
@@ -59,6 +60,9 @@ typedef struct
 {
   guint64 offset;
   gboolean keyframe;
+  /* offset is the start of the edit unit from an index table segment,
+   * not the offset of this track's essence element */
+  gboolean edit_unit;
 } GstMXFDemuxIndex;
 
 typedef struct
@@ -149,7 +153,8 @@ struct _GstMXFDemux
   GstMXFDemuxPartition *current_partition;
 
   GArray *essence_tracks;
-  GList *pending_index_table_segments;
+  GList *index_table_segments;
+  gboolean index_table_segments_merged;
 
   GArray *random_index_pack;
 
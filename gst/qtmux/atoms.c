@@ -1166,6 +1166,58 @@ atom_mvhd_clear (AtomMVHD * mvhd)
   atom_full_clear (&mvhd->header);
 }
 
+static void
+atom_trex_init (AtomTREX * trex, guint32 track_ID)
+{
+  guint8 flags[3] = { 0, 0, 0 };
+
+  atom_full_init (&trex->header, FOURCC_trex, 0, 0, 0, flags);
+
+  trex->track_ID = track_ID;
+  trex->default_sample_description_index = 1;
+  trex->default_sample_duration = 0;
+  trex->default_sample_size = 0;
+  trex->default_sample_flags = 0;
+}
+
+static AtomTREX *
+atom_trex_new (guint32 track_ID)
+{
+  AtomTREX *trex = g_new0 (AtomTREX, 1);
+
+  atom_trex_init (trex, track_ID);
+  return trex;
+}
+
+static void
+atom_trex_free (AtomTREX * trex)
+{
+  atom_full_clear (&trex->header);
+  g_free (trex);
+}
+
+static AtomMVEX *
+atom_mvex_new (void)
+{
+  AtomMVEX *mvex = g_new0 (AtomMVEX, 1);
+
+  atom_header_set (&mvex->header, FOURCC_mvex, 0, 0);
+  mvex->trexs = NULL;
+  return mvex;
+}
+
+static void
+atom_mvex_free (AtomMVEX * mvex)
+{
+  GList *walker;
+
+  atom_clear (&mvex->header);
+  for (walker = mvex->trexs; walker; walker = g_list_next (walker))
+    atom_trex_free ((AtomTREX *) walker->data);
+  g_list_free (mvex->trexs);
+  g_free (mvex);
+}
+
 static void
 atom_moov_init (AtomMOOV * moov, AtomsContext * context)
 {
@@ -1173,6 +1225,7 @@ atom_moov_init (AtomMOOV * moov, AtomsContext * context)
   atom_mvhd_init (&(moov->mvhd));
   moov->udta = NULL;
   moov->traks = NULL;
+  moov->mvex = NULL;
   moov->context = *context;
 }
 
@@ -1206,9 +1259,100 @@ atom_moov_free (AtomMOOV * moov)
     moov->udta = NULL;
   }
 
+  if (moov->mvex) {
+    atom_mvex_free (moov->mvex);
+    moov->mvex = NULL;
+  }
+
   g_free (moov);
 }
 
+static void
+atom_mfhd_init (AtomMFHD * mfhd, guint32 sequence_number)
+{
+  guint8 flags[3] = { 0, 0, 0 };
+
+  atom_full_init (&mfhd->header, FOURCC_mfhd, 0, 0, 0, flags);
+  mfhd->sequence_number = sequence_number;
+}
+
+static void
+atom_tfhd_init (AtomTFHD * tfhd, guint32 track_ID)
+{
+  /* base-data-offset-present */
+  guint8 flags[3] = { 0, 0, 0x01 };
+
+  atom_full_init (&tfhd->header, FOURCC_tfhd, 0, 0, 0, flags);
+  tfhd->track_ID = track_ID;
+  tfhd->base_data_offset = 0;
+  tfhd->default_sample_duration = 0;
+  tfhd->default_sample_size = 0;
+  tfhd->default_sample_flags = 0;
+}
+
+static void
+atom_trun_init (AtomTRUN * trun)
+{
+  /* sample-duration, sample-size and sample-flags present; data follows
+   * right at the base data offset so no data-offset */
+  guint8 flags[3] = { 0, 0x07, 0 };
+
+  atom_full_init (&trun->header, FOURCC_trun, 0, 0, 0, flags);
+  atom_array_init (&trun->entries, 512);
+}
+
+static void
+atom_trun_clear (AtomTRUN * trun)
+{
+  atom_full_clear (&trun->header);
+  atom_array_clear (&trun->entries);
+}
+
+AtomTRAF *
+atom_traf_new (AtomsContext * context, guint32 track_ID)
+{
+  AtomTRAF *traf = g_new0 (AtomTRAF, 1);
+
+  atom_header_set (&traf->header, FOURCC_traf, 0, 0);
+  atom_tfhd_init (&traf->tfhd, track_ID);
+  atom_trun_init (&traf->trun);
+  traf->data_size = 0;
+  return traf;
+}
+
+void
+atom_traf_free (AtomTRAF * traf)
+{
+  atom_clear (&traf->header);
+  atom_full_clear (&traf->tfhd.header);
+  atom_trun_clear (&traf->trun);
+  g_free (traf);
+}
+
+AtomMOOF *
+atom_moof_new (AtomsContext * context, guint32 sequence_number)
+{
+  AtomMOOF *moof = g_new0 (AtomMOOF, 1);
+
+  atom_header_set (&moof->header, FOURCC_moof, 0, 0);
+  atom_mfhd_init (&moof->mfhd, sequence_number);
+  moof->trafs = NULL;
+  return moof;
+}
+
+void
+atom_moof_free (AtomMOOF * moof)
+{
+  GList *walker;
+
+  atom_clear (&moof->header);
+  atom_full_clear (&moof->mfhd.header);
+  for (walker = moof->trafs; walker; walker = g_list_next (walker))
+    atom_traf_free ((AtomTRAF *) walker->data);
+  g_list_free (moof->trafs);
+  g_free (moof);
+}
+
 /* -- end of init / free -- */
 
 /* -- copy data functions -- */
@@ -1518,22 +1662,15 @@ atom_stts_copy_data (AtomSTTS * stts, guint8 ** buffer, guint64 * size,
     guint64 * offset)
 {
   guint64 original_offset = *offset;
-  guint i;
 
   if (!atom_full_copy_data (&stts->header, buffer, size, offset)) {
     return 0;
   }
 
   prop_copy_uint32 (atom_array_get_len (&stts->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
-      8 * atom_array_get_len (&stts->entries));
-  for (i = 0; i < atom_array_get_len (&stts->entries); i++) {
-    STTSEntry *entry = &atom_array_index (&stts->entries, i);
-
-    prop_copy_uint32 (entry->sample_count, buffer, size, offset);
-    prop_copy_int32 (entry->sample_delta, buffer, size, offset);
-  }
+  /* entries are laid out as the on-disk pairs of 32 bit fields */
+  prop_copy_uint32_array ((guint32 *) stts->entries.data,
+      2 * atom_array_get_len (&stts->entries), buffer, size, offset);
 
   atom_write_size (buffer, size, offset, original_offset);
   return *offset - original_offset;
@@ -1702,7 +1839,6 @@ atom_stsz_copy_data (AtomSTSZ * stsz, guint8 ** buffer, guint64 * size,
     guint64 * offset)
 {
   guint64 original_offset = *offset;
-  guint i;
 
   if (!atom_full_copy_data (&stsz->header, buffer, size, offset)) {
     return 0;
@@ -1711,14 +1847,10 @@ atom_stsz_copy_data (AtomSTSZ * stsz, guint8 ** buffer, guint64 * size,
   prop_copy_uint32 (stsz->sample_size, buffer, size, offset);
   prop_copy_uint32 (stsz->table_size, buffer, size, offset);
   if (stsz->sample_size == 0) {
-    /* minimize realloc */
-    prop_copy_ensure_buffer (buffer, size, offset, 4 * stsz->table_size);
     /* entry count must match sample count */
     g_assert (atom_array_get_len (&stsz->entries) == stsz->table_size);
-    for (i = 0; i < atom_array_get_len (&stsz->entries); i++) {
-      prop_copy_uint32 (atom_array_index (&stsz->entries, i), buffer, size,
-          offset);
-    }
+    prop_copy_uint32_array (stsz->entries.data,
+        atom_array_get_len (&stsz->entries), buffer, size, offset);
   }
 
   atom_write_size (buffer, size, offset, original_offset);
@@ -1730,24 +1862,15 @@ atom_stsc_copy_data (AtomSTSC * stsc, guint8 ** buffer, guint64 * size,
     guint64 * offset)
 {
   guint64 original_offset = *offset;
-  guint i;
 
   if (!atom_full_copy_data (&stsc->header, buffer, size, offset)) {
     return 0;
   }
 
   prop_copy_uint32 (atom_array_get_len (&stsc->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
-      12 * atom_array_get_len (&stsc->entries));
-
-  for (i = 0; i < atom_array_get_len (&stsc->entries); i++) {
-    STSCEntry *entry = &atom_array_index (&stsc->entries, i);
-
-    prop_copy_uint32 (entry->first_chunk, buffer, size, offset);
-    prop_copy_uint32 (entry->samples_per_chunk, buffer, size, offset);
-    prop_copy_uint32 (entry->sample_description_index, buffer, size, offset);
-  }
+  /* entries are laid out as the on-disk triplets of 32 bit fields */
+  prop_copy_uint32_array ((guint32 *) stsc->entries.data,
+      3 * atom_array_get_len (&stsc->entries), buffer, size, offset);
 
   atom_write_size (buffer, size, offset, original_offset);
   return *offset - original_offset;
@@ -1758,22 +1881,15 @@ atom_ctts_copy_data (AtomCTTS * ctts, guint8 ** buffer, guint64 * size,
     guint64 * offset)
 {
   guint64 original_offset = *offset;
-  guint i;
 
   if (!atom_full_copy_data (&ctts->header, buffer, size, offset)) {
     return 0;
   }
 
   prop_copy_uint32 (atom_array_get_len (&ctts->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
-      8 * atom_array_get_len (&ctts->entries));
-  for (i = 0; i < atom_array_get_len (&ctts->entries); i++) {
-    CTTSEntry *entry = &atom_array_index (&ctts->entries, i);
-
-    prop_copy_uint32 (entry->samplecount, buffer, size, offset);
-    prop_copy_uint32 (entry->sampleoffset, buffer, size, offset);
-  }
+  /* entries are laid out as the on-disk pairs of 32 bit fields */
+  prop_copy_uint32_array ((guint32 *) ctts->entries.data,
+      2 * atom_array_get_len (&ctts->entries), buffer, size, offset);
 
   atom_write_size (buffer, size, offset, original_offset);
   return *offset - original_offset;
@@ -1794,17 +1910,17 @@ atom_stco64_copy_data (AtomSTCO64 * stco64, guint8 ** buffer, guint64 * size,
   prop_copy_uint32 (atom_array_get_len (&stco64->entries), buffer, size,
       offset);
 
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
-      8 * atom_array_get_len (&stco64->entries));
-  for (i = 0; i < atom_array_get_len (&stco64->entries); i++) {
-    guint64 *value = &atom_array_index (&stco64->entries, i);
-
-    if (trunc_to_32) {
-      prop_copy_uint32 ((guint32) * value, buffer, size, offset);
-    } else {
-      prop_copy_uint64 (*value, buffer, size, offset);
+  if (trunc_to_32) {
+    /* minimize realloc */
+    prop_copy_ensure_buffer (buffer, size, offset,
+        4 * atom_array_get_len (&stco64->entries));
+    for (i = 0; i < atom_array_get_len (&stco64->entries); i++) {
+      prop_copy_uint32 ((guint32) atom_array_index (&stco64->entries, i),
+          buffer, size, offset);
     }
+  } else {
+    prop_copy_uint64_array (stco64->entries.data,
+        atom_array_get_len (&stco64->entries), buffer, size, offset);
   }
 
   atom_write_size (buffer, size, offset, original_offset);
@@ -1816,7 +1932,6 @@ atom_stss_copy_data (AtomSTSS * stss, guint8 ** buffer, guint64 * size,
     guint64 * offset)
 {
   guint64 original_offset = *offset;
-  guint i;
 
   if (atom_array_get_len (&stss->entries) == 0) {
     /* FIXME not needing this atom might be confused with error while copying */
@@ -1828,13 +1943,8 @@ atom_stss_copy_data (AtomSTSS * stss, guint8 ** buffer, guint64 * size,
   }
 
   prop_copy_uint32 (atom_array_get_len (&stss->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
-      4 * atom_array_get_len (&stss->entries));
-  for (i = 0; i < atom_array_get_len (&stss->entries); i++) {
-    prop_copy_uint32 (atom_array_index (&stss->entries, i), buffer, size,
-        offset);
-  }
+  prop_copy_uint32_array (stss->entries.data,
+      atom_array_get_len (&stss->entries), buffer, size, offset);
 
   atom_write_size (buffer, size, offset, original_offset);
   return *offset - original_offset;
@@ -2245,6 +2355,49 @@ atom_udta_copy_data (AtomUDTA * udta, guint8 ** buffer, guint64 * size,
   return *offset - original_offset;
 }
 
+static guint64
+atom_trex_copy_data (AtomTREX * trex, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+
+  if (!atom_full_copy_data (&trex->header, buffer, size, offset)) {
+    return 0;
+  }
+
+  prop_copy_uint32 (trex->track_ID, buffer, size, offset);
+  prop_copy_uint32 (trex->default_sample_description_index, buffer, size,
+      offset);
+  prop_copy_uint32 (trex->default_sample_duration, buffer, size, offset);
+  prop_copy_uint32 (trex->default_sample_size, buffer, size, offset);
+  prop_copy_uint32 (trex->default_sample_flags, buffer, size, offset);
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
+static guint64
+atom_mvex_copy_data (AtomMVEX * mvex, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+  GList *walker;
+
+  if (!atom_copy_data (&mvex->header, buffer, size, offset)) {
+    return 0;
+  }
+
+  for (walker = mvex->trexs; walker; walker = g_list_next (walker)) {
+    if (!atom_trex_copy_data ((AtomTREX *) walker->data, buffer, size,
+            offset)) {
+      return 0;
+    }
+  }
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
 guint64
 atom_moov_copy_data (AtomMOOV * atom, guint8 ** buffer, guint64 * size,
     guint64 * offset)
@@ -2266,6 +2419,12 @@ atom_moov_copy_data (AtomMOOV * atom, guint8 ** buffer, guint64 * size,
     walker = g_list_next (walker);
   }
 
+  if (atom->mvex) {
+    if (!atom_mvex_copy_data (atom->mvex, buffer, size, offset)) {
+      return 0;
+    }
+  }
+
   if (atom->udta) {
     if (!atom_udta_copy_data (atom->udta, buffer, size, offset)) {
       return 0;
@@ -2276,6 +2435,184 @@ atom_moov_copy_data (AtomMOOV * atom, guint8 ** buffer, guint64 * size,
   return *offset - original_offset;
 }
 
+static guint64
+atom_mfhd_copy_data (AtomMFHD * mfhd, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+
+  if (!atom_full_copy_data (&mfhd->header, buffer, size, offset)) {
+    return 0;
+  }
+
+  prop_copy_uint32 (mfhd->sequence_number, buffer, size, offset);
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
+static guint64
+atom_tfhd_copy_data (AtomTFHD * tfhd, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+
+  if (!atom_full_copy_data (&tfhd->header, buffer, size, offset)) {
+    return 0;
+  }
+
+  prop_copy_uint32 (tfhd->track_ID, buffer, size, offset);
+  prop_copy_uint64 (tfhd->base_data_offset, buffer, size, offset);
+  if (tfhd->header.flags[2] & 0x08)
+    prop_copy_uint32 (tfhd->default_sample_duration, buffer, size, offset);
+  if (tfhd->header.flags[2] & 0x10)
+    prop_copy_uint32 (tfhd->default_sample_size, buffer, size, offset);
+  if (tfhd->header.flags[2] & 0x20)
+    prop_copy_uint32 (tfhd->default_sample_flags, buffer, size, offset);
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
+static guint64
+atom_trun_copy_data (AtomTRUN * trun, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+  guint i;
+
+  if (!atom_full_copy_data (&trun->header, buffer, size, offset)) {
+    return 0;
+  }
+
+  prop_copy_uint32 (atom_array_get_len (&trun->entries), buffer, size, offset);
+  if (trun->header.flags[1] == 0x0f) {
+    /* entries are laid out as the on-disk 32 bit fields */
+    prop_copy_uint32_array ((guint32 *) trun->entries.data,
+        4 * atom_array_get_len (&trun->entries), buffer, size, offset);
+  } else if (trun->header.flags[1] != 0) {
+    guint fields = 0;
+
+    for (i = 0x01; i <= 0x08; i <<= 1)
+      if (trun->header.flags[1] & i)
+        fields++;
+
+    /* minimize realloc */
+    prop_copy_ensure_buffer (buffer, size, offset,
+        4 * fields * atom_array_get_len (&trun->entries));
+    for (i = 0; i < atom_array_get_len (&trun->entries); i++) {
+      TRUNSampleEntry *entry = &atom_array_index (&trun->entries, i);
+
+      if (trun->header.flags[1] & 0x01)
+        prop_copy_uint32 (entry->sample_duration, buffer, size, offset);
+      if (trun->header.flags[1] & 0x02)
+        prop_copy_uint32 (entry->sample_size, buffer, size, offset);
+      if (trun->header.flags[1] & 0x04)
+        prop_copy_uint32 (entry->sample_flags, buffer, size, offset);
+      if (trun->header.flags[1] & 0x08)
+        prop_copy_uint32 (entry->sample_composition_time_offset, buffer,
+            size, offset);
+    }
+  }
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
+/*
+ * Moves the sample duration, size and flags to the tfhd defaults when all
+ * samples of the trun share them, so the trun leaves them out
+ */
+static void
+atom_traf_set_defaults (AtomTRAF * traf)
+{
+  AtomTFHD *tfhd = &traf->tfhd;
+  AtomTRUN *trun = &traf->trun;
+  TRUNSampleEntry *first;
+  gboolean same_duration = TRUE, same_size = TRUE, same_flags = TRUE;
+  guint i;
+
+  if (atom_array_get_len (&trun->entries) == 0)
+    return;
+
+  first = &atom_array_index (&trun->entries, 0);
+  for (i = 1; i < atom_array_get_len (&trun->entries); i++) {
+    TRUNSampleEntry *entry = &atom_array_index (&trun->entries, i);
+
+    same_duration &= entry->sample_duration == first->sample_duration;
+    same_size &= entry->sample_size == first->sample_size;
+    same_flags &= entry->sample_flags == first->sample_flags;
+  }
+
+  /* default-sample-duration, -size and -flags present */
+  tfhd->header.flags[2] &= ~(0x08 | 0x10 | 0x20);
+  /* sample-duration, -size and -flags present */
+  trun->header.flags[1] |= 0x01 | 0x02 | 0x04;
+
+  if (same_duration) {
+    tfhd->default_sample_duration = first->sample_duration;
+    tfhd->header.flags[2] |= 0x08;
+    trun->header.flags[1] &= ~0x01;
+  }
+  if (same_size) {
+    tfhd->default_sample_size = first->sample_size;
+    tfhd->header.flags[2] |= 0x10;
+    trun->header.flags[1] &= ~0x02;
+  }
+  if (same_flags) {
+    tfhd->default_sample_flags = first->sample_flags;
+    tfhd->header.flags[2] |= 0x20;
+    trun->header.flags[1] &= ~0x04;
+  }
+}
+
+static guint64
+atom_traf_copy_data (AtomTRAF * traf, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+
+  atom_traf_set_defaults (traf);
+
+  if (!atom_copy_data (&traf->header, buffer, size, offset)) {
+    return 0;
+  }
+  if (!atom_tfhd_copy_data (&traf->tfhd, buffer, size, offset)) {
+    return 0;
+  }
+  if (!atom_trun_copy_data (&traf->trun, buffer, size, offset)) {
+    return 0;
+  }
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
+guint64
+atom_moof_copy_data (AtomMOOF * moof, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+  GList *walker;
+
+  if (!atom_copy_data (&moof->header, buffer, size, offset)) {
+    return 0;
+  }
+  if (!atom_mfhd_copy_data (&moof->mfhd, buffer, size, offset)) {
+    return 0;
+  }
+
+  for (walker = moof->trafs; walker; walker = g_list_next (walker)) {
+    if (!atom_traf_copy_data ((AtomTRAF *) walker->data, buffer, size,
+            offset)) {
+      return 0;
+    }
+  }
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
 static guint64
 atom_wave_copy_data (AtomWAVE * wave, guint8 ** buffer,
     guint64 * size, guint64 * offset)
@@ -2454,6 +2791,66 @@ atom_moov_add_trak (AtomMOOV * moov, AtomTRAK * trak)
   moov->traks = g_list_append (moov->traks, trak);
 }
 
+/*
+ * Declares the movie as fragmented, adding a trex with neutral defaults for
+ * each trak; samples are then described by the trun of each fragment
+ */
+void
+atom_moov_add_mvex (AtomMOOV * moov)
+{
+  GList *traks;
+
+  if (moov->mvex)
+    return;
+
+  moov->mvex = atom_mvex_new ();
+  for (traks = moov->traks; traks; traks = g_list_next (traks)) {
+    AtomTRAK *trak = (AtomTRAK *) traks->data;
+
+    moov->mvex->trexs = g_list_append (moov->mvex->trexs,
+        atom_trex_new (trak->tkhd.track_ID));
+  }
+}
+
+void
+atom_moof_add_traf (AtomMOOF * moof, AtomTRAF * traf)
+{
+  moof->trafs = g_list_append (moof->trafs, traf);
+}
+
+/* sample_flags values for sync and non-sync samples */
+#define TRUN_SAMPLE_FLAGS_SYNC          0x02000000
+#define TRUN_SAMPLE_FLAGS_NON_SYNC      0x01010000
+
+void
+atom_traf_add_samples (AtomTRAF * traf, guint32 nsamples, guint32 delta,
+    guint32 size, gboolean sync, gboolean do_pts, gint64 pts_offset)
+{
+  TRUNSampleEntry entry;
+  guint32 i;
+
+  entry.sample_duration = delta;
+  entry.sample_size = size;
+  entry.sample_flags =
+      sync ? TRUN_SAMPLE_FLAGS_SYNC : TRUN_SAMPLE_FLAGS_NON_SYNC;
+  entry.sample_composition_time_offset = (guint32) pts_offset;
+
+  if (do_pts) {
+    /* sample-composition-time-offsets-present */
+    traf->trun.header.flags[1] |= 0x08;
+  }
+
+  for (i = 0; i < nsamples; i++)
+    atom_array_append (&traf->trun.entries, entry, 512);
+  traf->data_size += (guint64) nsamples *size;
+}
+
+guint32
+atom_traf_get_sample_count (AtomTRAF * traf)
+{
+  return atom_array_get_len (&traf->trun.entries);
+}
+
 static guint64
 atom_trak_get_duration (AtomTRAK * trak)
 {
@@ -73,7 +73,8 @@ G_STMT_START {                                                                \
   g_assert ((array)->data);                                                   \
   g_assert (inc > 0);                                                         \
   if (G_UNLIKELY ((array)->len == (array)->size)) {                           \
-    (array)->size += inc;                                                     \
+    /* grow geometrically, keeps appends amortized O(1) on long recordings */ \
+    (array)->size += MAX ((guint) (inc), (array)->size / 2);                  \
     (array)->data =                                                           \
         g_realloc ((array)->data, sizeof (*((array)->data)) * (array)->size); \
   }                                                                           \
@@ -582,6 +583,25 @@ typedef struct _AtomTRAK
   gboolean is_h264;
 } AtomTRAK;
 
+typedef struct _AtomTREX
+{
+  AtomFull header;
+
+  guint32 track_ID;
+  guint32 default_sample_description_index;
+  guint32 default_sample_duration;
+  guint32 default_sample_size;
+  guint32 default_sample_flags;
+} AtomTREX;
+
+typedef struct _AtomMVEX
+{
+  Atom header;
+
+  /* list of AtomTREX */
+  GList *trexs;
+} AtomMVEX;
+
 typedef struct _AtomMOOV
 {
   /* style */
@@ -594,8 +614,68 @@ typedef struct _AtomMOOV
   /* list of AtomTRAK */
   GList *traks;
   AtomUDTA *udta;
+  /* NULL if not fragmented */
+  AtomMVEX *mvex;
 } AtomMOOV;
 
+/* movie fragments */
+
+typedef struct _AtomMFHD
+{
+  AtomFull header;
+
+  guint32 sequence_number;
+} AtomMFHD;
+
+typedef struct _AtomTFHD
+{
+  AtomFull header;
+
+  guint32 track_ID;
+  /* absolute file offset of the fragment's first sample of this track */
+  guint64 base_data_offset;
+  /* only written when all samples of the trun share them */
+  guint32 default_sample_duration;
+  guint32 default_sample_size;
+  guint32 default_sample_flags;
+} AtomTFHD;
+
+typedef struct _TRUNSampleEntry
+{
+  guint32 sample_duration;
+  guint32 sample_size;
+  guint32 sample_flags;
+  guint32 sample_composition_time_offset;
+} TRUNSampleEntry;
+
+typedef struct _AtomTRUN
+{
+  AtomFull header;
+
+  /* sample count is implicit */
+  ATOM_ARRAY (TRUNSampleEntry) entries;
+} AtomTRUN;
+
+typedef struct _AtomTRAF
+{
+  Atom header;
+
+  AtomTFHD tfhd;
+  AtomTRUN trun;
+
+  /* not written */
+  guint64 data_size;
+} AtomTRAF;
+
+typedef struct _AtomMOOF
+{
+  Atom header;
+
+  AtomMFHD mfhd;
+  /* list of AtomTRAF */
+  GList *trafs;
+} AtomMOOF;
+
 typedef struct _AtomWAVE
 {
   Atom header;
@@ -657,6 +737,18 @@ void       atom_moov_update_duration   (AtomMOOV *moov);
 void       atom_moov_set_64bits        (AtomMOOV *moov, gboolean large_file);
 void       atom_moov_chunks_add_offset (AtomMOOV *moov, guint32 offset);
 void       atom_moov_add_trak          (AtomMOOV *moov, AtomTRAK *trak);
+void       atom_moov_add_mvex          (AtomMOOV *moov);
+
+AtomMOOF*  atom_moof_new               (AtomsContext *context, guint32 sequence_number);
+void       atom_moof_free              (AtomMOOF *moof);
+guint64    atom_moof_copy_data         (AtomMOOF *moof, guint8 **buffer, guint64 *size, guint64* offset);
+void       atom_moof_add_traf          (AtomMOOF *moof, AtomTRAF *traf);
+AtomTRAF*  atom_traf_new               (AtomsContext *context, guint32 track_ID);
+void       atom_traf_free              (AtomTRAF *traf);
+void       atom_traf_add_samples       (AtomTRAF *traf, guint32 nsamples, guint32 delta,
+                                        guint32 size, gboolean sync,
+                                        gboolean do_pts, gint64 pts_offset);
+guint32    atom_traf_get_sample_count  (AtomTRAF *traf);
 
 guint64    atom_mvhd_copy_data         (AtomMVHD * atom, guint8 ** buffer,
                                         guint64 * size, guint64 * offset);
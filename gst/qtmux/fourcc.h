@@ -193,6 +193,15 @@ G_BEGIN_DECLS
 #define FOURCC_SEQH     GST_MAKE_FOURCC('S','E','Q','H')
 #define FOURCC_SMI_     GST_MAKE_FOURCC('S','M','I',' ')
 
+/* movie fragments */
+#define FOURCC_mvex     GST_MAKE_FOURCC('m','v','e','x')
+#define FOURCC_trex     GST_MAKE_FOURCC('t','r','e','x')
+#define FOURCC_moof     GST_MAKE_FOURCC('m','o','o','f')
+#define FOURCC_mfhd     GST_MAKE_FOURCC('m','f','h','d')
+#define FOURCC_traf     GST_MAKE_FOURCC('t','r','a','f')
+#define FOURCC_tfhd     GST_MAKE_FOURCC('t','f','h','d')
+#define FOURCC_trun     GST_MAKE_FOURCC('t','r','u','n')
+
 /* Xiph fourcc */
 #define FOURCC_XiTh     GST_MAKE_FOURCC('X','i','T','h')
 #define FOURCC_XdxT     GST_MAKE_FOURCC('X','d','x','T')
@@ -109,7 +109,10 @@ enum
   PROP_FLAVOR,
   PROP_FAST_START,
   PROP_FAST_START_TEMP_FILE,
-  PROP_MOOV_RECOV_FILE
+  PROP_MOOV_RECOV_FILE,
+  PROP_FRAGMENT_DURATION,
+  PROP_RESERVED_MAX_DURATION,
+  PROP_RESERVED_BYTES_PER_SEC
 };
 
 /* some spare for header size as well */
@@ -122,6 +125,13 @@ enum
 #define DEFAULT_FAST_START              FALSE
 #define DEFAULT_FAST_START_TEMP_FILE    NULL
 #define DEFAULT_MOOV_RECOV_FILE         NULL
+#define DEFAULT_FRAGMENT_DURATION       0
+#define DEFAULT_RESERVED_MAX_DURATION   0
+#define DEFAULT_RESERVED_BYTES_PER_SEC  550
+
+/* room for what the moov estimate can't know about up front (tags, edit
+ * lists) */
+#define RESERVED_MOOV_SPARE             4096
 
 static void gst_qt_mux_finalize (GObject * object);
 
@@ -240,6 +250,27 @@ gst_qt_mux_class_init (GstQTMuxClass * klass)
           "data for moov atom making movie file recovery possible in case "
           "of a crash during muxing. Null for disabled. (Experimental)",
           DEFAULT_MOOV_RECOV_FILE, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+  g_object_class_install_property (gobject_class, PROP_FRAGMENT_DURATION,
+      g_param_spec_uint ("fragment-duration", "Fragment duration",
+          "Fragment durations in ms (produce a fragmented file if > 0). "
+          "Fragments are closed on the next keyframe once this is reached",
+          0, G_MAXUINT32, DEFAULT_FRAGMENT_DURATION,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+  g_object_class_install_property (gobject_class, PROP_RESERVED_MAX_DURATION,
+      g_param_spec_uint64 ("reserved-max-duration",
+          "Reserved maximum file duration (ns)",
+          "When > 0, reserve space at the start of the file for a moov "
+          "covering this much media and write it there at EOS, producing a "
+          "faststart file in a single pass (falls back to a moov at the end "
+          "if it doesn't fit). Takes precedence over faststart",
+          0, G_MAXUINT64, DEFAULT_RESERVED_MAX_DURATION,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+  g_object_class_install_property (gobject_class, PROP_RESERVED_BYTES_PER_SEC,
+      g_param_spec_uint ("reserved-bytes-per-sec",
+          "Reserved moov bytes per second, per track",
+          "Multiplier used with reserved-max-duration to estimate the moov "
+          "size to reserve", 0, G_MAXUINT32, DEFAULT_RESERVED_BYTES_PER_SEC,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
   gstelement_class->request_new_pad =
       GST_DEBUG_FUNCPTR (gst_qt_mux_request_new_pad);
@@ -264,6 +295,17 @@ gst_qt_mux_pad_reset (GstQTPad * qtpad)
   if (qtpad->last_buf)
     gst_buffer_replace (&qtpad->last_buf, NULL);
 
+  if (qtpad->traf) {
+    atom_traf_free (qtpad->traf);
+    qtpad->traf = NULL;
+  }
+  if (qtpad->fragment_buffers) {
+    g_list_foreach (qtpad->fragment_buffers, (GFunc) gst_mini_object_unref,
+        NULL);
+    g_list_free (qtpad->fragment_buffers);
+    qtpad->fragment_buffers = NULL;
+  }
+
   /* reference owned elsewhere */
   qtpad->trak = NULL;
 }
@@ -280,7 +322,11 @@ gst_qt_mux_reset (GstQTMux * qtmux, gboolean alloc)
   qtmux->header_size = 0;
   qtmux->mdat_size = 0;
   qtmux->mdat_pos = 0;
+  qtmux->moov_pos = 0;
+  qtmux->reserved_moov_size = 0;
   qtmux->longest_chunk = GST_CLOCK_TIME_NONE;
+  qtmux->fragment_sequence = 0;
+  qtmux->fragment_start = GST_CLOCK_TIME_NONE;
   qtmux->video_pads = 0;
   qtmux->audio_pads = 0;
 
@@ -1282,6 +1328,270 @@ gst_qt_mux_prepare_and_send_ftyp (GstQTMux * qtmux)
   return gst_qt_mux_send_ftyp (qtmux, &qtmux->header_size);
 }
 
+/*
+ * Sends a free atom of @size bytes, or only its header if @fill is FALSE
+ * (when it covers data that is already there)
+ */
+static GstFlowReturn
+gst_qt_mux_send_free_atom (GstQTMux * qtmux, guint64 * off, guint32 size,
+    gboolean fill)
+{
+  GstBuffer *buf;
+  guint8 *data;
+
+  GST_DEBUG_OBJECT (qtmux, "Sending free atom of size %u", size);
+
+  buf = gst_buffer_new_and_alloc (fill ? size : 8);
+  data = GST_BUFFER_DATA (buf);
+  if (fill)
+    memset (data, 0, size);
+  GST_WRITE_UINT32_BE (data, size);
+  GST_WRITE_UINT32_LE (data + 4, FOURCC_free);
+
+  return gst_qt_mux_send_buffer (qtmux, buf, off, FALSE);
+}
+
+/*
+ * Estimates the moov size from the reserved-max-duration and
+ * reserved-bytes-per-sec hints and reserves that much room for it, as a free
+ * atom right before mdat
+ */
+static GstFlowReturn
+gst_qt_mux_reserve_moov (GstQTMux * qtmux)
+{
+  guint64 offset = 0, size = 0;
+  GstClockTime duration;
+  guint32 bytes_per_sec;
+
+  GST_OBJECT_LOCK (qtmux);
+  duration = qtmux->reserved_max_duration;
+  bytes_per_sec = qtmux->reserved_bytes_per_sec;
+  GST_OBJECT_UNLOCK (qtmux);
+
+  /* the sample-less moov is what every file will at least need */
+  if (!atom_moov_copy_data (qtmux->moov, NULL, &size, &offset))
+    goto serialize_error;
+
+  offset += gst_util_uint64_scale (duration,
+      (guint64) bytes_per_sec * g_slist_length (qtmux->sinkpads), GST_SECOND);
+  offset += RESERVED_MOOV_SPARE;
+  if (offset > G_MAXUINT32)
+    offset = G_MAXUINT32;
+
+  qtmux->moov_pos = qtmux->header_size;
+  qtmux->reserved_moov_size = offset;
+  GST_DEBUG_OBJECT (qtmux, "reserving %" G_GUINT64_FORMAT " bytes for moov",
+      offset);
+
+  return gst_qt_mux_send_free_atom (qtmux, &qtmux->header_size,
+      (guint32) offset, TRUE);
+
+  /* ERRORS */
+serialize_error:
+  {
+    GST_ELEMENT_ERROR (qtmux, STREAM, MUX, (NULL),
+        ("Failed to serialize moov"));
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * Fragmented files start with a moov that only describes the tracks (and
+ * announces fragments by way of mvex); samples follow in moof/mdat pairs
+ */
+static GstFlowReturn
+gst_qt_mux_start_fragmented_file (GstQTMux * qtmux)
+{
+  GstFlowReturn ret;
+  GstBuffer *buffer;
+  guint64 offset = 0, size = 0;
+  guint8 *data = NULL;
+  guint32 timescale;
+
+  GST_DEBUG_OBJECT (qtmux, "starting fragmented file, fragment duration %u ms",
+      qtmux->fragment_duration);
+
+  ret = gst_qt_mux_prepare_and_send_ftyp (qtmux);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  GST_OBJECT_LOCK (qtmux);
+  timescale = qtmux->timescale;
+  GST_OBJECT_UNLOCK (qtmux);
+
+  atom_moov_update_timescale (qtmux->moov, timescale);
+  atom_moov_add_mvex (qtmux->moov);
+  gst_qt_mux_setup_metadata (qtmux);
+
+  if (!atom_moov_copy_data (qtmux->moov, &data, &size, &offset))
+    goto serialize_error;
+
+  buffer = gst_buffer_new ();
+  GST_BUFFER_DATA (buffer) = GST_BUFFER_MALLOCDATA (buffer) = data;
+  GST_BUFFER_SIZE (buffer) = offset;
+
+  GST_DEBUG_OBJECT (qtmux, "Pushing initial movie atoms");
+  return gst_qt_mux_send_buffer (qtmux, buffer, &qtmux->header_size, FALSE);
+
+  /* ERRORS */
+serialize_error:
+  {
+    g_free (data);
+    GST_ELEMENT_ERROR (qtmux, STREAM, MUX, (NULL),
+        ("Failed to serialize moov"));
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * Sends the pending fragment: a moof with one traf per track that has
+ * samples, followed by an mdat with the data of those tracks, in the same
+ * order.
+ */
+static GstFlowReturn
+gst_qt_mux_send_fragment (GstQTMux * qtmux)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  AtomMOOF *moof;
+  GstBuffer *buffer;
+  GSList *walk;
+  GList *bwalk;
+  guint64 offset = 0, size = 0, data_size = 0, data_offset;
+  guint8 *data = NULL;
+  gboolean large_mdat;
+
+  moof = atom_moof_new (qtmux->context, qtmux->fragment_sequence + 1);
+  for (walk = qtmux->sinkpads; walk; walk = g_slist_next (walk)) {
+    GstQTPad *qtpad = (GstQTPad *) walk->data;
+
+    if (qtpad->traf == NULL)
+      continue;
+    data_size += qtpad->traf->data_size;
+    /* moof owns it from now on */
+    atom_moof_add_traf (moof, qtpad->traf);
+    qtpad->traf = NULL;
+  }
+
+  if (moof->trafs == NULL) {
+    atom_moof_free (moof);
+    return GST_FLOW_OK;
+  }
+  qtmux->fragment_sequence++;
+
+  /* copy into NULL to obtain size, which the data offsets don't affect */
+  if (!atom_moof_copy_data (moof, NULL, &size, &offset))
+    goto serialize_error;
+
+  large_mdat = (data_size > MDAT_LARGE_FILE_LIMIT);
+  data_offset = qtmux->header_size + qtmux->mdat_size + offset +
+      (large_mdat ? 16 : 8);
+  for (bwalk = moof->trafs; bwalk; bwalk = g_list_next (bwalk)) {
+    AtomTRAF *traf = (AtomTRAF *) bwalk->data;
+
+    traf->tfhd.base_data_offset = data_offset;
+    data_offset += traf->data_size;
+  }
+
+  GST_LOG_OBJECT (qtmux, "Sending fragment %u, %" G_GUINT64_FORMAT
+      " bytes of media", qtmux->fragment_sequence, data_size);
+
+  offset = size = 0;
+  if (!atom_moof_copy_data (moof, &data, &size, &offset))
+    goto serialize_error;
+  atom_moof_free (moof);
+
+  buffer = gst_buffer_new ();
+  GST_BUFFER_DATA (buffer) = GST_BUFFER_MALLOCDATA (buffer) = data;
+  GST_BUFFER_SIZE (buffer) = offset;
+  ret = gst_qt_mux_send_buffer (qtmux, buffer, &qtmux->mdat_size, FALSE);
+  if (ret == GST_FLOW_OK)
+    ret = gst_qt_mux_send_mdat_header (qtmux, &qtmux->mdat_size, data_size,
+        large_mdat);
+
+  for (walk = qtmux->sinkpads; walk; walk = g_slist_next (walk)) {
+    GstQTPad *qtpad = (GstQTPad *) walk->data;
+
+    qtpad->fragment_buffers = g_list_reverse (qtpad->fragment_buffers);
+    for (bwalk = qtpad->fragment_buffers; bwalk; bwalk = g_list_next (bwalk)) {
+      buffer = (GstBuffer *) bwalk->data;
+      if (ret == GST_FLOW_OK)
+        ret = gst_qt_mux_send_buffer (qtmux, buffer, &qtmux->mdat_size, FALSE);
+      else
+        gst_buffer_unref (buffer);
+    }
+    g_list_free (qtpad->fragment_buffers);
+    qtpad->fragment_buffers = NULL;
+  }
+
+  qtmux->fragment_start = GST_CLOCK_TIME_NONE;
+
+  return ret;
+
+  /* ERRORS */
+serialize_error:
+  {
+    g_free (data);
+    atom_moof_free (moof);
+    GST_ELEMENT_ERROR (qtmux, STREAM, MUX, (NULL),
+        ("Failed to serialize moof"));
+    return GST_FLOW_ERROR;
+  }
+}
+
+static gboolean
+gst_qt_mux_has_sync_pads (GstQTMux * qtmux)
+{
+  GSList *walk;
+
+  for (walk = qtmux->sinkpads; walk; walk = g_slist_next (walk)) {
+    if (((GstQTPad *) walk->data)->sync)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * Adds a sample to the pending fragment of @pad, sending out the fragment
+ * first if it is long enough and @buf can start a new one.
+ * Takes ownership of @buf.
+ */
+static GstFlowReturn
+gst_qt_mux_add_fragment_sample (GstQTMux * qtmux, GstQTPad * pad,
+    GstBuffer * buf, GstClockTime dts, guint32 nsamples, guint32 delta,
+    guint32 size, gboolean sync, gboolean do_pts, gint64 pts_offset)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  gboolean cut_point;
+
+  /* fragments should start on a keyframe of the sync tracked pads, if any */
+  if (pad->sync)
+    cut_point = sync;
+  else
+    cut_point = !gst_qt_mux_has_sync_pads (qtmux);
+
+  if (cut_point && GST_CLOCK_TIME_IS_VALID (qtmux->fragment_start) &&
+      dts >= qtmux->fragment_start +
+      (GstClockTime) qtmux->fragment_duration * GST_MSECOND) {
+    ret = gst_qt_mux_send_fragment (qtmux);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (buf);
+      return ret;
+    }
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (qtmux->fragment_start))
+    qtmux->fragment_start = dts;
+
+  if (pad->traf == NULL)
+    pad->traf = atom_traf_new (qtmux->context, pad->trak->tkhd.track_ID);
+  /* tracks without sync table consist of sync samples only */
+  atom_traf_add_samples (pad->traf, nsamples, delta, size,
+      sync || !pad->sync, do_pts, pts_offset);
+  pad->fragment_buffers = g_list_prepend (pad->fragment_buffers, buf);
+
+  return ret;
+}
+
 static GstFlowReturn
 gst_qt_mux_start_file (GstQTMux * qtmux)
 {
@@ -1293,6 +1603,11 @@ gst_qt_mux_start_file (GstQTMux * qtmux)
   gst_pad_push_event (qtmux->srcpad,
       gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_BYTES, 0, -1, 0));
 
+  /* fragments are self-contained, so no recovery file and no faststart
+   * rewriting are needed */
+  if (qtmux->fragment_duration)
+    return gst_qt_mux_start_fragmented_file (qtmux);
+
   /* initialize our moov recovery file */
   GST_OBJECT_LOCK (qtmux);
   if (qtmux->moov_recov_file_path) {
@@ -1349,7 +1664,7 @@ gst_qt_mux_start_file (GstQTMux * qtmux)
    * better fine tune using the information we gather to create the whole moov
    * atom.
    */
-  if (qtmux->fast_start) {
+  if (qtmux->fast_start && !qtmux->reserved_max_duration) {
     GST_OBJECT_LOCK (qtmux);
     qtmux->fast_start_file = g_fopen (qtmux->fast_start_file_path, "wb+");
     if (!qtmux->fast_start_file)
@@ -1367,6 +1682,13 @@ gst_qt_mux_start_file (GstQTMux * qtmux)
       goto exit;
     }
 
+    /* single pass faststart: keep room for the moov ahead of mdat */
+    if (qtmux->reserved_max_duration) {
+      ret = gst_qt_mux_reserve_moov (qtmux);
+      if (ret != GST_FLOW_OK)
+        goto exit;
+    }
+
     /* extended to ensure some spare space */
     qtmux->mdat_pos = qtmux->header_size;
     ret = gst_qt_mux_send_mdat_header (qtmux, &qtmux->header_size, 0, TRUE);
@@ -1415,6 +1737,10 @@ gst_qt_mux_stop_file (GstQTMux * qtmux)
           gst_flow_get_name (ret));
   }
 
+  /* everything but the last fragment is already out */
+  if (qtmux->fragment_duration)
+    return gst_qt_mux_send_fragment (qtmux);
+
   GST_OBJECT_LOCK (qtmux);
   timescale = qtmux->timescale;
   large_file = qtmux->large_file;
@@ -1506,8 +1832,28 @@ gst_qt_mux_stop_file (GstQTMux * qtmux)
   GST_BUFFER_SIZE (buffer) = offset;
   /* note: as of this point, we no longer care about tracking written data size,
    * since there is no more use for it anyway */
-  GST_DEBUG_OBJECT (qtmux, "Pushing movie atoms");
-  gst_qt_mux_send_buffer (qtmux, buffer, NULL, FALSE);
+  if (qtmux->reserved_moov_size &&
+      (offset == qtmux->reserved_moov_size ||
+          offset + 8 <= qtmux->reserved_moov_size)) {
+    GstEvent *event;
+
+    GST_DEBUG_OBJECT (qtmux, "Pushing movie atoms into reserved space");
+    event = gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_BYTES,
+        qtmux->moov_pos, GST_CLOCK_TIME_NONE, 0);
+    gst_pad_push_event (qtmux->srcpad, event);
+    gst_qt_mux_send_buffer (qtmux, buffer, NULL, FALSE);
+    /* what is left of the reservation stays a free atom */
+    if (offset < qtmux->reserved_moov_size)
+      gst_qt_mux_send_free_atom (qtmux, NULL,
+          qtmux->reserved_moov_size - offset, FALSE);
+  } else {
+    if (qtmux->reserved_moov_size)
+      GST_WARNING_OBJECT (qtmux, "moov of %" G_GUINT64_FORMAT " bytes doesn't "
+          "fit in the %" G_GUINT64_FORMAT " reserved bytes, appending it "
+          "after mdat instead", offset, qtmux->reserved_moov_size);
+    GST_DEBUG_OBJECT (qtmux, "Pushing movie atoms");
+    gst_qt_mux_send_buffer (qtmux, buffer, NULL, FALSE);
+  }
 
   /* if needed, send mdat atom and move buffered data into it */
   if (qtmux->fast_start_file) {
@@ -1566,6 +1912,7 @@ gst_qt_mux_add_buffer (GstQTMux * qtmux, GstQTPad * pad, GstBuffer * buf)
   gint64 last_dts;
   gint64 pts_offset = 0;
   gboolean sync = FALSE, do_pts = FALSE;
+  GstClockTime sample_dts;
 
   if (!pad->fourcc)
     goto not_negotiated;
@@ -1656,6 +2003,7 @@ gst_qt_mux_add_buffer (GstQTMux * qtmux, GstQTPad * pad, GstBuffer * buf)
   }
 
   gst_buffer_replace (&pad->last_buf, buf);
+  sample_dts = pad->last_dts;
 
   last_dts = gst_util_uint64_scale_round (pad->last_dts,
       atom_trak_get_timescale (pad->trak), GST_SECOND);
@@ -1768,6 +2116,13 @@ gst_qt_mux_add_buffer (GstQTMux * qtmux, GstQTPad * pad, GstBuffer * buf)
         GST_TIME_ARGS (pad->first_ts));
   }
 
+  if (qtmux->fragment_duration) {
+    if (buf)
+      gst_buffer_unref (buf);
+    return gst_qt_mux_add_fragment_sample (qtmux, pad, last_buf, sample_dts,
+        nsamples, scaled_duration, sample_size, sync, do_pts, pts_offset);
+  }
+
   /* now we go and register this buffer/sample all over */
   /* note that a new chunk is started each time (not fancy but works) */
   if (qtmux->moov_recov_file) {
@@ -2699,6 +3054,15 @@ gst_qt_mux_get_property (GObject * object,
     case PROP_MOOV_RECOV_FILE:
       g_value_set_string (value, qtmux->moov_recov_file_path);
       break;
+    case PROP_FRAGMENT_DURATION:
+      g_value_set_uint (value, qtmux->fragment_duration);
+      break;
+    case PROP_RESERVED_MAX_DURATION:
+      g_value_set_uint64 (value, qtmux->reserved_max_duration);
+      break;
+    case PROP_RESERVED_BYTES_PER_SEC:
+      g_value_set_uint (value, qtmux->reserved_bytes_per_sec);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2751,6 +3115,15 @@ gst_qt_mux_set_property (GObject * object,
       g_free (qtmux->moov_recov_file_path);
       qtmux->moov_recov_file_path = g_value_dup_string (value);
       break;
+    case PROP_FRAGMENT_DURATION:
+      qtmux->fragment_duration = g_value_get_uint (value);
+      break;
+    case PROP_RESERVED_MAX_DURATION:
+      qtmux->reserved_max_duration = g_value_get_uint64 (value);
+      break;
+    case PROP_RESERVED_BYTES_PER_SEC:
+      qtmux->reserved_bytes_per_sec = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -109,6 +109,10 @@ struct _GstQTPad
 
   /* if nothing is set, it won't be called */
   GstQTPadPrepareBufferFunc prepare_buf_func;
+
+  /* fragmented mode: samples and data of the pending fragment */
+  AtomTRAF *traf;
+  GList *fragment_buffers;
 };
 
 typedef enum _GstQTMuxState
@@ -132,10 +136,14 @@ struct _GstQTMux
 
   /* size of header (prefix, atoms (ftyp, mdat)) */
   guint64 header_size;
-  /* accumulated size of raw media data (a priori not including mdat header) */
+  /* accumulated size of raw media data (a priori not including mdat header),
+   * or of all moof and mdat atoms sent so far in fragmented mode */
   guint64 mdat_size;
   /* position of mdat atom (for later updating) */
   guint64 mdat_pos;
+  /* position and size of the free atom reserved for the moov, if any */
+  guint64 moov_pos;
+  guint64 reserved_moov_size;
 
   /* keep track of the largest chunk to fine-tune brands */
   GstClockTime longest_chunk;
@@ -151,6 +159,10 @@ struct _GstQTMux
   /* moov recovery */
   FILE *moov_recov_file;
 
+  /* fragmented mode */
+  guint32 fragment_sequence;
+  GstClockTime fragment_start;
+
   /* properties */
   guint32 timescale;
   AtomsTreeFlavor flavor;
@@ -159,6 +171,9 @@ struct _GstQTMux
   gboolean guess_pts;
   gchar *fast_start_file_path;
   gchar *moov_recov_file_path;
+  guint32 fragment_duration;
+  GstClockTime reserved_max_duration;
+  guint32 reserved_bytes_per_sec;
 
   /* for collect pads event handling function */
   GstPadEventFunction collect_event;
@@ -72,14 +72,28 @@ guint64 prop_copy_ ## name ## _array (datatype *prop, guint size,	\
   return copy_func (prop, sizeof (datatype) * size, buffer, bsize, offset);\
 }
 
-#define INT_ARRAY_COPY_FUNC(name, datatype) 				\
+/* byte-swaps straight into the destination after a single buffer check, so
+ * large sample tables are written in one linear pass. swap has to be the
+ * conversion prop_copy_##name uses, so both write the same bytes */
+#define INT_ARRAY_COPY_FUNC(name, datatype, swap) 			\
 guint64 prop_copy_ ## name ## _array (datatype *prop, guint size,	\
     guint8 ** buffer, guint64 * bsize, guint64 * offset) { 		\
   guint i;								\
 									\
-  for (i = 0; i < size; i++) {						\
-    prop_copy_ ## name (prop[i], buffer, bsize, offset);		\
+  if (buffer) {								\
+    guint8 *dest;							\
+									\
+    prop_copy_ensure_buffer (buffer, bsize, offset,			\
+        sizeof (datatype) * size);					\
+    dest = *buffer + *offset;						\
+    for (i = 0; i < size; i++) {					\
+      datatype val = swap (prop[i]);					\
+									\
+      memcpy (dest, &val, sizeof (datatype));				\
+      dest += sizeof (datatype);					\
+    }									\
   }									\
+  *offset += sizeof (datatype) * size;					\
   return sizeof (datatype) * size;					\
 }
 
@@ -125,10 +139,10 @@ prop_copy_int32 (gint32 prop, guint8 ** buffer, guint64 * size,
 
 /* uint8 can use direct copy in any case, and may be used for large quantity */
 INT_ARRAY_COPY_FUNC_FAST (uint8, guint8);
-/* not used in large quantity anyway */
-INT_ARRAY_COPY_FUNC (uint16, guint16);
-INT_ARRAY_COPY_FUNC (uint32, guint32);
-INT_ARRAY_COPY_FUNC (uint64, guint64);
+/* uint32 and uint64 back the sample tables, which can get big */
+INT_ARRAY_COPY_FUNC (uint16, guint16, GUINT16_TO_BE);
+INT_ARRAY_COPY_FUNC (uint32, guint32, GUINT32_TO_BE);
+INT_ARRAY_COPY_FUNC (uint64, guint64, GUINT64_TO_BE);
 
 /* FOURCC */
 guint64
@@ -139,7 +153,7 @@ prop_copy_fourcc (guint32 prop, guint8 ** buffer, guint64 * size,
   return copy_func (&prop, sizeof (guint32), buffer, size, offset);
 }
 
-INT_ARRAY_COPY_FUNC (fourcc, guint32);
+INT_ARRAY_COPY_FUNC (fourcc, guint32, GINT32_TO_LE);
 
 /**
  * prop_copy_fixed_size_string:
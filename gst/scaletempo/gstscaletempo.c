@@ -57,6 +57,12 @@
  * for the best overlap position.  Scaletempo uses a statistical cross correlation
  * (roughly a dot-product).  Scaletempo consumes most of its CPU cycles here.
  * </para>
+ * <para>
+ * With search-mode set to coarse-to-fine, only the offsets on a grid of about
+ * 8 kHz are correlated first, then the ones around the best of them.  This
+ * is several times faster at 44.1 and 48 kHz, at the risk of settling on a
+ * slightly worse overlap for content with strong high frequencies.
+ * </para>
  * </refsect2>
  */
 
@@ -72,6 +78,10 @@
 #include <gst/base/gstbasetransform.h>
 #include <string.h>             /* for memset */
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "gstscaletempo.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_scaletempo_debug);
@@ -90,8 +100,41 @@ enum
   PROP_STRIDE,
   PROP_OVERLAP,
   PROP_SEARCH,
+  PROP_SEARCH_MODE,
 };
 
+typedef enum
+{
+  GST_SCALETEMPO_SEARCH_MODE_FULL,
+  GST_SCALETEMPO_SEARCH_MODE_COARSE_TO_FINE
+} GstScaletempoSearchMode;
+
+#define DEFAULT_SEARCH_MODE GST_SCALETEMPO_SEARCH_MODE_FULL
+
+/* resolution of the coarse pass of the coarse-to-fine search */
+#define COARSE_SEARCH_RATE 8000
+
+#define GST_TYPE_SCALETEMPO_SEARCH_MODE (gst_scaletempo_search_mode_get_type ())
+static GType
+gst_scaletempo_search_mode_get_type (void)
+{
+  static GType search_mode_type = 0;
+  static const GEnumValue search_modes[] = {
+    {GST_SCALETEMPO_SEARCH_MODE_FULL, "Correlate every offset", "full"},
+    {GST_SCALETEMPO_SEARCH_MODE_COARSE_TO_FINE,
+        "Correlate a coarse grid of offsets, then around the best one",
+        "coarse-to-fine"},
+    {0, NULL, NULL}
+  };
+
+  if (!search_mode_type) {
+    search_mode_type =
+        g_enum_register_static ("GstScaletempoSearchMode", search_modes);
+  }
+
+  return search_mode_type;
+}
+
 #define SUPPORTED_CAPS \
 GST_STATIC_CAPS ( \
     "audio/x-raw-float, " \
@@ -130,6 +173,7 @@ typedef struct _GstScaletempoPrivate
   guint ms_stride;
   gdouble percent_overlap;
   guint ms_search;
+  GstScaletempoSearchMode search_mode;
   /* caps */
   gboolean use_int;
   guint samples_per_frame;      /* AKA number of channels */
@@ -156,6 +200,7 @@ typedef struct _GstScaletempoPrivate
       guint bytes_off);
   /* best overlap */
   guint frames_search;
+  guint frames_search_step;
   gpointer buf_pre_corr;
   gpointer table_window;
     guint (*best_overlap_offset) (GstScaletempo * scaletempo);
@@ -167,14 +212,135 @@ typedef struct _GstScaletempoPrivate
 #define GST_SCALETEMPO_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GST_TYPE_SCALETEMPO, GstScaletempoPrivate))
 
 
+/* dot product of n samples */
+static gfloat
+corr_float (const gfloat * a, const gfloat * b, guint n)
+{
+  gfloat corr = 0;
+  guint i = 0;
+
+#ifdef __SSE2__
+  __m128 acc0 = _mm_setzero_ps ();
+  __m128 acc1 = _mm_setzero_ps ();
+  gfloat lanes[4];
+
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps (acc0,
+        _mm_mul_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i)));
+    acc1 = _mm_add_ps (acc1,
+        _mm_mul_ps (_mm_loadu_ps (a + i + 4), _mm_loadu_ps (b + i + 4)));
+  }
+  _mm_storeu_ps (lanes, _mm_add_ps (acc0, acc1));
+  corr = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+  for (; i < n; i++)
+    corr += a[i] * b[i];
+
+  return corr;
+}
+
+/* dot product of n samples, the products of two samples must fit in 31 bits
+ * (i.e. a must not contain -32768) */
+static gint64
+corr_s16 (const gint16 * a, const gint16 * b, guint n)
+{
+  gint64 corr = 0;
+  guint i = 0;
+
+#ifdef __SSE2__
+  __m128i acc = _mm_setzero_si128 ();
+  gint64 lanes[2];
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i prod = _mm_madd_epi16 (_mm_loadu_si128 ((const __m128i *) (a + i)),
+        _mm_loadu_si128 ((const __m128i *) (b + i)));
+    __m128i sign = _mm_srai_epi32 (prod, 31);
+
+    /* sign extend the 4 sums of 2 products to 64 bits */
+    acc = _mm_add_epi64 (acc, _mm_unpacklo_epi32 (prod, sign));
+    acc = _mm_add_epi64 (acc, _mm_unpackhi_epi32 (prod, sign));
+  }
+  _mm_storeu_si128 ((__m128i *) lanes, acc);
+  corr = lanes[0] + lanes[1];
+#endif
+
+  for (; i < n; i++)
+    corr += a[i] * b[i];
+
+  return corr;
+}
+
+static guint
+search_float (GstScaletempoPrivate * p, guint first, guint last, guint step)
+{
+  gfloat *ppc = p->buf_pre_corr;
+  gfloat *search_start = (gfloat *) p->buf_queue + p->samples_per_frame;
+  guint n = p->samples_overlap - p->samples_per_frame;
+  gfloat best_corr = G_MININT;
+  guint best_off = first;
+  guint off;
+
+  for (off = first; off < last; off += step) {
+    gfloat corr = corr_float (ppc, search_start + off * p->samples_per_frame,
+        n);
+    if (corr > best_corr) {
+      best_corr = corr;
+      best_off = off;
+    }
+  }
+
+  return best_off;
+}
+
+static guint
+search_s16 (GstScaletempoPrivate * p, guint first, guint last, guint step)
+{
+  gint16 *ppc = p->buf_pre_corr;
+  gint16 *search_start = (gint16 *) p->buf_queue + p->samples_per_frame;
+  guint n = p->samples_overlap - p->samples_per_frame;
+  gint64 best_corr = G_MININT64;
+  guint best_off = first;
+  guint off;
+
+  for (off = first; off < last; off += step) {
+    gint64 corr = corr_s16 (ppc, search_start + off * p->samples_per_frame, n);
+    if (corr > best_corr) {
+      best_corr = corr;
+      best_off = off;
+    }
+  }
+
+  return best_off;
+}
+
+/* Returns the best offset in frames, searching every frames_search_step
+ * offsets first and then all the offsets around the best of those */
+static guint
+search_best_offset (GstScaletempoPrivate * p,
+    guint (*search) (GstScaletempoPrivate * p, guint first, guint last,
+        guint step))
+{
+  guint step = p->frames_search_step;
+  guint best_off;
+
+  best_off = search (p, 0, p->frames_search, step);
+  if (step > 1) {
+    guint first = best_off > step - 1 ? best_off - (step - 1) : 0;
+    guint last = MIN (best_off + step, p->frames_search);
+
+    best_off = search (p, first, last, 1);
+  }
+
+  return best_off;
+}
+
 static guint
 best_overlap_offset_float (GstScaletempo * scaletempo)
 {
   GstScaletempoPrivate *p = GST_SCALETEMPO_GET_PRIVATE (scaletempo);
-  gfloat *pw, *po, *ppc, *search_start;
-  gfloat best_corr = G_MININT;
-  guint best_off = 0;
-  gint i, off;
+  gfloat *pw, *po, *ppc;
+  gint i;
 
   pw = p->table_window;
   po = p->buf_overlap;
@@ -184,68 +350,28 @@ best_overlap_offset_float (GstScaletempo * scaletempo)
     *ppc++ = *pw++ * *po++;
   }
 
-  search_start = (gfloat *) p->buf_queue + p->samples_per_frame;
-  for (off = 0; off < p->frames_search; off++) {
-    gfloat corr = 0;
-    gfloat *ps = search_start;
-    ppc = p->buf_pre_corr;
-    for (i = p->samples_per_frame; i < p->samples_overlap; i++) {
-      corr += *ppc++ * *ps++;
-    }
-    if (corr > best_corr) {
-      best_corr = corr;
-      best_off = off;
-    }
-    search_start += p->samples_per_frame;
-  }
-
-  return best_off * p->bytes_per_frame;
+  return search_best_offset (p, search_float) * p->bytes_per_frame;
 }
 
-/* buffer padding for loop optimization: sizeof(gint32) * (loop_size - 1) */
-#define UNROLL_PADDING (4*3)
 static guint
 best_overlap_offset_s16 (GstScaletempo * scaletempo)
 {
   GstScaletempoPrivate *p = GST_SCALETEMPO_GET_PRIVATE (scaletempo);
-  gint32 *pw, *ppc;
-  gint16 *po, *search_start;
-  gint64 best_corr = G_MININT64;
-  guint best_off = 0;
-  guint off;
+  gint32 *pw;
+  gint16 *po, *ppc;
   glong i;
 
+  /* the window peaks at 2^16, scale the products back to 16 bits so the
+   * correlation can multiply pairs of 16 bit samples */
   pw = p->table_window;
   po = p->buf_overlap;
   po += p->samples_per_frame;
   ppc = p->buf_pre_corr;
   for (i = p->samples_per_frame; i < p->samples_overlap; i++) {
-    *ppc++ = (*pw++ * *po++) >> 15;
-  }
-
-  search_start = (gint16 *) p->buf_queue + p->samples_per_frame;
-  for (off = 0; off < p->frames_search; off++) {
-    gint64 corr = 0;
-    gint16 *ps = search_start;
-    ppc = p->buf_pre_corr;
-    ppc += p->samples_overlap - p->samples_per_frame;
-    ps += p->samples_overlap - p->samples_per_frame;
-    i = -((glong) p->samples_overlap - (glong) p->samples_per_frame);
-    do {
-      corr += ppc[i + 0] * ps[i + 0];
-      corr += ppc[i + 1] * ps[i + 1];
-      corr += ppc[i + 2] * ps[i + 2];
-      corr += ppc[i + 3] * ps[i + 3];
-      i += 4;
-    } while (i < 0);
-    if (corr > best_corr) {
-      best_corr = corr;
-      best_off = off;
-    }
-    search_start += p->samples_per_frame;
+    *ppc++ = CLAMP ((*pw++ * *po++) >> 16, -32767, 32767);
   }
 
-  return best_off * p->bytes_per_frame;
+  return search_best_offset (p, search_s16) * p->bytes_per_frame;
 }
 
 static void
@@ -376,15 +502,17 @@ reinit_buffers (GstScaletempo * scaletempo)
     p->best_overlap_offset = NULL;
   } else {
     guint bytes_pre_corr = (p->samples_overlap - p->samples_per_frame) * 4;     /* sizeof (gint32|gfloat) */
-    p->buf_pre_corr =
-        g_realloc (p->buf_pre_corr, bytes_pre_corr + UNROLL_PADDING);
+    p->buf_pre_corr = g_realloc (p->buf_pre_corr, bytes_pre_corr);
     p->table_window = g_realloc (p->table_window, bytes_pre_corr);
+    if (p->search_mode == GST_SCALETEMPO_SEARCH_MODE_COARSE_TO_FINE)
+      p->frames_search_step = MAX (1, p->sample_rate / COARSE_SEARCH_RATE);
+    else
+      p->frames_search_step = 1;
     if (p->use_int) {
       gint64 t = frames_overlap;
       gint32 n = 8589934588LL / (t * t);        /* 4 * (2^31 - 1) / t^2 */
       gint32 *pw;
 
-      memset ((guint8 *) p->buf_pre_corr + bytes_pre_corr, 0, UNROLL_PADDING);
       pw = p->table_window;
       for (i = 1; i < frames_overlap; i++) {
         gint32 v = (i * (t - i) * n) >> 15;
@@ -629,6 +757,9 @@ gst_scaletempo_get_property (GObject * object,
     case PROP_SEARCH:
       g_value_set_uint (value, priv->ms_search);
       break;
+    case PROP_SEARCH_MODE:
+      g_value_set_enum (value, priv->search_mode);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -667,6 +798,14 @@ gst_scaletempo_set_property (GObject * object,
       }
       break;
     }
+    case PROP_SEARCH_MODE:{
+      GstScaletempoSearchMode new_value = g_value_get_enum (value);
+      if (priv->search_mode != new_value) {
+        priv->search_mode = new_value;
+        priv->reinit_buffers = TRUE;
+      }
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -718,6 +857,12 @@ gst_scaletempo_class_init (GstScaletempoClass * klass)
           "Length in milliseconds to search for best overlap position", 0, 500,
           14, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_SEARCH_MODE,
+      g_param_spec_enum ("search-mode", "Search Mode",
+          "How to search for the best overlap position, trading quality for "
+          "speed", GST_TYPE_SCALETEMPO_SEARCH_MODE, DEFAULT_SEARCH_MODE,
+          G_PARAM_READWRITE));
+
   basetransform_class->event = GST_DEBUG_FUNCPTR (gst_scaletempo_sink_event);
   basetransform_class->set_caps = GST_DEBUG_FUNCPTR (gst_scaletempo_set_caps);
   basetransform_class->transform_size =
@@ -733,6 +878,7 @@ gst_scaletempo_init (GstScaletempo * scaletempo, GstScaletempoClass * klass)
   priv->ms_stride = 30;
   priv->percent_overlap = .2;
   priv->ms_search = 14;
+  priv->search_mode = DEFAULT_SEARCH_MODE;
 
   /* uninitialized */
   priv->scale = 0;
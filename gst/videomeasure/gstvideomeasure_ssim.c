@@ -62,6 +62,14 @@
 #define GST_CAT_DEFAULT gst_ssim_debug
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 
+/* Size of the blocks per-macroblock SSIM is reported for. Bands are a
+ * multiple of it high */
+#define SSIM_MACROBLOCK_SIZE 16
+#define SSIM_MACROBLOCK_COLUMNS(ssim) \
+    (((ssim)->width + SSIM_MACROBLOCK_SIZE - 1) / SSIM_MACROBLOCK_SIZE)
+#define SSIM_MACROBLOCK_ROWS(ssim) \
+    (((ssim)->height + SSIM_MACROBLOCK_SIZE - 1) / SSIM_MACROBLOCK_SIZE)
+
 /* elementfactory information */
 
 #define SINK_CAPS \
@@ -139,22 +147,86 @@ gst_ssim_get_type (void)
   return ssim_type;
 }
 
+static void
+gst_ssim_value_array_append_float (GValueArray * array, gfloat value)
+{
+  GValue v = { 0, };
+
+  g_value_init (&v, G_TYPE_FLOAT);
+  g_value_set_float (&v, value);
+  g_value_array_append (array, &v);
+  g_value_unset (&v);
+}
+
 static void
 gst_ssim_post_message (GstSSim * ssim, GstBuffer * buffer, gfloat mssim,
-    gfloat lowest, gfloat highest)
+    gfloat lowest, gfloat highest, GstSSimBand * bands, gint nbands,
+    gfloat * mb_summ)
 {
   GstMessage *m;
+  GstStructure *s;
   guint64 offset;
 
   offset = GST_BUFFER_OFFSET (buffer);
 
-  m = gst_message_new_element (GST_OBJECT_CAST (ssim),
-      gst_structure_new ("SSIM",
-          "offset", G_TYPE_UINT64, offset,
-          "timestamp", GST_TYPE_CLOCK_TIME, GST_BUFFER_TIMESTAMP (buffer),
-          "mean", G_TYPE_FLOAT, mssim,
-          "lowest", G_TYPE_FLOAT, lowest,
-          "highest", G_TYPE_FLOAT, highest, NULL));
+  s = gst_structure_new ("SSIM",
+      "offset", G_TYPE_UINT64, offset,
+      "timestamp", GST_TYPE_CLOCK_TIME, GST_BUFFER_TIMESTAMP (buffer),
+      "mean", G_TYPE_FLOAT, mssim,
+      "lowest", G_TYPE_FLOAT, lowest, "highest", G_TYPE_FLOAT, highest, NULL);
+
+  if (ssim->band_stats) {
+    GValueArray *means, *lowests, *highests;
+    gint i;
+
+    means = g_value_array_new (nbands);
+    lowests = g_value_array_new (nbands);
+    highests = g_value_array_new (nbands);
+    for (i = 0; i < nbands; i++) {
+      gint pixels = (bands[i].yend - bands[i].ystart) * ssim->width;
+
+      gst_ssim_value_array_append_float (means, bands[i].summ / pixels);
+      gst_ssim_value_array_append_float (lowests, bands[i].lowest);
+      gst_ssim_value_array_append_float (highests, bands[i].highest);
+    }
+    gst_structure_set (s,
+        "band-height", G_TYPE_INT, bands[0].yend - bands[0].ystart,
+        "band-mean", G_TYPE_VALUE_ARRAY, means,
+        "band-lowest", G_TYPE_VALUE_ARRAY, lowests,
+        "band-highest", G_TYPE_VALUE_ARRAY, highests, NULL);
+    g_value_array_free (means);
+    g_value_array_free (lowests);
+    g_value_array_free (highests);
+  }
+
+  if (ssim->macroblock_stats) {
+    GValueArray *means;
+    gint columns = SSIM_MACROBLOCK_COLUMNS (ssim);
+    gint rows = SSIM_MACROBLOCK_ROWS (ssim);
+    gint x, y;
+
+    means = g_value_array_new (columns * rows);
+    for (y = 0; y < rows; y++) {
+      for (x = 0; x < columns; x++) {
+        /* macroblocks on the right and bottom edges may be cut */
+        gint mb_width = MIN (SSIM_MACROBLOCK_SIZE,
+            ssim->width - x * SSIM_MACROBLOCK_SIZE);
+        gint mb_height = MIN (SSIM_MACROBLOCK_SIZE,
+            ssim->height - y * SSIM_MACROBLOCK_SIZE);
+
+        gst_ssim_value_array_append_float (means,
+            mb_summ[y * columns + x] / (mb_width * mb_height));
+      }
+    }
+    gst_structure_set (s,
+        "macroblock-size", G_TYPE_INT, SSIM_MACROBLOCK_SIZE,
+        "macroblock-columns", G_TYPE_INT, columns,
+        "macroblock-rows", G_TYPE_INT, rows,
+        "macroblock-mean", G_TYPE_VALUE_ARRAY, means, NULL);
+    g_value_array_free (means);
+  }
+
+  m = gst_message_new_element (GST_OBJECT_CAST (ssim), s);
 
   GST_DEBUG_OBJECT (GST_OBJECT (ssim), "Frame %" G_GINT64_FORMAT
       " @ %" GST_TIME_FORMAT " mean SSIM is %f, l-h is %f-%f", offset,
@@ -198,11 +270,13 @@ gst_ssim_sink_getcaps (GstPad * pad)
 }
 
 static void
-calculate_mu (GstSSim * ssim, gfloat * outmu, guint8 * buf)
+calculate_mu (GstSSim * ssim, GstSSimBand * band)
 {
+  guint8 *buf = band->org;
+  gfloat *outmu = band->orgmu;
   gint oy, ox, iy, ix;
 
-  for (oy = 0; oy < ssim->height; oy++) {
+  for (oy = band->ystart; oy < band->yend; oy++) {
     for (ox = 0; ox < ssim->width; ox++) {
       gfloat mu = 0;
       gfloat elsumm;
@@ -265,15 +339,21 @@ calculate_mu (GstSSim * ssim, gfloat * outmu, guint8 * buf)
 }
 
 static void
-calcssim_without_mu (GstSSim * ssim, guint8 * org, gfloat * orgmu, guint8 * mod,
-    guint8 * out, gfloat * mean, gfloat * lowest, gfloat * highest)
+calcssim_without_mu (GstSSim * ssim, GstSSimBand * band)
 {
+  guint8 *org = band->org;
+  guint8 *mod = band->mod;
+  guint8 *out = band->out;
   gint oy, ox, iy, ix;
+  gint mb_columns = SSIM_MACROBLOCK_COLUMNS (ssim);
   gfloat cumulative_ssim = 0;
-  *lowest = G_MAXFLOAT;
-  *highest = -G_MAXFLOAT;
+  gfloat lowest = G_MAXFLOAT;
+  gfloat highest = -G_MAXFLOAT;
+
+  for (oy = band->ystart; oy < band->yend; oy++) {
+    gfloat *mb_row =
+        &band->mb_summ[(oy / SSIM_MACROBLOCK_SIZE) * mb_columns];
 
-  for (oy = 0; oy < ssim->height; oy++) {
     for (ox = 0; ox < ssim->width; ox++) {
       gfloat mu_o = 128, mu_m = 128;
       gdouble sigma_o = 0, sigma_m = 0, sigma_om = 0;
@@ -357,24 +437,34 @@ calcssim_without_mu (GstSSim * ssim, guint8 * org, gfloat * orgmu, guint8 * mod,
       /* SSIM can go negative, that's why it is
          127 + index * 128 instead of index * 255 */
       out[oy * ssim->width + ox] = 127 + tmp1 * 128;
-      *lowest = MIN (*lowest, tmp1);
-      *highest = MAX (*highest, tmp1);
+      lowest = MIN (lowest, tmp1);
+      highest = MAX (highest, tmp1);
       cumulative_ssim += tmp1;
+      mb_row[ox / SSIM_MACROBLOCK_SIZE] += tmp1;
     }
   }
-  *mean = cumulative_ssim / (ssim->width * ssim->height);
+  band->summ = cumulative_ssim;
+  band->lowest = lowest;
+  band->highest = highest;
 }
 
 static void
-calcssim_canonical (GstSSim * ssim, guint8 * org, gfloat * orgmu, guint8 * mod,
-    guint8 * out, gfloat * mean, gfloat * lowest, gfloat * highest)
+calcssim_canonical (GstSSim * ssim, GstSSimBand * band)
 {
+  guint8 *org = band->org;
+  gfloat *orgmu = band->orgmu;
+  guint8 *mod = band->mod;
+  guint8 *out = band->out;
   gint oy, ox, iy, ix;
+  gint mb_columns = SSIM_MACROBLOCK_COLUMNS (ssim);
   gfloat cumulative_ssim = 0;
-  *lowest = G_MAXFLOAT;
-  *highest = -G_MAXFLOAT;
+  gfloat lowest = G_MAXFLOAT;
+  gfloat highest = -G_MAXFLOAT;
+
+  for (oy = band->ystart; oy < band->yend; oy++) {
+    gfloat *mb_row =
+        &band->mb_summ[(oy / SSIM_MACROBLOCK_SIZE) * mb_columns];
 
-  for (oy = 0; oy < ssim->height; oy++) {
     for (ox = 0; ox < ssim->width; ox++) {
       gfloat mu_o = 0, mu_m = 0;
       gdouble sigma_o = 0, sigma_m = 0, sigma_om = 0;
@@ -477,12 +567,168 @@ calcssim_canonical (GstSSim * ssim, guint8 * org, gfloat * orgmu, guint8 * mod,
       /* SSIM can go negative, that's why it is
          127 + index * 128 instead of index * 255 */
       out[oy * ssim->width + ox] = 127 + tmp1 * 128;
-      *lowest = MIN (*lowest, tmp1);
-      *highest = MAX (*highest, tmp1);
+      lowest = MIN (lowest, tmp1);
+      highest = MAX (highest, tmp1);
       cumulative_ssim += tmp1;
+      mb_row[ox / SSIM_MACROBLOCK_SIZE] += tmp1;
     }
   }
-  *mean = cumulative_ssim / (ssim->width * ssim->height);
+  band->summ = cumulative_ssim;
+  band->lowest = lowest;
+  band->highest = highest;
+}
+
+/* Number of window statistics calcssim_fast() keeps per pixel: the weighted
+ * sums of o, m, o * o, m * m and o * m, with samples centered around 128 */
+#define SSIM_FAST_PLANES 5
+
+/* Convolves len samples of src with the window kernel, clipping the kernel at
+ * the borders the same way the windows are clipped. The loop over the samples
+ * is the inner one, so that the compiler can vectorize it.
+ */
+static void
+ssim_fast_filter (const gfloat * kernel, gint ksize, gint kcenter,
+    const gfloat * src, gfloat * dst, gint len)
+{
+  gint t, x;
+
+  memset (dst, 0, sizeof (gfloat) * len);
+  for (t = 0; t < ksize; t++) {
+    gint d = t - kcenter;
+    gint start = MAX (0, -d);
+    gint end = MIN (len, len - d);
+    gfloat k = kernel[t];
+
+    for (x = start; x < end; x++)
+      dst[x] += k * src[x + d];
+  }
+}
+
+/* Computes the same metric as calcssim_canonical() and calcssim_without_mu()
+ * (depending on ssimtype), but gets the window statistics from a horizontal
+ * and a vertical pass of the separable window kernel instead of visiting
+ * every window element of every pixel. mu and sigma are then derived from
+ * the window sums, e.g. sum (w * (v - mu)^2) is
+ * sum (w * v^2) - 2 * mu * sum (w * v) + mu^2 * sum (w).
+ */
+static void
+calcssim_fast (GstSSim * ssim, GstSSimBand * band)
+{
+  guint8 *org = band->org;
+  guint8 *mod = band->mod;
+  guint8 *out = band->out;
+  gint mb_columns = SSIM_MACROBLOCK_COLUMNS (ssim);
+  gint width = ssim->width;
+  gint height = ssim->height;
+  gint ksize = ssim->windowsize;
+  gint rowlen = SSIM_FAST_PLANES * width;
+  gint kcenter;
+  gint oy, ox, iy, t, i;
+  gint next_row;
+  gfloat *wx = ssim->kernel_wx;
+  gfloat *wy = ssim->kernel_wy;
+  gfloat *src, *rows, *acc;
+  gfloat cumulative_ssim = 0;
+  gfloat lowest = G_MAXFLOAT;
+  gfloat highest = -G_MAXFLOAT;
+
+  /* kernel tap t covers the pixel t - kcenter away from the window center */
+  kcenter = ksize / 2 - ((ksize / 2) * 2 == ksize ? 1 : 0);
+
+  src = g_new (gfloat, rowlen);
+  acc = g_new (gfloat, rowlen);
+  /* horizontally filtered rows, source row iy lives in slot iy % ksize */
+  rows = g_new (gfloat, rowlen * ksize);
+
+  /* first row covered by the window of the first row of the band */
+  next_row = MAX (0, band->ystart - kcenter);
+
+  for (oy = band->ystart; oy < band->yend; oy++) {
+    gfloat *mb_row =
+        &band->mb_summ[(oy / SSIM_MACROBLOCK_SIZE) * mb_columns];
+
+    /* filter the rows that enter the window */
+    while (next_row <= MIN (oy + ksize - 1 - kcenter, height - 1)) {
+      gfloat *row = &rows[(next_row % ksize) * rowlen];
+      guint8 *org_with_offset = &org[next_row * width];
+      guint8 *mod_with_offset = &mod[next_row * width];
+
+      for (ox = 0; ox < width; ox++) {
+        gfloat vo = org_with_offset[ox] - 128;
+        gfloat vm = mod_with_offset[ox] - 128;
+
+        src[ox] = vo;
+        src[width + ox] = vm;
+        src[2 * width + ox] = vo * vo;
+        src[3 * width + ox] = vm * vm;
+        src[4 * width + ox] = vo * vm;
+      }
+      for (i = 0; i < SSIM_FAST_PLANES; i++)
+        ssim_fast_filter (ssim->kernel, ksize, kcenter, &src[i * width],
+            &row[i * width], width);
+      next_row++;
+    }
+
+    memset (acc, 0, sizeof (gfloat) * rowlen);
+    for (t = 0; t < ksize; t++) {
+      gfloat k = ssim->kernel[t];
+      gfloat *row;
+
+      iy = oy + t - kcenter;
+      if (iy < 0 || iy >= height)
+        continue;
+      row = &rows[(iy % ksize) * rowlen];
+      for (i = 0; i < rowlen; i++)
+        acc[i] += k * row[i];
+    }
+
+    for (ox = 0; ox < width; ox++) {
+      gdouble s_o = acc[ox];
+      gdouble s_m = acc[width + ox];
+      gdouble s_oo = acc[2 * width + ox];
+      gdouble s_mm = acc[3 * width + ox];
+      gdouble s_om = acc[4 * width + ox];
+      gdouble mu_o = 0, mu_m = 0;
+      gdouble sigma_o, sigma_m, sigma_om;
+      gdouble elsumm, wsumm;
+      gfloat tmp1;
+
+      elsumm = ssim->windows[oy * width + ox].element_summ;
+      wsumm = wx[ox] * wy[oy];
+
+      /* mu_o and mu_m are centered around 128 as well */
+      if (ssim->ssimtype == 0) {
+        mu_o = (s_o + 128 * wsumm) / elsumm - 128;
+        mu_m = (s_m + 128 * wsumm) / elsumm - 128;
+      }
+      sigma_o = (s_oo - 2 * mu_o * s_o + mu_o * mu_o * wsumm) / elsumm;
+      sigma_m = (s_mm - 2 * mu_m * s_m + mu_m * mu_m * wsumm) / elsumm;
+      sigma_om = (s_om - mu_o * s_m - mu_m * s_o + mu_o * mu_m * wsumm) /
+          elsumm;
+      /* rounding can make the variance of a flat window slightly negative */
+      sigma_o = MAX (sigma_o, 0);
+      sigma_m = MAX (sigma_m, 0);
+      mu_o += 128;
+      mu_m += 128;
+
+      tmp1 = (2 * mu_o * mu_m + ssim->const1) * (2 * sigma_om + ssim->const2) /
+          ((mu_o * mu_o + mu_m * mu_m + ssim->const1) *
+          (sigma_o + sigma_m + ssim->const2));
+
+      out[oy * width + ox] = 127 + tmp1 * 128;
+      lowest = MIN (lowest, tmp1);
+      highest = MAX (highest, tmp1);
+      cumulative_ssim += tmp1;
+      mb_row[ox / SSIM_MACROBLOCK_SIZE] += tmp1;
+    }
+  }
+  band->summ = cumulative_ssim;
+  band->lowest = lowest;
+  band->highest = highest;
+
+  g_free (src);
+  g_free (acc);
+  g_free (rows);
 }
 
 
@@ -1038,6 +1284,21 @@ gst_ssim_set_property (GObject * object, guint prop_id,
       g_free (ssim->windows);
       ssim->windows = NULL;
       break;
+    case PROP_FAST:
+      ssim->fast = g_value_get_boolean (value);
+      break;
+    case PROP_N_THREADS:
+      ssim->n_threads = g_value_get_int (value);
+      break;
+    case PROP_BAND_HEIGHT:
+      ssim->band_height = g_value_get_int (value);
+      break;
+    case PROP_BAND_STATS:
+      ssim->band_stats = g_value_get_boolean (value);
+      break;
+    case PROP_MACROBLOCK_STATS:
+      ssim->macroblock_stats = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1065,6 +1326,21 @@ gst_ssim_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_GAUSS_SIGMA:
       g_value_set_float (value, ssim->sigma);
       break;
+    case PROP_FAST:
+      g_value_set_boolean (value, ssim->fast);
+      break;
+    case PROP_N_THREADS:
+      g_value_set_int (value, ssim->n_threads);
+      break;
+    case PROP_BAND_HEIGHT:
+      g_value_set_int (value, ssim->band_height);
+      break;
+    case PROP_BAND_STATS:
+      g_value_set_boolean (value, ssim->band_stats);
+      break;
+    case PROP_MACROBLOCK_STATS:
+      g_value_set_boolean (value, ssim->macroblock_stats);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1104,6 +1380,34 @@ gst_ssim_class_init (GstSSimClass * klass)
           "(only when using Gaussian window).",
           G_MINFLOAT, 10, 1.5, G_PARAM_READWRITE));
 
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_FAST,
+      g_param_spec_boolean ("fast", "Fast",
+          "Compute the window statistics with separable filtering "
+          "(same results up to rounding errors, much faster with big windows)",
+          FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_N_THREADS,
+      g_param_spec_int ("n-threads", "Number of threads",
+          "Number of threads computing horizontal bands of a frame "
+          "in parallel", 1, 64, 1, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_BAND_HEIGHT,
+      g_param_spec_int ("band-height", "Band height",
+          "Height of a band, rounded up to a multiple of 16 "
+          "(0 - split the frame evenly between the threads)",
+          0, G_MAXINT, 0, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_BAND_STATS,
+      g_param_spec_boolean ("band-stats", "Band statistics",
+          "Add per-band mean, lowest and highest SSIM to the element message",
+          FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass),
+      PROP_MACROBLOCK_STATS, g_param_spec_boolean ("macroblock-stats",
+          "Macroblock statistics",
+          "Add the mean SSIM of every 16x16 block to the element message",
+          FALSE, G_PARAM_READWRITE));
+
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&gst_ssim_src_template));
   gst_element_class_add_pad_template (gstelement_class,
@@ -1267,6 +1571,18 @@ gst_ssim_init (GstSSim * ssim)
   ssim->windows = NULL;
   ssim->sigma = 1.5;
   ssim->ssimtype = 0;
+  ssim->fast = FALSE;
+  ssim->kernel = NULL;
+  ssim->kernel_wx = NULL;
+  ssim->kernel_wy = NULL;
+  ssim->n_threads = 1;
+  ssim->band_height = 0;
+  ssim->band_stats = FALSE;
+  ssim->macroblock_stats = FALSE;
+  ssim->pool = NULL;
+  ssim->bands_lock = g_mutex_new ();
+  ssim->bands_cond = g_cond_new ();
+  ssim->bands_pending = 0;
   ssim->src = g_ptr_array_new ();
   ssim->padcount = 0;
   ssim->collect_event = NULL;
@@ -1286,12 +1602,28 @@ gst_ssim_finalize (GObject * object)
   gst_object_unref (ssim->collect);
   ssim->collect = NULL;
 
+  if (ssim->pool) {
+    g_thread_pool_free (ssim->pool, FALSE, TRUE);
+    ssim->pool = NULL;
+  }
+  g_mutex_free (ssim->bands_lock);
+  g_cond_free (ssim->bands_cond);
+
   g_free (ssim->windows);
   ssim->windows = NULL;
 
   g_free (ssim->weights);
   ssim->weights = NULL;
 
+  g_free (ssim->kernel);
+  ssim->kernel = NULL;
+
+  g_free (ssim->kernel_wx);
+  ssim->kernel_wx = NULL;
+
+  g_free (ssim->kernel_wy);
+  ssim->kernel_wy = NULL;
+
   if (ssim->sinkcaps)
     gst_caps_unref (ssim->sinkcaps);
   if (ssim->srccaps)
@@ -1326,11 +1658,16 @@ gst_ssim_regenerate_windows (GstSSim * ssim)
   GstSSimWeightFunc func;
   gfloat normal_summ = 0;
   gint normal_count = 0;
+  gfloat *ones;
 
   g_free (ssim->weights);
 
   ssim->weights = g_new (gfloat, ssim->windowsize * ssim->windowsize);
 
+  g_free (ssim->kernel);
+
+  ssim->kernel = g_new (gfloat, ssim->windowsize);
+
   windowiseven = ((gint) ssim->windowsize / 2) * 2 == ssim->windowsize ? 1 : 0;
 
   g_free (ssim->windows);
@@ -1361,6 +1698,28 @@ gst_ssim_regenerate_windows (GstSSim * ssim)
     }
   }
 
+  /* Weight functions are separable: w (x, y) == k (x) * k (y) with
+   * k (x) == w (x, 0) / sqrt (w (0, 0)) */
+  for (x = 0; x < ssim->windowsize; x++)
+    ssim->kernel[x] = func (ssim, x - ssim->windowsize / 2 + windowiseven, 0) /
+        sqrt (func (ssim, 0, 0));
+
+  /* sum of the kernel taps covered by the (clipped) window of each column
+   * and row, for calcssim_fast () */
+  g_free (ssim->kernel_wx);
+  g_free (ssim->kernel_wy);
+  ssim->kernel_wx = g_new (gfloat, ssim->width);
+  ssim->kernel_wy = g_new (gfloat, ssim->height);
+  ones = g_new (gfloat, MAX (ssim->width, ssim->height));
+  for (x = 0; x < MAX (ssim->width, ssim->height); x++)
+    ones[x] = 1;
+  ssim_fast_filter (ssim->kernel, ssim->windowsize,
+      ssim->windowsize / 2 - windowiseven, ones, ssim->kernel_wx, ssim->width);
+  ssim_fast_filter (ssim->kernel, ssim->windowsize,
+      ssim->windowsize / 2 - windowiseven, ones, ssim->kernel_wy,
+      ssim->height);
+  g_free (ones);
+
   for (y = 0; y < ssim->height; y++) {
     for (x = 0; x < ssim->width; x++) {
       GstSSimWindowCache win;
@@ -1412,6 +1771,49 @@ gst_ssim_regenerate_windows (GstSSim * ssim)
   return TRUE;
 }
 
+static void
+gst_ssim_band_worker (gpointer data, gpointer user_data)
+{
+  GstSSimBand *band = (GstSSimBand *) data;
+  GstSSim *ssim = GST_SSIM (user_data);
+
+  band->func (ssim, band);
+
+  g_mutex_lock (ssim->bands_lock);
+  if (--ssim->bands_pending == 0)
+    g_cond_signal (ssim->bands_cond);
+  g_mutex_unlock (ssim->bands_lock);
+}
+
+/* Runs func on all bands, in parallel if we have a thread pool, and returns
+ * when all of them are done */
+static void
+gst_ssim_run_bands (GstSSim * ssim, GstSSimFunction func, GstSSimBand * bands,
+    gint nbands)
+{
+  gint i;
+
+  if (ssim->pool == NULL || nbands == 1) {
+    for (i = 0; i < nbands; i++)
+      func (ssim, &bands[i]);
+    return;
+  }
+
+  g_mutex_lock (ssim->bands_lock);
+  ssim->bands_pending = nbands;
+  g_mutex_unlock (ssim->bands_lock);
+
+  for (i = 0; i < nbands; i++) {
+    bands[i].func = func;
+    g_thread_pool_push (ssim->pool, &bands[i], NULL);
+  }
+
+  g_mutex_lock (ssim->bands_lock);
+  while (ssim->bands_pending > 0)
+    g_cond_wait (ssim->bands_cond, ssim->bands_lock);
+  g_mutex_unlock (ssim->bands_lock);
+}
+
 static GstFlowReturn
 gst_ssim_collected (GstCollectPads * pads, gpointer user_data)
 {
@@ -1420,6 +1822,10 @@ gst_ssim_collected (GstCollectPads * pads, gpointer user_data)
   GstFlowReturn ret = GST_FLOW_OK;
   GstBuffer *orgbuf = NULL;
   gfloat *orgmu = NULL;
+  GstSSimBand *bands = NULL;
+  gint nbands, band_height, i;
+  gfloat *mb_summ = NULL;
+  gint mb_count;
   GstBuffer *outbuf = NULL;
   gpointer outdata = NULL;
   guint outsize = 0;
@@ -1446,6 +1852,28 @@ gst_ssim_collected (GstCollectPads * pads, gpointer user_data)
       return GST_FLOW_ERROR;
   }
 
+  if (ssim->fast)
+    ssim->func = (GstSSimFunction) calcssim_fast;
+
+  if (ssim->n_threads > 1) {
+    if (ssim->pool == NULL) {
+      GError *err = NULL;
+
+      ssim->pool = g_thread_pool_new (gst_ssim_band_worker, ssim,
+          ssim->n_threads, FALSE, &err);
+      if (ssim->pool == NULL) {
+        GST_WARNING_OBJECT (ssim, "could not create thread pool: %s",
+            err->message);
+        g_error_free (err);
+      }
+    } else if (g_thread_pool_get_max_threads (ssim->pool) != ssim->n_threads) {
+      g_thread_pool_set_max_threads (ssim->pool, ssim->n_threads, NULL);
+    }
+  } else if (ssim->pool) {
+    g_thread_pool_free (ssim->pool, FALSE, TRUE);
+    ssim->pool = NULL;
+  }
+
   for (collected = pads->data; collected; collected = g_slist_next (collected)) {
     GstCollectData *collect_data;
     GstBuffer *inbuf;
@@ -1470,31 +1898,53 @@ gst_ssim_collected (GstCollectPads * pads, gpointer user_data)
   if (G_UNLIKELY (!ready))
     goto eos;
 
-  /* Mu is just a blur, we can calculate it once */
-  if (ssim->ssimtype == 0) {
-    orgmu = g_new (gfloat, ssim->width * ssim->height);
+  for (collected = pads->data; collected; collected = g_slist_next (collected)) {
+    GstCollectData *collect_data;
 
-    for (collected = pads->data; collected;
-        collected = g_slist_next (collected)) {
-      GstCollectData *collect_data;
+    collect_data = (GstCollectData *) collected->data;
 
-      collect_data = (GstCollectData *) collected->data;
+    if (collect_data->pad == ssim->orig) {
+      orgbuf = gst_collect_pads_pop (pads, collect_data);
 
-      if (collect_data->pad == ssim->orig) {
-        orgbuf = gst_collect_pads_pop (pads, collect_data);;
+      GST_DEBUG_OBJECT (ssim, "Original stream - flags(0x%x), timestamp(%"
+          GST_TIME_FORMAT "), duration(%" GST_TIME_FORMAT ")",
+          GST_BUFFER_FLAGS (orgbuf),
+          GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (orgbuf)),
+          GST_TIME_ARGS (GST_BUFFER_DURATION (orgbuf)));
+      break;
+    }
+  }
 
-        GST_DEBUG_OBJECT (ssim, "Original stream - flags(0x%x), timestamp(%"
-            GST_TIME_FORMAT "), duration(%" GST_TIME_FORMAT ")",
-            GST_BUFFER_FLAGS (orgbuf),
-            GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (orgbuf)),
-            GST_TIME_ARGS (GST_BUFFER_DURATION (orgbuf)));
-        calculate_mu (ssim, orgmu, GST_BUFFER_DATA (orgbuf));
+  /* Split the frame into bands starting on macroblock boundaries */
+  band_height = ssim->band_height;
+  if (band_height <= 0)
+    band_height = (ssim->height + ssim->n_threads - 1) / ssim->n_threads;
+  band_height = MIN (band_height, ssim->height);
+  band_height = (band_height + SSIM_MACROBLOCK_SIZE - 1) /
+      SSIM_MACROBLOCK_SIZE * SSIM_MACROBLOCK_SIZE;
+  nbands = (ssim->height + band_height - 1) / band_height;
 
-        break;
-      }
-    }
+  GST_LOG_OBJECT (ssim, "computing %d bands of %d rows", nbands, band_height);
+
+  mb_count = SSIM_MACROBLOCK_COLUMNS (ssim) * SSIM_MACROBLOCK_ROWS (ssim);
+  mb_summ = g_new (gfloat, mb_count);
+
+  /* Mu is just a blur, we can calculate it once */
+  if (ssim->ssimtype == 0 && !ssim->fast)
+    orgmu = g_new (gfloat, ssim->width * ssim->height);
+
+  bands = g_new0 (GstSSimBand, nbands);
+  for (i = 0; i < nbands; i++) {
+    bands[i].org = GST_BUFFER_DATA (orgbuf);
+    bands[i].orgmu = orgmu;
+    bands[i].mb_summ = mb_summ;
+    bands[i].ystart = i * band_height;
+    bands[i].yend = MIN (ssim->height, bands[i].ystart + band_height);
   }
 
+  if (orgmu)
+    gst_ssim_run_bands (ssim, calculate_mu, bands, nbands);
+
   GST_LOG_OBJECT (ssim, "starting to cycle through streams");
 
   for (collected = pads->data; collected; collected = g_slist_next (collected)) {
@@ -1561,13 +2011,28 @@ gst_ssim_collected (GstCollectPads * pads, gpointer user_data)
 
         GST_LOG_OBJECT (ssim, "channel %p: calculating SSIM", collect_data);
 
-        ssim->func (ssim, GST_BUFFER_DATA (orgbuf), orgmu, indata, outdata,
-            &mssim, &lowest, &highest);
+        memset (mb_summ, 0, sizeof (gfloat) * mb_count);
+        for (i = 0; i < nbands; i++) {
+          bands[i].mod = indata;
+          bands[i].out = outdata;
+        }
+        gst_ssim_run_bands (ssim, ssim->func, bands, nbands);
+
+        mssim = 0;
+        lowest = G_MAXFLOAT;
+        highest = -G_MAXFLOAT;
+        for (i = 0; i < nbands; i++) {
+          mssim += bands[i].summ;
+          lowest = MIN (lowest, bands[i].lowest);
+          highest = MAX (highest, bands[i].highest);
+        }
+        mssim /= ssim->width * ssim->height;
 
         GST_DEBUG_OBJECT (GST_OBJECT (ssim), "MSSIM is %f, l-h is %f - %f",
             mssim, lowest, highest);
 
-        gst_ssim_post_message (ssim, outbuf, mssim, lowest, highest);
+        gst_ssim_post_message (ssim, outbuf, mssim, lowest, highest, bands,
+            nbands, mb_summ);
 
         g_value_set_float (&vmean, mssim);
         g_value_set_float (&vlowest, lowest);
@@ -1623,8 +2088,9 @@ gst_ssim_collected (GstCollectPads * pads, gpointer user_data)
   }
   gst_buffer_unref (orgbuf);
 
-  if (ssim->ssimtype == 0)
-    g_free (orgmu);
+  g_free (orgmu);
+  g_free (bands);
+  g_free (mb_summ);
 
   ssim->segment_position = 0;
 
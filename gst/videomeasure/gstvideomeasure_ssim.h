@@ -33,6 +33,11 @@ enum
   PROP_WINDOW_TYPE,
   PROP_WINDOW_SIZE,
   PROP_GAUSS_SIGMA,
+  PROP_FAST,
+  PROP_N_THREADS,
+  PROP_BAND_HEIGHT,
+  PROP_BAND_STATS,
+  PROP_MACROBLOCK_STATS,
 };
 
 
@@ -61,8 +66,33 @@ typedef struct _GstSSimWindowCache {
   gfloat element_summ;
 } GstSSimWindowCache;
 
-typedef void (*GstSSimFunction) (GstSSim *ssim, guint8 *org, gfloat *orgmu,
-    guint8 *mod, guint8 *out, gfloat *mean, gfloat *lowest, gfloat *highest);
+typedef struct _GstSSimBand GstSSimBand;
+
+typedef void (*GstSSimFunction) (GstSSim *ssim, GstSSimBand *band);
+
+/* A horizontal band of a frame, the unit of work of the SSIM functions */
+struct _GstSSimBand {
+  GstSSimFunction func;
+
+  guint8         *org;
+  gfloat         *orgmu;
+  guint8         *mod;
+  guint8         *out;
+
+  /* Rows [ystart, yend) of the frame */
+  gint            ystart;
+  gint            yend;
+
+  /* Sums of the SSIM index per macroblock, shared by all bands of a frame.
+   * Bands start on macroblock boundaries, so a band only touches its own
+   * macroblock rows */
+  gfloat         *mb_summ;
+
+  /* Results */
+  gfloat          summ;
+  gfloat          lowest;
+  gfloat          highest;
+};
 
 typedef struct _GstSSimOutputContext GstSSimOutputContext;
 
@@ -110,6 +140,32 @@ struct _GstSSim {
   /* Array of windowsize*windowsize gfloats */
   gfloat         *weights;
 
+  /* Array of windowsize gfloats, weights[y][x] == kernel[y] * kernel[x] */
+  gfloat         *kernel;
+
+  /* Arrays of width and height gfloats, the sum of the (clipped) window
+   * weights of pixel (x, y) is kernel_wx[x] * kernel_wy[y] */
+  gfloat         *kernel_wx;
+  gfloat         *kernel_wy;
+
+  /* Use separable filtering to compute the window statistics */
+  gboolean        fast;
+
+  /* Number of threads computing bands in parallel */
+  gint            n_threads;
+
+  /* Height of a band (0 - split the frame evenly between threads) */
+  gint            band_height;
+
+  /* Report per-band/per-macroblock SSIM in the element message */
+  gboolean        band_stats;
+  gboolean        macroblock_stats;
+
+  GThreadPool    *pool;
+  GMutex         *bands_lock;
+  GCond          *bands_cond;
+  gint            bands_pending;
+
   /* For Gaussian function */
   gfloat          sigma;
   
@@ -27,6 +27,7 @@
 #include "gstshmsink.h"
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
 #include <string.h>
 
@@ -45,7 +46,17 @@ enum
   PROP_SOCKET_PATH,
   PROP_PERMS,
   PROP_SHM_SIZE,
-  PROP_WAIT_FOR_CONNECTION
+  PROP_WAIT_FOR_CONNECTION,
+  PROP_SHM_USED,
+  PROP_SHM_LARGEST_FREE,
+  PROP_SHM_FREE_CHUNKS,
+  PROP_FRAGMENTATION,
+  PROP_ALLOC_WAITS,
+  PROP_RING_SIZE,
+  PROP_POOL_BUFFERS,
+  PROP_ZERO_COPY_BUFFERS,
+  PROP_COPIED_BUFFERS,
+  PROP_CLIENT_STATS
 };
 
 struct GstShmClient
@@ -54,9 +65,18 @@ struct GstShmClient
   GstPollFD pollfd;
 };
 
+struct GstShmPoolBlock
+{
+  GstShmSink *sink;
+  ShmBlock *block;
+  guint generation;
+};
+
 #define DEFAULT_SIZE ( 256 * 1024 )
 #define DEFAULT_WAIT_FOR_CONNECTION (TRUE)
 #define DEFAULT_PERMS (S_IRWXU | S_IRWXG)
+#define DEFAULT_RING_SIZE (0)
+#define DEFAULT_POOL_BUFFERS (0)
 
 
 GST_DEBUG_CATEGORY_STATIC (shmsink_debug);
@@ -77,6 +97,7 @@ static void gst_shm_sink_get_property (GObject * object, guint prop_id,
 
 static gboolean gst_shm_sink_start (GstBaseSink * bsink);
 static gboolean gst_shm_sink_stop (GstBaseSink * bsink);
+static gboolean gst_shm_sink_set_caps (GstBaseSink * bsink, GstCaps * caps);
 static GstFlowReturn gst_shm_sink_render (GstBaseSink * bsink, GstBuffer * buf);
 static GstFlowReturn gst_shm_sink_buffer_alloc (GstBaseSink * sink,
     guint64 offset, guint size, GstCaps * caps, GstBuffer ** out_buf);
@@ -87,6 +108,10 @@ static gboolean gst_shm_sink_unlock_stop (GstBaseSink * bsink);
 
 static gpointer pollthread_func (gpointer data);
 
+static void gst_shm_sink_configure_pool (GstShmSink * self, guint block_size);
+static guint gst_shm_sink_pool_area_size (GstShmSink * self);
+static void gst_shm_sink_clear_pool (GstShmSink * self);
+
 static guint signals[LAST_SIGNAL] = { 0 };
 
 static void
@@ -111,6 +136,8 @@ gst_shm_sink_init (GstShmSink * self, GstShmSinkClass * g_class)
   self->size = DEFAULT_SIZE;
   self->wait_for_connection = DEFAULT_WAIT_FOR_CONNECTION;
   self->perms = DEFAULT_PERMS;
+  self->ring_size = DEFAULT_RING_SIZE;
+  self->pool_buffers = DEFAULT_POOL_BUFFERS;
 }
 
 static void
@@ -130,6 +157,7 @@ gst_shm_sink_class_init (GstShmSinkClass * klass)
 
   gstbasesink_class->start = GST_DEBUG_FUNCPTR (gst_shm_sink_start);
   gstbasesink_class->stop = GST_DEBUG_FUNCPTR (gst_shm_sink_stop);
+  gstbasesink_class->set_caps = GST_DEBUG_FUNCPTR (gst_shm_sink_set_caps);
   gstbasesink_class->render = GST_DEBUG_FUNCPTR (gst_shm_sink_render);
   gstbasesink_class->event = GST_DEBUG_FUNCPTR (gst_shm_sink_event);
   gstbasesink_class->unlock = GST_DEBUG_FUNCPTR (gst_shm_sink_unlock);
@@ -163,6 +191,80 @@ gst_shm_sink_class_init (GstShmSinkClass * klass)
           DEFAULT_WAIT_FOR_CONNECTION,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_SHM_USED,
+      g_param_spec_uint ("shm-used",
+          "Used shared memory",
+          "Bytes of the shared memory area currently allocated",
+          0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHM_LARGEST_FREE,
+      g_param_spec_uint ("shm-largest-free",
+          "Largest free block",
+          "Size of the largest buffer that can currently be allocated",
+          0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHM_FREE_CHUNKS,
+      g_param_spec_uint ("shm-free-chunks",
+          "Free chunks",
+          "Number of separate free chunks in the shared memory area",
+          0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRAGMENTATION,
+      g_param_spec_double ("fragmentation",
+          "Fragmentation",
+          "Fraction of the free shared memory outside of the largest free "
+          "block (0 = not fragmented)",
+          0.0, 1.0, 0.0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ALLOC_WAITS,
+      g_param_spec_uint64 ("alloc-waits",
+          "Allocation waits",
+          "Number of times rendering had to wait for shared memory to "
+          "be released",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RING_SIZE,
+      g_param_spec_uint ("ring-size",
+          "Descriptor ring size",
+          "Number of buffer descriptors queued in shared memory for each "
+          "client, announcing and releasing buffers in batches instead of "
+          "one socket message per buffer (0 = disabled, applies to new "
+          "clients)",
+          0, 65536, DEFAULT_RING_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_POOL_BUFFERS,
+      g_param_spec_uint ("pool-buffers",
+          "Pool buffers",
+          "Number of frames in flight to keep a pool of shared memory "
+          "buffers for, upstream allocations are served from the pool and "
+          "the shared memory area is grown to fit it (0 = no pool)",
+          0, 1024, DEFAULT_POOL_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ZERO_COPY_BUFFERS,
+      g_param_spec_uint64 ("zero-copy-buffers",
+          "Zero-copy buffers",
+          "Number of buffers sent that were already in shared memory",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COPIED_BUFFERS,
+      g_param_spec_uint64 ("copied-buffers",
+          "Copied buffers",
+          "Number of buffers that had to be copied into shared memory",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CLIENT_STATS,
+      g_param_spec_value_array ("client-stats",
+          "Client statistics",
+          "One structure per connected client with its fd, the number of "
+          "buffers it has not released yet (lag), the highest lag seen and "
+          "the number of buffers sent to it and dropped for it",
+          g_param_spec_boxed ("client-stat", "Client statistic",
+              "Statistics of one client", GST_TYPE_STRUCTURE,
+              G_PARAM_READABLE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   signals[SIGNAL_CLIENT_CONNECTED] = g_signal_new ("client-connected",
       GST_TYPE_SHM_SINK, G_SIGNAL_RUN_LAST, 0, NULL, NULL,
       g_cclosure_marshal_VOID__INT, G_TYPE_NONE, 1, G_TYPE_INT);
@@ -213,15 +315,22 @@ gst_shm_sink_set_property (GObject * object, guint prop_id,
       break;
     case PROP_SHM_SIZE:
       GST_OBJECT_LOCK (object);
+      self->size = g_value_get_uint (value);
       if (self->pipe) {
-        if (sp_writer_resize (self->pipe, g_value_get_uint (value)) < 0)
-          GST_DEBUG_OBJECT (self, "Resized shared memory area from %u to "
-              "%u bytes", self->size, g_value_get_uint (value));
-        else
+        /* never shrink below what the pool needs */
+        guint area_size = MAX (self->size, gst_shm_sink_pool_area_size (self));
+
+        if (sp_writer_resize (self->pipe, area_size) < 0) {
           GST_WARNING_OBJECT (self, "Could not resize shared memory area from"
-              "%u to %u bytes", self->size, g_value_get_uint (value));
+              " %u to %u bytes", self->area_size, area_size);
+        } else {
+          GST_DEBUG_OBJECT (self, "Resized shared memory area from %u to "
+              "%u bytes", self->area_size, area_size);
+          self->area_size = area_size;
+        }
       }
-      self->size = g_value_get_uint (value);
+      /* a pool that did not fit may fit now */
+      self->pool_disabled = FALSE;
       GST_OBJECT_UNLOCK (object);
       break;
     case PROP_WAIT_FOR_CONNECTION:
@@ -230,6 +339,19 @@ gst_shm_sink_set_property (GObject * object, guint prop_id,
       GST_OBJECT_UNLOCK (object);
       g_cond_broadcast (self->cond);
       break;
+    case PROP_RING_SIZE:
+      GST_OBJECT_LOCK (object);
+      self->ring_size = g_value_get_uint (value);
+      if (self->pipe)
+        sp_writer_set_ring_size (self->pipe, self->ring_size);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_POOL_BUFFERS:
+      GST_OBJECT_LOCK (object);
+      self->pool_buffers = g_value_get_uint (value);
+      gst_shm_sink_configure_pool (self, self->pool_block_size);
+      GST_OBJECT_UNLOCK (object);
+      break;
     default:
       break;
   }
@@ -264,6 +386,68 @@ gst_shm_sink_get_property (GObject * object, guint prop_id,
     case PROP_WAIT_FOR_CONNECTION:
       g_value_set_boolean (value, self->wait_for_connection);
       break;
+    case PROP_SHM_USED:
+    case PROP_SHM_LARGEST_FREE:
+    case PROP_SHM_FREE_CHUNKS:
+    case PROP_FRAGMENTATION:
+    {
+      ShmAllocStats stats = { 0, };
+
+      if (self->pipe)
+        sp_writer_get_alloc_stats (self->pipe, &stats);
+
+      if (prop_id == PROP_SHM_USED)
+        g_value_set_uint (value, stats.used);
+      else if (prop_id == PROP_SHM_LARGEST_FREE)
+        g_value_set_uint (value, stats.largest_free);
+      else if (prop_id == PROP_SHM_FREE_CHUNKS)
+        g_value_set_uint (value, stats.num_free_chunks);
+      else if (stats.free > 0)
+        g_value_set_double (value,
+            1.0 - (gdouble) stats.largest_free / stats.free);
+      else
+        g_value_set_double (value, 0.0);
+      break;
+    }
+    case PROP_ALLOC_WAITS:
+      g_value_set_uint64 (value, self->alloc_waits);
+      break;
+    case PROP_RING_SIZE:
+      g_value_set_uint (value, self->ring_size);
+      break;
+    case PROP_POOL_BUFFERS:
+      g_value_set_uint (value, self->pool_buffers);
+      break;
+    case PROP_ZERO_COPY_BUFFERS:
+      g_value_set_uint64 (value, self->zero_copy_buffers);
+      break;
+    case PROP_COPIED_BUFFERS:
+      g_value_set_uint64 (value, self->copied_buffers);
+      break;
+    case PROP_CLIENT_STATS:
+    {
+      GValueArray *array = g_value_array_new (0);
+      GList *item;
+
+      for (item = self->clients; item; item = item->next) {
+        struct GstShmClient *gclient = item->data;
+        ShmClientStats stats;
+        GValue v = { 0, };
+
+        sp_writer_get_client_stats (gclient->client, &stats);
+        g_value_init (&v, GST_TYPE_STRUCTURE);
+        g_value_take_boxed (&v, gst_structure_new ("shm-client-stats",
+                "fd", G_TYPE_INT, gclient->pollfd.fd,
+                "lag", G_TYPE_UINT, stats.lag,
+                "max-lag", G_TYPE_UINT, stats.max_lag,
+                "sent", G_TYPE_UINT64, (guint64) stats.sent,
+                "dropped", G_TYPE_UINT64, (guint64) stats.dropped, NULL));
+        g_value_array_append (array, &v);
+        g_value_unset (&v);
+      }
+      g_value_take_boxed (value, array);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -280,6 +464,9 @@ gst_shm_sink_start (GstBaseSink * bsink)
   GstShmSink *self = GST_SHM_SINK (bsink);
 
   self->stop = FALSE;
+  self->alloc_waits = 0;
+  self->zero_copy_buffers = 0;
+  self->copied_buffers = 0;
 
   if (!self->socket_path) {
     GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ_WRITE,
@@ -291,6 +478,7 @@ gst_shm_sink_start (GstBaseSink * bsink)
       " with shared memory of %d bytes", self->socket_path, self->size);
 
   self->pipe = sp_writer_create (self->socket_path, self->size, self->perms);
+  self->area_size = self->size;
 
   if (!self->pipe) {
     GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ_WRITE,
@@ -298,6 +486,8 @@ gst_shm_sink_start (GstBaseSink * bsink)
     return FALSE;
   }
 
+  sp_writer_set_ring_size (self->pipe, self->ring_size);
+
   g_free (self->socket_path);
   self->socket_path = g_strdup (sp_writer_get_path (self->pipe));
 
@@ -340,6 +530,12 @@ gst_shm_sink_stop (GstBaseSink * bsink)
 
   GST_DEBUG_OBJECT (self, "Stopping");
 
+  GST_OBJECT_LOCK (self);
+  gst_shm_sink_clear_pool (self);
+  self->pool_block_size = 0;
+  self->pool_disabled = FALSE;
+  GST_OBJECT_UNLOCK (self);
+
   while (self->clients) {
     struct GstShmClient *client = self->clients->data;
     self->clients = g_list_remove (self->clients, client);
@@ -358,6 +554,162 @@ gst_shm_sink_stop (GstBaseSink * bsink)
   return TRUE;
 }
 
+/* Called with the object lock held */
+static void
+gst_shm_sink_clear_pool (GstShmSink * self)
+{
+  while (self->pool) {
+    struct GstShmPoolBlock *pb = self->pool->data;
+
+    self->pool = g_slist_delete_link (self->pool, self->pool);
+    sp_writer_free_block (pb->block);
+    g_slice_free (struct GstShmPoolBlock, pb);
+  }
+
+  /* blocks still out there are freed when they come back */
+  self->pool_allocated = 0;
+  self->pool_generation++;
+}
+
+/* Called with the object lock held, returns the size of the shared memory
+ * area the configured pool needs, 0 if there is no pool */
+static guint
+gst_shm_sink_pool_area_size (GstShmSink * self)
+{
+  guint64 needed;
+
+  if (self->pool_buffers == 0 || self->pool_block_size == 0)
+    return 0;
+
+  /* keep room for one buffer that does not come from the pool */
+  needed = (guint64) (self->pool_buffers + 1) * self->pool_block_size;
+
+  return MIN (needed, G_MAXUINT);
+}
+
+/* Called with the object lock held */
+static void
+gst_shm_sink_configure_pool (GstShmSink * self, guint block_size)
+{
+  guint needed;
+
+  gst_shm_sink_clear_pool (self);
+  self->pool_block_size = block_size;
+  self->pool_disabled = FALSE;
+
+  needed = gst_shm_sink_pool_area_size (self);
+  if (needed == 0 || self->pipe == NULL || needed <= self->area_size)
+    return;
+
+  if (needed == G_MAXUINT || sp_writer_resize (self->pipe, needed) < 0) {
+    GST_WARNING_OBJECT (self, "Could not grow shared memory area to %u"
+        " bytes for a pool of %u buffers of %u bytes, not pooling",
+        needed, self->pool_buffers, block_size);
+    self->pool_block_size = 0;
+    self->pool_disabled = TRUE;
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "Grew shared memory area from %u to %u bytes for"
+      " a pool of %u buffers of %u bytes", self->area_size, needed,
+      self->pool_buffers, block_size);
+  self->area_size = needed;
+}
+
+/* Called with the object lock held, returns a block that no client is
+ * reading from anymore, or NULL if there is none to wait for */
+static GstFlowReturn
+gst_shm_sink_pool_acquire (GstShmSink * self, guint size,
+    struct GstShmPoolBlock **out_pb)
+{
+  struct GstShmPoolBlock *pb;
+  GSList *item;
+
+  *out_pb = NULL;
+
+  while (self->pipe && size <= self->pool_block_size) {
+    for (item = self->pool; item; item = item->next) {
+      pb = item->data;
+      if (!sp_writer_block_in_flight (pb->block)) {
+        self->pool = g_slist_delete_link (self->pool, item);
+        *out_pb = pb;
+        return GST_FLOW_OK;
+      }
+    }
+
+    if (self->pool_allocated < self->pool_buffers) {
+      ShmBlock *block = sp_writer_alloc_block (self->pipe,
+          self->pool_block_size);
+
+      if (block) {
+        pb = g_slice_new (struct GstShmPoolBlock);
+        pb->sink = NULL;
+        pb->block = block;
+        pb->generation = self->pool_generation;
+        self->pool_allocated++;
+        *out_pb = pb;
+        return GST_FLOW_OK;
+      }
+    }
+
+    /* All our blocks are held upstream, waiting could deadlock */
+    if (!self->pool)
+      break;
+
+    self->alloc_waits++;
+    sp_writer_flush_acks (self->pipe);
+    g_cond_wait (self->cond, GST_OBJECT_GET_LOCK (self));
+    if (self->unlock)
+      return GST_FLOW_WRONG_STATE;
+  }
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_shm_sink_pool_free_buffer (gpointer data)
+{
+  struct GstShmPoolBlock *pb = data;
+  GstShmSink *self = pb->sink;
+
+  GST_OBJECT_LOCK (self);
+  pb->sink = NULL;
+  if (pb->generation == self->pool_generation) {
+    /* oldest first, it is the most likely to be released by the clients */
+    self->pool = g_slist_append (self->pool, pb);
+  } else {
+    sp_writer_free_block (pb->block);
+    g_slice_free (struct GstShmPoolBlock, pb);
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  g_cond_broadcast (self->cond);
+  gst_object_unref (self);
+}
+
+static gboolean
+gst_shm_sink_set_caps (GstBaseSink * bsink, GstCaps * caps)
+{
+  GstShmSink *self = GST_SHM_SINK (bsink);
+  GstVideoFormat format;
+  gint width, height;
+  guint frame_size = 0;
+
+  /* For raw video we know the frame size, otherwise the pool is sized from
+   * the first allocation */
+  if (gst_video_format_parse_caps (caps, &format, &width, &height))
+    frame_size = gst_video_format_get_size (format, width, height);
+
+  GST_OBJECT_LOCK (self);
+  if (frame_size != self->pool_block_size) {
+    GST_DEBUG_OBJECT (self, "Pool block size %u", frame_size);
+    gst_shm_sink_configure_pool (self, frame_size);
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_shm_sink_render (GstBaseSink * bsink, GstBuffer * buf)
 {
@@ -376,11 +728,16 @@ gst_shm_sink_render (GstBaseSink * bsink, GstBuffer * buf)
   rv = sp_writer_send_buf (self->pipe, (char *) GST_BUFFER_DATA (buf),
       GST_BUFFER_SIZE (buf));
 
+  if (rv > 0)
+    self->zero_copy_buffers++;
+
   if (rv == -1) {
     ShmBlock *block = NULL;
     gchar *shmbuf = NULL;
     while ((block = sp_writer_alloc_block (self->pipe,
                 GST_BUFFER_SIZE (buf))) == NULL) {
+      self->alloc_waits++;
+      sp_writer_flush_acks (self->pipe);
       g_cond_wait (self->cond, GST_OBJECT_GET_LOCK (self));
       if (self->unlock) {
         GST_OBJECT_UNLOCK (self);
@@ -401,6 +758,7 @@ gst_shm_sink_render (GstBaseSink * bsink, GstBuffer * buf)
     memcpy (shmbuf, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
     sp_writer_send_buf (self->pipe, shmbuf, GST_BUFFER_SIZE (buf));
     sp_writer_free_block (block);
+    self->copied_buffers++;
   }
 
   GST_OBJECT_UNLOCK (self);
@@ -421,16 +779,44 @@ gst_shm_sink_buffer_alloc (GstBaseSink * sink, guint64 offset, guint size,
 {
   GstShmSink *self = GST_SHM_SINK (sink);
   GstBuffer *buffer;
+  struct GstShmPoolBlock *pb = NULL;
   ShmBlock *block = NULL;
   gpointer buf = NULL;
 
   GST_OBJECT_LOCK (self);
-  block = sp_writer_alloc_block (self->pipe, size);
-  if (block)
-    buf = sp_writer_block_get_buf (block);
+  if (self->pool_buffers > 0 && self->pipe) {
+    GstFlowReturn ret;
+
+    if (self->pool_block_size == 0 && !self->pool_disabled)
+      gst_shm_sink_configure_pool (self, size);
+
+    ret = gst_shm_sink_pool_acquire (self, size, &pb);
+    if (ret != GST_FLOW_OK) {
+      GST_OBJECT_UNLOCK (self);
+      return ret;
+    }
+  }
+
+  if (pb) {
+    buf = sp_writer_block_get_buf (pb->block);
+  } else {
+    block = sp_writer_alloc_block (self->pipe, size);
+    if (block)
+      buf = sp_writer_block_get_buf (block);
+  }
   GST_OBJECT_UNLOCK (self);
 
-  if (block) {
+  if (pb) {
+    pb->sink = gst_object_ref (self);
+    buffer = gst_buffer_new ();
+    GST_BUFFER_DATA (buffer) = buf;
+    GST_BUFFER_MALLOCDATA (buffer) = (guint8 *) pb;
+    GST_BUFFER_FREE_FUNC (buffer) =
+        GST_DEBUG_FUNCPTR (gst_shm_sink_pool_free_buffer);
+    GST_BUFFER_SIZE (buffer) = size;
+    GST_LOG_OBJECT (self, "Allocated buffer of %u bytes from the pool at %p",
+        size, buf);
+  } else if (block) {
     buffer = gst_buffer_new ();
     GST_BUFFER_DATA (buffer) = buf;
     GST_BUFFER_MALLOCDATA (buffer) = (guint8 *) block;
@@ -563,8 +949,10 @@ gst_shm_sink_event (GstBaseSink * bsink, GstEvent * event)
     case GST_EVENT_EOS:
       GST_OBJECT_LOCK (self);
       while (self->wait_for_connection && sp_writer_pending_writes (self->pipe)
-          && !self->unlock)
+          && !self->unlock) {
+        sp_writer_flush_acks (self->pipe);
         g_cond_wait (self->cond, GST_OBJECT_GET_LOCK (self));
+      }
       GST_OBJECT_UNLOCK (self);
       break;
     default:
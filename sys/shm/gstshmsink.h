@@ -51,6 +51,8 @@ struct _GstShmSink
 
   guint perms;
   guint size;
+  /* size of the shared memory area, grown beyond size for the pool */
+  guint area_size;
 
   GList *clients;
 
@@ -63,6 +65,25 @@ struct _GstShmSink
   gboolean unlock;
 
   GCond *cond;
+
+  /* times rendering waited for a free block */
+  guint64 alloc_waits;
+
+  guint ring_size;
+
+  /* pool of fixed size blocks handed to upstream, recycled once the
+   * clients have released them */
+  guint pool_buffers;
+  guint pool_block_size;
+  guint pool_allocated;
+  guint pool_generation;
+  GSList *pool;
+  /* the area could not grow for the pool, don't retry until the caps or the
+   * properties change */
+  gboolean pool_disabled;
+
+  guint64 zero_copy_buffers;
+  guint64 copied_buffers;
 };
 
 struct _GstShmSinkClass
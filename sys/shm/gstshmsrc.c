@@ -40,9 +40,35 @@ enum
 {
   PROP_0,
   PROP_SOCKET_PATH,
-  PROP_IS_LIVE
+  PROP_IS_LIVE,
+  PROP_POLICY,
+  PROP_MAX_LAG,
+  PROP_DROPPED
 };
 
+#define DEFAULT_POLICY SHM_CLIENT_POLICY_BLOCK
+#define DEFAULT_MAX_LAG 0
+
+#define GST_TYPE_SHM_SRC_POLICY (gst_shm_src_policy_get_type ())
+static GType
+gst_shm_src_policy_get_type (void)
+{
+  static GType policy_type = 0;
+  static const GEnumValue policy_types[] = {
+    {SHM_CLIENT_POLICY_BLOCK, "Make the sink wait for this source", "block"},
+    {SHM_CLIENT_POLICY_DROP_OLDEST, "Skip to the newest buffer when behind",
+        "drop-oldest"},
+    {SHM_CLIENT_POLICY_DROP_CLIENT, "Get disconnected when behind",
+        "drop-client"},
+    {0, NULL, NULL}
+  };
+
+  if (!policy_type) {
+    policy_type = g_enum_register_static ("GstShmSrcPolicy", policy_types);
+  }
+  return policy_type;
+}
+
 struct GstShmBuffer
 {
   char *buf;
@@ -124,12 +150,33 @@ gst_shm_src_class_init (GstShmSrcClass * klass)
           "True if the element cannot produce data in PAUSED", FALSE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_POLICY,
+      g_param_spec_enum ("policy", "Backpressure policy",
+          "What happens when this source falls behind the sink, the sink "
+          "only applies it once max-lag buffers are not released",
+          GST_TYPE_SHM_SRC_POLICY, DEFAULT_POLICY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_LAG,
+      g_param_spec_uint ("max-lag", "Maximum lag",
+          "Number of buffers this source can hold before the sink stops "
+          "waiting for it (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_MAX_LAG,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DROPPED,
+      g_param_spec_uint64 ("dropped", "Dropped buffers",
+          "Number of buffers skipped to catch up with the sink",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   GST_DEBUG_CATEGORY_INIT (shmsrc_debug, "shmsrc", 0, "Shared Memory Source");
 }
 
 static void
 gst_shm_src_init (GstShmSrc * self, GstShmSrcClass * g_class)
 {
+  self->policy = DEFAULT_POLICY;
+  self->max_lag = DEFAULT_MAX_LAG;
 }
 
 
@@ -155,6 +202,16 @@ gst_shm_src_set_property (GObject * object, guint prop_id,
       gst_base_src_set_live (GST_BASE_SRC (object),
           g_value_get_boolean (value));
       break;
+    case PROP_POLICY:
+      GST_OBJECT_LOCK (object);
+      self->policy = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_MAX_LAG:
+      GST_OBJECT_LOCK (object);
+      self->max_lag = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (object);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -176,6 +233,21 @@ gst_shm_src_get_property (GObject * object, guint prop_id,
     case PROP_IS_LIVE:
       g_value_set_boolean (value, gst_base_src_is_live (GST_BASE_SRC (object)));
       break;
+    case PROP_POLICY:
+      GST_OBJECT_LOCK (object);
+      g_value_set_enum (value, self->policy);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_MAX_LAG:
+      GST_OBJECT_LOCK (object);
+      g_value_set_uint (value, self->max_lag);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_DROPPED:
+      GST_OBJECT_LOCK (object);
+      g_value_set_uint64 (value, self->dropped);
+      GST_OBJECT_UNLOCK (object);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -201,6 +273,11 @@ gst_shm_src_start (GstBaseSrc * bsrc)
 
   GST_OBJECT_LOCK (self);
   gstpipe->pipe = sp_client_open (self->socket_path);
+  if (gstpipe->pipe && (self->policy != SHM_CLIENT_POLICY_BLOCK ||
+          self->max_lag > 0) && !sp_client_set_policy (gstpipe->pipe,
+          self->policy, self->max_lag))
+    GST_WARNING_OBJECT (self, "Could not send policy to the sink");
+  self->dropped = 0;
   GST_OBJECT_UNLOCK (self);
 
   if (!gstpipe->pipe) {
@@ -305,6 +382,28 @@ gst_shm_src_create (GstPushSrc * psrc, GstBuffer ** outbuf)
     }
   } while (buf == NULL);
 
+  /* Release what is queued behind and keep the newest buffer */
+  while (self->policy == SHM_CLIENT_POLICY_DROP_OLDEST &&
+      gst_poll_wait (self->poll, 0) > 0 &&
+      gst_poll_fd_can_read (self->poll, &self->pollfd)) {
+    gchar *newbuf = NULL;
+    int newrv;
+
+    GST_OBJECT_LOCK (self);
+    newrv = sp_client_recv (self->pipe->pipe, &newbuf);
+    if (newrv > 0 && newbuf) {
+      sp_client_recv_finish (self->pipe->pipe, buf);
+      buf = newbuf;
+      rv = newrv;
+      self->dropped++;
+    }
+    GST_OBJECT_UNLOCK (self);
+
+    /* errors are reported on the next call */
+    if (newrv < 0)
+      break;
+  }
+
   GST_LOG_OBJECT (self, "Got buffer %p of size %d", buf, rv);
 
   gsb = g_slice_new0 (struct GstShmBuffer);
@@ -56,6 +56,11 @@ struct _GstShmSrc
 
   GstFlowReturn flow_return;
   gboolean unlocked;
+
+  ShmClientPolicy policy;
+  guint max_lag;
+  /* buffers skipped to catch up */
+  guint64 dropped;
 };
 
 struct _GstShmSrcClass
@@ -33,11 +33,31 @@
 #include <string.h>
 #include <assert.h>
 
+/* Free space is kept in segregated lists, one per power of two size class,
+ * with a bitmap of the non-empty classes. An allocation takes the first
+ * chunk of the smallest class whose chunks are all big enough, so both
+ * allocating and freeing take constant time. All chunks, free or not, are
+ * also linked in address order so that freed chunks can be merged with their
+ * free neighbours right away. */
+
+#define SHM_ALLOC_CLASSES (sizeof (unsigned long) * 8)
+
 struct _ShmAllocSpace
 {
   size_t size;
 
-  ShmAllocBlock *blocks;
+  /* all chunks in address order */
+  ShmAllocBlock *chunks;
+
+  ShmAllocBlock *free_lists[SHM_ALLOC_CLASSES];
+  unsigned long free_map;
+
+  /* most recently allocated block, to speed up lookups */
+  ShmAllocBlock *last;
+
+  unsigned long used;
+  unsigned int num_blocks;
+  unsigned int num_free_chunks;
 };
 
 struct _ShmAllocBlock
@@ -49,9 +69,91 @@ struct _ShmAllocBlock
   unsigned long offset;
   unsigned long size;
 
+  /* neighbours in address order */
+  ShmAllocBlock *prev;
   ShmAllocBlock *next;
+
+  /* links in the size class list, for free chunks */
+  int free;
+  ShmAllocBlock *prev_free;
+  ShmAllocBlock *next_free;
 };
 
+/* index of the highest bit set, size must not be 0 */
+static unsigned int
+size_class (unsigned long size)
+{
+#if defined(__GNUC__) && (__GNUC__ >= 4)
+  return SHM_ALLOC_CLASSES - 1 - __builtin_clzl (size);
+#else
+  unsigned int c = 0;
+
+  while (size >>= 1)
+    c++;
+  return c;
+#endif
+}
+
+static unsigned int
+lowest_bit (unsigned long map)
+{
+#if defined(__GNUC__) && (__GNUC__ >= 4)
+  return __builtin_ctzl (map);
+#else
+  unsigned int c = 0;
+
+  while (!(map & 1)) {
+    map >>= 1;
+    c++;
+  }
+  return c;
+#endif
+}
+
+static void
+free_list_insert (ShmAllocSpace * self, ShmAllocBlock * chunk)
+{
+  unsigned int c = size_class (chunk->size);
+
+  chunk->free = 1;
+  chunk->prev_free = NULL;
+  chunk->next_free = self->free_lists[c];
+  if (chunk->next_free)
+    chunk->next_free->prev_free = chunk;
+  self->free_lists[c] = chunk;
+  self->free_map |= 1UL << c;
+  self->num_free_chunks++;
+}
+
+static void
+free_list_remove (ShmAllocSpace * self, ShmAllocBlock * chunk)
+{
+  unsigned int c = size_class (chunk->size);
+
+  if (chunk->prev_free)
+    chunk->prev_free->next_free = chunk->next_free;
+  else
+    self->free_lists[c] = chunk->next_free;
+  if (chunk->next_free)
+    chunk->next_free->prev_free = chunk->prev_free;
+  if (!self->free_lists[c])
+    self->free_map &= ~(1UL << c);
+  chunk->free = 0;
+  self->num_free_chunks--;
+}
+
+static ShmAllocBlock *
+chunk_new (ShmAllocSpace * self, unsigned long offset, unsigned long size)
+{
+  ShmAllocBlock *chunk = spalloc_new (ShmAllocBlock);
+
+  memset (chunk, 0, sizeof (ShmAllocBlock));
+  chunk->space = self;
+  chunk->offset = offset;
+  chunk->size = size;
+
+  return chunk;
+}
 
 ShmAllocSpace *
 shm_alloc_space_new (size_t size)
@@ -62,13 +164,22 @@ shm_alloc_space_new (size_t size)
 
   self->size = size;
 
+  if (size > 0) {
+    self->chunks = chunk_new (self, 0, size);
+    free_list_insert (self, self->chunks);
+  }
+
   return self;
 }
 
 void
 shm_alloc_space_free (ShmAllocSpace * self)
 {
-  assert (self && self->blocks == NULL);
+  assert (self && self->num_blocks == 0);
+
+  /* only the single free chunk spanning the space is left */
+  if (self->chunks)
+    spalloc_free (ShmAllocBlock, self->chunks);
   spalloc_free (ShmAllocSpace, self);
 }
 
@@ -76,45 +187,49 @@ shm_alloc_space_free (ShmAllocSpace * self)
 ShmAllocBlock *
 shm_alloc_space_alloc_block (ShmAllocSpace * self, unsigned long size)
 {
-  ShmAllocBlock *block;
-  ShmAllocBlock *item = NULL;
-  ShmAllocBlock *prev_item = NULL;
-  unsigned long prev_end_offset = 0;
-
-
-  for (item = self->blocks; item; item = item->next) {
-    unsigned long max_size = 0;
+  ShmAllocBlock *block = NULL;
+  unsigned int c, first;
+
+  if (size == 0)
+    size = 1;
+
+  /* all the chunks of the classes above that of size are big enough, and
+   * so are those of its own class for a power of two */
+  c = size_class (size);
+  first = (size & (size - 1)) == 0 ? c : c + 1;
+  if (first < SHM_ALLOC_CLASSES && (self->free_map >> first))
+    block = self->free_lists[lowest_bit (self->free_map >> first) + first];
+
+  /* otherwise only some chunks of the same class may fit */
+  if (!block) {
+    for (block = self->free_lists[c]; block; block = block->next_free)
+      if (block->size >= size)
+        break;
+  }
 
-    max_size = item->offset - prev_end_offset;
+  if (!block)
+    return NULL;
 
-    if (max_size >= size)
-      break;
+  free_list_remove (self, block);
 
-    prev_end_offset = item->offset + item->size;
-    prev_item = item;
-  }
+  /* put the remainder back */
+  if (block->size > size) {
+    ShmAllocBlock *rest = chunk_new (self, block->offset + size,
+        block->size - size);
 
-  /* Did not find space before an existing block */
-  if (self->blocks && !item) {
-    /* Return NULL if there is no big enough space, otherwise, there is space
-     * at the end */
-    if (self->size - prev_end_offset < size)
-      return NULL;
+    rest->prev = block;
+    rest->next = block->next;
+    if (rest->next)
+      rest->next->prev = rest;
+    block->next = rest;
+    block->size = size;
+    free_list_insert (self, rest);
   }
 
-  block = spalloc_new (ShmAllocBlock);
-  memset (block, 0, sizeof (ShmAllocBlock));
-  block->offset = prev_end_offset;
-  block->size = size;
   block->use_count = 1;
-  block->space = self;
-
-  if (prev_item)
-    prev_item->next = block;
-  else
-    self->blocks = block;
-
-  block->next = item;
+  self->used += size;
+  self->num_blocks++;
+  self->last = block;
 
   return block;
 }
@@ -125,40 +240,84 @@ shm_alloc_space_alloc_block_get_offset (ShmAllocBlock * block)
   return block->offset;
 }
 
+/* merges chunk into its predecessor and frees it */
+static void
+chunk_merge_into_prev (ShmAllocBlock * chunk)
+{
+  ShmAllocBlock *prev = chunk->prev;
+
+  prev->size += chunk->size;
+  prev->next = chunk->next;
+  if (chunk->next)
+    chunk->next->prev = prev;
+  spalloc_free (ShmAllocBlock, chunk);
+}
+
 static void
 shm_alloc_space_free_block (ShmAllocBlock * block)
 {
-  ShmAllocBlock *item = NULL;
-  ShmAllocBlock *prev_item = NULL;
   ShmAllocSpace *self = block->space;
 
-  for (item = self->blocks; item; item = item->next) {
-    if (item == block) {
-      if (prev_item)
-        prev_item->next = item->next;
-      else
-        self->blocks = item->next;
-      break;
-    }
-    prev_item = item;
+  self->used -= block->size;
+  self->num_blocks--;
+  if (self->last == block)
+    self->last = NULL;
+
+  if (block->next && block->next->free) {
+    free_list_remove (self, block->next);
+    chunk_merge_into_prev (block->next);
+  }
+  if (block->prev && block->prev->free) {
+    ShmAllocBlock *prev = block->prev;
+
+    free_list_remove (self, prev);
+    chunk_merge_into_prev (block);
+    block = prev;
   }
 
-  spalloc_free (ShmAllocBlock, block);
+  free_list_insert (self, block);
 }
 
 ShmAllocBlock *
 shm_alloc_space_block_get (ShmAllocSpace * self, unsigned long offset)
 {
-  ShmAllocBlock *block = NULL;
+  ShmAllocBlock *block = self->last;
+
+  /* usually the block that was just allocated */
+  if (block && block->offset <= offset &&
+      (block->offset + block->size) > offset)
+    return block;
 
-  for (block = self->blocks; block; block = block->next) {
+  for (block = self->chunks; block; block = block->next) {
     if (block->offset <= offset && (block->offset + block->size) > offset)
-      return block;
+      return block->free ? NULL : block;
   }
 
   return NULL;
 }
 
+void
+shm_alloc_space_get_stats (ShmAllocSpace * self, ShmAllocStats * stats)
+{
+  ShmAllocBlock *chunk;
+
+  stats->size = self->size;
+  stats->used = self->used;
+  stats->free = self->size - self->used;
+  stats->num_blocks = self->num_blocks;
+  stats->num_free_chunks = self->num_free_chunks;
+
+  /* the largest chunk is in the highest non-empty class */
+  stats->largest_free = 0;
+  if (self->free_map) {
+    unsigned int c = size_class (self->free_map);
+
+    for (chunk = self->free_lists[c]; chunk; chunk = chunk->next_free)
+      if (chunk->size > stats->largest_free)
+        stats->largest_free = chunk->size;
+  }
+}
+
 
 void
 shm_alloc_space_block_inc (ShmAllocBlock * block)
@@ -166,6 +325,12 @@ shm_alloc_space_block_inc (ShmAllocBlock * block)
   block->use_count++;
 }
 
+int
+shm_alloc_space_block_get_use_count (ShmAllocBlock * block)
+{
+  return block->use_count;
+}
+
 void
 shm_alloc_space_block_dec (ShmAllocBlock * block)
 {
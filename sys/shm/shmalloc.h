@@ -48,6 +48,18 @@
 
 typedef struct _ShmAllocSpace ShmAllocSpace;
 typedef struct _ShmAllocBlock ShmAllocBlock;
+typedef struct _ShmAllocStats ShmAllocStats;
+
+struct _ShmAllocStats
+{
+  unsigned long size;
+  unsigned long used;
+  unsigned long free;
+  /* the biggest block that can currently be allocated */
+  unsigned long largest_free;
+  unsigned int num_blocks;
+  unsigned int num_free_chunks;
+};
 
 ShmAllocSpace *shm_alloc_space_new (size_t size);
 void shm_alloc_space_free (ShmAllocSpace * self);
@@ -59,9 +71,12 @@ unsigned long shm_alloc_space_alloc_block_get_offset (ShmAllocBlock *block);
 
 void shm_alloc_space_block_inc (ShmAllocBlock * block);
 void shm_alloc_space_block_dec (ShmAllocBlock * block);
+int shm_alloc_space_block_get_use_count (ShmAllocBlock * block);
 ShmAllocBlock * shm_alloc_space_block_get (ShmAllocSpace * space,
     unsigned long offset);
 
+void shm_alloc_space_get_stats (ShmAllocSpace * self, ShmAllocStats * stats);
+
 
 #ifdef __cplusplus
 }
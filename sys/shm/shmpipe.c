@@ -59,9 +59,39 @@
  * type 4: ack buffer
  * offset
  *
- * Type 4 goes from the client to the server
+ * type 5: new descriptor ring
+ * offset of the ring in the area
+ * number of entries
+ *
+ * type 6: wakeup
+ * No payload
+ *
+ * type 7: flush acks
+ * No payload
+ *
+ * type 8: ack buffers
+ * number of acks
+ * flags
+ * ring read position
+ * number of buffers received on the socket
+ * (followed by the acks)
+ *
+ * type 9: set policy
+ * policy
+ * max lag
+ *
+ * Types 4, 8 and 9 go from the client to the server
  * The rest are from the server to the client
  * The client should never write in the SHM
+ *
+ * If the writer has a ring size set, each client gets its own ring of
+ * buffer descriptors allocated in the shm area. Buffers are then
+ * announced by appending to the ring, and a wakeup is only sent if the
+ * client has not been woken up since it last reported its read position.
+ * As the client maps the area read-only, it reports its position and
+ * releases its buffers in batches of acks over the socket instead. When
+ * a client's ring is full, the writer falls back to sending the buffers
+ * on the socket until the client has caught up with both.
  */
 
 
@@ -72,11 +102,27 @@ enum
   COMMAND_NEW_SHM_AREA = 1,
   COMMAND_CLOSE_SHM_AREA = 2,
   COMMAND_NEW_BUFFER = 3,
-  COMMAND_ACK_BUFFER = 4
+  COMMAND_ACK_BUFFER = 4,
+  COMMAND_NEW_RING = 5,
+  COMMAND_WAKEUP = 6,
+  COMMAND_FLUSH_ACKS = 7,
+  COMMAND_ACK_BUFFERS = 8,
+  COMMAND_SET_POLICY = 9
 };
 
+/* the ack batch is a reply to a wakeup */
+#define ACK_FLAG_WAKEUP (1 << 0)
+/* the ack batch is a reply to a flush, no acks are held back anymore */
+#define ACK_FLAG_FLUSH (1 << 1)
+
+#define SHM_ACK_BATCH 32
+
+#define sp_memory_barrier() __sync_synchronize ()
+
 typedef struct _ShmArea ShmArea;
 typedef struct _ShmBuffer ShmBuffer;
+typedef struct _ShmRing ShmRing;
+typedef struct _ShmRingEntry ShmRingEntry;
 
 struct _ShmArea
 {
@@ -113,6 +159,27 @@ struct _ShmBuffer
 };
 
 
+/* Lives in the shm area, only ever written by the writer */
+struct _ShmRingEntry
+{
+  unsigned long offset;
+  unsigned long size;
+  int area_id;
+};
+
+struct _ShmRing
+{
+  volatile unsigned int head;
+  unsigned int num_entries;
+  ShmRingEntry entries[0];
+};
+
+struct AckEntry
+{
+  unsigned long offset;
+  int area_id;
+};
+
 struct _ShmPipe
 {
   int main_socket;
@@ -128,12 +195,48 @@ struct _ShmPipe
   ShmClient *clients;
 
   mode_t perms;
+
+  /* writer: number of ring entries per client, 0 for no ring */
+  unsigned int ring_size;
+
+  /* client: ring we read from and acks not sent yet */
+  ShmArea *ring_area;
+  const ShmRing *ring;
+  unsigned int ring_entries;
+  unsigned int ring_read;
+  unsigned int socket_received;
+  int urgent_acks;
+  unsigned int num_pending_acks;
+  struct AckEntry pending_acks[SHM_ACK_BATCH];
 };
 
 struct _ShmClient
 {
   int fd;
 
+  /* descriptor ring, NULL if buffers are announced on the socket */
+  ShmArea *ring_area;
+  ShmAllocBlock *ring_block;
+  ShmRing *ring;
+  unsigned int ring_entries;
+  /* last position reported by the client */
+  unsigned int ring_read;
+  /* the ring was full, use the socket until the client catches up */
+  int ring_blocked;
+  int wakeup_sent;
+  int flush_requested;
+  unsigned int socket_sent;
+  unsigned int socket_received;
+
+  ShmClientPolicy policy;
+  unsigned int max_lag;
+  /* acks were requested because the client reached max_lag, and whether
+   * they came */
+  int lag_flush_sent;
+  int lag_flush_answered;
+  int dropped_client;
+  ShmClientStats stats;
+
   ShmClient *next;
 };
 
@@ -166,6 +269,24 @@ struct CommandBuffer
     {
       unsigned long offset;
     } ack_buffer;
+    struct
+    {
+      unsigned long offset;
+      unsigned int num_entries;
+    } ring;
+    struct
+    {
+      unsigned short num;
+      unsigned short flags;
+      unsigned int ring_read;
+      unsigned int socket_received;
+      /* Followed by num struct AckEntry */
+    } ack_buffers;
+    struct
+    {
+      unsigned int policy;
+      unsigned int max_lag;
+    } policy;
   } payload;
 };
 
@@ -495,6 +616,80 @@ sp_writer_free_block (ShmBlock * block)
   spalloc_free (ShmBlock, block);
 }
 
+/* Returns 1 if the buffer was queued in the client's ring, 0 if it has to
+ * go through the socket */
+
+static int
+sp_writer_ring_push (ShmClient * client, int area_id, unsigned long offset,
+    unsigned long size)
+{
+  ShmRing *ring = client->ring;
+  ShmRingEntry *entry;
+  unsigned int head = ring->head;
+
+  if (client->ring_blocked ||
+      head - client->ring_read >= client->ring_entries) {
+    client->ring_blocked = 1;
+    return 0;
+  }
+
+  entry = &ring->entries[head & (client->ring_entries - 1)];
+  entry->offset = offset;
+  entry->size = size;
+  entry->area_id = area_id;
+  sp_memory_barrier ();
+  ring->head = head + 1;
+
+  if (!client->wakeup_sent) {
+    struct CommandBuffer cb = { 0 };
+
+    /* if this fails, the client is gone and will be closed */
+    send_command (client->fd, &cb, COMMAND_WAKEUP, area_id);
+    client->wakeup_sent = 1;
+    client->flush_requested = 0;
+  }
+
+  return 1;
+}
+
+/* Returns 1 if some client still has not released a buffer sent from
+ * this block */
+
+int
+sp_writer_block_in_flight (ShmBlock * block)
+{
+  return shm_alloc_space_block_get_use_count (block->ablock) > 1;
+}
+
+/* A client with a ring holds back up to SHM_ACK_BATCH acks for buffers it is
+ * done with, so its lag only counts once it was asked to flush them and is
+ * still behind. While the answer is pending it is only lagging if it is
+ * behind even counting a full batch of held back acks. */
+
+static int
+sp_writer_client_lagging (ShmPipe * self, ShmClient * client)
+{
+  struct CommandBuffer cb = { 0 };
+
+  if (client->max_lag == 0 || client->stats.lag < client->max_lag) {
+    client->lag_flush_answered = 0;
+    return 0;
+  }
+
+  if (!client->ring || client->lag_flush_answered)
+    return 1;
+
+  if (!client->lag_flush_sent) {
+    if (send_command (client->fd, &cb, COMMAND_FLUSH_ACKS,
+            self->shm_area->id)) {
+      client->lag_flush_sent = 1;
+      client->flush_requested = 1;
+    }
+  }
+
+  return client->stats.lag >= client->max_lag + SHM_ACK_BATCH;
+}
+
 /* Returns the number of client this has successfully been sent to */
 
 int
@@ -535,12 +730,39 @@ sp_writer_send_buf (ShmPipe * self, char *buf, size_t size)
 
   for (client = self->clients; client; client = client->next) {
     struct CommandBuffer cb = { 0 };
-    cb.payload.buffer.offset = offset;
-    cb.payload.buffer.size = bsize;
-    if (!send_command (client->fd, &cb, COMMAND_NEW_BUFFER, self->shm_area->id))
+
+    if (client->dropped_client)
       continue;
+
+    if (sp_writer_client_lagging (self, client)) {
+      if (client->policy == SHM_CLIENT_POLICY_DROP_CLIENT) {
+        /* The fd is reported as closed and the application then calls
+         * sp_writer_close_client() which releases its buffers */
+        shutdown (client->fd, SHUT_RDWR);
+        client->dropped_client = 1;
+        continue;
+      } else if (client->policy == SHM_CLIENT_POLICY_DROP_OLDEST) {
+        client->stats.dropped++;
+        continue;
+      }
+    }
+
+    if (!client->ring || !sp_writer_ring_push (client, area->id, offset,
+            bsize)) {
+      cb.payload.buffer.offset = offset;
+      cb.payload.buffer.size = bsize;
+      if (!send_command (client->fd, &cb, COMMAND_NEW_BUFFER,
+              self->shm_area->id))
+        continue;
+      client->socket_sent++;
+    }
     sb->clients[i++] = client->fd;
     c++;
+
+    client->stats.sent++;
+    client->stats.lag++;
+    if (client->stats.lag > client->stats.max_lag)
+      client->stats.max_lag = client->stats.lag;
   }
 
   if (c == 0) {
@@ -572,6 +794,70 @@ recv_command (int fd, struct CommandBuffer *cb)
   }
 }
 
+/* Returns the size of the next buffer in the ring, 0 if it is empty. After
+ * a resize the writer puts buffers of the new area in the ring before we
+ * read its COMMAND_NEW_SHM_AREA from the socket, so such an entry is left in
+ * the ring and *unknown_area is set */
+
+static long
+sp_client_ring_pop (ShmPipe * self, char **buf, int *unknown_area)
+{
+  const ShmRingEntry *entry;
+  ShmArea *area;
+
+  *unknown_area = 0;
+
+  if (self->ring_read == self->ring->head)
+    return 0;
+  sp_memory_barrier ();
+
+  entry = &self->ring->entries[self->ring_read & (self->ring_entries - 1)];
+
+  for (area = self->shm_area; area; area = area->next) {
+    if (area->id == entry->area_id) {
+      self->ring_read++;
+      if (entry->offset >= area->shm_area_len)
+        return -24;
+      *buf = area->shm_area + entry->offset;
+      sp_shm_area_inc (area);
+      return entry->size;
+    }
+  }
+
+  *unknown_area = 1;
+  return 0;
+}
+
+static int
+sp_client_send_acks (ShmPipe * self, unsigned short flags)
+{
+  struct
+  {
+    struct CommandBuffer cb;
+    struct AckEntry acks[SHM_ACK_BATCH];
+  } msg;
+  size_t size;
+
+  memset (&msg.cb, 0, sizeof (struct CommandBuffer));
+  msg.cb.type = COMMAND_ACK_BUFFERS;
+  msg.cb.area_id = self->shm_area->id;
+  msg.cb.payload.ack_buffers.num = self->num_pending_acks;
+  msg.cb.payload.ack_buffers.flags = flags;
+  msg.cb.payload.ack_buffers.ring_read = self->ring_read;
+  msg.cb.payload.ack_buffers.socket_received = self->socket_received;
+  memcpy (msg.acks, self->pending_acks,
+      sizeof (struct AckEntry) * self->num_pending_acks);
+
+  size = sizeof (struct CommandBuffer) +
+      sizeof (struct AckEntry) * self->num_pending_acks;
+  self->num_pending_acks = 0;
+
+  if (send (self->main_socket, &msg, size, MSG_NOSIGNAL) != size)
+    return 0;
+
+  return 1;
+}
+
 unsigned long
 sp_client_recv (ShmPipe * self, char **buf)
 {
@@ -580,9 +866,21 @@ sp_client_recv (ShmPipe * self, char **buf)
   ShmArea *area;
   struct CommandBuffer cb;
   int retval;
+  int unknown_area = 0;
+
+  /* Buffers queued in the ring always come before anything that is still
+   * on the socket, unless their area still has to be read from it */
+  if (self->ring) {
+    long size;
+
+    assert (buf);
+    size = sp_client_ring_pop (self, buf, &unknown_area);
+    if (size != 0)
+      return size;
+  }
 
   if (!recv_command (self->main_socket, &cb))
-    return -1;
+    return unknown_area ? -23 : -1;
 
   switch (cb.type) {
     case COMMAND_NEW_SHM_AREA:
@@ -610,6 +908,11 @@ sp_client_recv (ShmPipe * self, char **buf)
          if (oldarea)
          sp_shm_area_dec (self, oldarea);
        */
+
+      /* the socket may be empty now, hand out the entry that waited for
+       * this area right away */
+      if (unknown_area)
+        return sp_client_ring_pop (self, buf, &unknown_area);
       break;
 
     case COMMAND_CLOSE_SHM_AREA:
@@ -623,6 +926,7 @@ sp_client_recv (ShmPipe * self, char **buf)
 
     case COMMAND_NEW_BUFFER:
       assert (buf);
+      self->socket_received++;
       for (area = self->shm_area; area; area = area->next) {
         if (area->id == cb.area_id) {
           *buf = area->shm_area + cb.payload.buffer.offset;
@@ -632,6 +936,46 @@ sp_client_recv (ShmPipe * self, char **buf)
       }
       return -23;
 
+    case COMMAND_NEW_RING:
+      if (self->ring)
+        return -25;
+      if (cb.payload.ring.num_entries == 0 ||
+          (cb.payload.ring.num_entries & (cb.payload.ring.num_entries - 1)))
+        return -25;
+      for (area = self->shm_area; area; area = area->next) {
+        if (area->id == cb.area_id)
+          break;
+      }
+      if (!area || cb.payload.ring.offset > area->shm_area_len ||
+          sizeof (ShmRing) + sizeof (ShmRingEntry) *
+          cb.payload.ring.num_entries >
+          area->shm_area_len - cb.payload.ring.offset)
+        return -25;
+
+      sp_shm_area_inc (area);
+      self->ring_area = area;
+      self->ring = (const ShmRing *) (area->shm_area + cb.payload.ring.offset);
+      self->ring_entries = cb.payload.ring.num_entries;
+      self->ring_read = 0;
+      break;
+
+    case COMMAND_WAKEUP:
+      /* We have drained the ring before getting here, tell the writer up to
+       * where so it knows if it has to wake us up again */
+      self->urgent_acks = 0;
+      if (!sp_client_send_acks (self, ACK_FLAG_WAKEUP))
+        return -5;
+      break;
+
+    case COMMAND_FLUSH_ACKS:
+      /* The writer is waiting for memory or we reached our max lag, stop
+       * holding back acks until the next wakeup. Always answer, even with
+       * no acks, so the writer knows our lag is real */
+      self->urgent_acks = 1;
+      if (!sp_client_send_acks (self, ACK_FLAG_FLUSH))
+        return -5;
+      break;
+
     default:
       return -99;
   }
@@ -639,10 +983,34 @@ sp_client_recv (ShmPipe * self, char **buf)
   return 0;
 }
 
+static int
+sp_writer_ack_buffer (ShmPipe * self, ShmClient * client, int area_id,
+    unsigned long offset)
+{
+  ShmBuffer *buf = NULL, *prev_buf = NULL;
+  int i;
+
+  for (buf = self->buffers; buf; buf = buf->next) {
+    if (buf->shm_area->id == area_id && buf->offset == offset) {
+      for (i = 0; i < buf->num_clients; i++) {
+        if (buf->clients[i] == client->fd) {
+          /* So closing the client does not release it again */
+          buf->clients[i] = -1;
+          client->stats.lag--;
+          sp_shmbuf_dec (self, buf, prev_buf);
+          return 1;
+        }
+      }
+    }
+    prev_buf = buf;
+  }
+
+  return 0;
+}
+
 int
 sp_writer_recv (ShmPipe * self, ShmClient * client)
 {
-  ShmBuffer *buf = NULL, *prev_buf = NULL;
   struct CommandBuffer cb;
 
   if (!recv_command (client->fd, &cb))
@@ -650,20 +1018,75 @@ sp_writer_recv (ShmPipe * self, ShmClient * client)
 
   switch (cb.type) {
     case COMMAND_ACK_BUFFER:
+      if (!sp_writer_ack_buffer (self, client, cb.area_id,
+              cb.payload.ack_buffer.offset))
+        return -2;
+      break;
 
-      for (buf = self->buffers; buf; buf = buf->next) {
-        if (buf->shm_area->id == cb.area_id &&
-            buf->offset == cb.payload.ack_buffer.offset) {
-          sp_shmbuf_dec (self, buf, prev_buf);
-          break;
+    case COMMAND_ACK_BUFFERS:
+    {
+      struct AckEntry acks[SHM_ACK_BATCH];
+      unsigned int num = cb.payload.ack_buffers.num;
+      unsigned int i;
+
+      if (!client->ring || num > SHM_ACK_BATCH)
+        return -3;
+
+      if (num > 0 && recv (client->fd, acks, sizeof (struct AckEntry) * num,
+              MSG_WAITALL) != sizeof (struct AckEntry) * num)
+        return -3;
+
+      for (i = 0; i < num; i++)
+        if (!sp_writer_ack_buffer (self, client, acks[i].area_id,
+                acks[i].offset))
+          return -2;
+
+      if (client->ring->head - cb.payload.ack_buffers.ring_read >
+          client->ring_entries)
+        return -4;
+
+      client->ring_read = cb.payload.ack_buffers.ring_read;
+      client->socket_received = cb.payload.ack_buffers.socket_received;
+
+      if (cb.payload.ack_buffers.flags & ACK_FLAG_FLUSH) {
+        if (client->lag_flush_sent) {
+          client->lag_flush_sent = 0;
+          client->lag_flush_answered = 1;
         }
-        prev_buf = buf;
+      } else if (cb.payload.ack_buffers.flags & ACK_FLAG_WAKEUP) {
+        /* the client holds back acks again after a wakeup */
+        client->lag_flush_answered = 0;
       }
 
-      if (!buf)
-        return -2;
+      /* The client has read everything we sent on the socket after the
+       * ring got full, so the ring is in order again */
+      if (client->ring_blocked &&
+          client->socket_received == client->socket_sent &&
+          client->ring_read == client->ring->head)
+        client->ring_blocked = 0;
+
+      if (cb.payload.ack_buffers.flags & ACK_FLAG_WAKEUP) {
+        if (client->ring_read != client->ring->head) {
+          struct CommandBuffer wcb = { 0 };
+
+          if (!send_command (client->fd, &wcb, COMMAND_WAKEUP,
+                  self->shm_area->id))
+            return -1;
+          client->flush_requested = 0;
+        } else {
+          client->wakeup_sent = 0;
+        }
+      }
+      break;
+    }
 
+    case COMMAND_SET_POLICY:
+      if (cb.payload.policy.policy > SHM_CLIENT_POLICY_DROP_CLIENT)
+        return -5;
+      client->policy = cb.payload.policy.policy;
+      client->max_lag = cb.payload.policy.max_lag;
       break;
+
     default:
       return -99;
   }
@@ -688,6 +1111,18 @@ sp_client_recv_finish (ShmPipe * self, char *buf)
 
   offset = buf - shm_area->shm_area;
 
+  if (self->ring) {
+    struct AckEntry *ack = &self->pending_acks[self->num_pending_acks++];
+
+    ack->offset = offset;
+    ack->area_id = shm_area->id;
+    sp_shm_area_dec (self, shm_area);
+
+    if (self->urgent_acks || self->num_pending_acks == SHM_ACK_BATCH)
+      return sp_client_send_acks (self, 0);
+    return 1;
+  }
+
   sp_shm_area_dec (self, shm_area);
 
   cb.payload.ack_buffer.offset = offset;
@@ -695,6 +1130,18 @@ sp_client_recv_finish (ShmPipe * self, char *buf)
       self->shm_area->id);
 }
 
+int
+sp_client_set_policy (ShmPipe * self, ShmClientPolicy policy,
+    unsigned int max_lag)
+{
+  struct CommandBuffer cb = { 0 };
+
+  cb.payload.policy.policy = policy;
+  cb.payload.policy.max_lag = max_lag;
+  return send_command (self->main_socket, &cb, COMMAND_SET_POLICY,
+      self->shm_area ? self->shm_area->id : 0);
+}
+
 ShmPipe *
 sp_client_open (const char *path)
 {
@@ -724,6 +1171,57 @@ error:
 }
 
 
+static void
+sp_writer_free_ring (ShmPipe * self, ShmClient * client)
+{
+  if (!client->ring_block)
+    return;
+
+  shm_alloc_space_block_dec (client->ring_block);
+  sp_shm_area_dec (self, client->ring_area);
+  client->ring_block = NULL;
+  client->ring_area = NULL;
+  client->ring = NULL;
+}
+
+/* Returns 0 if the client could not be told about its ring, not having
+ * enough memory for it is not an error, the client then only uses the
+ * socket */
+
+static int
+sp_writer_create_ring (ShmPipe * self, ShmClient * client)
+{
+  struct CommandBuffer cb = { 0 };
+  ShmArea *area = self->shm_area;
+  unsigned long offset;
+  unsigned int num_entries = 1;
+
+  while (num_entries < self->ring_size)
+    num_entries <<= 1;
+
+  /* blocks are not aligned, keep room to align the ring */
+  client->ring_block = shm_alloc_space_alloc_block (area->allocspace,
+      sizeof (ShmRing) + sizeof (ShmRingEntry) * num_entries +
+      sizeof (unsigned long) - 1);
+  if (!client->ring_block)
+    return 1;
+
+  offset = shm_alloc_space_alloc_block_get_offset (client->ring_block);
+  offset = (offset + sizeof (unsigned long) - 1) &
+      ~(sizeof (unsigned long) - 1);
+
+  sp_shm_area_inc (area);
+  client->ring_area = area;
+  client->ring = (ShmRing *) (area->shm_area + offset);
+  client->ring->head = 0;
+  client->ring->num_entries = num_entries;
+  client->ring_entries = num_entries;
+
+  cb.payload.ring.offset = offset;
+  cb.payload.ring.num_entries = num_entries;
+  return send_command (client->fd, &cb, COMMAND_NEW_RING, area->id);
+}
+
 ShmClient *
 sp_writer_accept_client (ShmPipe * self)
 {
@@ -754,8 +1252,16 @@ sp_writer_accept_client (ShmPipe * self)
   }
 
   client = spalloc_new (ShmClient);
+  memset (client, 0, sizeof (ShmClient));
   client->fd = fd;
 
+  if (self->ring_size > 0 && !sp_writer_create_ring (self, client)) {
+    fprintf (stderr, "Sending new ring failed: %s", strerror (errno));
+    sp_writer_free_ring (self, client);
+    spalloc_free (ShmClient, client);
+    goto error;
+  }
+
   /* Prepend ot linked list */
   client->next = self->clients;
   self->clients = client;
@@ -798,6 +1304,7 @@ sp_writer_close_client (ShmPipe * self, ShmClient * client)
   close (client->fd);
 
 again:
+  prev_buf = NULL;
   for (buffer = self->buffers; buffer; buffer = buffer->next) {
     int i;
 
@@ -808,8 +1315,8 @@ again:
           goto again;
         break;
       }
-      prev_buf = buffer;
     }
+    prev_buf = buffer;
   }
 
   for (item = self->clients; item; item = item->next) {
@@ -826,6 +1333,7 @@ again:
 
   self->num_clients--;
 
+  sp_writer_free_ring (self, client);
   spalloc_free (ShmClient, client);
 }
 
@@ -847,6 +1355,45 @@ sp_writer_pending_writes (ShmPipe * self)
   return (self->buffers != NULL);
 }
 
+void
+sp_writer_get_client_stats (ShmClient * client, ShmClientStats * stats)
+{
+  *stats = client->stats;
+}
+
+/* Applies to clients connecting after this call */
+void
+sp_writer_set_ring_size (ShmPipe * self, unsigned int num_entries)
+{
+  self->ring_size = num_entries;
+}
+
+/* Asks the clients holding back acks to send them right away, to be called
+ * when waiting for buffers to be released */
+void
+sp_writer_flush_acks (ShmPipe * self)
+{
+  ShmClient *client;
+
+  for (client = self->clients; client; client = client->next) {
+    struct CommandBuffer cb = { 0 };
+
+    if (!client->ring || client->flush_requested)
+      continue;
+
+    if (send_command (client->fd, &cb, COMMAND_FLUSH_ACKS,
+            self->shm_area->id))
+      client->flush_requested = 1;
+  }
+}
+
+/* statistics of the current shm area */
+void
+sp_writer_get_alloc_stats (ShmPipe * self, ShmAllocStats * stats)
+{
+  shm_alloc_space_get_stats (self->shm_area->allocspace, stats);
+}
+
 const char *
 sp_writer_get_path (ShmPipe * pipe)
 {
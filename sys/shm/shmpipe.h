@@ -40,7 +40,12 @@
  * the other side. When it is done with the block, it calls
  * sp_writer_free_block().
  * If alloc fails, then the server must wait for events from the clients before
- * trying again.
+ * trying again, calling sp_writer_flush_acks() first so that clients batching
+ * their acks send them right away.
+ *
+ * With sp_writer_set_ring_size(), clients that connect afterwards get a ring
+ * of buffer descriptors in the shm area and are only woken up on the socket
+ * when they have drained it, they release their buffers in batches.
  *
  *
  * The clients connect with sp_client_open()
@@ -50,6 +55,10 @@
  * message and <0 if there was an error. If there was an error, one must close
  * it with sp_close(). If was valid buffer was received, the client must release
  * it with sp_client_recv_finish() when it is done reading from it.
+ *
+ * A client can call sp_client_set_policy() to stop the writer from waiting
+ * for it once it holds max_lag buffers, the writer then either stops sending
+ * it buffers until it has caught up, or disconnects it.
  */
 
 
@@ -61,6 +70,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include "shmalloc.h"
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -69,6 +80,25 @@ extern "C" {
 typedef struct _ShmClient ShmClient;
 typedef struct _ShmPipe ShmPipe;
 typedef struct _ShmBlock ShmBlock;
+typedef struct _ShmClientStats ShmClientStats;
+
+/* What the writer does when a client has max_lag buffers it has not
+ * released yet */
+typedef enum
+{
+  SHM_CLIENT_POLICY_BLOCK,
+  SHM_CLIENT_POLICY_DROP_OLDEST,
+  SHM_CLIENT_POLICY_DROP_CLIENT
+} ShmClientPolicy;
+
+struct _ShmClientStats
+{
+  /* buffers sent but not released yet */
+  unsigned int lag;
+  unsigned int max_lag;
+  unsigned long sent;
+  unsigned long dropped;
+};
 
 ShmPipe *sp_writer_create (const char *path, size_t size, mode_t perms);
 const char *sp_writer_get_path (ShmPipe *pipe);
@@ -84,16 +114,23 @@ ShmBlock *sp_writer_alloc_block (ShmPipe * self, size_t size);
 void sp_writer_free_block (ShmBlock *block);
 int sp_writer_send_buf (ShmPipe * self, char *buf, size_t size);
 char *sp_writer_block_get_buf (ShmBlock *block);
+int sp_writer_block_in_flight (ShmBlock *block);
 
 ShmClient * sp_writer_accept_client (ShmPipe * self);
 void sp_writer_close_client (ShmPipe *self, ShmClient * client);
 int sp_writer_recv (ShmPipe * self, ShmClient * client);
+void sp_writer_get_client_stats (ShmClient * client, ShmClientStats * stats);
 
 int sp_writer_pending_writes (ShmPipe * self);
+void sp_writer_set_ring_size (ShmPipe * self, unsigned int num_entries);
+void sp_writer_flush_acks (ShmPipe * self);
+void sp_writer_get_alloc_stats (ShmPipe * self, ShmAllocStats * stats);
 
 ShmPipe *sp_client_open (const char *path);
 unsigned long sp_client_recv (ShmPipe * self, char **buf);
 int sp_client_recv_finish (ShmPipe * self, char *buf);
+int sp_client_set_policy (ShmPipe * self, ShmClientPolicy policy,
+    unsigned int max_lag);
 
 #ifdef __cplusplus
 }
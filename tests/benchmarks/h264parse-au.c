@@ -0,0 +1,150 @@
+/* GStreamer
+ *
+ * h264parse-au.c: h264parse access unit throughput, with buffer lists
+ * going downstream or merged buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#define N_FRAMES 250
+/* high bitrate 1080p: 8 slices of 50 kB per frame, about 80 Mbit/s */
+#define N_SLICES 8
+#define SLICE_SIZE (50 * 1024)
+
+/* baseline profile, level 4.0, 1920x1080 */
+static const guint8 sps[] = {
+  0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x28, 0xda, 0x01, 0xe0, 0x08,
+  0x9f, 0x95
+};
+
+/* pps_id 0 referring to sps_id 0 */
+static const guint8 pps[] = {
+  0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80
+};
+
+/* An SPS and PPS, so that codec_data can be made for the sample output, then
+ * IDR frames of several slices, the first one with a 4 byte start code and
+ * the others with 3 byte start codes, as x264 writes them */
+static gboolean
+write_stream (const gchar * path)
+{
+  FILE *f;
+  guint8 *slice;
+  gint i, j;
+
+  f = g_fopen (path, "wb");
+  if (!f)
+    return FALSE;
+
+  fwrite (sps, sizeof (sps), 1, f);
+  fwrite (pps, sizeof (pps), 1, f);
+
+  slice = g_malloc (SLICE_SIZE);
+  for (i = 0; i < SLICE_SIZE; i++)
+    slice[i] = g_random_int_range (1, 256);
+  /* NAL header of an IDR slice */
+  slice[0] = 0x65;
+
+  for (i = 0; i < N_FRAMES; i++) {
+    for (j = 0; j < N_SLICES; j++) {
+      static const guint8 sc[] = { 0x00, 0x00, 0x00, 0x01 };
+
+      if (j == 0) {
+        fwrite (sc, 4, 1, f);
+        /* first_mb_in_slice 0, slice_type 7 (I), pic_parameter_set_id 0 */
+        slice[1] = 0x88;
+        slice[2] |= 0x80;
+      } else {
+        fwrite (sc + 1, 3, 1, f);
+        /* first_mb_in_slice > 0 */
+        slice[1] = 0x04;
+      }
+      fwrite (slice, SLICE_SIZE, 1, f);
+    }
+  }
+
+  g_free (slice);
+  fclose (f);
+  return TRUE;
+}
+
+static void
+run (const gchar * path, const gchar * name, const gchar * format,
+    const gchar * downstream)
+{
+  GstElement *pipeline;
+  GstBus *bus;
+  GstMessage *msg;
+  GstClockTime start, end;
+  gchar *desc;
+
+  desc = g_strdup_printf ("filesrc location=%s blocksize=%d ! video/x-h264 ! "
+      "h264parse access-unit=true output-format=%s ! %s", path,
+      N_SLICES * SLICE_SIZE, format, downstream);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  g_assert (pipeline);
+
+  start = gst_util_get_timestamp ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  end = gst_util_get_timestamp ();
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    g_printerr ("%s: pipeline error\n", name);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  g_print ("%-20s %" GST_TIME_FORMAT ", %.1f frames/s\n", name,
+      GST_TIME_ARGS (end - start),
+      (gdouble) N_FRAMES / ((gdouble) (end - start) / GST_SECOND));
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gchar *path;
+
+  gst_init (&argc, &argv);
+
+  path = g_build_filename (g_get_tmp_dir (), "h264parse-au-bench", NULL);
+  if (!write_stream (path)) {
+    g_printerr ("could not write %s\n", path);
+    return 1;
+  }
+
+  /* fakesink takes buffer lists, identity makes the core merge them */
+  run (path, "byte, lists", "byte", "fakesink");
+  run (path, "byte, merged", "byte", "identity ! fakesink");
+  run (path, "sample, lists", "sample", "fakesink");
+  run (path, "sample, merged", "sample", "identity ! fakesink");
+
+  g_unlink (path);
+  g_free (path);
+
+  return 0;
+}
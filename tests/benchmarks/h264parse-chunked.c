@@ -0,0 +1,123 @@
+/* GStreamer
+ *
+ * h264parse-chunked.c: h264parse throughput with large NALs arriving in
+ * small chunks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#define N_FRAMES 50
+/* 4 Mbit IDR frames */
+#define FRAME_SIZE (4 * 1024 * 1024 / 8)
+/* 7 TS packets, as in a typical UDP datagram */
+#define CHUNK_SIZE 1316
+
+/* IDR slices with payload that holds no zero bytes, and thus no start
+ * codes, separated by 4 byte start codes */
+static gboolean
+write_stream (const gchar * path)
+{
+  FILE *f;
+  guint8 *frame;
+  gint i;
+
+  f = g_fopen (path, "wb");
+  if (!f)
+    return FALSE;
+
+  frame = g_malloc (FRAME_SIZE);
+  frame[0] = frame[1] = frame[2] = 0x00;
+  frame[3] = 0x01;
+  frame[4] = 0x65;
+  /* first_mb_in_slice 0, slice_type 7 (I), pps_id 0 */
+  frame[5] = 0x88;
+  frame[6] = 0x80;
+  for (i = 7; i < FRAME_SIZE; i++)
+    frame[i] = g_random_int_range (1, 256);
+
+  for (i = 0; i < N_FRAMES; i++)
+    fwrite (frame, FRAME_SIZE, 1, f);
+
+  g_free (frame);
+  fclose (f);
+  return TRUE;
+}
+
+static void
+run (const gchar * path, gint blocksize)
+{
+  GstElement *pipeline;
+  GstBus *bus;
+  GstMessage *msg;
+  GstClockTime start, end;
+  gchar *desc;
+
+  desc = g_strdup_printf ("filesrc location=%s blocksize=%d ! "
+      "video/x-h264 ! h264parse ! fakesink", path, blocksize);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  g_assert (pipeline);
+
+  start = gst_util_get_timestamp ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  end = gst_util_get_timestamp ();
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    g_printerr ("blocksize %d: pipeline error\n", blocksize);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  g_print ("blocksize %7d: %" GST_TIME_FORMAT ", %.1f MB/s\n", blocksize,
+      GST_TIME_ARGS (end - start),
+      (gdouble) N_FRAMES * FRAME_SIZE / 1e6 /
+      ((gdouble) (end - start) / GST_SECOND));
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gchar *path;
+
+  gst_init (&argc, &argv);
+
+  path = g_build_filename (g_get_tmp_dir (), "h264parse-chunked-bench",
+      NULL);
+  if (!write_stream (path)) {
+    g_printerr ("could not write %s\n", path);
+    return 1;
+  }
+
+  run (path, CHUNK_SIZE);
+  /* one read per frame, for reference */
+  run (path, FRAME_SIZE);
+
+  g_unlink (path);
+  g_free (path);
+
+  return 0;
+}
@@ -0,0 +1,267 @@
+/* GStreamer
+ *
+ * h264parse-nalbs.c: speed of the h264parse NAL header bitstream reader
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+#include "gstnalbs.h"
+
+#define N_HEADERS 100000
+/* room for a slice header and some escaped slice data after it */
+#define HEADER_SIZE 48
+#define N_RUNS 20
+
+/* the reader as previously used by h264parse, filling its cache a byte at a
+ * time and reading Exp-Golomb prefixes a bit at a time */
+typedef struct
+{
+  const guint8 *data;
+  const guint8 *end;
+  gint head;
+  guint64 cache;
+} SlowBs;
+
+static void
+slow_bs_init (SlowBs * bs, const guint8 * data, guint size)
+{
+  bs->data = data;
+  bs->end = data + size;
+  bs->head = 0;
+  bs->cache = 0xffffffff;
+}
+
+static guint32
+slow_bs_read (SlowBs * bs, guint n)
+{
+  guint32 res = 0;
+  gint shift;
+
+  if (n == 0)
+    return res;
+
+  while (bs->head < n) {
+    guint8 byte;
+    gboolean check_three_byte;
+
+    check_three_byte = TRUE;
+  next_byte:
+    if (bs->data >= bs->end) {
+      n = bs->head;
+      break;
+    }
+    byte = *bs->data++;
+    if (check_three_byte && byte == 0x03 && ((bs->cache & 0xffff) == 0)) {
+      check_three_byte = FALSE;
+      goto next_byte;
+    }
+    bs->cache = (bs->cache << 8) | byte;
+    bs->head += 8;
+  }
+
+  if ((shift = bs->head - n) > 0)
+    res = bs->cache >> shift;
+  else
+    res = bs->cache;
+
+  if (n < 32)
+    res &= (1 << n) - 1;
+
+  bs->head = shift;
+
+  return res;
+}
+
+static gboolean
+slow_bs_eos (SlowBs * bs)
+{
+  return (bs->data >= bs->end) && (bs->head == 0);
+}
+
+static gint
+slow_bs_read_ue (SlowBs * bs)
+{
+  gint i = 0;
+
+  while (slow_bs_read (bs, 1) == 0 && !slow_bs_eos (bs) && i < 32)
+    i++;
+
+  return ((1 << i) - 1 + slow_bs_read (bs, i));
+}
+
+static gint
+slow_bs_read_se (SlowBs * bs)
+{
+  gint i = slow_bs_read_ue (bs);
+
+  return (i + 1) / 2 * (i & 1 ? 1 : -1);
+}
+
+/* the fields of a P slice header, as h264parse and decoders read them */
+#define PARSE_SLICE_HEADER(prefix, BsType)                                    \
+static guint32                                                                \
+parse_slice_header_##prefix (const guint8 * data, guint size)                 \
+{                                                                             \
+  BsType bs;                                                                  \
+  guint32 sum = 0;                                                            \
+                                                                              \
+  prefix##_init (&bs, data, size);                                            \
+  sum += prefix##_read_ue (&bs);        /* first_mb_in_slice */               \
+  sum += prefix##_read_ue (&bs);        /* slice_type */                      \
+  sum += prefix##_read_ue (&bs);        /* pic_parameter_set_id */            \
+  sum += prefix##_read (&bs, 8);        /* frame_num */                       \
+  sum += prefix##_read (&bs, 10);       /* pic_order_cnt_lsb */               \
+  sum += prefix##_read (&bs, 1);        /* num_ref_idx_active_override */     \
+  sum += prefix##_read_ue (&bs);        /* num_ref_idx_l0_active_minus1 */    \
+  sum += prefix##_read (&bs, 1);        /* ref_pic_list_modification_flag */  \
+  sum += prefix##_read (&bs, 1);        /* adaptive_ref_pic_marking_mode */   \
+  sum += prefix##_read_ue (&bs);        /* cabac_init_idc */                  \
+  sum += prefix##_read_se (&bs);        /* slice_qp_delta */                  \
+  sum += prefix##_read_ue (&bs);        /* disable_deblocking_filter_idc */   \
+  sum += prefix##_read_se (&bs);        /* slice_alpha_c0_offset_div2 */      \
+  sum += prefix##_read_se (&bs);        /* slice_beta_offset_div2 */          \
+                                                                              \
+  return sum;                                                                 \
+}
+
+PARSE_SLICE_HEADER (slow_bs, SlowBs)
+PARSE_SLICE_HEADER (gst_nal_bs, GstNalBs)
+
+typedef struct
+{
+  guint8 data[HEADER_SIZE];
+  guint pos;
+} BitWriter;
+
+static void
+put_bits (BitWriter * bw, guint32 value, guint n)
+{
+  while (n--) {
+    if ((value >> n) & 1)
+      bw->data[bw->pos >> 3] |= 0x80 >> (bw->pos & 7);
+    bw->pos++;
+  }
+}
+
+static void
+put_ue (BitWriter * bw, guint32 value)
+{
+  guint n = g_bit_storage (value + 1);
+
+  put_bits (bw, 0, n - 1);
+  put_bits (bw, value + 1, n);
+}
+
+static void
+put_se (BitWriter * bw, gint32 value)
+{
+  put_ue (bw, value > 0 ? 2 * value - 1 : -2 * value);
+}
+
+/* writes an escaped random slice header, returns its size */
+static guint
+make_slice_header (guint8 * out)
+{
+  BitWriter bw = { {0,}, 0 };
+  guint i, len, zeros = 0;
+
+  put_ue (&bw, g_random_int_range (0, 8160));
+  put_ue (&bw, 5);
+  put_ue (&bw, 0);
+  put_bits (&bw, g_random_int_range (0, 256), 8);
+  put_bits (&bw, g_random_int_range (0, 1024), 10);
+  put_bits (&bw, 1, 1);
+  put_ue (&bw, g_random_int_range (0, 4));
+  put_bits (&bw, 0, 1);
+  put_bits (&bw, 0, 1);
+  put_ue (&bw, g_random_int_range (0, 3));
+  put_se (&bw, g_random_int_range (-12, 13));
+  put_ue (&bw, 0);
+  put_se (&bw, g_random_int_range (-6, 7));
+  put_se (&bw, g_random_int_range (-6, 7));
+  /* slice data, with plenty of zeros to get emulation prevention */
+  while (bw.pos < (HEADER_SIZE / 2) * 8)
+    put_bits (&bw, g_random_boolean () ? 0 : g_random_int_range (0, 4), 8);
+
+  len = 0;
+  for (i = 0; i < (bw.pos + 7) / 8 && len < HEADER_SIZE - 1; i++) {
+    if (zeros >= 2 && bw.data[i] <= 3) {
+      out[len++] = 0x03;
+      zeros = 0;
+    }
+    out[len++] = bw.data[i];
+    zeros = bw.data[i] ? 0 : zeros + 1;
+  }
+  return len;
+}
+
+/* the sum is printed so the work cannot be optimized away, the reader is
+ * checked in tests/check/libs/h264nalbs */
+static gdouble
+run (const gchar * name, guint32 (*func) (const guint8 *, guint),
+    const guint8 * data, const guint * sizes)
+{
+  GstClockTime start, end;
+  guint32 sum = 0;
+  gdouble rate;
+  guint i, j;
+
+  start = gst_util_get_timestamp ();
+  for (i = 0; i < N_RUNS; i++) {
+    for (j = 0; j < N_HEADERS; j++)
+      sum += func (data + j * HEADER_SIZE, sizes[j]);
+  }
+  end = gst_util_get_timestamp ();
+
+  rate = ((gdouble) N_RUNS * N_HEADERS) /
+      ((gdouble) (end - start) / GST_SECOND) / 1e6;
+  g_print ("%-10s %" GST_TIME_FORMAT " %8.2f Mheaders/s, sum %u\n", name,
+      GST_TIME_ARGS (end - start), rate, sum);
+
+  return rate;
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  guint8 *data;
+  guint *sizes;
+  gdouble rate_slow, rate_fast;
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  data = g_malloc0 (N_HEADERS * HEADER_SIZE);
+  sizes = g_new (guint, N_HEADERS);
+  for (i = 0; i < N_HEADERS; i++)
+    sizes[i] = make_slice_header (data + i * HEADER_SIZE);
+
+  rate_slow = run ("bytewise", parse_slice_header_slow_bs, data, sizes);
+  rate_fast = run ("cached", parse_slice_header_gst_nal_bs, data, sizes);
+
+  g_free (sizes);
+  g_free (data);
+
+  g_print ("speedup %.2fx\n", rate_fast / rate_slow);
+
+  return 0;
+}
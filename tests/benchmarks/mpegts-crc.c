@@ -0,0 +1,93 @@
+/* GStreamer
+ *
+ * mpegts-crc.c: benchmark of the MPEG-2 section CRC32
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/gst-mpegts-crc.h>
+
+/* Sections are at most 4096 bytes, EIT sections are typically a few
+ * hundred bytes long */
+#define SECTION_SIZE 1024
+#define N_SECTIONS 1024
+#define N_RUNS 100
+
+/* the plain byte wise CRC, as previously used by the TS elements */
+static guint32
+crc32_bytewise (const guint8 * data, guint len)
+{
+  guint32 crc = 0xffffffff;
+
+  while (len--)
+    crc = (crc << 8) ^ gst_mpegts_crc_tab[0][((crc >> 24) ^ *data++) & 0xff];
+
+  return crc;
+}
+
+/* the CRC is printed so the work cannot be optimized away, the results are
+ * compared in tests/check/libs/mpegtscrc */
+static gdouble
+run (const gchar * name, guint32 (*func) (const guint8 *, guint),
+    const guint8 * data)
+{
+  GstClockTime start, end;
+  guint32 crc = 0;
+  gdouble mbps;
+  guint i, j;
+
+  start = gst_util_get_timestamp ();
+  for (i = 0; i < N_RUNS; i++) {
+    for (j = 0; j < N_SECTIONS; j++)
+      crc ^= func (data + j * SECTION_SIZE, SECTION_SIZE);
+  }
+  end = gst_util_get_timestamp ();
+
+  mbps = ((gdouble) N_RUNS * N_SECTIONS * SECTION_SIZE) /
+      ((gdouble) (end - start) / GST_SECOND) / (1024 * 1024);
+  g_print ("%-10s %" GST_TIME_FORMAT " %8.1f MB/s, crc 0x%08x\n", name,
+      GST_TIME_ARGS (end - start), mbps, crc);
+
+  return mbps;
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  guint8 *data;
+  gdouble mbps_bytewise, mbps_slice8;
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  data = g_malloc (N_SECTIONS * SECTION_SIZE);
+  for (i = 0; i < N_SECTIONS * SECTION_SIZE; i++)
+    data[i] = g_random_int_range (0, 256);
+
+  mbps_bytewise = run ("bytewise", crc32_bytewise, data);
+  mbps_slice8 = run ("slice-by-8", gst_mpegts_crc32, data);
+
+  g_free (data);
+
+  g_print ("speedup %.2fx\n", mbps_slice8 / mbps_bytewise);
+
+  return 0;
+}
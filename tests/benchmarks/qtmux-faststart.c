@@ -0,0 +1,109 @@
+/* GStreamer
+ *
+ * qtmux-faststart.c: I/O volume of qtmux faststart with a temporary file
+ * versus a reserved moov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#define N_FRAMES 500
+
+static void
+handoff_cb (GstElement * sink, GstBuffer * buf, GstPad * pad, guint64 * bytes)
+{
+  *bytes += GST_BUFFER_SIZE (buf);
+}
+
+/* runs the pipeline, returning the bytes pushed downstream and the bytes
+ * that went through the temporary file (written once, read back once) */
+static void
+run (const gchar * name, const gchar * mux_props, const gchar * tmp_path)
+{
+  GstElement *pipeline, *sink;
+  GstBus *bus;
+  GstMessage *msg;
+  GstClockTime start, end;
+  struct stat st;
+  guint64 out_bytes = 0, tmp_bytes = 0;
+  gchar *desc;
+
+  desc = g_strdup_printf ("videotestsrc num-buffers=%d ! "
+      "video/x-raw-yuv,format=(fourcc)UYVY,width=320,height=240,"
+      "framerate=25/1 ! qtmux %s ! fakesink name=sink signal-handoffs=true",
+      N_FRAMES, mux_props);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  g_assert (pipeline);
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_signal_connect (sink, "handoff", G_CALLBACK (handoff_cb), &out_bytes);
+  gst_object_unref (sink);
+
+  start = gst_util_get_timestamp ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  end = gst_util_get_timestamp ();
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    g_printerr ("%s: pipeline error\n", name);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (tmp_path && g_stat (tmp_path, &st) == 0) {
+    tmp_bytes = 2 * (guint64) st.st_size;
+    g_unlink (tmp_path);
+  }
+
+  g_print ("%-10s %" GST_TIME_FORMAT "  output %10" G_GUINT64_FORMAT
+      "  temp file %10" G_GUINT64_FORMAT "  total I/O %10" G_GUINT64_FORMAT
+      "\n", name, GST_TIME_ARGS (end - start), out_bytes, tmp_bytes,
+      out_bytes + tmp_bytes);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gchar *tmp_path, *props;
+
+  gst_init (&argc, &argv);
+
+  tmp_path = g_build_filename (g_get_tmp_dir (), "qtmux-faststart-bench",
+      NULL);
+
+  props = g_strdup_printf ("faststart=true faststart-file=%s", tmp_path);
+  run ("temp-file", props, tmp_path);
+  g_free (props);
+
+  /* ask for a reservation covering the whole stream */
+  props = g_strdup_printf ("reserved-max-duration=%" G_GUINT64_FORMAT,
+      (guint64) (N_FRAMES / 25 + 1) * GST_SECOND);
+  run ("reserved", props, NULL);
+  g_free (props);
+
+  g_free (tmp_path);
+
+  return 0;
+}
@@ -195,6 +195,122 @@ cleanup_aacparse (GstElement * aacparse)
 }
 
 
+/* pull mode: the data is served from memory by getrange on srcpad */
+static const guint8 *pull_data;
+static guint pull_size;
+static gboolean have_eos;
+
+static GstFlowReturn
+pull_getrange (GstPad * pad, guint64 offset, guint length, GstBuffer ** buffer)
+{
+  if (offset >= pull_size)
+    return GST_FLOW_UNEXPECTED;
+
+  length = MIN (length, pull_size - offset);
+  *buffer = gst_buffer_new_and_alloc (length);
+  memcpy (GST_BUFFER_DATA (*buffer), pull_data + offset, length);
+  GST_BUFFER_OFFSET (*buffer) = offset;
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+pull_checkgetrange (GstPad * pad)
+{
+  return TRUE;
+}
+
+static gboolean
+pull_src_query (GstPad * pad, GstQuery * query)
+{
+  GstFormat format;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_DURATION)
+    return FALSE;
+
+  gst_query_parse_duration (query, &format, NULL);
+  if (format != GST_FORMAT_BYTES)
+    return FALSE;
+
+  gst_query_set_duration (query, GST_FORMAT_BYTES, pull_size);
+  return TRUE;
+}
+
+/* time seeks are left to the parser */
+static gboolean
+pull_src_event (GstPad * pad, GstEvent * event)
+{
+  gst_event_unref (event);
+  return FALSE;
+}
+
+static gboolean
+pull_sink_event (GstPad * pad, GstEvent * event)
+{
+  g_mutex_lock (check_mutex);
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_EOS:
+      have_eos = TRUE;
+      g_cond_signal (check_cond);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      /* only keep what is pushed after a seek */
+      gst_check_drop_buffers ();
+      have_eos = FALSE;
+      break;
+    default:
+      break;
+  }
+  g_mutex_unlock (check_mutex);
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static void
+wait_for_eos (void)
+{
+  g_mutex_lock (check_mutex);
+  while (!have_eos)
+    g_cond_wait (check_cond, check_mutex);
+  g_mutex_unlock (check_mutex);
+}
+
+static GstElement *
+setup_aacparse_pull (const guint8 * data, guint size)
+{
+  GstElement *aacparse;
+  GstBus *bus;
+
+  pull_data = data;
+  pull_size = size;
+  have_eos = FALSE;
+
+  aacparse = gst_check_setup_element ("aacparse");
+  srcpad = gst_check_setup_src_pad (aacparse, &srctemplate, NULL);
+  gst_pad_set_getrange_function (srcpad, pull_getrange);
+  gst_pad_set_checkgetrange_function (srcpad, pull_checkgetrange);
+  gst_pad_set_query_function (srcpad, pull_src_query);
+  gst_pad_set_event_function (srcpad, pull_src_event);
+  sinkpad = gst_check_setup_sink_pad (aacparse, &sinktemplate, NULL);
+  gst_pad_set_event_function (sinkpad, pull_sink_event);
+  gst_pad_set_active (sinkpad, TRUE);
+
+  bus = gst_bus_new ();
+  gst_element_set_bus (aacparse, bus);
+
+  ts_counter = offset_counter = buffer_counter = 0;
+  buffers = NULL;
+
+  /* activates srcpad in pull mode and starts the streaming task */
+  fail_unless (gst_element_set_state (aacparse,
+          GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE,
+      "could not set to paused");
+
+  return aacparse;
+}
+
+
 /*
  * Test if the parser pushes data with ADIF header properly and detects the
  * stream to MPEG4 properly.
@@ -485,6 +601,50 @@ GST_START_TEST (test_parse_handle_codec_data)
 GST_END_TEST;
 
 
+/*
+ * Test if an accurate seek in pull mode starts with the frame containing the
+ * seek position, rather than with the seek table entry before it.
+ */
+GST_START_TEST (test_parse_adts_pull_accurate_seek)
+{
+  GstElement *aacparse;
+  GstBuffer *buffer;
+  GstClockTime ts;
+  guint8 *data;
+  guint i;
+
+  /* 200 frames of 1024 samples at 48 kHz, a bit over 4 seconds */
+  data = g_malloc (200 * ADTS_FRAME_LEN);
+  for (i = 0; i < 200; i++)
+    memcpy (data + i * ADTS_FRAME_LEN, adts_frame_mpeg4, ADTS_FRAME_LEN);
+
+  aacparse = setup_aacparse_pull (data, 200 * ADTS_FRAME_LEN);
+
+  /* the first pass fills the seek table with an entry about every second */
+  wait_for_eos ();
+  fail_unless_equals_int (g_list_length (buffers), 200);
+
+  fail_unless (gst_element_send_event (aacparse,
+          gst_event_new_seek (1.0, GST_FORMAT_TIME,
+              GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+              GST_SEEK_TYPE_SET, 3 * GST_SECOND, GST_SEEK_TYPE_NONE, -1)));
+  wait_for_eos ();
+
+  fail_unless (buffers != NULL);
+  buffer = GST_BUFFER (buffers->data);
+  ts = GST_BUFFER_TIMESTAMP (buffer);
+  GST_LOG ("first timestamp after seek %" GST_TIME_FORMAT, GST_TIME_ARGS (ts));
+  fail_unless (ts <= 3 * GST_SECOND);
+  fail_unless (ts + GST_BUFFER_DURATION (buffer) > 3 * GST_SECOND);
+
+  gst_element_set_state (aacparse, GST_STATE_NULL);
+  cleanup_aacparse (aacparse);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+
 static Suite *
 aacparse_suite (void)
 {
@@ -502,6 +662,7 @@ aacparse_suite (void)
   tcase_add_test (tc_chain, test_parse_adts_split);
   tcase_add_test (tc_chain, test_parse_adts_skip_garbage);
   tcase_add_test (tc_chain, test_parse_adts_detect_mpeg_version);
+  tcase_add_test (tc_chain, test_parse_adts_pull_accurate_seek);
 
   /* Other tests */
   tcase_add_test (tc_chain, test_parse_handle_codec_data);
@@ -0,0 +1,309 @@
+/*
+ * GStreamer
+ *
+ * unit test for flacparse
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+
+#define SRC_CAPS_TMPL   "audio/x-flac, framed=(boolean)false"
+#define SINK_CAPS_TMPL  "audio/x-flac"
+
+/* mono, 16 bits, frames of 4096 samples at 44.1 kHz holding a constant
+ * subframe */
+#define BLOCK_SIZE 4096
+#define SAMPLE_RATE 44100
+#define N_FRAMES 48
+#define FRAME_LEN 11
+/* the SEEKTABLE has a point every 8 frames (0.74 seconds), close enough
+ * for the parser not to add entries of its own in between */
+#define SEEK_POINT_INTERVAL 8
+#define N_SEEK_POINTS (N_FRAMES / SEEK_POINT_INTERVAL - 1)
+#define HEADERS_LEN (4 + 4 + 34 + 4 + 18 * N_SEEK_POINTS)
+
+GstPad *srcpad, *sinkpad;
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (SINK_CAPS_TMPL)
+    );
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (SRC_CAPS_TMPL)
+    );
+
+/* CRC-8, poly = x^8 + x^2 + x^1 + x^0, init = 0 */
+static guint8
+crc8 (const guint8 * data, guint length)
+{
+  guint8 crc = 0;
+  guint i;
+
+  while (length--) {
+    crc ^= *data++;
+    for (i = 0; i < 8; i++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+
+  return crc;
+}
+
+/* the frame CRC-16 is only verified when asked for, it is left 0 */
+static guint8 *
+create_stream (guint * size)
+{
+  guint8 *data, *p;
+  guint i;
+
+  *size = HEADERS_LEN + N_FRAMES * FRAME_LEN;
+  data = p = g_malloc0 (*size);
+
+  memcpy (p, "fLaC", 4);
+  p += 4;
+
+  /* STREAMINFO, frame sizes and MD5 unknown */
+  GST_WRITE_UINT32_BE (p, 34);
+  GST_WRITE_UINT16_BE (p + 4, BLOCK_SIZE);
+  GST_WRITE_UINT16_BE (p + 6, BLOCK_SIZE);
+  GST_WRITE_UINT64_BE (p + 14, ((guint64) SAMPLE_RATE << 44) |
+      (G_GUINT64_CONSTANT (15) << 36) | (N_FRAMES * BLOCK_SIZE));
+  p += 4 + 34;
+
+  /* SEEKTABLE, the last metadata block */
+  GST_WRITE_UINT32_BE (p, 0x83000000 | (18 * N_SEEK_POINTS));
+  p += 4;
+  for (i = 1; i <= N_SEEK_POINTS; i++) {
+    guint frame = i * SEEK_POINT_INTERVAL;
+
+    GST_WRITE_UINT64_BE (p, (guint64) frame * BLOCK_SIZE);
+    GST_WRITE_UINT64_BE (p + 8, (guint64) frame * FRAME_LEN);
+    GST_WRITE_UINT16_BE (p + 16, BLOCK_SIZE);
+    p += 18;
+  }
+
+  for (i = 0; i < N_FRAMES; i++) {
+    p[0] = 0xff;
+    p[1] = 0xf8;
+    /* 4096 samples, 44.1 kHz */
+    p[2] = 0xc9;
+    /* mono, 16 bits */
+    p[3] = 0x08;
+    p[4] = i;
+    p[5] = crc8 (p, 5);
+    /* constant subframe of 0 */
+    p += FRAME_LEN;
+  }
+
+  return data;
+}
+
+/* pull mode: the data is served from memory by getrange on srcpad */
+static const guint8 *pull_data;
+static guint pull_size;
+static gboolean have_eos;
+
+static GstFlowReturn
+pull_getrange (GstPad * pad, guint64 offset, guint length, GstBuffer ** buffer)
+{
+  if (offset >= pull_size)
+    return GST_FLOW_UNEXPECTED;
+
+  length = MIN (length, pull_size - offset);
+  *buffer = gst_buffer_new_and_alloc (length);
+  memcpy (GST_BUFFER_DATA (*buffer), pull_data + offset, length);
+  GST_BUFFER_OFFSET (*buffer) = offset;
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+pull_checkgetrange (GstPad * pad)
+{
+  return TRUE;
+}
+
+static gboolean
+pull_src_query (GstPad * pad, GstQuery * query)
+{
+  GstFormat format;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_DURATION)
+    return FALSE;
+
+  gst_query_parse_duration (query, &format, NULL);
+  if (format != GST_FORMAT_BYTES)
+    return FALSE;
+
+  gst_query_set_duration (query, GST_FORMAT_BYTES, pull_size);
+  return TRUE;
+}
+
+/* time seeks are left to the parser */
+static gboolean
+pull_src_event (GstPad * pad, GstEvent * event)
+{
+  gst_event_unref (event);
+  return FALSE;
+}
+
+static gboolean
+pull_sink_event (GstPad * pad, GstEvent * event)
+{
+  g_mutex_lock (check_mutex);
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_EOS:
+      have_eos = TRUE;
+      g_cond_signal (check_cond);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      /* only keep what is pushed after a seek */
+      gst_check_drop_buffers ();
+      have_eos = FALSE;
+      break;
+    default:
+      break;
+  }
+  g_mutex_unlock (check_mutex);
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static void
+wait_for_eos (void)
+{
+  g_mutex_lock (check_mutex);
+  while (!have_eos)
+    g_cond_wait (check_cond, check_mutex);
+  g_mutex_unlock (check_mutex);
+}
+
+static GstElement *
+setup_flacparse_pull (const guint8 * data, guint size)
+{
+  GstElement *flacparse;
+  GstBus *bus;
+
+  pull_data = data;
+  pull_size = size;
+  have_eos = FALSE;
+
+  flacparse = gst_check_setup_element ("flacparse");
+  srcpad = gst_check_setup_src_pad (flacparse, &srctemplate, NULL);
+  gst_pad_set_getrange_function (srcpad, pull_getrange);
+  gst_pad_set_checkgetrange_function (srcpad, pull_checkgetrange);
+  gst_pad_set_query_function (srcpad, pull_src_query);
+  gst_pad_set_event_function (srcpad, pull_src_event);
+  sinkpad = gst_check_setup_sink_pad (flacparse, &sinktemplate, NULL);
+  gst_pad_set_event_function (sinkpad, pull_sink_event);
+  gst_pad_set_active (sinkpad, TRUE);
+
+  bus = gst_bus_new ();
+  gst_element_set_bus (flacparse, bus);
+
+  buffers = NULL;
+
+  /* activates srcpad in pull mode and starts the streaming task */
+  fail_unless (gst_element_set_state (flacparse,
+          GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE,
+      "could not set to paused");
+
+  return flacparse;
+}
+
+static void
+cleanup_flacparse (GstElement * flacparse)
+{
+  GstBus *bus;
+
+  gst_element_set_state (flacparse, GST_STATE_NULL);
+
+  /* Free parsed buffers */
+  gst_check_drop_buffers ();
+
+  bus = GST_ELEMENT_BUS (flacparse);
+  gst_bus_set_flushing (bus, TRUE);
+  gst_object_unref (bus);
+
+  gst_pad_set_active (srcpad, FALSE);
+  gst_pad_set_active (sinkpad, FALSE);
+  gst_check_teardown_src_pad (flacparse);
+  gst_check_teardown_sink_pad (flacparse);
+  gst_check_teardown_element (flacparse);
+}
+
+
+/*
+ * Test if a seek in pull mode starts at the SEEKTABLE point before the seek
+ * position.
+ */
+GST_START_TEST (test_parse_seektable_seek)
+{
+  GstElement *flacparse;
+  GstBuffer *buffer;
+  GstClockTime expected;
+  guint8 *data;
+  guint size;
+
+  data = create_stream (&size);
+  flacparse = setup_flacparse_pull (data, size);
+
+  /* the marker, STREAMINFO and SEEKTABLE, then the frames */
+  wait_for_eos ();
+  fail_unless_equals_int (g_list_length (buffers), 3 + N_FRAMES);
+
+  fail_unless (gst_element_send_event (flacparse,
+          gst_event_new_seek (1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
+              GST_SEEK_TYPE_SET, 2700 * GST_MSECOND, GST_SEEK_TYPE_NONE, -1)));
+  wait_for_eos ();
+
+  /* the point at frame 24 (2.23 seconds) is the last one before */
+  expected = gst_util_uint64_scale (3 * SEEK_POINT_INTERVAL,
+      BLOCK_SIZE * GST_SECOND, SAMPLE_RATE);
+
+  fail_unless (buffers != NULL);
+  buffer = GST_BUFFER (buffers->data);
+  GST_LOG ("first timestamp after seek %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buffer)));
+  fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffer), expected);
+  fail_unless_equals_int (g_list_length (buffers),
+      N_FRAMES - 3 * SEEK_POINT_INTERVAL);
+
+  cleanup_flacparse (flacparse);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+
+static Suite *
+flacparse_suite (void)
+{
+  Suite *s = suite_create ("flacparse");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_parse_seektable_seek);
+
+  return s;
+}
+
+GST_CHECK_MAIN (flacparse);
@@ -0,0 +1,258 @@
+/* GStreamer
+ *
+ * unit test for liveadder
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+
+#define N_INPUTS 3
+#define RATE 8000
+/* liveadder pushes periods of 10 ms */
+#define PERIOD_SAMPLES (RATE / 100)
+#define N_PERIODS 2
+#define N_SAMPLES (N_PERIODS * PERIOD_SAMPLES)
+
+#define AUDIO_CAPS_STRING "audio/x-raw-int, " \
+    "rate = (int) 8000, " \
+    "channels = (int) 1, " \
+    "endianness = (int) BYTE_ORDER, " \
+    "width = (int) 16, " \
+    "depth = (int) 16, " \
+    "signed = (boolean) true"
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw-int"));
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw-int"));
+
+/* what arrives on the mixminusN pads, protected by check_mutex */
+static GList *mixminus_buffers[N_INPUTS];
+
+static GstFlowReturn
+mixminus_chain (GstPad * pad, GstBuffer * buffer)
+{
+  gint index = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (pad), "index"));
+
+  g_mutex_lock (check_mutex);
+  mixminus_buffers[index] = g_list_append (mixminus_buffers[index], buffer);
+  g_cond_signal (check_cond);
+  g_mutex_unlock (check_mutex);
+
+  return GST_FLOW_OK;
+}
+
+/* The first period stays well inside the range, so the mixminus outputs
+ * are made by taking the input out of the mix again. In the second period
+ * the mix saturates and they have to be added up from the other inputs.
+ * The signs alternate but agree between the inputs of a sample, so the
+ * clipped mix does not depend on the order the inputs are added in. */
+static gint16
+input_sample (gint input, gint i)
+{
+  static const gint16 loud[N_INPUTS] = { 30000, 20000, 10000 };
+
+  if (i < PERIOD_SAMPLES) {
+    switch (input) {
+      case 0:
+        return 100 * i - 4000;
+      case 1:
+        return 1000 - 25 * i;
+      default:
+        return (i % 7) * 300 - 900;
+    }
+  }
+
+  return (i & 1) ? -loud[input] : loud[input];
+}
+
+/* the sum of the inputs except the one numbered exclude, -1 for all */
+static gint16
+expected_sample (gint exclude, gint i)
+{
+  gint input, sum = 0;
+
+  for (input = 0; input < N_INPUTS; input++)
+    if (input != exclude)
+      sum += input_sample (input, i);
+
+  return CLAMP (sum, G_MININT16, G_MAXINT16);
+}
+
+static void
+check_output (GList * outbuffers, gint exclude, const gchar * name)
+{
+  GList *item;
+  gint i = 0, j;
+
+  fail_unless_equals_int (g_list_length (outbuffers), N_PERIODS);
+
+  for (item = outbuffers; item; item = g_list_next (item)) {
+    GstBuffer *buffer = GST_BUFFER (item->data);
+    gint16 *data = (gint16 *) GST_BUFFER_DATA (buffer);
+
+    fail_unless_equals_int (GST_BUFFER_SIZE (buffer), PERIOD_SAMPLES * 2);
+    fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffer),
+        gst_util_uint64_scale_int (i, GST_SECOND, RATE));
+
+    for (j = 0; j < PERIOD_SAMPLES; j++, i++)
+      fail_unless (data[j] == expected_sample (exclude, i),
+          "%s sample %d is %d instead of %d", name, i, data[j],
+          expected_sample (exclude, i));
+  }
+}
+
+GST_START_TEST (test_mix_and_mixminus)
+{
+  GstElement *liveadder;
+  GstClock *clock;
+  GstCaps *caps;
+  GstPad *sinkpads[N_INPUTS], *mmpads[N_INPUTS];
+  GstPad *srcs[N_INPUTS], *mmsinks[N_INPUTS];
+  GstPad *sink;
+  gint input, i;
+
+  liveadder = gst_check_setup_element ("liveadder");
+
+  /* pushing of the first period is held back until all inputs are in, the
+   * latency is dropped again to release it */
+  g_object_set (liveadder, "latency", 5000, NULL);
+  clock = gst_system_clock_obtain ();
+  gst_element_set_clock (liveadder, clock);
+  gst_element_set_base_time (liveadder, gst_clock_get_time (clock));
+
+  sink = gst_check_setup_sink_pad (liveadder, &sinktemplate, NULL);
+
+  for (input = 0; input < N_INPUTS; input++) {
+    gchar *name;
+
+    name = g_strdup_printf ("sink%d", input);
+    sinkpads[input] = gst_element_get_request_pad (liveadder, name);
+    fail_unless (sinkpads[input] != NULL);
+    fail_unless_equals_string (GST_PAD_NAME (sinkpads[input]), name);
+    srcs[input] = gst_check_setup_src_pad_by_name (liveadder, &srctemplate,
+        name);
+    g_free (name);
+
+    name = g_strdup_printf ("mixminus%d", input);
+    mmpads[input] = gst_element_get_request_pad (liveadder, name);
+    fail_unless (mmpads[input] != NULL);
+    mmsinks[input] = gst_check_setup_sink_pad_by_name (liveadder,
+        &sinktemplate, name);
+    g_object_set_data (G_OBJECT (mmsinks[input]), "index",
+        GINT_TO_POINTER (input));
+    gst_pad_set_chain_function (mmsinks[input], mixminus_chain);
+    g_free (name);
+  }
+
+  fail_unless (gst_element_set_state (liveadder,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  gst_pad_set_active (sink, TRUE);
+  caps = gst_caps_from_string (AUDIO_CAPS_STRING);
+  for (input = 0; input < N_INPUTS; input++) {
+    gst_pad_set_active (srcs[input], TRUE);
+    gst_pad_set_active (mmsinks[input], TRUE);
+    fail_unless (gst_pad_set_caps (srcs[input], caps));
+    fail_unless (gst_pad_push_event (srcs[input],
+            gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_TIME, 0, -1,
+                0)));
+  }
+
+  for (input = 0; input < N_INPUTS; input++) {
+    GstBuffer *buffer = gst_buffer_new_and_alloc (N_SAMPLES * 2);
+    gint16 *data = (gint16 *) GST_BUFFER_DATA (buffer);
+
+    for (i = 0; i < N_SAMPLES; i++)
+      data[i] = input_sample (input, i);
+    GST_BUFFER_TIMESTAMP (buffer) = 0;
+    GST_BUFFER_DURATION (buffer) =
+        gst_util_uint64_scale_int (N_SAMPLES, GST_SECOND, RATE);
+    gst_buffer_set_caps (buffer, caps);
+
+    fail_unless_equals_int (gst_pad_push (srcs[input], buffer), GST_FLOW_OK);
+  }
+
+  g_object_set (liveadder, "latency", 0, NULL);
+
+  g_mutex_lock (check_mutex);
+  for (;;) {
+    gboolean done = g_list_length (buffers) == N_PERIODS;
+
+    for (input = 0; input < N_INPUTS; input++)
+      done &= g_list_length (mixminus_buffers[input]) == N_PERIODS;
+    if (done)
+      break;
+    g_cond_wait (check_cond, check_mutex);
+  }
+  g_mutex_unlock (check_mutex);
+
+  check_output (buffers, -1, "src");
+  for (input = 0; input < N_INPUTS; input++) {
+    gchar *name = g_strdup_printf ("mixminus%d", input);
+
+    check_output (mixminus_buffers[input], input, name);
+    g_free (name);
+  }
+
+  fail_unless (gst_element_set_state (liveadder,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  for (input = 0; input < N_INPUTS; input++) {
+    gst_pad_set_active (srcs[input], FALSE);
+    gst_pad_set_active (mmsinks[input], FALSE);
+    gst_object_unref (sinkpads[input]);
+    gst_object_unref (mmpads[input]);
+    gst_check_teardown_pad_by_name (liveadder, GST_PAD_NAME (sinkpads[input]));
+    gst_check_teardown_pad_by_name (liveadder, GST_PAD_NAME (mmpads[input]));
+    gst_element_release_request_pad (liveadder, sinkpads[input]);
+    gst_element_release_request_pad (liveadder, mmpads[input]);
+
+    g_list_foreach (mixminus_buffers[input], (GFunc) gst_buffer_unref, NULL);
+    g_list_free (mixminus_buffers[input]);
+    mixminus_buffers[input] = NULL;
+  }
+  gst_pad_set_active (sink, FALSE);
+  gst_check_teardown_sink_pad (liveadder);
+  gst_check_drop_buffers ();
+
+  gst_caps_unref (caps);
+  gst_object_unref (clock);
+  gst_check_teardown_element (liveadder);
+}
+
+GST_END_TEST;
+
+static Suite *
+liveadder_suite (void)
+{
+  Suite *s = suite_create ("liveadder");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_mix_and_mixminus);
+
+  return s;
+}
+
+GST_CHECK_MAIN (liveadder);
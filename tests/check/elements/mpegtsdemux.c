@@ -0,0 +1,530 @@
+/*
+ * GStreamer
+ *
+ * unit test for mpegtsdemux
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+#include <gst/gst-mpegts-crc.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SRC_CAPS_TMPL   "video/mpegts"
+#define SINK_CAPS_TMPL  "audio/mpeg"
+
+#define PACKET_SIZE 188
+#define PMT_PID 0x0100
+#define AUDIO_PID 0x0101
+#define NULL_PID 0x1fff
+
+/* every 10ms of the 10 second stream has one audio packet carrying the PCR
+ * and a PES with a PTS 100ms after it, padded with null packets to keep the
+ * bitrate high enough for the seek bisection to narrow down the position.
+ * PAT and PMT are repeated every 100ms */
+#define N_TICKS 1000
+#define TICK_PACKETS 10
+#define TICK_PCR 900
+#define TABLE_INTERVAL 10
+#define FIRST_PCR 90000
+#define PTS_DELAY 9000
+
+#define MPEG_TIME(ts) gst_util_uint64_scale ((ts), GST_MSECOND / 10, 9)
+#define BASE_TIME MPEG_TIME (FIRST_PCR)
+#define TICK_TIME(tick) MPEG_TIME (FIRST_PCR + (tick) * TICK_PCR + PTS_DELAY)
+/* the demuxer starts up to 500ms before the target to find the frames
+ * presented after their PCR, and the index or the bisection only find a
+ * PCR up to another 500ms before that */
+#define SEEK_WINDOW GST_SECOND
+
+GstPad *srcpad, *sinkpad;
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (SINK_CAPS_TMPL)
+    );
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (SRC_CAPS_TMPL)
+    );
+
+static guint8 continuity[NULL_PID + 1];
+
+static guint8 *
+write_header (guint8 * p, guint16 pid, gboolean start, gboolean adaptation)
+{
+  memset (p, 0xff, PACKET_SIZE);
+  p[0] = 0x47;
+  p[1] = (start ? 0x40 : 0x00) | (pid >> 8);
+  p[2] = pid & 0xff;
+  p[3] = (adaptation ? 0x30 : 0x10) | (continuity[pid]++ & 0x0f);
+
+  return p + 4;
+}
+
+/* one section starting in a packet of its own, @section holds the
+ * section_length and room for the CRC_32 */
+static void
+write_section (guint8 * p, guint16 pid, guint8 * section, guint len)
+{
+  guint32 crc = gst_mpegts_crc32 (section, len - 4);
+
+  GST_WRITE_UINT32_BE (section + len - 4, crc);
+  p = write_header (p, pid, TRUE, FALSE);
+  *p++ = 0x00;
+  memcpy (p, section, len);
+}
+
+static void
+write_pat (guint8 * p)
+{
+  guint8 section[] = {
+    0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0x00, 0x01, 0xe0 | (PMT_PID >> 8), PMT_PID & 0xff,
+    0x00, 0x00, 0x00, 0x00
+  };
+
+  write_section (p, 0x0000, section, sizeof (section));
+}
+
+static void
+write_pmt (guint8 * p)
+{
+  guint8 section[] = {
+    0x02, 0xb0, 0x12, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0xe0 | (AUDIO_PID >> 8), AUDIO_PID & 0xff, 0xf0, 0x00,
+    0x03, 0xe0 | (AUDIO_PID >> 8), AUDIO_PID & 0xff, 0xf0, 0x00,
+    0x00, 0x00, 0x00, 0x00
+  };
+
+  write_section (p, PMT_PID, section, sizeof (section));
+}
+
+/* the PCR in the adaptation field, followed by a PES filling the packet */
+static void
+write_audio (guint8 * p, guint64 pcr, guint64 pts)
+{
+  guint8 *pes;
+  guint len;
+
+  p = write_header (p, AUDIO_PID, TRUE, TRUE);
+  *p++ = 7;
+  *p++ = 0x10;
+  *p++ = pcr >> 25;
+  *p++ = pcr >> 17;
+  *p++ = pcr >> 9;
+  *p++ = pcr >> 1;
+  *p++ = ((pcr & 1) << 7) | 0x7e;
+  *p++ = 0x00;
+
+  pes = p;
+  len = PACKET_SIZE - 12 - 6;
+  *p++ = 0x00;
+  *p++ = 0x00;
+  *p++ = 0x01;
+  *p++ = 0xc0;
+  *p++ = len >> 8;
+  *p++ = len & 0xff;
+  *p++ = 0x80;
+  *p++ = 0x80;
+  *p++ = 5;
+  *p++ = 0x21 | ((pts >> 29) & 0x0e);
+  *p++ = pts >> 22;
+  *p++ = ((pts >> 14) & 0xfe) | 0x01;
+  *p++ = pts >> 7;
+  *p++ = ((pts << 1) & 0xfe) | 0x01;
+  memset (p, 0x00, PACKET_SIZE - 12 - (p - pes));
+}
+
+static guint8 *
+create_stream (guint * size)
+{
+  guint8 *data, *p;
+  guint tick, i;
+
+  memset (continuity, 0, sizeof (continuity));
+
+  *size = N_TICKS * TICK_PACKETS * PACKET_SIZE;
+  p = data = g_malloc (*size);
+
+  for (tick = 0; tick < N_TICKS; tick++) {
+    guint64 pcr = FIRST_PCR + tick * TICK_PCR;
+
+    i = 0;
+    if (tick % TABLE_INTERVAL == 0) {
+      write_pat (p);
+      write_pmt (p + PACKET_SIZE);
+      p += 2 * PACKET_SIZE;
+      i += 2;
+    }
+    write_audio (p, pcr, pcr + PTS_DELAY);
+    p += PACKET_SIZE;
+    for (i++; i < TICK_PACKETS; i++) {
+      write_header (p, NULL_PID, FALSE, FALSE);
+      p += PACKET_SIZE;
+    }
+  }
+
+  return data;
+}
+
+/* pull mode: the data is served from memory by getrange on srcpad */
+static const guint8 *pull_data;
+static guint pull_size;
+static gboolean have_eos;
+static gint64 segment_start;
+
+static GstFlowReturn
+pull_getrange (GstPad * pad, guint64 offset, guint length, GstBuffer ** buffer)
+{
+  if (offset >= pull_size)
+    return GST_FLOW_UNEXPECTED;
+
+  length = MIN (length, pull_size - offset);
+  *buffer = gst_buffer_new_and_alloc (length);
+  memcpy (GST_BUFFER_DATA (*buffer), pull_data + offset, length);
+  GST_BUFFER_OFFSET (*buffer) = offset;
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+pull_checkgetrange (GstPad * pad)
+{
+  return TRUE;
+}
+
+static gboolean
+pull_src_query (GstPad * pad, GstQuery * query)
+{
+  GstFormat format;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_DURATION)
+    return FALSE;
+
+  gst_query_parse_duration (query, &format, NULL);
+  if (format != GST_FORMAT_BYTES)
+    return FALSE;
+
+  gst_query_set_duration (query, GST_FORMAT_BYTES, pull_size);
+  return TRUE;
+}
+
+/* time seeks are left to the demuxer */
+static gboolean
+pull_src_event (GstPad * pad, GstEvent * event)
+{
+  gst_event_unref (event);
+  return FALSE;
+}
+
+static GstFlowReturn
+pull_sink_chain (GstPad * pad, GstBuffer * buffer)
+{
+  g_mutex_lock (check_mutex);
+  buffers = g_list_append (buffers, buffer);
+  g_mutex_unlock (check_mutex);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+pull_sink_event (GstPad * pad, GstEvent * event)
+{
+  g_mutex_lock (check_mutex);
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_NEWSEGMENT:
+      gst_event_parse_new_segment (event, NULL, NULL, NULL, &segment_start,
+          NULL, NULL);
+      break;
+    case GST_EVENT_EOS:
+      have_eos = TRUE;
+      g_cond_signal (check_cond);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      /* only keep what is pushed after a seek */
+      gst_check_drop_buffers ();
+      have_eos = FALSE;
+      break;
+    default:
+      break;
+  }
+  g_mutex_unlock (check_mutex);
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static void
+wait_for_eos (void)
+{
+  g_mutex_lock (check_mutex);
+  while (!have_eos)
+    g_cond_wait (check_cond, check_mutex);
+  g_mutex_unlock (check_mutex);
+}
+
+static void
+pad_added (GstElement * element, GstPad * pad, gpointer user_data)
+{
+  gchar *name = gst_pad_get_name (pad);
+
+  fail_unless_equals_string (name, "audio_0101");
+  fail_unless (gst_pad_link (pad, sinkpad) == GST_PAD_LINK_OK);
+
+  g_free (name);
+}
+
+static GstElement *
+setup_mpegtsdemux_pull (const guint8 * data, guint size,
+    const gchar * index_location)
+{
+  GstElement *mpegtsdemux;
+  GstBus *bus;
+
+  pull_data = data;
+  pull_size = size;
+  have_eos = FALSE;
+  segment_start = -1;
+
+  mpegtsdemux = gst_check_setup_element ("mpegtsdemux");
+  g_object_set (mpegtsdemux, "index-location", index_location, NULL);
+  g_signal_connect (mpegtsdemux, "pad-added", G_CALLBACK (pad_added), NULL);
+
+  srcpad = gst_check_setup_src_pad (mpegtsdemux, &srctemplate, NULL);
+  gst_pad_set_getrange_function (srcpad, pull_getrange);
+  gst_pad_set_checkgetrange_function (srcpad, pull_checkgetrange);
+  gst_pad_set_query_function (srcpad, pull_src_query);
+  gst_pad_set_event_function (srcpad, pull_src_event);
+
+  /* linked when the demuxer adds the audio pad */
+  sinkpad = gst_pad_new_from_static_template (&sinktemplate, "sink");
+  gst_pad_set_chain_function (sinkpad, pull_sink_chain);
+  gst_pad_set_event_function (sinkpad, pull_sink_event);
+  gst_pad_set_active (sinkpad, TRUE);
+
+  bus = gst_bus_new ();
+  gst_element_set_bus (mpegtsdemux, bus);
+
+  buffers = NULL;
+
+  /* activates srcpad in pull mode and starts the streaming task */
+  fail_unless (gst_element_set_state (mpegtsdemux,
+          GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE,
+      "could not set to paused");
+
+  return mpegtsdemux;
+}
+
+static void
+cleanup_mpegtsdemux (GstElement * mpegtsdemux)
+{
+  GstBus *bus;
+
+  /* saves the index */
+  gst_element_set_state (mpegtsdemux, GST_STATE_NULL);
+
+  /* Free demuxed buffers */
+  gst_check_drop_buffers ();
+
+  bus = GST_ELEMENT_BUS (mpegtsdemux);
+  gst_bus_set_flushing (bus, TRUE);
+  gst_object_unref (bus);
+
+  gst_pad_set_active (srcpad, FALSE);
+  gst_pad_set_active (sinkpad, FALSE);
+  gst_object_unref (sinkpad);
+  gst_check_teardown_src_pad (mpegtsdemux);
+  gst_check_teardown_element (mpegtsdemux);
+}
+
+static void
+seek_and_wait (GstElement * mpegtsdemux, GstClockTime position)
+{
+  fail_unless (gst_element_send_event (mpegtsdemux,
+          gst_event_new_seek (1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
+              GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_NONE, -1)));
+  wait_for_eos ();
+
+  /* the segment is in the PTS timeline, starting at the first PCR */
+  fail_unless_equals_uint64 (segment_start, BASE_TIME + position);
+}
+
+/* Checks that the data after the seek starts shortly before the seek target
+ * and is complete up to the end of the stream */
+static void
+check_seek_data (GstClockTime position)
+{
+  GstClockTime first, last;
+
+  fail_unless (buffers != NULL);
+  first = GST_BUFFER_TIMESTAMP (GST_BUFFER (buffers->data));
+  last = GST_BUFFER_TIMESTAMP (GST_BUFFER (g_list_last (buffers)->data));
+  GST_LOG ("first timestamp after seek %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (first - BASE_TIME));
+
+  fail_unless (first <= BASE_TIME + position);
+  fail_unless (first + SEEK_WINDOW >= BASE_TIME + position);
+  fail_unless_equals_uint64 (last, TICK_TIME (N_TICKS - 1));
+  fail_unless_equals_int (g_list_length (buffers),
+      N_TICKS - (first - TICK_TIME (0)) / (10 * GST_MSECOND));
+}
+
+static gchar *
+create_index_location (void)
+{
+  gchar *location;
+  gint fd;
+
+  location = g_build_filename (g_get_tmp_dir (), "mpegtsdemux-XXXXXX", NULL);
+  fd = g_mkstemp (location);
+  fail_unless (fd != -1);
+  close (fd);
+  g_unlink (location);
+
+  return location;
+}
+
+/*
+ * Test a seek right after starting, the demuxer has to bisect on the PCRs
+ * as it did not see most of the file yet.
+ */
+GST_START_TEST (test_pull_seek)
+{
+  GstElement *mpegtsdemux;
+  guint8 *data;
+  guint size;
+
+  data = create_stream (&size);
+  mpegtsdemux = setup_mpegtsdemux_pull (data, size, NULL);
+
+  seek_and_wait (mpegtsdemux, 3 * GST_SECOND);
+  check_seek_data (3 * GST_SECOND);
+
+  seek_and_wait (mpegtsdemux, 7250 * GST_MSECOND);
+  check_seek_data (7250 * GST_MSECOND);
+
+  cleanup_mpegtsdemux (mpegtsdemux);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/*
+ * Test that the index of a first pass is saved to the index-location and
+ * used for seeking by the next instance.
+ */
+GST_START_TEST (test_pull_seek_index)
+{
+  GstElement *mpegtsdemux;
+  gchar *location, *contents, *header;
+  gchar **lines;
+  guint8 *data;
+  guint size;
+
+  data = create_stream (&size);
+  location = create_index_location ();
+
+  mpegtsdemux = setup_mpegtsdemux_pull (data, size, location);
+  wait_for_eos ();
+  fail_unless_equals_int (g_list_length (buffers), N_TICKS);
+  cleanup_mpegtsdemux (mpegtsdemux);
+
+  /* no random access points flagged, an entry every 500ms */
+  fail_unless (g_file_get_contents (location, &contents, NULL, NULL));
+  header = g_strdup_printf ("mpegtsdemux-index 1\n%u %u 0\n0 %u ", size,
+      FIRST_PCR, 2 * PACKET_SIZE);
+  fail_unless (g_str_has_prefix (contents, header));
+  lines = g_strsplit (contents, "\n", -1);
+  fail_unless_equals_int (g_strv_length (lines), 2 + N_TICKS / 50 + 1);
+  g_strfreev (lines);
+  g_free (header);
+  g_free (contents);
+
+  mpegtsdemux = setup_mpegtsdemux_pull (data, size, location);
+  seek_and_wait (mpegtsdemux, 3 * GST_SECOND);
+  check_seek_data (3 * GST_SECOND);
+  cleanup_mpegtsdemux (mpegtsdemux);
+
+  g_unlink (location);
+  g_free (location);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/*
+ * Test that an index entry close enough to the target is used as it is,
+ * without looking at the PCRs of the file.
+ */
+GST_START_TEST (test_pull_seek_index_entry)
+{
+  GstElement *mpegtsdemux;
+  GstBuffer *buffer;
+  gchar *location, *contents;
+  guint8 *data;
+  guint size;
+
+  data = create_stream (&size);
+  location = create_index_location ();
+
+  /* the entry for 2.4 seconds points at the PAT of the tick at 1 second,
+   * which a PCR search would never come up with. Entries the demuxer adds
+   * while it runs are merged into it */
+  contents = g_strdup_printf ("mpegtsdemux-index 1\n%u %u 0\n0 %u 0\n"
+      "%" G_GUINT64_FORMAT " %u 0\n", size, FIRST_PCR, 2 * PACKET_SIZE,
+      2400 * GST_MSECOND, 100 * TICK_PACKETS * PACKET_SIZE);
+  fail_unless (g_file_set_contents (location, contents, -1, NULL));
+  g_free (contents);
+
+  mpegtsdemux = setup_mpegtsdemux_pull (data, size, location);
+  seek_and_wait (mpegtsdemux, 3 * GST_SECOND);
+
+  fail_unless (buffers != NULL);
+  buffer = GST_BUFFER (buffers->data);
+  fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffer), TICK_TIME (100));
+  fail_unless_equals_int (g_list_length (buffers), N_TICKS - 100);
+
+  cleanup_mpegtsdemux (mpegtsdemux);
+
+  g_unlink (location);
+  g_free (location);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+
+static Suite *
+mpegtsdemux_suite (void)
+{
+  Suite *s = suite_create ("mpegtsdemux");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_pull_seek);
+  tcase_add_test (tc_chain, test_pull_seek_index);
+  tcase_add_test (tc_chain, test_pull_seek_index_entry);
+
+  return s;
+}
+
+GST_CHECK_MAIN (mpegtsdemux);
@@ -206,6 +206,207 @@ GST_START_TEST (test_pull)
 
 GST_END_TEST;
 
+/* The essence element of mxf_file follows the header metadata directly.
+ * For test_pull_seek a fill item is put in front of it so that the demuxer
+ * resolves the metadata and adds its pad before pulling the essence */
+#define ESSENCE_OFFSET 19995
+#define ESSENCE_VALUE_LEN 16
+#define FILL_SIZE 64
+
+static const guint8 mxf_fill[] = {
+  0x06, 0x0e, 0x2b, 0x34, 0x01, 0x01, 0x01, 0x01,
+  0x03, 0x01, 0x02, 0x10, 0x01, 0x00, 0x00, 0x00,
+  0x83, 0x00, 0x00, FILL_SIZE - 20
+};
+
+/* the footer partition offset in the header and footer partition packs and
+ * in the random index pack */
+static const guint mxf_footer_offset_fields[] = { 44, 20059, 20075, 20307 };
+
+static guint8 *fill_file;
+static guint fill_file_size;
+static gboolean seek_started = FALSE;
+static gboolean seeking = FALSE;
+static gboolean essence_blocked = FALSE;
+static gboolean essence_pulled_while_seeking = FALSE;
+
+static void
+_create_fill_file (void)
+{
+  guint i;
+
+  fill_file_size = sizeof (mxf_file) + FILL_SIZE;
+  fill_file = g_malloc0 (fill_file_size);
+  memcpy (fill_file, mxf_file, ESSENCE_OFFSET);
+  memcpy (fill_file + ESSENCE_OFFSET, mxf_fill, sizeof (mxf_fill));
+  memcpy (fill_file + ESSENCE_OFFSET + FILL_SIZE, mxf_file + ESSENCE_OFFSET,
+      sizeof (mxf_file) - ESSENCE_OFFSET);
+
+  for (i = 0; i < G_N_ELEMENTS (mxf_footer_offset_fields); i++) {
+    guint8 *field = fill_file + mxf_footer_offset_fields[i];
+
+    if (mxf_footer_offset_fields[i] > ESSENCE_OFFSET)
+      field += FILL_SIZE;
+    GST_WRITE_UINT64_BE (field, GST_READ_UINT64_BE (field) + FILL_SIZE);
+  }
+}
+
+/* Holds back the first read of the essence until a seek flushes us, the
+ * essence must not be read while seeking either */
+static GstFlowReturn
+_src_getrange_fill (GstPad * pad, guint64 offset, guint length,
+    GstBuffer ** buffer)
+{
+  guint64 essence = ESSENCE_OFFSET + FILL_SIZE + 20;
+  GstCaps *caps;
+
+  if (offset + length > fill_file_size)
+    return GST_FLOW_UNEXPECTED;
+
+  if (offset < essence + ESSENCE_VALUE_LEN && offset + length > essence) {
+    g_mutex_lock (check_mutex);
+    if (seeking)
+      essence_pulled_while_seeking = TRUE;
+    if (!seek_started) {
+      essence_blocked = TRUE;
+      g_cond_broadcast (check_cond);
+      while (!seek_started)
+        g_cond_wait (check_cond, check_mutex);
+      g_mutex_unlock (check_mutex);
+      return GST_FLOW_WRONG_STATE;
+    }
+    g_mutex_unlock (check_mutex);
+  }
+
+  caps = gst_caps_new_simple ("application/mxf", NULL);
+
+  *buffer = gst_buffer_new ();
+  GST_BUFFER_DATA (*buffer) = fill_file + offset;
+  GST_BUFFER_SIZE (*buffer) = length;
+  gst_buffer_set_caps (*buffer, caps);
+  gst_caps_unref (caps);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+_src_query_fill (GstPad * pad, GstQuery * query)
+{
+  GstFormat fmt;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_DURATION)
+    return FALSE;
+
+  gst_query_parse_duration (query, &fmt, NULL);
+
+  if (fmt != GST_FORMAT_BYTES)
+    return FALSE;
+
+  gst_query_set_duration (query, fmt, fill_file_size);
+
+  return TRUE;
+}
+
+static gboolean
+_src_event_fill (GstPad * pad, GstEvent * event)
+{
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_START) {
+    g_mutex_lock (check_mutex);
+    seek_started = TRUE;
+    seeking = TRUE;
+    g_cond_broadcast (check_cond);
+    g_mutex_unlock (check_mutex);
+  }
+
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static gboolean
+_sink_event_fill (GstPad * pad, GstEvent * event)
+{
+  /* sent downstream once the seek position is found */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+    g_mutex_lock (check_mutex);
+    seeking = FALSE;
+    g_mutex_unlock (check_mutex);
+  }
+
+  return _sink_event (pad, event);
+}
+
+/* Seeking before the essence was seen has to look up the essence element
+ * in the index table segment of the footer partition. Without it the
+ * demuxer would have to read through the essence to find the element */
+GST_START_TEST (test_pull_seek)
+{
+  GstElement *mxfdemux;
+  GstPad *sinkpad;
+
+  have_eos = FALSE;
+  have_data = FALSE;
+  seek_started = FALSE;
+  seeking = FALSE;
+  essence_blocked = FALSE;
+  essence_pulled_while_seeking = FALSE;
+  loop = g_main_loop_new (NULL, FALSE);
+  _create_fill_file ();
+
+  mxfdemux = gst_element_factory_make ("mxfdemux", NULL);
+  fail_unless (mxfdemux != NULL);
+  g_signal_connect (mxfdemux, "pad-added", G_CALLBACK (_pad_added), NULL);
+  sinkpad = gst_element_get_static_pad (mxfdemux, "sink");
+  fail_unless (sinkpad != NULL);
+
+  mysinkpad = _create_sink_pad ();
+  fail_unless (mysinkpad != NULL);
+  gst_pad_set_event_function (mysinkpad, _sink_event_fill);
+  mysrcpad = gst_pad_new_from_static_template (&mysrctemplate, "src");
+  gst_pad_set_getrange_function (mysrcpad, _src_getrange_fill);
+  gst_pad_set_query_function (mysrcpad, _src_query_fill);
+  gst_pad_set_event_function (mysrcpad, _src_event_fill);
+
+  fail_unless (gst_pad_link (mysrcpad, sinkpad) == GST_PAD_LINK_OK);
+  gst_object_unref (sinkpad);
+
+  gst_pad_set_active (mysinkpad, TRUE);
+  gst_pad_set_active (mysrcpad, TRUE);
+
+  gst_element_set_state (mxfdemux, GST_STATE_PAUSED);
+
+  /* the pad is there, the essence was not read yet */
+  g_mutex_lock (check_mutex);
+  while (!essence_blocked)
+    g_cond_wait (check_cond, check_mutex);
+  g_mutex_unlock (check_mutex);
+  fail_unless (have_data == FALSE);
+
+  fail_unless (gst_element_send_event (mxfdemux,
+          gst_event_new_seek (1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
+              GST_SEEK_TYPE_SET, 100 * GST_MSECOND, GST_SEEK_TYPE_NONE, -1)));
+  fail_unless (essence_pulled_while_seeking == FALSE);
+
+  /* the edit unit containing 100ms is pushed from its start */
+  g_main_loop_run (loop);
+  fail_unless (have_eos == TRUE);
+  fail_unless (have_data == TRUE);
+
+  gst_element_set_state (mxfdemux, GST_STATE_NULL);
+  gst_pad_set_active (mysinkpad, FALSE);
+  gst_pad_set_active (mysrcpad, FALSE);
+
+  gst_object_unref (mxfdemux);
+  gst_object_unref (mysinkpad);
+  gst_object_unref (mysrcpad);
+  g_main_loop_unref (loop);
+  loop = NULL;
+  g_free (fill_file);
+  fill_file = NULL;
+}
+
+GST_END_TEST;
+
 GST_START_TEST (test_push)
 {
   GstElement *mxfdemux;
@@ -265,6 +466,7 @@ mxfdemux_suite (void)
   suite_add_tcase (s, tc_chain);
   tcase_set_timeout (tc_chain, 180);
   tcase_add_test (tc_chain, test_pull);
+  tcase_add_test (tc_chain, test_pull_seek);
   tcase_add_test (tc_chain, test_push);
 
   return s;
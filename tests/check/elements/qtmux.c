@@ -231,6 +231,119 @@ GST_START_TEST (test_audio_pad)
 
 GST_END_TEST;
 
+/* returns the atom of type fourcc among the atoms in data, or NULL */
+static const guint8 *
+find_atom (const guint8 * data, guint size, const gchar * fourcc)
+{
+  while (size >= 8) {
+    guint32 atom_size = GST_READ_UINT32_BE (data);
+
+    if (atom_size < 8 || atom_size > size)
+      return NULL;
+    if (memcmp (data + 4, fourcc, 4) == 0)
+      return data;
+    data += atom_size;
+    size -= atom_size;
+  }
+
+  return NULL;
+}
+
+GST_START_TEST (test_audio_pad_frag)
+{
+  GstElement *qtmux;
+  GstBuffer *inbuffer, *outbuffer;
+  GstCaps *caps;
+  const guint8 *moof, *traf, *tfhd, *trun;
+  guint8 *data;
+  guint size;
+  int num_buffers;
+  int i;
+
+  qtmux = setup_qtmux (&srcaudiotemplate, "audio_%d");
+  g_object_set (qtmux, "fragment-duration", 2000, NULL);
+  fail_unless (gst_element_set_state (qtmux,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* samples of the same size and duration, all in one fragment */
+  caps = gst_caps_copy (gst_pad_get_pad_template_caps (mysrcpad));
+  for (i = 0; i < 3; i++) {
+    inbuffer = gst_buffer_new_and_alloc (1);
+    gst_buffer_set_caps (inbuffer, caps);
+    GST_BUFFER_TIMESTAMP (inbuffer) = i * 40 * GST_MSECOND;
+    GST_BUFFER_DURATION (inbuffer) = 40 * GST_MSECOND;
+    ASSERT_BUFFER_REFCOUNT (inbuffer, "inbuffer", 1);
+    fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+  }
+  gst_caps_unref (caps);
+
+  /* send eos to have the last fragment written */
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+
+  num_buffers = g_list_length (buffers);
+  /* ftyp, moov, moof, mdat header and the buffers we put in */
+  fail_unless_equals_int (num_buffers, 7);
+
+  for (i = 0; i < num_buffers; ++i) {
+    outbuffer = GST_BUFFER (buffers->data);
+    fail_if (outbuffer == NULL);
+    buffers = g_list_remove (buffers, outbuffer);
+    data = GST_BUFFER_DATA (outbuffer);
+    size = GST_BUFFER_SIZE (outbuffer);
+
+    switch (i) {
+      case 1:                  /* moov, announcing fragments */
+        fail_unless (find_atom (data, size, "moov") == data);
+        fail_unless (find_atom (data + 8, size - 8, "mvex") != NULL);
+        break;
+      case 2:
+        moof = find_atom (data, size, "moof");
+        fail_unless (moof == data);
+        traf = find_atom (moof + 8, size - 8, "traf");
+        fail_unless (traf != NULL);
+        tfhd = find_atom (traf + 8, GST_READ_UINT32_BE (traf) - 8, "tfhd");
+        trun = find_atom (traf + 8, GST_READ_UINT32_BE (traf) - 8, "trun");
+        fail_unless (tfhd != NULL && trun != NULL);
+
+        /* base-data-offset and the default duration, size and flags */
+        fail_unless_equals_int (GST_READ_UINT32_BE (tfhd + 8) & 0xffffff,
+            0x39);
+        fail_unless_equals_int (GST_READ_UINT32_BE (tfhd), 36);
+        fail_unless_equals_int (GST_READ_UINT32_BE (tfhd + 28), 1);
+
+        /* so the trun has no per-sample fields */
+        fail_unless_equals_int (GST_READ_UINT32_BE (trun + 8) & 0xffffff, 0);
+        fail_unless_equals_int (GST_READ_UINT32_BE (trun + 12), 3);
+        fail_unless_equals_int (GST_READ_UINT32_BE (trun), 16);
+        break;
+      case 3:                  /* mdat header */
+        fail_unless_equals_int (size, 8);
+        fail_unless (memcmp (data + 4, "mdat", 4) == 0);
+        fail_unless_equals_int (GST_READ_UINT32_BE (data), 8 + 3);
+        break;
+      case 4:
+      case 5:
+      case 6:                  /* buffers we put in */
+        fail_unless_equals_int (size, 1);
+        break;
+      default:
+        break;
+    }
+
+    ASSERT_BUFFER_REFCOUNT (outbuffer, "outbuffer", 1);
+    gst_buffer_unref (outbuffer);
+    outbuffer = NULL;
+  }
+
+  g_list_free (buffers);
+  buffers = NULL;
+
+  cleanup_qtmux (qtmux, "audio_%d");
+}
+
+GST_END_TEST;
+
 
 static Suite *
 qtmux_suite (void)
@@ -241,6 +354,7 @@ qtmux_suite (void)
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, test_video_pad);
   tcase_add_test (tc_chain, test_audio_pad);
+  tcase_add_test (tc_chain, test_audio_pad_frag);
 
   return s;
 }
@@ -0,0 +1,201 @@
+/* GStreamer
+ *
+ * unit test for the h264parse NAL unit bitstream reader
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include "gstnalbs.h"
+
+/* several chunks of the reader */
+#define MAX_SIZE 512
+#define N_FIELDS 64
+#define N_RUNS 1000
+
+typedef enum
+{
+  FIELD_BITS,
+  FIELD_UE,
+  FIELD_SE
+} FieldType;
+
+typedef struct
+{
+  FieldType type;
+  guint n;
+  gint value;
+} Field;
+
+typedef struct
+{
+  guint8 data[MAX_SIZE];
+  guint pos;
+} BitWriter;
+
+static void
+put_bits (BitWriter * bw, guint32 value, guint n)
+{
+  while (n--) {
+    if ((value >> n) & 1)
+      bw->data[bw->pos >> 3] |= 0x80 >> (bw->pos & 7);
+    bw->pos++;
+  }
+}
+
+static void
+put_ue (BitWriter * bw, guint32 value)
+{
+  guint n = g_bit_storage (value + 1);
+
+  put_bits (bw, 0, n - 1);
+  put_bits (bw, value + 1, n);
+}
+
+static void
+put_se (BitWriter * bw, gint32 value)
+{
+  put_ue (bw, value > 0 ? 2 * value - 1 : -2 * value);
+}
+
+/* inserts the emulation_prevention_three_bytes, returns the escaped size */
+static guint
+escape (const BitWriter * bw, guint8 * out)
+{
+  guint i, len = 0, zeros = 0;
+
+  for (i = 0; i < (bw->pos + 7) / 8; i++) {
+    if (zeros >= 2 && bw->data[i] <= 3) {
+      out[len++] = 0x03;
+      zeros = 0;
+    }
+    out[len++] = bw->data[i];
+    zeros = bw->data[i] ? 0 : zeros + 1;
+  }
+
+  return len;
+}
+
+/* random fields, many of them 0 to get emulation prevention */
+static void
+make_fields (Field * fields, guint n_fields)
+{
+  guint i;
+
+  for (i = 0; i < n_fields; i++) {
+    Field *f = &fields[i];
+
+    f->type = g_random_int_range (FIELD_BITS, FIELD_SE + 1);
+    switch (f->type) {
+      case FIELD_BITS:
+        f->n = g_random_int_range (1, 33);
+        f->value = g_random_boolean () ? 0 : g_random_int ();
+        if (f->n < 32)
+          f->value &= (1U << f->n) - 1;
+        break;
+      case FIELD_UE:
+        f->value = g_random_boolean () ? g_random_int_range (0, 4) :
+            g_random_int_range (0, 1 << 16);
+        break;
+      case FIELD_SE:
+        f->value = g_random_int_range (-(1 << 15), 1 << 15);
+        break;
+    }
+  }
+}
+
+GST_START_TEST (test_nalbs_read)
+{
+  Field fields[N_FIELDS];
+  guint8 escaped[MAX_SIZE * 3 / 2];
+  guint run, i, len;
+
+  for (run = 0; run < N_RUNS; run++) {
+    BitWriter bw = { {0,}, 0 };
+    GstNalBs bs;
+
+    make_fields (fields, N_FIELDS);
+    for (i = 0; i < N_FIELDS; i++) {
+      switch (fields[i].type) {
+        case FIELD_BITS:
+          put_bits (&bw, fields[i].value, fields[i].n);
+          break;
+        case FIELD_UE:
+          put_ue (&bw, fields[i].value);
+          break;
+        case FIELD_SE:
+          put_se (&bw, fields[i].value);
+          break;
+      }
+    }
+    len = escape (&bw, escaped);
+
+    gst_nal_bs_init (&bs, escaped, len);
+    for (i = 0; i < N_FIELDS; i++) {
+      switch (fields[i].type) {
+        case FIELD_BITS:
+          fail_unless_equals_int (gst_nal_bs_read (&bs, fields[i].n),
+              fields[i].value);
+          break;
+        case FIELD_UE:
+          fail_unless_equals_int (gst_nal_bs_read_ue (&bs), fields[i].value);
+          break;
+        case FIELD_SE:
+          fail_unless_equals_int (gst_nal_bs_read_se (&bs), fields[i].value);
+          break;
+      }
+    }
+
+    /* only the padding of the last byte is left */
+    gst_nal_bs_read (&bs, (8 - (bw.pos & 7)) & 7);
+    fail_unless (gst_nal_bs_eos (&bs));
+  }
+}
+
+GST_END_TEST;
+
+/* reads past the end return the bits that are left */
+GST_START_TEST (test_nalbs_read_end)
+{
+  static const guint8 data[] = { 0x00, 0x00, 0x03, 0x01, 0xa5 };
+  GstNalBs bs;
+
+  gst_nal_bs_init (&bs, data, sizeof (data));
+  fail_unless_equals_int (gst_nal_bs_read (&bs, 16), 0x0000);
+  fail_unless_equals_int (gst_nal_bs_read (&bs, 8), 0x01);
+  fail_unless (!gst_nal_bs_eos (&bs));
+  fail_unless_equals_int (gst_nal_bs_read (&bs, 12), 0xa5);
+  fail_unless (gst_nal_bs_eos (&bs));
+  fail_unless_equals_int (gst_nal_bs_read (&bs, 8), 0);
+}
+
+GST_END_TEST;
+
+static Suite *
+h264nalbs_suite (void)
+{
+  Suite *s = suite_create ("h264nalbs");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_nalbs_read);
+  tcase_add_test (tc_chain, test_nalbs_read_end);
+
+  return s;
+}
+
+GST_CHECK_MAIN (h264nalbs);
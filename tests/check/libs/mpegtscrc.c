@@ -0,0 +1,93 @@
+/* GStreamer
+ *
+ * unit test for the MPEG-2 section CRC32
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+#include <gst/gst-mpegts-crc.h>
+
+/* a PAT with program 1 on PID 0x1000, followed by its CRC_32 */
+static const guint8 pat[] = {
+  0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x00,
+  0x2a, 0xb1, 0x04, 0xb2
+};
+
+/* the plain byte wise CRC */
+static guint32
+crc32_bytewise (const guint8 * data, guint len)
+{
+  guint32 crc = 0xffffffff;
+
+  while (len--)
+    crc = (crc << 8) ^ gst_mpegts_crc_tab[0][((crc >> 24) ^ *data++) & 0xff];
+
+  return crc;
+}
+
+GST_START_TEST (test_crc_known_values)
+{
+  /* the check value of CRC-32/MPEG-2 */
+  fail_unless_equals_int (gst_mpegts_crc32 ((const guint8 *) "123456789", 9),
+      0x0376e6e7);
+
+  fail_unless_equals_int (gst_mpegts_crc32 (pat, sizeof (pat) - 4),
+      GST_READ_UINT32_BE (pat + sizeof (pat) - 4));
+  /* an intact section including its CRC_32 gives 0 */
+  fail_unless_equals_int (gst_mpegts_crc32 (pat, sizeof (pat)), 0);
+
+  fail_unless_equals_int (gst_mpegts_crc32 (pat, 0), 0xffffffff);
+}
+
+GST_END_TEST;
+
+/* the slice-by-8 loop has to give the same result as the byte wise one for
+ * any alignment and for any number of trailing bytes */
+GST_START_TEST (test_crc_slice_by_8)
+{
+  guint8 data[4096 + 8];
+  guint i, offset, len;
+
+  for (i = 0; i < sizeof (data); i++)
+    data[i] = g_random_int_range (0, 256);
+
+  for (offset = 0; offset < 8; offset++) {
+    for (len = 0; len <= 64; len++) {
+      fail_unless_equals_int (gst_mpegts_crc32 (data + offset, len),
+          crc32_bytewise (data + offset, len));
+    }
+    fail_unless_equals_int (gst_mpegts_crc32 (data + offset, 4096),
+        crc32_bytewise (data + offset, 4096));
+  }
+}
+
+GST_END_TEST;
+
+static Suite *
+mpegtscrc_suite (void)
+{
+  Suite *s = suite_create ("mpegtscrc");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_crc_known_values);
+  tcase_add_test (tc_chain, test_crc_slice_by_8);
+
+  return s;
+}
+
+GST_CHECK_MAIN (mpegtscrc);